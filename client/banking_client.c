@@ -16,6 +16,10 @@
 #include "tls_wrapper.h"
 
 #define BUFFER_SIZE 1024
+#define TRANSFER_RETRIES 5
+
+// Token from the last successful login, used by "Resume Session"
+static char session_token[33] = {0};
 
 // Send request and receive response
 int send_request(SSL *ssl, uint16_t opcode, const void *req_data, size_t req_size, BankingResponse *response) {
@@ -46,6 +50,11 @@ int send_request(SSL *ssl, uint16_t opcode, const void *req_data, size_t req_siz
         return -1;
     }
     
+    if (ntohs(resp_packet.header.op_code) == OP_GOAWAY) {
+        printf("Server is shutting down: this request was not processed.\n"
+               "Reconnect and use Resume Session to continue.\n");
+    }
+    
     return 0;
 }
 
@@ -106,6 +115,7 @@ void menu_withdraw(SSL *ssl) {
 
 void menu_check_balance(SSL *ssl) {
     BalanceRequest req;
+    memset(&req, 0, sizeof(req));
     printf("\n=== Check Balance ===\n");
     printf("Enter Account ID: ");
     scanf("%s", req.account_id);
@@ -120,6 +130,116 @@ void menu_check_balance(SSL *ssl) {
     }
 }
 
+// Balance and version of an account (the read phase of a transaction)
+static int read_account(SSL *ssl, const char *account_id, BankingResponse *response) {
+    BalanceRequest req;
+    memset(&req, 0, sizeof(req));
+    strncpy(req.account_id, account_id, sizeof(req.account_id) - 1);
+    if (send_request(ssl, OP_BALANCE, &req, sizeof(req), response) != 0) return -1;
+    if (response->status != 0) {
+        printf("Message: %s\n", response->message);
+        return -1;
+    }
+    return 0;
+}
+
+// Transfer between two accounts as one OP_TRANSACTION: read both, then commit
+// only if neither changed in between; on a conflict read again and retry
+void menu_transfer(SSL *ssl) {
+    char from[20] = {0}, to[20] = {0};
+    double amount;
+    printf("\n=== Transfer ===\n");
+    printf("From Account ID (logged in): ");
+    scanf("%19s", from);
+    printf("To Account ID: ");
+    scanf("%19s", to);
+    printf("Enter Amount: ");
+    scanf("%lf", &amount);
+    
+    for (int attempt = 1; attempt <= TRANSFER_RETRIES; attempt++) {
+        BankingResponse src, dst, response;
+        if (read_account(ssl, from, &src) != 0 || read_account(ssl, to, &dst) != 0) return;
+        if (src.balance < amount) {
+            printf("Insufficient funds (balance %.2f)\n", src.balance);
+            return;
+        }
+        
+        TxnRequest txn;
+        memset(&txn, 0, sizeof(txn));
+        txn.num_reads = 2;
+        memcpy(txn.reads[0].account_id, from, sizeof(from));
+        txn.reads[0].version = src.version;
+        memcpy(txn.reads[1].account_id, to, sizeof(to));
+        txn.reads[1].version = dst.version;
+        txn.num_writes = 2;
+        memcpy(txn.writes[0].account_id, from, sizeof(from));
+        txn.writes[0].amount = -amount;
+        memcpy(txn.writes[1].account_id, to, sizeof(to));
+        txn.writes[1].amount = amount;
+        
+        if (send_request(ssl, OP_TRANSACTION, &txn, sizeof(txn), &response) != 0) return;
+        if (response.status == STATUS_TXN_CONFLICT && attempt < TRANSFER_RETRIES) {
+            printf("Conflict (%s), retrying\n", response.message);
+            continue;
+        }
+        printf("\nStatus: %d\n", response.status);
+        printf("Message: %s\n", response.message);
+        return;
+    }
+}
+
+void menu_request_otp(SSL *ssl) {
+    OtpRequest req;
+    printf("\n=== Request OTP ===\n");
+    printf("Enter Account ID: ");
+    scanf("%19s", req.account_id);
+    
+    BankingResponse response;
+    if (send_request(ssl, OP_REQ_OTP, &req, sizeof(req), &response) == 0) {
+        printf("\nStatus: %d\n", response.status);
+        printf("Message: %s\n", response.message);
+    }
+}
+
+void menu_login(SSL *ssl) {
+    LoginRequest req;
+    printf("\n=== Login ===\n");
+    printf("Enter Account ID: ");
+    scanf("%19s", req.account_id);
+    printf("Enter OTP: ");
+    scanf("%9s", req.otp);
+    
+    BankingResponse response;
+    if (send_request(ssl, OP_LOGIN, &req, sizeof(req), &response) == 0) {
+        printf("\nStatus: %d\n", response.status);
+        printf("Message: %s\n", response.message);
+        if (response.status == 0) {
+            memcpy(session_token, response.session_token, sizeof(session_token));
+            session_token[sizeof(session_token) - 1] = '\0';
+            printf("Session Token: %s\n", session_token);
+        }
+    }
+}
+
+void menu_resume_session(SSL *ssl) {
+    SessionRequest req;
+    printf("\n=== Resume Session ===\n");
+    if (session_token[0]) {
+        // Reuse the token from this run's login
+        memcpy(req.session_token, session_token, sizeof(req.session_token));
+        printf("Using Session Token: %s\n", session_token);
+    } else {
+        printf("Enter Session Token: ");
+        scanf("%32s", req.session_token);
+    }
+    
+    BankingResponse response;
+    if (send_request(ssl, OP_RESUME_SESSION, &req, sizeof(req), &response) == 0) {
+        printf("\nStatus: %d\n", response.status);
+        printf("Message: %s\n", response.message);
+    }
+}
+
 int main(int argc, char **argv) {
     if (argc < 3) {
         printf("Usage: %s <ip> <port> [verify_server (0=No, 1=Yes)]\n", argv[0]);
@@ -200,7 +320,11 @@ int main(int argc, char **argv) {
         printf("2. Deposit\n");
         printf("3. Withdraw\n");
         printf("4. Check Balance\n");
-        printf("5. Exit\n");
+        printf("5. Request OTP\n");
+        printf("6. Login\n");
+        printf("7. Resume Session\n");
+        printf("8. Transfer\n");
+        printf("9. Exit\n");
         printf("Enter choice: ");
         
         if (scanf("%d", &choice) != 1) {
@@ -223,6 +347,18 @@ int main(int argc, char **argv) {
                 menu_check_balance(ssl);
                 break;
             case 5:
+                menu_request_otp(ssl);
+                break;
+            case 6:
+                menu_login(ssl);
+                break;
+            case 7:
+                menu_resume_session(ssl);
+                break;
+            case 8:
+                menu_transfer(ssl);
+                break;
+            case 9:
                 printf("Goodbye!\n");
                 goto cleanup;
             default:
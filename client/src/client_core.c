@@ -104,7 +104,7 @@ int client_send(ClientContext *client, uint16_t op_code, void *payload, uint32_t
     PacketHeader header;
     header.length = sizeof(PacketHeader) + payload_len;
     header.op_code = op_code;
-    header.req_id = rand(); 
+    header.req_id = 0;  // No idempotency key
     
     // [Security Hook 1] 計算 Checksum
     // 這裡我們計算 payload 的校驗碼放入 Header
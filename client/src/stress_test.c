@@ -111,6 +111,7 @@ void *worker_routine(void *arg) {
             WithdrawRequest wid;
             BalanceRequest bal;
         } trans_req;
+        memset(&trans_req, 0, sizeof(trans_req));
         
         switch (action) {
             case 0: op = OP_DEPOSIT; break;
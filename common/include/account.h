@@ -3,9 +3,22 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include "totp.h"
 
 #define MAX_ACCOUNTS 100
 #define ACCOUNT_ID_LEN 20
+#define ACCOUNT_VERSIONS 16      // 每個帳戶保留的餘額版本數 (快照讀取)
+#define MVCC_MAX_SNAPSHOTS 32    // 同時開啟的快照數
+#define MVCC_LEASE_MS 30000      // 快照預設租約 (每次讀取會延長)
+#define MVCC_MAX_LEASE_MS 600000
+#define TXN_MAX_ACCOUNTS 16      // 一筆交易最多涉及的帳戶數
+
+// 某個提交時間戳之後的餘額
+typedef struct {
+    uint64_t ts;
+    uint64_t version;
+    double balance;
+} AccountVersion;
 
 // 帳戶資料結構
 typedef struct {
@@ -13,15 +26,53 @@ typedef struct {
     double balance;
     int active;  // 1 = active, 0 = inactive
     pthread_mutex_t lock;  // 每個帳戶獨立的鎖
+    uint8_t totp_secret[TOTP_SECRET_LEN];  // TOTP 金鑰 (建立帳戶時產生)
+    uint64_t totp_last_step;               // 最後一次成功登入的時間步 (防重放)
+    uint64_t ops;                          // 取得帳戶鎖的次數 (持有鎖時累加)
+    uint64_t lock_contended;               // 需要等待帳戶鎖的次數
+    uint64_t repl_seq;                     // 最後一次變更的複寫序號 (repl_log.h)
+    uint64_t version;                      // 餘額每變更一次加一 (持有帳戶鎖時)，交易提交時驗證
+    uint64_t created_ts;                   // 建立時的提交時間戳
+    AccountVersion versions[ACCOUNT_VERSIONS];  // 環狀，持有帳戶鎖時讀寫
+    uint32_t version_newest;               // 最新版本的位置
+    uint32_t version_count;
 } Account;
 
+// 快照：讀取提交時間戳 <= ts 的餘額，租約到期 (或關閉) 後不再保留舊版本
+typedef struct {
+    uint64_t ts;                           // 0 = 空位
+    uint64_t expires_ms;                   // CLOCK_MONOTONIC
+    uint32_t lease_ms;                     // 每次讀取後延長的租約
+    uint32_t generation;                   // 每次配出此位置時遞增，舊 id 因此失效
+} AccountView;
+
 // 共享記憶體中的帳戶資料庫
 typedef struct {
     Account accounts[MAX_ACCOUNTS];
     int account_count;
     pthread_mutex_t db_lock;  // 全域資料庫鎖
+    uint64_t db_lock_contended;  // 需要等待 db_lock 的次數
+    uint64_t commit_ts;          // 提交時鐘：每次餘額變更遞增 (持有帳戶鎖時)
+    AccountView views[MVCC_MAX_SNAPSHOTS];
+    uint64_t versions_dropped;   // 快照仍需要卻因版本環已滿被覆蓋的版本數
 } AccountDB;
 
+// 複寫 (repl_log.h)
+typedef struct ReplLog ReplLog;
+typedef struct ReplRecord ReplRecord;
+
+// 交易 (account_transact) 讀取過的帳戶與當時的版本
+typedef struct {
+    char account_id[ACCOUNT_ID_LEN];
+    uint64_t version;
+} AccountTxnRead;
+
+// 交易的變動量：正 = 存入, 負 = 提出
+typedef struct {
+    char account_id[ACCOUNT_ID_LEN];
+    double amount;
+} AccountTxnWrite;
+
 // 交易類型
 typedef enum {
     TXN_DEPOSIT,
@@ -51,8 +102,67 @@ int account_init(AccountDB *db);
 int account_create(AccountDB *db, const char *account_id, double initial_balance);
 int account_deposit(AccountDB *db, const char *account_id, double amount, double *new_balance);
 int account_withdraw(AccountDB *db, const char *account_id, double amount, double *new_balance);
-int account_get_balance(AccountDB *db, const char *account_id, double *balance);
+int account_get_balance(AccountDB *db, const char *account_id, double *balance, uint64_t *version);
 Account* account_find(AccountDB *db, const char *account_id);
+int account_totp_code(AccountDB *db, const char *account_id, TotpAlgo algo, char *code_out);
+int account_totp_verify(AccountDB *db, const char *account_id, const char *code, int skew, TotpAlgo algo);
 void account_cleanup(AccountDB *db);
 
+/**
+ * Standby 套用 Primary 的 after-image (不存在則建立；REPL_DEACTIVATE 停用帳戶)
+ * force = 0: 只套用比帳戶目前序號新的紀錄; force = 1: 無條件覆寫 (新 timeline 的快照)
+ * return: 1 = 已套用, 0 = 舊紀錄略過, -1 = 失敗 (資料庫已滿)
+ */
+int account_apply(AccountDB *db, const ReplRecord *rec, int force);
+
+/**
+ * 搬移：以其他 shard 的 after-image 建立或覆寫帳戶 (bank_migrate)
+ * 與 account_apply 不同，不比較序號 (由呼叫端依來源序號去重)，並以本機的新序號寫入 mutation log
+ * return: 0 = 成功, -1 = 資料庫已滿
+ */
+int account_import(AccountDB *db, const ReplRecord *rec);
+
+// 取得第 index 個帳戶的快照 (REPL_CREATE 紀錄，seq 為帳戶目前序號)
+// return: 0 = 成功, 1 = 帳戶已停用 (out 為 REPL_DEACTIVATE 紀錄), 2 = 已停用且帳號已在別的位置重建, -1 = 超出帳戶數
+int account_snapshot(AccountDB *db, int index, ReplRecord *out);
+
+// 停用第 index 個帳戶 (搬走的帳戶、新 timeline 的快照中不存在的帳戶)
+// 已 attach mutation log 的行程會記錄 REPL_DEACTIVATE；位置之後由新帳戶重用
+void account_deactivate(AccountDB *db, int index);
+
+// 所有帳戶中最大的複寫序號 (promote 後新序號由此接續)
+uint64_t account_max_seq(AccountDB *db);
+
+/**
+ * 開啟快照：之後的讀取都看到目前為止已提交的餘額，寫入不受影響
+ * lease_ms: 0 = MVCC_LEASE_MS；超過 lease_ms 沒有讀取即自動關閉
+ * return: 0 = 成功 (id_out, ts_out), -1 = 快照已達 MVCC_MAX_SNAPSHOTS
+ */
+int account_view_open(AccountDB *db, uint32_t lease_ms, uint64_t *id_out, uint64_t *ts_out);
+
+// return: 0 = 已關閉, -1 = 不存在或已過期
+int account_view_close(AccountDB *db, uint64_t id);
+
+/**
+ * 以快照讀取餘額 (並延長租約)
+ * return: 0 = 成功, -2 = 快照時帳戶不存在, -3 = 快照不存在/已過期或所需版本已被覆蓋
+ */
+int account_view_balance(AccountDB *db, uint64_t id, const char *account_id, double *balance,
+                         uint64_t *version, uint64_t *ts_out);
+
+/**
+ * 樂觀並行交易：讀取階段不持有任何鎖，提交時依帳戶位置順序鎖定所有涉及的帳戶，
+ * 確認讀取過的帳戶版本未變，再一起套用變動 (同一個提交時間戳，快照看到全部或全不)
+ * failed: 失敗時指向造成失敗的帳號 (reads 或 writes 中的字串)
+ * return: 0 = 已提交, -1 = 參數不合法, -2 = 帳戶不存在, -3 = 餘額不足, -4 = 版本衝突
+ */
+int account_transact(AccountDB *db, const AccountTxnRead *reads, int num_reads,
+                     const AccountTxnWrite *writes, int num_writes, const char **failed);
+
+// 本行程最後一次寫入 mutation log 的序號 (同步複寫時等待此序號被確認)
+uint64_t account_last_seq(void);
+
+// 本行程等待帳戶鎖的累計時間 (ns)，取前後差值即為單一請求的等待時間
+uint64_t account_lock_wait_ns(void);
+
 #endif // ACCOUNT_H
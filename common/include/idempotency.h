@@ -0,0 +1,83 @@
+/*
+ * idempotency.h
+ * Response Cache for Idempotent Retries (Shared Memory)
+ *
+ * A client that may resend a deposit, withdrawal or transaction (timeout,
+ * broken connection) puts a nonzero idempotency key in PacketHeader.req_id
+ * (LocalRequest.key on the local transport) and reuses it for every
+ * attempt of that operation. Keys are scoped by the login session, so they
+ * only have to be unique per client, and a retry over a new connection or
+ * to another worker finds the same entry.
+ *
+ * The first attempt claims an entry (in progress); the response it finally
+ * sends is stored in the entry and returned to every later attempt without
+ * running the operation again. An attempt that arrives while the first one
+ * is still running (e.g. held for a standby ack) is told to retry later.
+ *
+ * Entries live IDEM_TTL_SEC. The table is set-associative: a key maps to one
+ * set of IDEM_WAYS entries behind a process-shared mutex. A full set reuses
+ * an expired entry, else evicts its oldest completed one (a retry of that
+ * operation would run again, so the caller counts evictions). In-progress
+ * entries are never evicted before they expire.
+ */
+
+#ifndef IDEMPOTENCY_H
+#define IDEMPOTENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "protocol.h"
+#include "session.h"
+
+#define IDEM_SETS 1024             // Power of 2
+#define IDEM_WAYS 8
+#define IDEM_TTL_SEC 300
+
+typedef enum {
+    IDEM_NEW,                      // Claimed: run the request, then idem_finish (or idem_abort)
+    IDEM_REPLAY,                   // Already answered: send the stored response
+    IDEM_IN_PROGRESS,              // First attempt still running: nothing done, retry later
+    IDEM_MISMATCH,                 // Key already used for a different request
+    IDEM_FULL                      // Every entry of the set is in progress: nothing done, retry later
+} IdemResult;
+
+typedef struct {
+    uint8_t token[SESSION_TOKEN_LEN];
+    uint32_t key;                  // 0 = empty
+    uint32_t done;                 // 1 = response stored
+    uint64_t fingerprint;          // idem_fingerprint of the first attempt: same key with another request = client bug
+    int64_t expiry;                // time(NULL) after which the entry is free
+    BankingResponse response;
+} IdemEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    IdemEntry entries[IDEM_WAYS];
+} __attribute__((aligned(64))) IdemSet;
+
+typedef struct {
+    IdemSet sets[IDEM_SETS];
+} IdemCache;
+
+// 請求的指紋：OpCode、payload 長度與 payload 的 64-bit FNV-1a
+uint64_t idem_fingerprint(uint16_t opcode, const void *payload, size_t len);
+
+int idem_init(IdemCache *cache);
+void idem_cleanup(IdemCache *cache);
+
+/**
+ * 以 (session token, key) 查詢或佔用一個 entry
+ * stored: IDEM_REPLAY 時填入先前的回應
+ * evicted: IDEM_NEW 時，是否逐出了一個尚未過期的已完成 entry
+ */
+IdemResult idem_begin(IdemCache *cache, const uint8_t *token, uint32_t key,
+                      uint64_t fingerprint, BankingResponse *stored, int *evicted);
+
+// 儲存 IDEM_NEW 請求最後送出的回應
+void idem_finish(IdemCache *cache, const uint8_t *token, uint32_t key, const BankingResponse *response);
+
+// IDEM_NEW 的請求沒有執行 (可以安全重試)：釋放 entry
+void idem_abort(IdemCache *cache, const uint8_t *token, uint32_t key);
+
+#endif // IDEMPOTENCY_H
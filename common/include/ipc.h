@@ -2,22 +2,52 @@
 #define IPC_H
 
 #include "account.h"
+#include "session.h"
+#include "stats.h"
+#include "log_ring.h"
+#include "ratelimit.h"
+#include "repl_log.h"
+#include "migration.h"
+#include "idempotency.h"
 #include <sys/types.h>
 
-#define SHM_KEY 0x12345678
+#define SHM_KEY 0x12345678  // 預設值；同一台機器上的 Standby 以 ipc_set_key 使用另一個 key
 #define SEM_KEY 0x87654321
 
+// 共享記憶體區段配置
+typedef struct {
+    AccountDB db;
+    SessionTable sessions;
+    StatsTable stats;
+    LogTable logs;
+    RateLimitTable ratelimits;
+    uint32_t generation;            // 熱升級次數：每代 Master 的 Worker 使用不同的 stats/log 槽位
+    ReplLog repl;                   // 帳戶變更紀錄與複寫角色
+    MigrationState migration;       // 搬到其他 shard 的帳戶 (bank_migrate)
+    IdemCache idempotency;          // 帶 idempotency key 的請求的回應 (重試時直接回傳)
+} SharedSegment;
+
 // IPC 控制結構
 typedef struct {
     int shm_id;
     int sem_id;
+    SharedSegment *seg;
     AccountDB *db;
 } IPCContext;
 
 // 函數宣告
+void ipc_set_key(key_t key);  // 在 init/attach 之前呼叫
 int ipc_init_server(IPCContext *ctx);
-int ipc_attach_client(IPCContext *ctx);
+int ipc_attach_server(IPCContext *ctx);
+int ipc_attach_client(IPCContext *ctx, int readonly);
 void ipc_cleanup(IPCContext *ctx, int is_server);
 AccountDB* ipc_get_db(IPCContext *ctx);
+SessionTable* ipc_get_sessions(IPCContext *ctx);
+StatsTable* ipc_get_stats(IPCContext *ctx);
+LogTable* ipc_get_logs(IPCContext *ctx);
+RateLimitTable* ipc_get_ratelimits(IPCContext *ctx);
+ReplLog* ipc_get_repl(IPCContext *ctx);
+MigrationState* ipc_get_migration(IPCContext *ctx);
+IdemCache* ipc_get_idempotency(IPCContext *ctx);
 
 #endif // IPC_H
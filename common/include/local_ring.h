@@ -0,0 +1,150 @@
+/*
+ * local_ring.h
+ * Local Transport for Co-located Clients (Shared Memory Rings)
+ *
+ * A batch job on the same host as banking_server can skip TCP, TLS and the
+ * padded BankingPacket: it connects to the server's UNIX socket
+ * (--local-socket), the worker that accepts checks the peer's credentials
+ * and answers with three descriptors (SCM_RIGHTS): a memfd holding one
+ * LocalChannel and two eventfds. The channel is a pair of single-producer/
+ * single-consumer rings: requests from the client, responses (in the same
+ * order) from the worker. Requests go through the same dispatch and opcode
+ * handlers as TLS ones; a session bound by OP_LOGIN lives on the channel.
+ *
+ * Notification: a side that finds its ring empty announces that it sleeps
+ * before re-checking it (Dekker pairing with the producer, which publishes
+ * before checking the flag), so the other side only writes the eventfd to
+ * someone actually asleep. Under load neither side makes a system call per
+ * request: the client publishes a batch with one local_flush(), the worker
+ * drains everything queued per wake-up.
+ *
+ * The client keeps at most LOCAL_RING_SIZE requests unanswered, so neither
+ * ring can overflow. The worker never trusts the shared indices: a client
+ * that corrupts them is disconnected. The channel is closed (closed = 1,
+ * eventfd kicked) when the worker drains; requests without a response at
+ * that point were not processed.
+ */
+
+#ifndef LOCAL_RING_H
+#define LOCAL_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protocol.h"
+
+#define LOCAL_RING_SIZE 256         // Slots per ring (power of 2)
+#define LOCAL_REQ_BYTES 456         // Largest request payload (TxnRequest, 450 bytes)
+#define LOCAL_MAGIC 0x424c4331      // "BLC1"
+#define LOCAL_SPIN 2000             // local_receive polls this often before sleeping (multi-CPU hosts)
+
+typedef struct {
+    uint32_t id;                    // Echoed in the response
+    uint16_t op;                    // OP_CREATE_ACCOUNT ... OP_TRANSACTION
+    uint16_t len;                   // Bytes used in data
+    uint32_t key;                   // Idempotency key, as PacketHeader.req_id (0 = none)
+    char data[LOCAL_REQ_BYTES];     // Same payload structs as on the wire
+} LocalRequest;
+
+typedef struct {
+    uint32_t id;
+    uint32_t pad;
+    BankingResponse response;
+} LocalResponse;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t closed;                            // Worker gone: no further responses
+    uint64_t req_head __attribute__((aligned(64)));   // Written by the client
+    uint32_t server_sleeping;                   // Worker waits on the request eventfd
+    uint64_t resp_head __attribute__((aligned(64)));  // Written by the worker
+    uint32_t client_sleeping;                   // Client waits on the response eventfd
+    uint64_t resp_tail __attribute__((aligned(64)));  // Written by the client
+    LocalRequest reqs[LOCAL_RING_SIZE] __attribute__((aligned(64)));
+    LocalResponse resps[LOCAL_RING_SIZE] __attribute__((aligned(64)));
+} LocalChannel;
+
+// Worker side of one channel (process-local; the indices are private copies)
+typedef struct {
+    LocalChannel *ch;
+    int req_efd;                    // Client -> worker (in the worker's epoll set)
+    int resp_efd;                   // Worker -> client
+    uint64_t req_tail;
+    uint64_t resp_head;
+    uint64_t notified;              // resp_head at the last local_server_notify
+} LocalEndpoint;
+
+// Client side
+typedef struct {
+    LocalChannel *ch;
+    int sock;                       // Kept open: the worker sees the client leave as a hangup
+    int req_efd;
+    int resp_efd;
+    uint64_t req_head;              // Queued, published by local_flush
+    uint64_t published;
+    uint64_t resp_tail;
+    uint32_t next_id;
+    int spin;                       // 0 on a single CPU: the worker cannot run while we poll
+} LocalClient;
+
+/* ---------- Worker ---------- */
+
+/**
+ * 建立 channel (memfd + 兩個 eventfd) 並經由 sock 傳給 client
+ * return: 0 = 成功, -1 = 失敗 (ep 不需清理)
+ */
+int local_server_open(LocalEndpoint *ep, int sock);
+
+// 標記 closed、叫醒 client、釋放資源
+void local_server_close(LocalEndpoint *ep);
+
+/**
+ * 取出下一個 request (呼叫前先前的 request 都必須已 push 回應)
+ * return: 1 = 取得, 0 = 沒有, -1 = client 破壞了索引或超過 LOCAL_RING_SIZE 個未回應
+ */
+int local_server_pop(LocalEndpoint *ep, LocalRequest *req);
+
+void local_server_push(LocalEndpoint *ep, uint32_t id, const BankingResponse *response);
+
+// 發布到目前為止的回應；client 在睡時寫 eventfd 叫醒它
+void local_server_notify(LocalEndpoint *ep);
+
+/**
+ * 準備回到 epoll 等待 (宣告 server_sleeping 後再檢查一次)
+ * return: 1 = 可以睡, 0 = 剛好有新 request，繼續處理
+ */
+int local_server_sleep(LocalEndpoint *ep);
+
+// request eventfd 可讀時呼叫：清除計數
+void local_server_woken(LocalEndpoint *ep);
+
+/* ---------- Client ---------- */
+
+/**
+ * 連線到 Server 的 --local-socket
+ * return: 0 = 成功, -1 = 失敗 (errno)
+ */
+int local_connect(LocalClient *lc, const char *path);
+
+void local_disconnect(LocalClient *lc);
+
+/**
+ * 排入一個 request (local_flush 後 Server 才看得到)
+ * key: idempotency key (idempotency.h)，重送同一個操作時沿用，0 = 不去重
+ * return: request id, -1 = 未回應的 request 已達 LOCAL_RING_SIZE 或 payload 過大
+ */
+int64_t local_submit(LocalClient *lc, uint16_t op, const void *data, size_t len, uint32_t key);
+
+// 發布已排入的 request，Worker 在睡時叫醒它
+void local_flush(LocalClient *lc);
+
+// 尚未收到回應的 request 數
+uint32_t local_pending(const LocalClient *lc);
+
+/**
+ * 取回下一個回應 (與 request 同順序)；會先 local_flush
+ * timeout_ms: 0 = 不等待, -1 = 一直等
+ * return: 1 = 取得, 0 = 逾時, -1 = Server 關閉了 channel
+ */
+int local_receive(LocalClient *lc, LocalResponse *out, int timeout_ms);
+
+#endif // LOCAL_RING_H
@@ -0,0 +1,74 @@
+/*
+ * log_ring.h
+ * Binary Log Rings (Shared Memory)
+ *
+ * Each worker owns one single-producer/single-consumer ring. log_write()
+ * never formats text and never touches stdio: it copies the format string
+ * pointer and the raw argument values into the next slot and publishes it
+ * with a release store. A separate drainer process (forked from the same
+ * binary, so format pointers are valid there too) renders the entries and
+ * does the blocking write to stdout.
+ *
+ * Entries below LOG_LEVEL_WARN are rate limited per writer (token bucket).
+ * If the ring is full the entry is dropped and counted; the writer never
+ * waits for the drainer.
+ *
+ * Supported conversions: d i u x X o c (with h/l/ll/z/j), f F e E g G, s, p.
+ * '*' width/precision is not supported.
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOG_MAX_RINGS 16
+#define LOG_RING_SIZE 1024          // Entries per ring (power of 2)
+#define LOG_ARG_BYTES 104           // Packed arguments per entry
+
+#define LOG_DEFAULT_RATE 10000      // Entries/s per worker below LOG_LEVEL_WARN
+
+typedef enum {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} LogLevel;
+
+typedef struct {
+    uint64_t ts_ns;                 // CLOCK_REALTIME, used to merge rings in order
+    const char *fmt;
+    uint8_t level;
+    uint8_t truncated;              // Arguments did not fit in args[]
+    uint16_t args_len;
+    char args[LOG_ARG_BYTES];
+} LogEntry;
+
+typedef struct {
+    uint64_t head __attribute__((aligned(64)));  // Written by the worker
+    uint64_t rate_dropped;
+    uint64_t full_dropped;
+    uint64_t tail __attribute__((aligned(64)));  // Written by the drainer
+    LogEntry entries[LOG_RING_SIZE] __attribute__((aligned(64)));
+} LogRing;
+
+typedef struct {
+    LogRing rings[LOG_MAX_RINGS];
+} LogTable;
+
+void log_table_init(LogTable *table);
+
+// 設定本行程寫入的 ring (Worker fork 後呼叫)；未設定時 log_write 直接輸出到 stdout
+void log_attach(LogRing *ring, LogLevel min_level, int rate_per_sec);
+
+void log_write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Drainer：依時間順序輸出 rings[first .. first+num_rings) 中已發布的紀錄
+ * (熱升級期間新舊兩代 Worker 各有一組 ring，由各自的 Drainer 清空)
+ * return: 輸出的筆數
+ */
+int log_drain(LogTable *table, int first, int num_rings, FILE *out);
+
+#endif // LOG_RING_H
@@ -0,0 +1,90 @@
+/*
+ * migration.h
+ * Moving accounts to another shard while both keep serving (Shared Memory)
+ *
+ * A migration is driven by bank_migrate on the new owner: it subscribes to
+ * the source's replication port with the membership after the move, and the
+ * source's replication process streams it only the accounts the new ring
+ * assigns to the target shard (a snapshot, then every later change of
+ * those accounts). The source's workers keep serving them meanwhile.
+ *
+ * Cutover:
+ *   COPYING -> FROZEN: requests on the moving accounts are answered
+ *     STATUS_ACCOUNT_MOVED (nothing done). The replication process waits
+ *     until no worker is between its check and the end of a request, so
+ *     every change made before the freeze is in the log it streams.
+ *   FROZEN -> DONE: once bank_migrate has applied the stream up to the
+ *     freeze, the accounts are deactivated here and stay "moved" until the
+ *     next migration, while the routers switch to the new membership.
+ * A migration stream that breaks before DONE unfreezes the accounts.
+ * bank_migrate releases a DONE state on the shard it fills, which may be
+ * taking back accounts it gave away earlier.
+ */
+
+#ifndef MIGRATION_H
+#define MIGRATION_H
+
+#include <stdint.h>
+#include "shard_ring.h"
+#include "stats.h"
+
+#define MIGRATE_QUIESCE_MS 1000     // Longest wait for the workers at a freeze
+
+typedef enum {
+    MIGRATE_NONE = 0,
+    MIGRATE_COPYING,                // Streaming, accounts still served here
+    MIGRATE_FROZEN,                 // Cutover in progress: moving accounts refused
+    MIGRATE_DONE                    // Moved: refused until the next migration
+} MigratePhase;
+
+// Which accounts move (sent by bank_migrate)
+typedef struct {
+    int32_t num_shards;
+    int32_t target;                 // Index in shards[] of the new owner
+    uint32_t rate;                  // Snapshot pace, accounts/s (0 = MIGRATE_DEFAULT_RATE)
+    uint32_t pad;
+    ShardInfo shards[SHARD_MAX];    // Membership after the move
+} MigrateSpec;
+
+#define MIGRATE_DEFAULT_RATE 2000
+
+typedef struct {
+    uint32_t phase;                 // MigratePhase
+    uint32_t generation;            // Bumped whenever spec changes
+    MigrateSpec spec;
+    struct {
+        uint32_t busy;              // Worker is between migration_enter and migration_exit
+    } __attribute__((aligned(64))) workers[STATS_MAX_WORKERS];
+} MigrationState;
+
+void migration_init(MigrationState *ms);
+
+/**
+ * Worker：處理以帳號開頭的請求之前呼叫，之後一定要呼叫 migration_exit
+ * return: 1 = 帳戶已 (或正在) 搬到其他 shard，*to 為新 shard 名稱，請求不可處理
+ */
+int migration_enter(MigrationState *ms, int worker, const char *account_id, const char **to);
+void migration_exit(MigrationState *ms, int worker);
+
+// 新的 ring 是否把帳戶分配給 target (複寫行程篩選串流；呼叫前 phase 必須不是 NONE)
+int migration_moving(MigrationState *ms, const char *account_id);
+
+/**
+ * 複寫行程：開始一次搬移 (COPYING)
+ * return: 0 = 成功, -1 = spec 不合法或已有搬移在進行中
+ */
+int migration_start(MigrationState *ms, const MigrateSpec *spec);
+
+/**
+ * 凍結搬移中的帳戶並等待所有 Worker 離開請求 (最多 MIGRATE_QUIESCE_MS)
+ * return: 0 = 已凍結, -1 = 逾時 (回到 COPYING)
+ */
+int migration_freeze(MigrationState *ms);
+
+void migration_finish(MigrationState *ms);  // FROZEN -> DONE
+void migration_abort(MigrationState *ms);   // COPYING / FROZEN -> NONE
+void migration_release(MigrationState *ms); // DONE -> NONE (bank_migrate：帳戶搬回先前送出它們的 shard)
+
+const char *migration_phase_name(uint32_t phase);
+
+#endif // MIGRATION_H
@@ -1,6 +1,8 @@
 #ifndef OTP_IPC_H
 #define OTP_IPC_H
 
+#include <stdint.h>
+
 #define OTP_PORT 8889
 #define OTP_IP "127.0.0.1"
 
@@ -9,7 +11,9 @@
 #define OTP_OP_VERIFY   2
 
 // 請求封包 (Bank Server -> OTP Server)
+// 連線為長連線，可連續送多個請求；回應帶回相同的 req_id 以便對應
 typedef struct {
+    uint32_t req_id;    // 關聯 ID (Correlation ID)，由呼叫端產生
     int op_code;        // 1=Gen, 2=Verify
     char account[32];   // 帳號
     char otp_code[8];   // 驗證時填入，請求時留空
@@ -17,6 +21,7 @@ typedef struct {
 
 // 回應封包 (OTP Server -> Bank Server)
 typedef struct {
+    uint32_t req_id;    // 對應請求的 req_id
     int status;         // 1=Success, 0=Fail
     char otp_code[8];   // Gen 成功時回傳
     char message[64];   // 訊息
@@ -20,8 +20,13 @@
 #define OP_WITHDRAW        0x0003
 #define OP_BALANCE         0x0004
 #define OP_RESPONSE        0x00FF
+#define OP_GOAWAY          0x00FE  // Server -> client, unsolicited: draining, closing after this packet
 #define OP_REQ_OTP         0x0005
 #define OP_LOGIN           0x0006
+#define OP_RESUME_SESSION  0x0007
+#define OP_SNAPSHOT_OPEN   0x0008  // Consistent view for OP_BALANCE across accounts (snapshot_id)
+#define OP_SNAPSHOT_CLOSE  0x0009
+#define OP_TRANSACTION     0x000A  // Several deposits/withdrawals applied atomically if the accounts read are unchanged
 
 // Response Status Codes
 #define STATUS_SUCCESS            0
@@ -31,6 +36,19 @@
 #define STATUS_ACCOUNT_EXISTS    -4
 #define STATUS_DB_FULL           -5
 #define STATUS_INVALID_AMOUNT    -6
+#define STATUS_UNAUTHORIZED      -7   // No valid session for this account
+#define STATUS_RATE_LIMITED      -8   // Over the per-client/per-account budget, retry later
+#define STATUS_SERVER_BUSY       -9   // Shed under overload before any work was done, retry later
+#define STATUS_GOING_AWAY       -10   // OP_GOAWAY: requests sent after the last response were not processed
+#define STATUS_NOT_PRIMARY      -11   // Standby server: nothing was done, send the request to the primary
+#define STATUS_REPLICA_STALE    -12   // Read replica too far behind (or behind min_seq): read from the primary
+#define STATUS_ACCOUNT_MOVED    -13   // Account migrated (or being migrated) to another shard: nothing was done
+#define STATUS_SNAPSHOT_TOO_OLD -14   // Snapshot closed, expired, or its versions were overwritten: open a new one
+#define STATUS_TXN_CONFLICT     -15   // OP_TRANSACTION: an account read changed since, nothing was done: re-read and retry
+
+// OP_TRANSACTION limits
+#define TXN_MAX_READS  8
+#define TXN_MAX_WRITES 8
 
 // Banking Packet Structure
 
@@ -38,7 +56,7 @@ typedef struct {
     uint32_t length;    // 對應 packet_length
     uint16_t op_code;   // 對應 opcode
     uint16_t checksum;
-    uint32_t req_id;    // 新增：用於追蹤請求
+    uint32_t req_id;    // Idempotency key: nonzero = same key on every retry of this request (idempotency.h), 0 = none
 } __attribute__((packed)) PacketHeader;
 
 #define PROTOCOL_HEADER_SIZE sizeof(PacketHeader)
@@ -66,12 +84,42 @@ typedef struct {
 
 typedef struct {
     char account_id[20];
+    uint64_t min_seq;  // Read replica: only answer once this change is applied (read-your-writes), 0 = any
+    uint64_t snapshot_id;  // Read as of this OP_SNAPSHOT_OPEN, 0 = latest
 } __attribute__((packed)) BalanceRequest;
 
+typedef struct {
+    uint64_t snapshot_id;  // OP_SNAPSHOT_CLOSE
+    uint32_t lease_ms;     // OP_SNAPSHOT_OPEN: closed after this long without a read, 0 = default
+} __attribute__((packed)) SnapshotRequest;
+
+typedef struct {
+    char account_id[20];
+    uint64_t version;  // BankingResponse.version when this account was read
+} __attribute__((packed)) TxnRead;
+
+typedef struct {
+    char account_id[20];
+    double amount;     // > 0 deposit, < 0 withdrawal
+} __attribute__((packed)) TxnWrite;
+
+typedef struct {
+    uint8_t num_reads;
+    uint8_t num_writes;
+    TxnRead reads[TXN_MAX_READS];      // Validated at commit (optimistic concurrency)
+    TxnWrite writes[TXN_MAX_WRITES];   // Accounts written without a read are not validated
+} __attribute__((packed)) TxnRequest;
+
 typedef struct {
     int status;
     char message[256];
     double balance;  // For balance query or final balance after operation
+    char session_token[33];  // Hex token, set by a successful OP_LOGIN
+    uint64_t commit_seq;     // Primary: replication sequence number of this change; replica: position read at
+    uint32_t staleness_ms;   // Read replica: how far behind the primary the answer may be
+    uint64_t snapshot_id;    // OP_SNAPSHOT_OPEN
+    uint64_t snapshot_ts;    // Commit timestamp a snapshot (or snapshot read) sees
+    uint64_t version;        // Account version read or written (TxnRead.version)
 } __attribute__((packed)) BankingResponse;
 
 typedef struct {
@@ -83,9 +131,14 @@ typedef struct {
     char otp[10];
 } __attribute__((packed)) LoginRequest;
 
+typedef struct {
+    char session_token[33];  // Hex token returned by OP_LOGIN
+} __attribute__((packed)) SessionRequest;
+
 // Protocol Functions
 int verify_packet_checksum(const BankingPacket *packet);
 int pack_request(BankingPacket *packet, uint16_t opcode, const void *data, size_t data_size);
+void packet_set_idempotency_key(BankingPacket *packet, uint32_t key);  // After pack_request
 int unpack_request(const BankingPacket *packet, void *data, size_t data_size);
 int pack_response(BankingPacket *packet, const BankingResponse *response);
 int unpack_response(const BankingPacket *packet, BankingResponse *response);
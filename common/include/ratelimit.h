@@ -0,0 +1,59 @@
+/*
+ * ratelimit.h
+ * Shared Token Bucket Rate Limits (Shared Memory)
+ *
+ * Buckets live in the shared segment, so all workers enforce one budget per
+ * key (client IP, client certificate CN, account). Each bucket is a single
+ * 64-bit word, last refill time (ms) | tokens (milli-tokens), updated with
+ * compare-and-swap: no locks on the request path.
+ *
+ * Keys are 64-bit hashes in an open-addressed table. A slot whose bucket has
+ * been idle long enough to be full again carries no state and is reused for
+ * a new key. If no slot is found within the probe window the request is
+ * allowed (fail open).
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RL_SLOTS 8192              // Power of 2
+#define RL_PROBE_LIMIT 8
+#define RL_MAX_BURST 16000         // Tokens are stored in 24 bits of milli-tokens
+
+typedef enum {
+    RL_CLIENT_IP,                  // Every request from one IP
+    RL_CLIENT_CERT,                // Every request from one client certificate (mTLS)
+    RL_ACCOUNT,                    // Every request naming one account
+    RL_ACCOUNT_OTP,                // OP_REQ_OTP / OP_LOGIN for one account
+    RL_CLASSES
+} RateClass;
+
+typedef struct {
+    uint32_t rate;                 // Tokens per second, 0 = class disabled
+    uint32_t burst;                // Bucket capacity in tokens
+} RateLimit;
+
+typedef struct {
+    uint64_t key;                  // 0 = empty
+    uint64_t state;                // refill_ms << 24 | milli-tokens
+} RateBucket;
+
+typedef struct {
+    RateLimit limits[RL_CLASSES];  // Set by the master before forking
+    RateBucket buckets[RL_SLOTS];
+} RateLimitTable;
+
+void ratelimit_init(RateLimitTable *table);
+void ratelimit_configure(RateLimitTable *table, RateClass cls, uint32_t rate, uint32_t burst);
+int ratelimit_enabled(const RateLimitTable *table, RateClass cls);
+
+/**
+ * 從 key 對應的 bucket 取一個 token
+ * return: 1 = 允許, 0 = 超過限制
+ */
+int ratelimit_allow(RateLimitTable *table, RateClass cls, const void *key, size_t key_len);
+
+#endif // RATELIMIT_H
@@ -0,0 +1,108 @@
+/*
+ * repl_log.h
+ * Account Mutation Log for Replication (Shared Memory)
+ *
+ * Every committed account change (create, balance change, TOTP replay
+ * step) is appended by the worker that made it, and the deactivation of
+ * an account moved away at a migration cutover by the replication sender
+ * process (deactivate_moving() -> account_deactivate()). Either writer
+ * still holds the account lock, and appends an after-image of the account
+ * with a global sequence number. Records of one account are therefore in
+ * commit order, and replaying an after-image is idempotent: a standby
+ * applies a record only if its sequence number is newer than the one the
+ * account already has.
+ *
+ * Writers reserve a sequence number with one fetch-and-add and publish the
+ * slot with a per-slot seqlock; they never wait for readers. The ring is
+ * overwritten after REPL_LOG_SIZE records, so a reader that falls that far
+ * behind sees its next record gone and has to resynchronise from a
+ * snapshot of the account table (MAX_ACCOUNTS after-images).
+ *
+ * A transaction's records get consecutive sequence numbers; each one says
+ * how many of the group follow it, and a standby applies a group only once
+ * it has all of it, so it never holds half a transaction.
+ *
+ * A timeline id names the history the data belongs to. It is drawn at
+ * startup and again when a standby is promoted; a standby that meets a new
+ * timeline takes the primary's snapshot as authoritative.
+ */
+
+#ifndef REPL_LOG_H
+#define REPL_LOG_H
+
+#include <stdint.h>
+#include "account.h"
+
+#define REPL_LOG_SIZE 8192          // Records, power of 2
+
+typedef enum {
+    REPL_ROLE_PRIMARY = 0,
+    REPL_ROLE_STANDBY = 1
+} ReplRole;
+
+typedef enum {
+    REPL_CREATE = 1,
+    REPL_UPDATE = 2,
+    REPL_DEACTIVATE = 3             // Moved to another shard: no longer served here
+} ReplRecordType;
+
+struct ReplRecord {
+    uint64_t seq;                   // Seqlock: 0 while the slot is written, then the record's number
+    uint32_t type;                  // ReplRecordType
+    char account_id[ACCOUNT_ID_LEN];
+    double balance;
+    uint64_t version;               // Account.version after the change (clients validate transactions with it)
+    uint32_t group_left;            // Records of the same transaction after this one (0 = last or alone)
+    uint64_t totp_last_step;
+    uint8_t totp_secret[TOTP_SECRET_LEN];
+    int64_t commit_ns;              // CLOCK_REALTIME on the primary (replication lag)
+} __attribute__((aligned(64)));
+
+struct ReplLog {
+    uint32_t role;                  // ReplRole; workers check it per request
+    uint64_t timeline;
+    uint64_t head;                  // Last sequence number handed out
+    uint64_t acked;                 // Highest sequence number a standby has applied
+    uint32_t sync_waiters;          // Requests parked until `acked` (standby: applied) covers their record
+    uint32_t sender_idle;           // Senders asleep on their kick eventfd
+    struct ReplRecord records[REPL_LOG_SIZE];
+};
+
+void repl_log_init(ReplLog *log, ReplRole role);
+
+// 新的 timeline id (啟動與 promote 時)
+uint64_t repl_new_timeline(void);
+
+/**
+ * 設定本行程的 mutation log (Worker fork 後呼叫)；kick_fd 為 Sender 的 eventfd，
+ * Sender 休眠時寫入以喚醒。未設定時 repl_log_append 不做任何事
+ */
+void repl_log_attach(ReplLog *log, int kick_fd);
+
+/**
+ * 記錄帳戶的 after-image (持有帳戶鎖時呼叫)
+ * return: 序號, 0 = 未 attach
+ */
+uint64_t repl_log_append(ReplRecordType type, const Account *acc);
+
+/**
+ * 以連續序號記錄一筆交易變更的 count 個帳戶 (持有所有帳戶鎖時呼叫)
+ * seqs: 各帳戶的序號
+ * return: 最後一筆的序號, 0 = 未 attach
+ */
+uint64_t repl_log_append_group(ReplRecordType type, Account *const *accs, int count, uint64_t *seqs);
+
+/**
+ * 讀取序號 seq 的紀錄
+ * return: 1 = 成功, 0 = 尚未發布, -1 = 已被覆寫 (讀取端落後超過 REPL_LOG_SIZE)
+ */
+int repl_log_read(const ReplLog *log, uint64_t seq, ReplRecord *out);
+
+static inline uint64_t repl_log_head(const ReplLog *log) {
+    return __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+}
+
+// acked = max(acked, seq)
+void repl_log_ack(ReplLog *log, uint64_t seq);
+
+#endif // REPL_LOG_H
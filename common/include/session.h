@@ -0,0 +1,62 @@
+/*
+ * session.h
+ * Login Session Table (Shared Memory)
+ *
+ * Filled on a successful OP_LOGIN and shared by every worker, so a client
+ * that reconnects to any worker can resume with its token instead of
+ * going through OTP again. Lookups are lock-free (per-slot seqlock);
+ * only login (session_create) takes the table's write lock. There is no
+ * logout: a session ends when it expires.
+ *
+ * A token probes SESSION_PROBE_LIMIT slots from its hash. Login takes an
+ * empty or expired one; when all of them hold live sessions it overwrites
+ * the one that expires soonest, which logs that client out (the caller
+ * counts these evictions). The table holds at most MAX_SESSIONS sessions
+ * per SESSION_TTL_SEC, fewer when probe windows fill unevenly.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "account.h"
+
+#define MAX_SESSIONS 1024          // Power of 2
+#define SESSION_TOKEN_LEN 16       // Random bytes
+#define SESSION_TOKEN_HEX_LEN (SESSION_TOKEN_LEN * 2 + 1)
+#define SESSION_TTL_SEC 1800       // 30 minutes
+#define SESSION_PROBE_LIMIT 8      // Linear probing window
+
+typedef struct {
+    uint32_t seq;                  // Seqlock: odd while a writer is updating the slot
+    uint8_t token[SESSION_TOKEN_LEN];
+    char account_id[ACCOUNT_ID_LEN];
+    int64_t expiry;                // 0 = empty
+} __attribute__((aligned(64))) SessionSlot;
+
+typedef struct {
+    pthread_mutex_t write_lock;    // Serializes writers only
+    SessionSlot slots[MAX_SESSIONS];
+} SessionTable;
+
+int session_table_init(SessionTable *table);
+void session_table_cleanup(SessionTable *table);
+
+/**
+ * 建立 Session，token_out 取得新產生的 token
+ * evicted: (可為 NULL) 是否覆蓋了一個尚未過期的 Session
+ */
+int session_create(SessionTable *table, const char *account_id, uint8_t *token_out, int *evicted);
+
+/**
+ * Lock-free 查詢
+ * account_out: (可為 NULL) 取得綁定的帳號
+ * return: 0 = 有效, -1 = 不存在或已過期
+ */
+int session_lookup(SessionTable *table, const uint8_t *token, char *account_out);
+
+void session_token_to_hex(const uint8_t *token, char *hex_out);
+int session_token_from_hex(const char *hex, uint8_t *token_out);
+
+#endif // SESSION_H
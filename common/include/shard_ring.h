@@ -0,0 +1,64 @@
+/*
+ * shard_ring.h
+ * Account -> shard mapping (consistent hashing), shared by bank_router,
+ * banking_server and bank_migrate
+ *
+ * Every shard is placed on a 64-bit hash ring at SHARD_VNODES points per
+ * unit of weight, derived from its name only. An account belongs to the
+ * first point at or after the hash of its id. Adding or removing a shard
+ * therefore moves only the accounts on the ring arcs it gains or loses
+ * (about 1/N of them), and reordering the file or changing a shard's
+ * address moves nothing.
+ *
+ * Membership file, one shard per line ('#' starts a comment):
+ *     NAME HOST:PORT [WEIGHT]
+ */
+
+#ifndef SHARD_RING_H
+#define SHARD_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHARD_MAX 16
+#define SHARD_NAME_LEN 32
+#define SHARD_VNODES 128            // Ring points per unit of weight
+#define SHARD_MAX_WEIGHT 16
+
+typedef struct {
+    char name[SHARD_NAME_LEN];      // Ring identity: renaming a shard moves its accounts
+    char host[64];
+    int port;
+    int weight;
+} ShardInfo;
+
+typedef struct {
+    uint64_t hash;
+    int shard;
+} RingPoint;
+
+typedef struct {
+    int num_shards;
+    ShardInfo shards[SHARD_MAX];
+    int num_points;
+    RingPoint *points;              // Sorted by hash
+} ShardRing;
+
+/**
+ * 讀取 membership 檔並建立 ring
+ * return: 0 = 成功, -1 = 檔案或格式錯誤 (訊息寫到 stderr，ring 不變)
+ */
+int shard_ring_load(ShardRing *ring, const char *path);
+
+// 由 shard 清單建立 ring (帳戶搬移時 Server 依新的 membership 判斷帳戶歸屬)；失敗時 ring 不變
+int shard_ring_build(ShardRing *ring, const ShardInfo *shards, int num_shards);
+
+// 名稱為 name 的 shard index (-1 = 不存在)
+int shard_ring_find(const ShardRing *ring, const char *name);
+
+// 帳戶所屬的 shard index (ring 為空時 -1)
+int shard_ring_lookup(const ShardRing *ring, const char *account_id);
+
+void shard_ring_free(ShardRing *ring);
+
+#endif // SHARD_RING_H
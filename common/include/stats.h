@@ -0,0 +1,119 @@
+/*
+ * stats.h
+ * Per-Worker Request Statistics (Shared Memory)
+ *
+ * Every worker owns one cache-line aligned slot and is its only writer, so
+ * the hot path is a plain load + store per counter (no locks, no atomic
+ * read-modify-write). The master reads all slots and sums them when the
+ * stats endpoint is scraped.
+ *
+ * Latency histograms are log-linear in microseconds: values below 4 us get
+ * their own bucket, above that every power of two is split into 4 buckets
+ * (<= 25% relative error), up to ~16 s.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STATS_MAX_WORKERS 16
+#define STATS_OPS 11                // Index 0 = unknown opcode, 1..10 = OP_* codes
+#define STATS_HIST_SUB_BITS 2       // 4 buckets per power of two
+#define STATS_HIST_BUCKETS 100
+
+// Connection deadlines (closed when the phase takes too long)
+typedef enum {
+    TIMEOUT_HANDSHAKE,              // TLS handshake
+    TIMEOUT_HEADER,                 // First byte of a request -> complete header
+    TIMEOUT_BODY,                   // Complete header -> complete packet
+    TIMEOUT_IDLE,                   // Between requests, or response not being read
+    TIMEOUT_PHASES
+} TimeoutPhase;
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;                // Response status != STATUS_SUCCESS
+    uint64_t sum_us;
+    uint64_t hist[STATS_HIST_BUCKETS];
+} OpStats;
+
+typedef struct {
+    OpStats ops[STATS_OPS];
+    uint64_t conns_accepted;
+    uint64_t conns_closed;
+    uint64_t tls_handshakes;
+    uint64_t tls_handshake_failures;
+    uint64_t otp_ok;
+    uint64_t otp_rejected;
+    uint64_t otp_unavailable;       // Timeout, connection error or circuit open
+    uint64_t checksum_failures;
+    uint64_t rate_limited;          // Answered STATUS_RATE_LIMITED
+    uint64_t shed;                  // Answered STATUS_SERVER_BUSY
+    uint64_t load_level;            // Gauge: 0 normal, 1 high, 2 overloaded
+    uint64_t conn_timeouts[TIMEOUT_PHASES];
+    uint64_t repl_sync_waits;       // Responses held until a standby applied the change
+    uint64_t repl_sync_timeouts;    // ... answered without an ack after the sync timeout
+    uint64_t replica_reads;         // Read replica: balance queries answered locally
+    uint64_t replica_stale;         // ... refused (STATUS_REPLICA_STALE): too stale, or behind the client's write
+    uint64_t replica_read_waits;    // ... parked until the client's last write was applied here
+    uint64_t moved;                 // Answered STATUS_ACCOUNT_MOVED (account migrated to another shard)
+    uint64_t snapshot_reads;        // Balance queries answered as of a snapshot
+    uint64_t snapshot_too_old;      // ... refused (STATUS_SNAPSHOT_TOO_OLD): snapshot expired or versions overwritten
+    uint64_t txn_conflicts;         // OP_TRANSACTION answered STATUS_TXN_CONFLICT
+    uint64_t idem_replays;          // Retries answered with the stored response of their key
+    uint64_t idem_in_progress;      // ... refused: the first attempt was still running (or its set full)
+    uint64_t idem_evictions;        // Completed entries evicted before expiring (their retries would run again)
+    uint64_t session_evictions;     // Logins that overwrote a live session (its client is logged out)
+} __attribute__((aligned(64))) WorkerStats;
+
+// Replication, written by the master's replication process (role by the master)
+typedef struct {
+    uint64_t role;                  // Gauge: 0 primary, 1 standby
+    uint64_t standbys;              // Gauge (primary): standbys connected
+    uint64_t connected;             // Gauge (standby): streaming from the primary
+    uint64_t primary_seq;           // Gauge: last sequence number on the primary (as last heard)
+    uint64_t applied_seq;           // Gauge (standby): last record applied
+    uint64_t applied;               // Records applied (standby)
+    uint64_t lag_ns_sum;            // Commit on the primary -> applied here, over `applied`
+    uint64_t lag_ns;                // Gauge: lag of the last applied record
+    uint64_t snapshots;             // Full resynchronisations sent (primary) / received (standby)
+    uint64_t fresh_ns;              // Standby: CLOCK_MONOTONIC time our data was known to match the primary
+    uint64_t migrate_phase;         // Gauge: MigratePhase of the account migration out of this shard
+    uint64_t migrate_records;       // Records streamed to bank_migrate
+} __attribute__((aligned(64))) ReplStats;
+
+// Standby staleness: how long ago the data here was known to match the primary (UINT64_MAX = never)
+uint64_t stats_repl_staleness_ns(const ReplStats *repl);
+
+typedef struct {
+    uint32_t num_workers;           // Set by the master before forking
+    WorkerStats workers[STATS_MAX_WORKERS];
+    ReplStats repl;
+} StatsTable;
+
+// Single-writer increment: readers see either the old or the new value
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(uint64_t *gauge, uint64_t value) {
+    __atomic_store_n(gauge, value, __ATOMIC_RELAXED);
+}
+
+void stats_init(StatsTable *table);
+int stats_op_index(uint16_t opcode);
+const char *stats_op_name(int index);
+const char *stats_timeout_name(TimeoutPhase phase);
+int stats_hist_bucket(uint64_t us);
+uint64_t stats_hist_upper(int bucket);
+void stats_record_op(WorkerStats *ws, uint16_t opcode, uint64_t latency_us, int is_error);
+
+/**
+ * 彙總所有 Worker 並輸出 Prometheus text format
+ * return: 寫入的長度 (不含結尾 '\0')
+ */
+size_t stats_format_prometheus(const StatsTable *table, int num_workers, char *buf, size_t len);
+
+#endif // STATS_H
@@ -0,0 +1,48 @@
+/*
+ * timer_wheel.h
+ * Hierarchical Timer Wheel
+ *
+ * 4 levels x 64 slots, intrusive nodes. Add/delete are O(1); advancing one
+ * tick is O(1) amortized (each timer is cascaded at most once per level).
+ * The tick unit is up to the caller (seconds for OTP expiry, milliseconds
+ * for connection deadlines). Not thread-safe: guard with the owner's lock.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TW_LEVELS 4
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;  // NULL when not scheduled
+    uint64_t expires;          // Absolute tick
+} TimerNode;
+
+typedef struct {
+    uint64_t now;              // Current tick
+    size_t count;              // Scheduled timers
+    TimerNode *slots[TW_LEVELS][TW_SLOTS];
+} TimerWheel;
+
+// Expiry callback: the node is already unlinked and may be freed or re-added
+typedef void (*TimerCallback)(TimerNode *node, void *arg);
+
+// Get the struct containing an embedded TimerNode
+#define timer_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+void timer_wheel_init(TimerWheel *tw, uint64_t now);
+void timer_node_init(TimerNode *node);
+int timer_pending(const TimerNode *node);
+void timer_wheel_add(TimerWheel *tw, TimerNode *node, uint64_t expires);
+void timer_wheel_del(TimerWheel *tw, TimerNode *node);
+size_t timer_wheel_advance(TimerWheel *tw, uint64_t now, TimerCallback cb, void *arg);
+int64_t timer_wheel_next_timeout(const TimerWheel *tw);
+
+#endif // TIMER_WHEEL_H
@@ -19,6 +19,15 @@ typedef struct {
     int verify_peer;  // 1 = verify, 0 = no verify
 } TLSConfig;
 
+// Result of a non-blocking TLS operation
+typedef enum {
+    TLS_IO_OK = 0,
+    TLS_IO_WANT_READ,
+    TLS_IO_WANT_WRITE,
+    TLS_IO_CLOSED,      // Peer sent close_notify / EOF
+    TLS_IO_ERROR
+} TlsIoStatus;
+
 // Default configuration
 #define DEFAULT_CA_CERT       "certificate/ca.crt"
 #define DEFAULT_SERVER_CERT   "certificate/server_wildcard.crt"
@@ -29,10 +38,16 @@ typedef struct {
 // TLS Functions
 SSL_CTX *tls_create_server_context(const TLSConfig *config);
 SSL_CTX *tls_create_client_context(const TLSConfig *config);
+int tls_reload_server_context(SSL_CTX **ctx, const TLSConfig *config);
 SSL *tls_accept_connection(SSL_CTX *ctx, int client_fd);
+SSL *tls_accept_start(SSL_CTX *ctx, int client_fd);
+TlsIoStatus tls_handshake_step(SSL *ssl);
+TlsIoStatus tls_io_status(SSL *ssl, int ret);
 SSL *tls_connect(SSL_CTX *ctx, int sock_fd, const char *hostname);
+SSL *tls_connect_start(SSL_CTX *ctx, int sock_fd, const char *hostname);
 int tls_read(SSL *ssl, void *buf, int len);
 int tls_write(SSL *ssl, const void *buf, int len);
+int tls_peer_common_name(SSL *ssl, char *buf, int len);
 void tls_close(SSL *ssl);
 void tls_cleanup_context(SSL_CTX *ctx);
 void tls_print_error(const char *msg);
@@ -0,0 +1,34 @@
+/*
+ * totp.h
+ * RFC 6238 Time-based One-Time Password (HOTP over a 30-second step)
+ */
+
+#ifndef TOTP_H
+#define TOTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOTP_SECRET_LEN 20     // 160-bit secret (RFC 4226 recommendation)
+#define TOTP_STEP_SEC   30
+#define TOTP_DIGITS     6
+#define TOTP_DEFAULT_SKEW 1    // Accept codes from +-1 step
+
+typedef enum {
+    TOTP_SHA1 = 0,
+    TOTP_SHA256 = 1
+} TotpAlgo;
+
+int totp_generate_secret(uint8_t *secret, size_t len);
+uint64_t totp_current_step(void);
+uint32_t totp_code(const uint8_t *secret, size_t len, uint64_t step, TotpAlgo algo);
+
+/**
+ * 在 [step - skew, step + skew] 範圍內比對 code
+ * 已使用過的時間步 (<= last_step) 一律拒絕，防止重放
+ * return: 比對成功的時間步, 0 = 失敗
+ */
+uint64_t totp_match(const uint8_t *secret, size_t len, const char *code,
+                    uint64_t step, int skew, uint64_t last_step, TotpAlgo algo);
+
+#endif // TOTP_H
@@ -1,7 +1,128 @@
 #include "account.h"
+#include "log_ring.h"
+#include "repl_log.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+// 本行程累計等待帳戶鎖的時間 (單執行緒 Worker，不需原子操作)
+static uint64_t lock_wait_ns = 0;
+
+// 取鎖：無競爭時 trylock 直接成功，只有需要等待時才讀時鐘
+// contended 在取得鎖之後才累加，因此受該鎖保護
+static void account_lock(pthread_mutex_t *m, uint64_t *contended) {
+    if (pthread_mutex_trylock(m) == 0) return;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    pthread_mutex_lock(m);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    lock_wait_ns += (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (t1.tv_nsec - t0.tv_nsec);
+    (*contended)++;
+}
+
+// 鎖定帳戶並累計存取次數 (bankstat 的熱門帳戶)
+static void lock_account(Account *acc) {
+    account_lock(&acc->lock, &acc->lock_contended);
+    acc->ops++;
+}
+
+uint64_t account_lock_wait_ns(void) {
+    return lock_wait_ns;
+}
+
+// 本行程最後一次寫入 mutation log 的序號
+static uint64_t last_seq = 0;
+
+// 記錄變更後的帳戶 (持有帳戶鎖或 db_lock 時呼叫，同一帳戶的紀錄因此依提交順序排列)
+static void journal_account(Account *acc, ReplRecordType type) {
+    uint64_t seq = repl_log_append(type, acc);
+    if (seq) {
+        acc->repl_seq = seq;
+        last_seq = seq;
+    }
+}
+
+// 一筆交易變更的帳戶以連續序號記錄 (持有所有帳戶鎖)，Standby 整組套用
+static void journal_group(Account **accs, int count) {
+    uint64_t seqs[TXN_MAX_ACCOUNTS];
+    uint64_t last = repl_log_append_group(REPL_UPDATE, accs, count, seqs);
+    if (last) {
+        for (int i = 0; i < count; i++) accs[i]->repl_seq = seqs[i];
+        last_seq = last;
+    }
+}
+
+uint64_t account_last_seq(void) {
+    return last_seq;
+}
+
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 仍開啟的快照中最舊的時間戳 (沒有則 UINT64_MAX)；不取鎖，只有在有快照時才讀時鐘
+static uint64_t view_horizon(AccountDB *db) {
+    uint64_t horizon = UINT64_MAX, now = 0;
+    for (int i = 0; i < MVCC_MAX_SNAPSHOTS; i++) {
+        uint64_t ts = __atomic_load_n(&db->views[i].ts, __ATOMIC_SEQ_CST);
+        if (ts == 0 || ts >= horizon) continue;
+        if (!now) now = mono_ms();
+        if (__atomic_load_n(&db->views[i].expires_ms, __ATOMIC_RELAXED) > now) horizon = ts;
+    }
+    return horizon;
+}
+
+// 新的提交時間戳 (持有要變更的帳戶鎖時取得)
+static uint64_t next_commit_ts(AccountDB *db) {
+    return __atomic_add_fetch(&db->commit_ts, 1, __ATOMIC_SEQ_CST);
+}
+
+// 以提交時間戳 ts 記錄目前餘額 (持有帳戶鎖，或帳戶尚未對其他行程可見時)
+// 時鐘先遞增才檢查快照 (與 account_view_open 的 Dekker 配對)：沒看到的快照
+// 一定在此之後才取時間戳，不需要比這次更舊的版本
+static void record_version_at(AccountDB *db, Account *acc, uint64_t ts) {
+    uint64_t horizon = view_horizon(db);
+    
+    // 回收：次舊的版本已能滿足所有快照時，最舊的就不再需要
+    while (acc->version_count > 1) {
+        uint32_t oldest = (acc->version_newest + ACCOUNT_VERSIONS + 1 - acc->version_count) % ACCOUNT_VERSIONS;
+        if (acc->versions[(oldest + 1) % ACCOUNT_VERSIONS].ts > horizon) break;
+        acc->version_count--;
+    }
+    if (acc->version_count == ACCOUNT_VERSIONS) {
+        acc->version_count--;  // 仍被快照需要：覆蓋，該快照讀取時回報 too old
+        __atomic_add_fetch(&db->versions_dropped, 1, __ATOMIC_RELAXED);
+    }
+    acc->version++;
+    acc->version_newest = (acc->version_newest + 1) % ACCOUNT_VERSIONS;
+    acc->versions[acc->version_newest].ts = ts;
+    acc->versions[acc->version_newest].version = acc->version;
+    acc->versions[acc->version_newest].balance = acc->balance;
+    acc->version_count++;
+}
+
+static void record_version(AccountDB *db, Account *acc) {
+    record_version_at(db, acc, next_commit_ts(db));
+}
+
+// 新帳戶的第一個版本 (持有 db_lock，帳戶尚未對其他行程可見)
+static void record_created(AccountDB *db, Account *acc) {
+    acc->version = 0;
+    acc->version_count = 0;
+    record_version(db, acc);
+    acc->created_ts = acc->versions[acc->version_newest].ts;
+}
+
+// 複寫或搬移來的變更沿用來源的版本號：Client 在另一個節點讀到的版本，
+// 在這裡驗證交易時才有意義
+static void adopt_version(Account *acc, uint64_t version) {
+    acc->version = version;
+    acc->versions[acc->version_newest].version = version;
+}
 
 // 初始化帳戶資料庫
 int account_init(AccountDB *db) {
@@ -9,6 +130,7 @@ int account_init(AccountDB *db) {
     
     memset(db, 0, sizeof(AccountDB));
     db->account_count = 0;
+    db->commit_ts = 1;  // 快照時間戳 0 代表空位
     
     // 初始化全域鎖
     pthread_mutexattr_t attr;
@@ -42,12 +164,36 @@ Account* account_find(AccountDB *db, const char *account_id) {
     return NULL;
 }
 
+// 新帳戶的位置 (持有 db_lock)：優先重用已停用 (搬走) 帳戶的位置，來回搬移才不會
+// 用完 MAX_ACCOUNTS。重用的位置對其他行程仍可見 (快照、bankstat)，呼叫端要在
+// 帳戶鎖內填入內容；新位置在 account_count 之外，填完才遞增
+static Account *claim_slot(AccountDB *db, int *reused) {
+    for (int i = 0; i < db->account_count; i++) {
+        if (!db->accounts[i].active) {
+            Account *acc = &db->accounts[i];
+            account_lock(&acc->lock, &acc->lock_contended);
+            acc->ops = 0;
+            acc->lock_contended = 0;
+            *reused = 1;
+            return acc;
+        }
+    }
+    *reused = 0;
+    return db->account_count < MAX_ACCOUNTS ? &db->accounts[db->account_count] : NULL;
+}
+
+// claim_slot 的位置填好了：重用的放開帳戶鎖，新的才對其他行程可見
+static void publish_slot(AccountDB *db, Account *acc, int reused) {
+    if (reused) pthread_mutex_unlock(&acc->lock);
+    else db->account_count++;
+}
+
 // 建立新帳戶
 int account_create(AccountDB *db, const char *account_id, double initial_balance) {
     if (!db || !account_id) return -1;
     if (initial_balance < 0) return -1;
     
-    pthread_mutex_lock(&db->db_lock);
+    account_lock(&db->db_lock, &db->db_lock_contended);
     
     // 檢查帳戶是否已存在
     if (account_find(db, account_id) != NULL) {
@@ -56,23 +202,29 @@ int account_create(AccountDB *db, const char *account_id, double initial_balance
     }
     
     // 檢查是否已滿
-    if (db->account_count >= MAX_ACCOUNTS) {
+    int reused;
+    Account *acc = claim_slot(db, &reused);
+    if (!acc) {
         pthread_mutex_unlock(&db->db_lock);
         return -3;  // Database full
     }
     
     // 建立新帳戶
-    Account *acc = &db->accounts[db->account_count];
     strncpy(acc->account_id, account_id, ACCOUNT_ID_LEN - 1);
     acc->account_id[ACCOUNT_ID_LEN - 1] = '\0';
     acc->balance = initial_balance;
     acc->active = 1;
-    db->account_count++;
+    totp_generate_secret(acc->totp_secret, TOTP_SECRET_LEN);
+    acc->totp_last_step = 0;
+    acc->repl_seq = 0;
+    record_created(db, acc);
+    journal_account(acc, REPL_CREATE);
+    publish_slot(db, acc, reused);
     
     pthread_mutex_unlock(&db->db_lock);
     
-    printf("[ACCOUNT] Created account %s with initial balance %.2f\n", 
-           account_id, initial_balance);
+    log_write(LOG_LEVEL_INFO, "[ACCOUNT] Created account %s with initial balance %.2f\n", 
+                              account_id, initial_balance);
     return 0;
 }
 
@@ -80,7 +232,7 @@ int account_create(AccountDB *db, const char *account_id, double initial_balance
 int account_deposit(AccountDB *db, const char *account_id, double amount, double *new_balance) {
     if (!db || !account_id || amount <= 0) return -1;
     
-    pthread_mutex_lock(&db->db_lock);
+    account_lock(&db->db_lock, &db->db_lock_contended);
     Account *acc = account_find(db, account_id);
     
     if (!acc) {
@@ -89,15 +241,17 @@ int account_deposit(AccountDB *db, const char *account_id, double amount, double
     }
     
     // 鎖定該帳戶（兩階段鎖定）
-    pthread_mutex_lock(&acc->lock);
+    lock_account(acc);
     pthread_mutex_unlock(&db->db_lock);
     
     // 執行交易
     acc->balance += amount;
     if (new_balance) *new_balance = acc->balance;
+    record_version(db, acc);
+    journal_account(acc, REPL_UPDATE);
     
-    printf("[ACCOUNT] Deposit %.2f to %s, new balance: %.2f\n", 
-           amount, account_id, acc->balance);
+    log_write(LOG_LEVEL_INFO, "[ACCOUNT] Deposit %.2f to %s, new balance: %.2f\n", 
+                              amount, account_id, acc->balance);
     
     pthread_mutex_unlock(&acc->lock);
     return 0;
@@ -107,7 +261,7 @@ int account_deposit(AccountDB *db, const char *account_id, double amount, double
 int account_withdraw(AccountDB *db, const char *account_id, double amount, double *new_balance) {
     if (!db || !account_id || amount <= 0) return -1;
     
-    pthread_mutex_lock(&db->db_lock);
+    account_lock(&db->db_lock, &db->db_lock_contended);
     Account *acc = account_find(db, account_id);
     
     if (!acc) {
@@ -116,7 +270,7 @@ int account_withdraw(AccountDB *db, const char *account_id, double amount, doubl
     }
     
     // 鎖定該帳戶
-    pthread_mutex_lock(&acc->lock);
+    lock_account(acc);
     pthread_mutex_unlock(&db->db_lock);
     
     // 檢查餘額（防止透支）
@@ -128,19 +282,21 @@ int account_withdraw(AccountDB *db, const char *account_id, double amount, doubl
     // 執行交易
     acc->balance -= amount;
     if (new_balance) *new_balance = acc->balance;
+    record_version(db, acc);
+    journal_account(acc, REPL_UPDATE);
     
-    printf("[ACCOUNT] Withdraw %.2f from %s, new balance: %.2f\n", 
-           amount, account_id, acc->balance);
+    log_write(LOG_LEVEL_INFO, "[ACCOUNT] Withdraw %.2f from %s, new balance: %.2f\n", 
+                              amount, account_id, acc->balance);
     
     pthread_mutex_unlock(&acc->lock);
     return 0;
 }
 
 // 查詢餘額
-int account_get_balance(AccountDB *db, const char *account_id, double *balance) {
+int account_get_balance(AccountDB *db, const char *account_id, double *balance, uint64_t *version) {
     if (!db || !account_id || !balance) return -1;
     
-    pthread_mutex_lock(&db->db_lock);
+    account_lock(&db->db_lock, &db->db_lock_contended);
     Account *acc = account_find(db, account_id);
     
     if (!acc) {
@@ -148,17 +304,425 @@ int account_get_balance(AccountDB *db, const char *account_id, double *balance)
         return -2;  // Account not found
     }
     
-    pthread_mutex_lock(&acc->lock);
+    lock_account(acc);
     pthread_mutex_unlock(&db->db_lock);
     
     *balance = acc->balance;
+    if (version) *version = acc->version;
+    
+    log_write(LOG_LEVEL_INFO, "[ACCOUNT] Balance query for %s: %.2f\n", account_id, *balance);
+    
+    pthread_mutex_unlock(&acc->lock);
+    return 0;
+}
+
+// 取得目前時間步的 TOTP (測試用，實際上由使用者的驗證器 App 產生)
+int account_totp_code(AccountDB *db, const char *account_id, TotpAlgo algo, char *code_out) {
+    if (!db || !account_id || !code_out) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    Account *acc = account_find(db, account_id);
+    
+    if (!acc) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -2;  // Account not found
+    }
+    
+    lock_account(acc);
+    pthread_mutex_unlock(&db->db_lock);
+    
+    uint32_t code = totp_code(acc->totp_secret, TOTP_SECRET_LEN, totp_current_step(), algo);
+    snprintf(code_out, TOTP_DIGITS + 1, "%06u", code);
+    
+    pthread_mutex_unlock(&acc->lock);
+    return 0;
+}
+
+// 本地 TOTP 驗證：比對與記錄已使用的時間步在同一把帳戶鎖內完成，
+// 同一組 code 在多個 Worker 間也只會被接受一次
+int account_totp_verify(AccountDB *db, const char *account_id, const char *code, int skew, TotpAlgo algo) {
+    if (!db || !account_id || !code) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    Account *acc = account_find(db, account_id);
+    
+    if (!acc) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -2;  // Account not found
+    }
+    
+    lock_account(acc);
+    pthread_mutex_unlock(&db->db_lock);
+    
+    uint64_t step = totp_match(acc->totp_secret, TOTP_SECRET_LEN, code,
+                               totp_current_step(), skew, acc->totp_last_step, algo);
+    if (step) {
+        acc->totp_last_step = step;
+        journal_account(acc, REPL_UPDATE);  // 防重放狀態也要跟著複寫
+    }
+    
+    pthread_mutex_unlock(&acc->lock);
+    return step ? 0 : -1;
+}
+
+// 加入交易涉及的帳戶 (去除重複)，依在帳戶表中的位置排序
+// 所有交易都依同一順序取鎖，彼此不會死結；單一帳戶的操作一次只持有一把帳戶鎖
+static void txn_add(Account **accs, int *count, Account *acc) {
+    int i = *count;
+    for (int k = 0; k < *count; k++) {
+        if (accs[k] == acc) return;
+    }
+    while (i > 0 && accs[i - 1] > acc) {
+        accs[i] = accs[i - 1];
+        i--;
+    }
+    accs[i] = acc;
+    (*count)++;
+}
+
+int account_transact(AccountDB *db, const AccountTxnRead *reads, int num_reads,
+                     const AccountTxnWrite *writes, int num_writes, const char **failed) {
+    if (!db || num_reads < 0 || num_writes < 1 || num_reads + num_writes > TXN_MAX_ACCOUNTS) return -1;
+    for (int i = 0; i < num_writes; i++) {
+        if (!(writes[i].amount > 0 || writes[i].amount < 0)) {  // 0 或 NaN
+            if (failed) *failed = writes[i].account_id;
+            return -1;
+        }
+    }
+    
+    Account *found[TXN_MAX_ACCOUNTS];   // reads, then writes
+    Account *accs[TXN_MAX_ACCOUNTS];    // Distinct, in lock order
+    double delta[TXN_MAX_ACCOUNTS];
+    int count = 0;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    for (int i = 0; i < num_reads + num_writes; i++) {
+        const char *id = i < num_reads ? reads[i].account_id : writes[i - num_reads].account_id;
+        found[i] = account_find(db, id);
+        if (!found[i]) {
+            pthread_mutex_unlock(&db->db_lock);
+            if (failed) *failed = id;
+            return -2;  // Account not found
+        }
+        txn_add(accs, &count, found[i]);
+    }
+    for (int k = 0; k < count; k++) {
+        lock_account(accs[k]);
+        delta[k] = 0;
+    }
+    pthread_mutex_unlock(&db->db_lock);
+    
+    // 驗證：讀取之後有人變更過就整筆放棄，由 Client 重讀重試
+    int result = 0;
+    for (int i = 0; i < num_reads && result == 0; i++) {
+        if (found[i]->version != reads[i].version) {
+            if (failed) *failed = reads[i].account_id;
+            result = -4;
+        }
+    }
+    for (int i = 0; i < num_writes; i++) {
+        int k = 0;
+        while (accs[k] != found[num_reads + i]) k++;
+        delta[k] += writes[i].amount;
+    }
+    for (int k = 0; k < count && result == 0; k++) {
+        if (delta[k] < 0 && accs[k]->balance + delta[k] < 0) {
+            if (failed) *failed = accs[k]->account_id;
+            result = -3;  // Insufficient funds
+        }
+    }
+    
+    if (result == 0) {
+        Account *changed[TXN_MAX_ACCOUNTS];
+        int num_changed = 0;
+        uint64_t ts = next_commit_ts(db);
+        for (int k = 0; k < count; k++) {
+            if (delta[k] == 0) continue;  // 只讀取，或變動互相抵銷
+            accs[k]->balance += delta[k];
+            record_version_at(db, accs[k], ts);
+            changed[num_changed++] = accs[k];
+            log_write(LOG_LEVEL_INFO, "[ACCOUNT] Transaction %+.2f on %s, new balance: %.2f\n",
+                                      delta[k], accs[k]->account_id, accs[k]->balance);
+        }
+        journal_group(changed, num_changed);
+    }
+    
+    for (int k = 0; k < count; k++) {
+        pthread_mutex_unlock(&accs[k]->lock);
+    }
+    return result;
+}
+
+// Standby 套用 after-image：序號比較讓重複、亂序抵達的紀錄不會讓帳戶倒退
+int account_apply(AccountDB *db, const ReplRecord *rec, int force) {
+    if (!db || !rec) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    Account *acc = account_find(db, rec->account_id);
+    
+    // 搬到其他 shard 的帳戶在 Standby 上也停用，promote 後不會有兩個 shard 擁有它
+    if (rec->type == REPL_DEACTIVATE) {
+        int applied = 0;
+        if (acc) {
+            account_lock(&acc->lock, &acc->lock_contended);
+            applied = force || rec->seq > acc->repl_seq;
+            if (applied) {
+                acc->active = 0;
+                acc->repl_seq = rec->seq;
+            }
+            pthread_mutex_unlock(&acc->lock);
+        }
+        pthread_mutex_unlock(&db->db_lock);
+        return applied;
+    }
+    
+    if (!acc) {
+        int reused;
+        acc = claim_slot(db, &reused);
+        if (!acc) {
+            pthread_mutex_unlock(&db->db_lock);
+            return -1;
+        }
+        memcpy(acc->account_id, rec->account_id, ACCOUNT_ID_LEN);
+        acc->account_id[ACCOUNT_ID_LEN - 1] = '\0';
+        acc->balance = rec->balance;
+        acc->active = 1;
+        memcpy(acc->totp_secret, rec->totp_secret, TOTP_SECRET_LEN);
+        acc->totp_last_step = rec->totp_last_step;
+        acc->repl_seq = rec->seq;
+        record_created(db, acc);
+        adopt_version(acc, rec->version);
+        publish_slot(db, acc, reused);
+        pthread_mutex_unlock(&db->db_lock);
+        return 1;
+    }
+    
+    account_lock(&acc->lock, &acc->lock_contended);
+    pthread_mutex_unlock(&db->db_lock);
+    
+    int applied = force || rec->seq > acc->repl_seq;
+    if (applied) {
+        int changed = acc->balance != rec->balance || acc->version != rec->version;
+        acc->balance = rec->balance;
+        acc->totp_last_step = rec->totp_last_step;
+        memcpy(acc->totp_secret, rec->totp_secret, TOTP_SECRET_LEN);
+        acc->repl_seq = rec->seq;
+        if (changed) {
+            record_version(db, acc);
+            adopt_version(acc, rec->version);
+        }
+    }
+    
+    pthread_mutex_unlock(&acc->lock);
+    return applied;
+}
+
+// 搬移 (bank_migrate)：來源 shard 的序號與本機無關，改以本機序號記錄；版本號沿用來源的
+int account_import(AccountDB *db, const ReplRecord *rec) {
+    if (!db || !rec) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    Account *acc = account_find(db, rec->account_id);
+    
+    if (!acc) {
+        int reused;
+        acc = claim_slot(db, &reused);
+        if (!acc) {
+            pthread_mutex_unlock(&db->db_lock);
+            return -1;
+        }
+        memcpy(acc->account_id, rec->account_id, ACCOUNT_ID_LEN);
+        acc->account_id[ACCOUNT_ID_LEN - 1] = '\0';
+        acc->balance = rec->balance;
+        acc->active = 1;
+        memcpy(acc->totp_secret, rec->totp_secret, TOTP_SECRET_LEN);
+        acc->totp_last_step = rec->totp_last_step;
+        acc->repl_seq = 0;
+        record_created(db, acc);
+        adopt_version(acc, rec->version);
+        journal_account(acc, REPL_CREATE);
+        publish_slot(db, acc, reused);
+        pthread_mutex_unlock(&db->db_lock);
+        return 0;
+    }
+    
+    lock_account(acc);
+    pthread_mutex_unlock(&db->db_lock);
+    acc->balance = rec->balance;
+    acc->totp_last_step = rec->totp_last_step;
+    memcpy(acc->totp_secret, rec->totp_secret, TOTP_SECRET_LEN);
+    record_version(db, acc);
+    adopt_version(acc, rec->version);
+    journal_account(acc, REPL_UPDATE);
+    pthread_mutex_unlock(&acc->lock);
+    return 0;
+}
+
+// Sender 的快照：return 0 = 已填入, 1 = 已停用的帳戶 (填入 REPL_DEACTIVATE 紀錄),
+// 2 = 沒有內容 (停用的帳戶已在別的位置重新出現), -1 = 超出帳戶數
+int account_snapshot(AccountDB *db, int index, ReplRecord *out) {
+    if (!db || !out) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    if (index < 0 || index >= db->account_count) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -1;
+    }
+    Account *acc = &db->accounts[index];
+    if (!acc->active) {
+        // 停用後錯過 REPL_DEACTIVATE 的 Standby 也要停用它
+        int result = account_find(db, acc->account_id) ? 2 : 1;
+        if (result == 1) {
+            memset(out, 0, sizeof(*out));
+            out->seq = acc->repl_seq;
+            out->type = REPL_DEACTIVATE;
+            memcpy(out->account_id, acc->account_id, ACCOUNT_ID_LEN);
+        }
+        pthread_mutex_unlock(&db->db_lock);
+        return result;
+    }
+    account_lock(&acc->lock, &acc->lock_contended);
+    pthread_mutex_unlock(&db->db_lock);
     
-    printf("[ACCOUNT] Balance query for %s: %.2f\n", account_id, *balance);
+    memset(out, 0, sizeof(*out));
+    out->seq = acc->repl_seq;
+    out->type = REPL_CREATE;
+    memcpy(out->account_id, acc->account_id, ACCOUNT_ID_LEN);
+    out->balance = acc->balance;
+    out->version = acc->version;
+    out->totp_last_step = acc->totp_last_step;
+    memcpy(out->totp_secret, acc->totp_secret, TOTP_SECRET_LEN);
     
     pthread_mutex_unlock(&acc->lock);
     return 0;
 }
 
+void account_deactivate(AccountDB *db, int index) {
+    if (!db) return;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    if (index >= 0 && index < db->account_count) {
+        Account *acc = &db->accounts[index];
+        account_lock(&acc->lock, &acc->lock_contended);
+        acc->active = 0;
+        journal_account(acc, REPL_DEACTIVATE);
+        pthread_mutex_unlock(&acc->lock);
+    }
+    pthread_mutex_unlock(&db->db_lock);
+}
+
+uint64_t account_max_seq(AccountDB *db) {
+    uint64_t max = 0;
+    if (!db) return 0;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    for (int i = 0; i < db->account_count; i++) {
+        if (db->accounts[i].repl_seq > max) max = db->accounts[i].repl_seq;
+    }
+    pthread_mutex_unlock(&db->db_lock);
+    return max;
+}
+
+// 開啟快照 (持有 db_lock 以配置位置；寫入端不取鎖，只讀位置)
+// 先公開時間戳再確認時鐘沒動：期間有提交就以新的時鐘重來，否則該提交
+// 的 record_version 可能沒看到這個快照而回收它需要的版本
+int account_view_open(AccountDB *db, uint32_t lease_ms, uint64_t *id_out, uint64_t *ts_out) {
+    if (!db || !id_out || !ts_out) return -1;
+    if (lease_ms == 0) lease_ms = MVCC_LEASE_MS;
+    if (lease_ms > MVCC_MAX_LEASE_MS) lease_ms = MVCC_MAX_LEASE_MS;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    uint64_t now = mono_ms();
+    int slot = -1;
+    for (int i = 0; i < MVCC_MAX_SNAPSHOTS; i++) {
+        AccountView *v = &db->views[i];
+        if (v->ts == 0 || v->expires_ms <= now) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -1;
+    }
+    
+    AccountView *v = &db->views[slot];
+    __atomic_store_n(&v->ts, 0, __ATOMIC_SEQ_CST);  // 過期的舊快照
+    v->generation++;
+    v->lease_ms = lease_ms;
+    __atomic_store_n(&v->expires_ms, now + lease_ms, __ATOMIC_RELAXED);
+    uint64_t ts;
+    do {
+        ts = __atomic_load_n(&db->commit_ts, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&v->ts, ts, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&db->commit_ts, __ATOMIC_SEQ_CST) != ts);
+    
+    *id_out = ((uint64_t)v->generation << 8) | (uint64_t)slot;
+    *ts_out = ts;
+    pthread_mutex_unlock(&db->db_lock);
+    return 0;
+}
+
+// id 對應的快照 (持有 db_lock)，不存在或已過期回傳 NULL
+static AccountView *view_lookup(AccountDB *db, uint64_t id, uint64_t now) {
+    uint64_t slot = id & 0xff;
+    if (slot >= MVCC_MAX_SNAPSHOTS) return NULL;
+    AccountView *v = &db->views[slot];
+    if (v->ts == 0 || v->generation != (uint32_t)(id >> 8) || v->expires_ms <= now) return NULL;
+    return v;
+}
+
+int account_view_close(AccountDB *db, uint64_t id) {
+    if (!db) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    AccountView *v = view_lookup(db, id, mono_ms());
+    if (v) __atomic_store_n(&v->ts, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&db->db_lock);
+    return v ? 0 : -1;
+}
+
+// 時間戳 <= 快照的提交都在持有帳戶鎖時取得時間戳並記錄版本，
+// 所以取得帳戶鎖之後，快照應看到的版本都已經在版本環裡
+int account_view_balance(AccountDB *db, uint64_t id, const char *account_id, double *balance,
+                         uint64_t *version, uint64_t *ts_out) {
+    if (!db || !account_id || !balance) return -1;
+    
+    account_lock(&db->db_lock, &db->db_lock_contended);
+    uint64_t now = mono_ms();
+    AccountView *v = view_lookup(db, id, now);
+    if (!v) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -3;
+    }
+    uint64_t ts = v->ts;
+    __atomic_store_n(&v->expires_ms, now + v->lease_ms, __ATOMIC_RELAXED);  // 延長租約
+    Account *acc = account_find(db, account_id);
+    
+    if (!acc) {
+        pthread_mutex_unlock(&db->db_lock);
+        return -2;  // Account not found
+    }
+    
+    lock_account(acc);
+    pthread_mutex_unlock(&db->db_lock);
+    
+    int result = acc->created_ts > ts ? -2 : -3;
+    for (uint32_t n = 0; n < acc->version_count; n++) {
+        const AccountVersion *ver = &acc->versions[(acc->version_newest + ACCOUNT_VERSIONS - n) % ACCOUNT_VERSIONS];
+        if (ver->ts <= ts) {
+            *balance = ver->balance;
+            if (version) *version = ver->version;
+            result = 0;
+            break;
+        }
+    }
+    
+    pthread_mutex_unlock(&acc->lock);
+    if (ts_out) *ts_out = ts;
+    return result;
+}
+
 // 清理資源
 void account_cleanup(AccountDB *db) {
     if (!db) return;
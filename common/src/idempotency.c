@@ -0,0 +1,127 @@
+/*
+ * idempotency.c
+ * Shared-Memory Response Cache Implementation
+ */
+
+#include "idempotency.h"
+#include <string.h>
+#include <time.h>
+
+// The key's request is recognised by content, not by the 16-bit wire checksum:
+// two deposits with the same byte sum must not share a response
+uint64_t idem_fingerprint(uint16_t opcode, const void *payload, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint64_t prefix[2] = { opcode, len };
+    const uint8_t *parts[2] = { (const uint8_t *)prefix, (const uint8_t *)payload };
+    size_t lens[2] = { sizeof(prefix), len };
+    for (int p = 0; p < 2; p++) {
+        for (size_t i = 0; i < lens[p]; i++) {
+            h ^= parts[p][i];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+int idem_init(IdemCache *cache) {
+    if (!cache) return -1;
+
+    memset(cache, 0, sizeof(IdemCache));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);  // 支援跨行程
+    for (int i = 0; i < IDEM_SETS; i++) {
+        pthread_mutex_init(&cache->sets[i].lock, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    return 0;
+}
+
+void idem_cleanup(IdemCache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < IDEM_SETS; i++) {
+        pthread_mutex_destroy(&cache->sets[i].lock);
+    }
+}
+
+// Tokens are random; mixing in the key spreads one client's keys over the sets
+static IdemSet *idem_set(IdemCache *cache, const uint8_t *token, uint32_t key) {
+    uint32_t h;
+    memcpy(&h, token, sizeof(h));
+    h ^= key * 0x9e3779b9u;
+    return &cache->sets[(h ^ (h >> 16)) & (IDEM_SETS - 1)];
+}
+
+static IdemEntry *idem_lookup(IdemSet *set, const uint8_t *token, uint32_t key, int64_t now) {
+    for (int i = 0; i < IDEM_WAYS; i++) {
+        IdemEntry *e = &set->entries[i];
+        if (e->key == key && e->expiry > now && memcmp(e->token, token, SESSION_TOKEN_LEN) == 0) return e;
+    }
+    return NULL;
+}
+
+IdemResult idem_begin(IdemCache *cache, const uint8_t *token, uint32_t key,
+                      uint64_t fingerprint, BankingResponse *stored, int *evicted) {
+    int64_t now = (int64_t)time(NULL);
+    IdemSet *set = idem_set(cache, token, key);
+
+    pthread_mutex_lock(&set->lock);
+    IdemEntry *e = idem_lookup(set, token, key, now);
+    if (e) {
+        IdemResult result = IDEM_IN_PROGRESS;
+        if (e->fingerprint != fingerprint) {
+            result = IDEM_MISMATCH;
+        } else if (e->done) {
+            *stored = e->response;
+            result = IDEM_REPLAY;
+        }
+        pthread_mutex_unlock(&set->lock);
+        return result;
+    }
+
+    // 空的或已過期的 entry；都沒有就逐出最舊的已完成 entry
+    IdemEntry *victim = NULL;
+    for (int i = 0; i < IDEM_WAYS; i++) {
+        IdemEntry *cand = &set->entries[i];
+        if (cand->key == 0 || cand->expiry <= now) {
+            victim = cand;
+            break;
+        }
+        if (cand->done && (!victim || cand->expiry < victim->expiry)) victim = cand;
+    }
+    if (!victim) {
+        pthread_mutex_unlock(&set->lock);
+        return IDEM_FULL;
+    }
+    *evicted = victim->key != 0 && victim->expiry > now;
+
+    memcpy(victim->token, token, SESSION_TOKEN_LEN);
+    victim->key = key;
+    victim->fingerprint = fingerprint;
+    victim->done = 0;
+    victim->expiry = now + IDEM_TTL_SEC;
+    pthread_mutex_unlock(&set->lock);
+    return IDEM_NEW;
+}
+
+void idem_finish(IdemCache *cache, const uint8_t *token, uint32_t key, const BankingResponse *response) {
+    IdemSet *set = idem_set(cache, token, key);
+
+    pthread_mutex_lock(&set->lock);
+    IdemEntry *e = idem_lookup(set, token, key, (int64_t)time(NULL));
+    if (e && !e->done) {
+        e->response = *response;
+        e->done = 1;
+    }
+    pthread_mutex_unlock(&set->lock);
+}
+
+void idem_abort(IdemCache *cache, const uint8_t *token, uint32_t key) {
+    IdemSet *set = idem_set(cache, token, key);
+
+    pthread_mutex_lock(&set->lock);
+    IdemEntry *e = idem_lookup(set, token, key, (int64_t)time(NULL));
+    if (e && !e->done) e->key = 0;
+    pthread_mutex_unlock(&set->lock);
+}
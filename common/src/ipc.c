@@ -7,6 +7,12 @@
 #include <string.h>
 #include <errno.h>
 
+static key_t shm_key = SHM_KEY;
+
+void ipc_set_key(key_t key) {
+    shm_key = key;
+}
+
 // Server 端初始化 IPC
 int ipc_init_server(IPCContext *ctx) {
     if (!ctx) return -1;
@@ -14,17 +20,17 @@ int ipc_init_server(IPCContext *ctx) {
     memset(ctx, 0, sizeof(IPCContext));
     
     // 建立共享記憶體
-    ctx->shm_id = shmget(SHM_KEY, sizeof(AccountDB), IPC_CREAT | IPC_EXCL | 0666);
+    ctx->shm_id = shmget(shm_key, sizeof(SharedSegment), IPC_CREAT | IPC_EXCL | 0666);
     if (ctx->shm_id < 0) {
         if (errno == EEXIST) {
             // 已存在，清除舊的
             printf("[IPC] Removing existing shared memory...\n");
-            int old_shm = shmget(SHM_KEY, 0, 0);
+            int old_shm = shmget(shm_key, 0, 0);
             if (old_shm >= 0) {
                 shmctl(old_shm, IPC_RMID, NULL);
             }
             // 重新建立
-            ctx->shm_id = shmget(SHM_KEY, sizeof(AccountDB), IPC_CREAT | 0666);
+            ctx->shm_id = shmget(shm_key, sizeof(SharedSegment), IPC_CREAT | 0666);
         }
         
         if (ctx->shm_id < 0) {
@@ -34,46 +40,112 @@ int ipc_init_server(IPCContext *ctx) {
     }
     
     // 附加共享記憶體
-    ctx->db = (AccountDB *)shmat(ctx->shm_id, NULL, 0);
-    if (ctx->db == (void *)-1) {
+    ctx->seg = (SharedSegment *)shmat(ctx->shm_id, NULL, 0);
+    if (ctx->seg == (void *)-1) {
         perror("[IPC] shmat failed");
         shmctl(ctx->shm_id, IPC_RMID, NULL);
         return -1;
     }
+    ctx->db = &ctx->seg->db;
     
     // 初始化帳戶資料庫
     if (account_init(ctx->db) < 0) {
         fprintf(stderr, "[IPC] Failed to initialize account database\n");
-        shmdt(ctx->db);
+        shmdt(ctx->seg);
+        shmctl(ctx->shm_id, IPC_RMID, NULL);
+        return -1;
+    }
+    
+    // 初始化 Session 表
+    if (session_table_init(&ctx->seg->sessions) < 0) {
+        fprintf(stderr, "[IPC] Failed to initialize session table\n");
+        account_cleanup(ctx->db);
+        shmdt(ctx->seg);
+        shmctl(ctx->shm_id, IPC_RMID, NULL);
+        return -1;
+    }
+    
+    // 重試去重的回應快取
+    if (idem_init(&ctx->seg->idempotency) < 0) {
+        fprintf(stderr, "[IPC] Failed to initialize idempotency cache\n");
+        session_table_cleanup(&ctx->seg->sessions);
+        account_cleanup(ctx->db);
+        shmdt(ctx->seg);
         shmctl(ctx->shm_id, IPC_RMID, NULL);
         return -1;
     }
     
+    // 統計資料歸零
+    stats_init(&ctx->seg->stats);
+    log_table_init(&ctx->seg->logs);
+    ratelimit_init(&ctx->seg->ratelimits);
+    ctx->seg->generation = 0;
+    repl_log_init(&ctx->seg->repl, REPL_ROLE_PRIMARY);
+    migration_init(&ctx->seg->migration);
+    
     printf("[IPC] Shared memory initialized (ID: %d, Size: %lu bytes)\n", 
-           ctx->shm_id, sizeof(AccountDB));
+           ctx->shm_id, sizeof(SharedSegment));
+    
+    return 0;
+}
+
+// 熱升級：新 Master 接手舊 Master 的共享記憶體，帳戶、Session 與限流狀態原樣保留
+int ipc_attach_server(IPCContext *ctx) {
+    if (!ctx) return -1;
+    
+    memset(ctx, 0, sizeof(IPCContext));
+    
+    ctx->shm_id = shmget(shm_key, 0, 0);
+    if (ctx->shm_id < 0) {
+        perror("[IPC] shmget failed (upgrade)");
+        return -1;
+    }
+    
+    // 結構配置不同的版本無法接手 (大小不符即拒絕，舊 Master 繼續服務)
+    struct shmid_ds info;
+    if (shmctl(ctx->shm_id, IPC_STAT, &info) < 0) {
+        perror("[IPC] shmctl IPC_STAT failed");
+        return -1;
+    }
+    if (info.shm_segsz != sizeof(SharedSegment)) {
+        fprintf(stderr, "[IPC] Shared memory layout changed (%lu bytes, expected %lu), cannot take over\n",
+                (unsigned long)info.shm_segsz, sizeof(SharedSegment));
+        return -1;
+    }
+    
+    ctx->seg = (SharedSegment *)shmat(ctx->shm_id, NULL, 0);
+    if (ctx->seg == (void *)-1) {
+        perror("[IPC] shmat failed (upgrade)");
+        return -1;
+    }
+    ctx->db = &ctx->seg->db;
+    
+    printf("[IPC] Took over shared memory (ID: %d, generation %u)\n", ctx->shm_id, ctx->seg->generation);
     
     return 0;
 }
 
-// Client 端附加 IPC
-int ipc_attach_client(IPCContext *ctx) {
+// Client 端附加 IPC (readonly: 監控工具以 SHM_RDONLY 附加，不會改動 Server 狀態)
+int ipc_attach_client(IPCContext *ctx, int readonly) {
     if (!ctx) return -1;
     
     memset(ctx, 0, sizeof(IPCContext));
     
     // 取得現有的共享記憶體
-    ctx->shm_id = shmget(SHM_KEY, sizeof(AccountDB), 0666);
+    // 大小不符 (Server 為不同版本編譯) 時 shmget 會失敗
+    ctx->shm_id = shmget(shm_key, sizeof(SharedSegment), readonly ? 0444 : 0666);
     if (ctx->shm_id < 0) {
         perror("[IPC] shmget failed (client)");
         return -1;
     }
     
     // 附加共享記憶體
-    ctx->db = (AccountDB *)shmat(ctx->shm_id, NULL, 0);
-    if (ctx->db == (void *)-1) {
+    ctx->seg = (SharedSegment *)shmat(ctx->shm_id, NULL, readonly ? SHM_RDONLY : 0);
+    if (ctx->seg == (void *)-1) {
         perror("[IPC] shmat failed (client)");
         return -1;
     }
+    ctx->db = &ctx->seg->db;
     
     printf("[IPC] Attached to shared memory (ID: %d)\n", ctx->shm_id);
     
@@ -85,15 +157,52 @@ AccountDB* ipc_get_db(IPCContext *ctx) {
     return ctx ? ctx->db : NULL;
 }
 
+// 取得 Session 表指標
+SessionTable* ipc_get_sessions(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->sessions : NULL;
+}
+
+// 取得統計資料指標
+StatsTable* ipc_get_stats(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->stats : NULL;
+}
+
+// 取得日誌 ring 指標
+LogTable* ipc_get_logs(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->logs : NULL;
+}
+
+// 取得限流表指標
+RateLimitTable* ipc_get_ratelimits(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->ratelimits : NULL;
+}
+
+// 取得 mutation log 指標
+ReplLog* ipc_get_repl(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->repl : NULL;
+}
+
+// 取得帳戶搬移狀態指標
+MigrationState* ipc_get_migration(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->migration : NULL;
+}
+
+// 取得 idempotency 回應快取指標
+IdemCache* ipc_get_idempotency(IPCContext *ctx) {
+    return (ctx && ctx->seg) ? &ctx->seg->idempotency : NULL;
+}
+
 // 清理 IPC 資源
 void ipc_cleanup(IPCContext *ctx, int is_server) {
     if (!ctx) return;
     
-    if (ctx->db && ctx->db != (void *)-1) {
+    if (ctx->seg && ctx->seg != (void *)-1) {
         if (is_server) {
+            idem_cleanup(&ctx->seg->idempotency);
+            session_table_cleanup(&ctx->seg->sessions);
             account_cleanup(ctx->db);
         }
-        shmdt(ctx->db);
+        shmdt(ctx->seg);
         printf("[IPC] Detached from shared memory\n");
     }
     
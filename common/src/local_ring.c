@@ -0,0 +1,317 @@
+/*
+ * local_ring.c
+ * Local Transport Implementation
+ */
+
+#define _GNU_SOURCE  // memfd_create
+#include "local_ring.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define LOCAL_MASK (LOCAL_RING_SIZE - 1)
+
+_Static_assert((LOCAL_RING_SIZE & LOCAL_MASK) == 0, "LOCAL_RING_SIZE must be a power of 2");
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static void kick(int efd) {
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0) {
+        // EAGAIN: the counter is saturated, the sleeper is woken anyway
+    }
+}
+
+/* ---------- Worker ---------- */
+
+int local_server_open(LocalEndpoint *ep, int sock) {
+    memset(ep, 0, sizeof(*ep));
+    ep->req_efd = ep->resp_efd = -1;
+    int memfd = memfd_create("bank_local", MFD_CLOEXEC);
+    if (memfd < 0) return -1;
+    if (ftruncate(memfd, sizeof(LocalChannel)) != 0) goto fail;
+    ep->ch = mmap(NULL, sizeof(LocalChannel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ep->ch == MAP_FAILED) {
+        ep->ch = NULL;
+        goto fail;
+    }
+    ep->ch->magic = LOCAL_MAGIC;  // The rest of a fresh memfd is zero
+    ep->req_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ep->resp_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ep->req_efd < 0 || ep->resp_efd < 0) goto fail;
+
+    // One byte carrying the channel, request eventfd and response eventfd
+    int fds[3] = { memfd, ep->req_efd, ep->resp_efd };
+    char hello = 'L';
+    struct iovec iov = { .iov_base = &hello, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)
+    };
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) goto fail;  // A fresh socket has room for it
+    close(memfd);  // The mapping keeps the channel
+    return 0;
+
+fail:
+    close(memfd);
+    if (ep->ch) munmap(ep->ch, sizeof(LocalChannel));
+    if (ep->req_efd >= 0) close(ep->req_efd);
+    if (ep->resp_efd >= 0) close(ep->resp_efd);
+    ep->ch = NULL;
+    return -1;
+}
+
+void local_server_close(LocalEndpoint *ep) {
+    if (!ep->ch) return;
+    __atomic_store_n(&ep->ch->closed, 1, __ATOMIC_SEQ_CST);
+    kick(ep->resp_efd);  // Whether or not the client sleeps: it must not start to
+    munmap(ep->ch, sizeof(LocalChannel));
+    close(ep->req_efd);
+    close(ep->resp_efd);
+    ep->ch = NULL;
+}
+
+int local_server_pop(LocalEndpoint *ep, LocalRequest *req) {
+    LocalChannel *ch = ep->ch;
+    uint64_t head = __atomic_load_n(&ch->req_head, __ATOMIC_ACQUIRE);
+    if (head == ep->req_tail) return 0;
+    if (head - ep->req_tail > LOCAL_RING_SIZE) return -1;
+
+    // The client freed a response slot before submitting this request
+    uint64_t resp_tail = __atomic_load_n(&ch->resp_tail, __ATOMIC_ACQUIRE);
+    if (ep->resp_head - resp_tail >= LOCAL_RING_SIZE) return -1;
+
+    // Copied out (the client could still change the slot), only the bytes in use
+    const LocalRequest *slot = &ch->reqs[ep->req_tail & LOCAL_MASK];
+    req->id = slot->id;
+    req->op = slot->op;
+    req->len = slot->len;
+    req->key = slot->key;
+    ep->req_tail++;
+    if (req->len > LOCAL_REQ_BYTES) return -1;
+    memcpy(req->data, slot->data, req->len);
+    return 1;
+}
+
+void local_server_push(LocalEndpoint *ep, uint32_t id, const BankingResponse *response) {
+    LocalResponse *slot = &ep->ch->resps[ep->resp_head & LOCAL_MASK];
+    slot->id = id;
+    slot->response = *response;
+    ep->resp_head++;
+    __atomic_store_n(&ep->ch->resp_head, ep->resp_head, __ATOMIC_RELEASE);
+}
+
+// Pairs with local_receive: we publish, then look for a sleeper; it
+// announces itself, then looks for responses
+void local_server_notify(LocalEndpoint *ep) {
+    if (ep->notified == ep->resp_head) return;
+    ep->notified = ep->resp_head;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ep->ch->client_sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&ep->ch->client_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        kick(ep->resp_efd);
+    }
+}
+
+int local_server_sleep(LocalEndpoint *ep) {
+    __atomic_store_n(&ep->ch->server_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ep->ch->req_head, __ATOMIC_SEQ_CST) != ep->req_tail) {
+        __atomic_store_n(&ep->ch->server_sleeping, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void local_server_woken(LocalEndpoint *ep) {
+    uint64_t count;
+    if (read(ep->req_efd, &count, sizeof(count)) < 0) {
+        // EAGAIN: already cleared
+    }
+}
+
+/* ---------- Client ---------- */
+
+static int recv_channel(int sock, int *fds) {
+    char hello;
+    struct iovec iov = { .iov_base = &hello, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)
+    };
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1 || hello != 'L' || (msg.msg_flags & MSG_CTRUNC)) {
+        if (n == 0) errno = ECONNREFUSED;  // Credentials refused
+        return -1;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cm), 3 * sizeof(int));
+    return 0;
+}
+
+int local_connect(LocalClient *lc, const char *path) {
+    memset(lc, 0, sizeof(*lc));
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    lc->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lc->sock < 0) return -1;
+    int fds[3];
+    if (connect(lc->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        recv_channel(lc->sock, fds) != 0) {
+        int saved = errno;
+        close(lc->sock);
+        errno = saved;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fds[0], &st) == 0 && st.st_size == (off_t)sizeof(LocalChannel)) {
+        lc->ch = mmap(NULL, sizeof(LocalChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    close(fds[0]);
+    if (!lc->ch || lc->ch == MAP_FAILED || lc->ch->magic != LOCAL_MAGIC) {
+        if (lc->ch && lc->ch != MAP_FAILED) munmap(lc->ch, sizeof(LocalChannel));
+        close(fds[1]);
+        close(fds[2]);
+        close(lc->sock);
+        lc->ch = NULL;
+        errno = EPROTO;
+        return -1;
+    }
+    lc->req_efd = fds[1];
+    lc->resp_efd = fds[2];
+    lc->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOCAL_SPIN : 0;
+    return 0;
+}
+
+void local_disconnect(LocalClient *lc) {
+    if (!lc->ch) return;
+    munmap(lc->ch, sizeof(LocalChannel));
+    close(lc->req_efd);
+    close(lc->resp_efd);
+    close(lc->sock);  // The worker closes its side on the hangup
+    lc->ch = NULL;
+}
+
+int64_t local_submit(LocalClient *lc, uint16_t op, const void *data, size_t len, uint32_t key) {
+    if (len > LOCAL_REQ_BYTES || lc->req_head - lc->resp_tail >= LOCAL_RING_SIZE) return -1;
+    LocalRequest *slot = &lc->ch->reqs[lc->req_head & LOCAL_MASK];
+    slot->id = lc->next_id++;
+    slot->op = op;
+    slot->len = (uint16_t)len;
+    slot->key = key;
+    memcpy(slot->data, data, len);
+    lc->req_head++;
+    return slot->id;
+}
+
+// Pairs with local_server_sleep (see local_server_notify for the other direction)
+void local_flush(LocalClient *lc) {
+    if (lc->published == lc->req_head) return;
+    lc->published = lc->req_head;
+    __atomic_store_n(&lc->ch->req_head, lc->req_head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lc->ch->server_sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&lc->ch->server_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        kick(lc->req_efd);
+    }
+}
+
+uint32_t local_pending(const LocalClient *lc) {
+    return (uint32_t)(lc->req_head - lc->resp_tail);
+}
+
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int local_receive(LocalClient *lc, LocalResponse *out, int timeout_ms) {
+    LocalChannel *ch = lc->ch;
+    local_flush(lc);
+    uint64_t deadline = timeout_ms > 0 ? mono_ms() + timeout_ms : 0;
+    int spins = 0;
+    while (1) {
+        if (__atomic_load_n(&ch->resp_head, __ATOMIC_ACQUIRE) != lc->resp_tail) {
+            *out = ch->resps[lc->resp_tail & LOCAL_MASK];
+            lc->resp_tail++;
+            __atomic_store_n(&ch->resp_tail, lc->resp_tail, __ATOMIC_RELEASE);
+            return 1;
+        }
+        // Responses pushed before the close are still taken above
+        if (__atomic_load_n(&ch->closed, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&ch->resp_head, __ATOMIC_ACQUIRE) != lc->resp_tail) continue;
+            return -1;
+        }
+        if (timeout_ms == 0 || lc->resp_tail == lc->req_head) return 0;  // Nothing to wait for
+        if (spins++ < lc->spin) {
+            cpu_relax();
+            continue;
+        }
+
+        // Announce, then re-check: the worker publishes, then looks for us
+        __atomic_store_n(&ch->client_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ch->resp_head, __ATOMIC_SEQ_CST) != lc->resp_tail ||
+            __atomic_load_n(&ch->closed, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&ch->client_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            uint64_t now = mono_ms();
+            wait_ms = now < deadline ? (int)(deadline - now) : 0;
+        }
+        struct pollfd pfd = { .fd = lc->resp_efd, .events = POLLIN };
+        int r = poll(&pfd, 1, wait_ms);
+        __atomic_store_n(&ch->client_sleeping, 0, __ATOMIC_RELAXED);
+        if (r > 0) {
+            uint64_t count;
+            if (read(lc->resp_efd, &count, sizeof(count)) < 0) {
+                // EAGAIN: already cleared
+            }
+        } else if (r == 0) {
+            if (__atomic_load_n(&ch->resp_head, __ATOMIC_ACQUIRE) != lc->resp_tail) continue;
+            return 0;
+        }
+        spins = 0;
+    }
+}
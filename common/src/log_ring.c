@@ -0,0 +1,293 @@
+/*
+ * log_ring.c
+ * Binary Log Rings Implementation
+ */
+
+#include "log_ring.h"
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum { ARG_NONE, ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_STR, ARG_PTR } ArgType;
+
+// Writer state (process-local: one writer per worker process)
+static LogRing *writer_ring = NULL;
+static LogLevel writer_min_level = LOG_LEVEL_INFO;
+static int writer_rate = 0;
+static double writer_tokens = 0;
+static uint64_t writer_refill_ns = 0;
+
+void log_table_init(LogTable *table) {
+    memset(table, 0, sizeof(LogTable));
+}
+
+void log_attach(LogRing *ring, LogLevel min_level, int rate_per_sec) {
+    writer_ring = ring;
+    writer_min_level = min_level;
+    writer_rate = rate_per_sec;
+    writer_tokens = rate_per_sec;
+    writer_refill_ns = 0;
+}
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Parse the conversion at p (pointing at '%'). spec gets a printf spec for a
+// single argument with any length modifier normalized ("ll" for integers,
+// since they are stored as 64 bit). Returns the position after the spec.
+static const char *parse_spec(const char *p, ArgType *type, int *is_long, char *spec, size_t spec_size) {
+    size_t n = 0;
+    spec[n++] = *p++;
+    *is_long = 0;
+
+    while (*p && strchr("-+ #0123456789.", *p) && n < spec_size - 4) {
+        spec[n++] = *p++;
+    }
+    while (*p && strchr("hlLqjzt", *p)) {
+        if (*p != 'h') *is_long = 1;
+        p++;
+    }
+
+    char conv = *p ? *p++ : '\0';
+    switch (conv) {
+        case 'd': case 'i': case 'c':
+            *type = ARG_INT;
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            *type = ARG_UINT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            *type = ARG_DOUBLE;
+            break;
+        case 's':
+            *type = ARG_STR;
+            break;
+        case 'p':
+            *type = ARG_PTR;
+            break;
+        default:  // "%%" or unsupported
+            *type = ARG_NONE;
+            break;
+    }
+
+    if ((*type == ARG_INT || *type == ARG_UINT) && conv != 'c') {
+        spec[n++] = 'l';
+        spec[n++] = 'l';
+    }
+    spec[n++] = conv;
+    spec[n] = '\0';
+    return p;
+}
+
+// Copy the raw argument values; returns 0 if they did not all fit
+static int pack_args(LogEntry *e, const char *fmt, va_list ap) {
+    char spec[32];
+    size_t off = 0;
+
+    for (const char *p = fmt; *p; ) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        ArgType type;
+        int is_long;
+        p = parse_spec(p, &type, &is_long, spec, sizeof(spec));
+
+        if (type == ARG_INT || type == ARG_UINT) {
+            int64_t v;
+            if (type == ARG_INT) {
+                v = is_long ? va_arg(ap, long long) : va_arg(ap, int);
+            } else {
+                v = is_long ? (int64_t)va_arg(ap, unsigned long long) : (int64_t)va_arg(ap, unsigned int);
+            }
+            if (off + sizeof(v) > LOG_ARG_BYTES) return 0;
+            memcpy(e->args + off, &v, sizeof(v));
+            off += sizeof(v);
+        } else if (type == ARG_DOUBLE) {
+            double v = va_arg(ap, double);
+            if (off + sizeof(v) > LOG_ARG_BYTES) return 0;
+            memcpy(e->args + off, &v, sizeof(v));
+            off += sizeof(v);
+        } else if (type == ARG_PTR) {
+            void *v = va_arg(ap, void *);
+            if (off + sizeof(v) > LOG_ARG_BYTES) return 0;
+            memcpy(e->args + off, &v, sizeof(v));
+            off += sizeof(v);
+        } else if (type == ARG_STR) {
+            const char *s = va_arg(ap, const char *);
+            if (!s) s = "(null)";
+            size_t len = strnlen(s, LOG_ARG_BYTES);
+            if (off + len + 1 > LOG_ARG_BYTES) return 0;
+            memcpy(e->args + off, s, len);
+            e->args[off + len] = '\0';
+            off += len + 1;
+        }
+        e->args_len = off;
+    }
+    return 1;
+}
+
+void log_write(LogLevel level, const char *fmt, ...) {
+    if (level < writer_min_level) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+
+    LogRing *ring = writer_ring;
+    if (!ring) {
+        // Not a worker (or logging not set up): plain stdout
+        vprintf(fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    uint64_t now = realtime_ns();
+    if (level < LOG_LEVEL_WARN && writer_rate > 0) {
+        if (writer_refill_ns) {
+            writer_tokens += (now - writer_refill_ns) * 1e-9 * writer_rate;
+            if (writer_tokens > writer_rate) writer_tokens = writer_rate;  // 1 s burst
+        }
+        writer_refill_ns = now;
+        if (writer_tokens < 1) {
+            __atomic_store_n(&ring->rate_dropped, ring->rate_dropped + 1, __ATOMIC_RELAXED);
+            va_end(ap);
+            return;
+        }
+        writer_tokens -= 1;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+        __atomic_store_n(&ring->full_dropped, ring->full_dropped + 1, __ATOMIC_RELAXED);
+        va_end(ap);
+        return;
+    }
+
+    LogEntry *e = &ring->entries[head & (LOG_RING_SIZE - 1)];
+    e->ts_ns = now;
+    e->fmt = fmt;
+    e->level = level;
+    e->args_len = 0;
+    e->truncated = !pack_args(e, fmt, ap);
+    va_end(ap);
+
+    // Publish: the drainer reads the slot only after seeing the new head
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Render one entry (drainer side)
+static void format_entry(const LogEntry *e, FILE *out) {
+    char spec[32];
+    char text[256];
+    size_t off = 0;
+
+    for (const char *p = e->fmt; *p; ) {
+        if (*p != '%') {
+            const char *next = strchr(p, '%');
+            size_t len = next ? (size_t)(next - p) : strlen(p);
+            fwrite(p, 1, len, out);
+            p += len;
+            continue;
+        }
+        ArgType type;
+        int is_long;
+        p = parse_spec(p, &type, &is_long, spec, sizeof(spec));
+
+        if (type == ARG_NONE) {
+            fputc('%', out);
+            continue;
+        }
+
+        size_t need = (type == ARG_STR) ? 1 : 8;
+        if (off + need > e->args_len) {
+            // Arguments that did not fit at write time
+            fputs(" [truncated]", out);
+            if (e->fmt[strlen(e->fmt) - 1] == '\n') fputc('\n', out);
+            return;
+        }
+
+        if (type == ARG_INT || type == ARG_UINT) {
+            int64_t v;
+            memcpy(&v, e->args + off, sizeof(v));
+            off += sizeof(v);
+            if (spec[strlen(spec) - 1] == 'c') {
+                snprintf(text, sizeof(text), spec, (int)v);
+            } else {
+                snprintf(text, sizeof(text), spec, (long long)v);
+            }
+        } else if (type == ARG_DOUBLE) {
+            double v;
+            memcpy(&v, e->args + off, sizeof(v));
+            off += sizeof(v);
+            snprintf(text, sizeof(text), spec, v);
+        } else if (type == ARG_PTR) {
+            void *v;
+            memcpy(&v, e->args + off, sizeof(v));
+            off += sizeof(v);
+            snprintf(text, sizeof(text), spec, v);
+        } else {
+            const char *s = e->args + off;
+            off += strlen(s) + 1;
+            snprintf(text, sizeof(text), spec, s);
+        }
+        fputs(text, out);
+    }
+}
+
+int log_drain(LogTable *table, int first, int num_rings, FILE *out) {
+    static uint64_t seen_rate[LOG_MAX_RINGS], seen_full[LOG_MAX_RINGS];
+    static uint64_t last_report_ns = 0;
+    uint64_t head[LOG_MAX_RINGS], tail[LOG_MAX_RINGS];
+    int count = 0;
+
+    int end = first + num_rings;
+    if (first < 0) first = 0;
+    if (end > LOG_MAX_RINGS) end = LOG_MAX_RINGS;
+    for (int i = first; i < end; i++) {
+        head[i] = __atomic_load_n(&table->rings[i].head, __ATOMIC_ACQUIRE);
+        tail[i] = table->rings[i].tail;
+    }
+
+    // Merge the snapshot of all rings by timestamp
+    while (1) {
+        int best = -1;
+        uint64_t best_ts = 0;
+        for (int i = first; i < end; i++) {
+            if (tail[i] == head[i]) continue;
+            uint64_t ts = table->rings[i].entries[tail[i] & (LOG_RING_SIZE - 1)].ts_ns;
+            if (best < 0 || ts < best_ts) {
+                best = i;
+                best_ts = ts;
+            }
+        }
+        if (best < 0) break;
+
+        LogRing *ring = &table->rings[best];
+        format_entry(&ring->entries[tail[best] & (LOG_RING_SIZE - 1)], out);
+        tail[best]++;
+        __atomic_store_n(&ring->tail, tail[best], __ATOMIC_RELEASE);  // Slot free for the writer
+        count++;
+    }
+
+    // Drop counts are reported at most once per second
+    int reported = 0;
+    uint64_t now = realtime_ns();
+    for (int i = first; i < end && now - last_report_ns >= 1000000000ULL; i++) {
+        uint64_t rate = __atomic_load_n(&table->rings[i].rate_dropped, __ATOMIC_RELAXED);
+        uint64_t full = __atomic_load_n(&table->rings[i].full_dropped, __ATOMIC_RELAXED);
+        if (rate != seen_rate[i] || full != seen_full[i]) {
+            fprintf(out, "[Log] Worker %d dropped %lu entries (rate limit), %lu (ring full)\n",
+                    i, rate - seen_rate[i], full - seen_full[i]);
+            seen_rate[i] = rate;
+            seen_full[i] = full;
+            reported = 1;
+        }
+    }
+    if (reported) last_report_ns = now;
+
+    if (count > 0 || reported) fflush(out);
+    return count;
+}
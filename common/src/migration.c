@@ -0,0 +1,122 @@
+/*
+ * migration.c
+ * Shard migration state shared by the workers and the replication process
+ */
+
+#include "migration.h"
+#include <string.h>
+#include <time.h>
+
+// This process's copy of the ring in MigrationState.spec
+static ShardRing ring;
+static uint32_t ring_generation = 0;
+
+void migration_init(MigrationState *ms) {
+    memset(ms, 0, sizeof(*ms));
+}
+
+const char *migration_phase_name(uint32_t phase) {
+    switch (phase) {
+        case MIGRATE_NONE:    return "none";
+        case MIGRATE_COPYING: return "copying";
+        case MIGRATE_FROZEN:  return "frozen";
+        case MIGRATE_DONE:    return "done";
+        default:              return "unknown";
+    }
+}
+
+// The spec only changes while no worker looks at it (see migration_start)
+static const ShardRing *current_ring(MigrationState *ms) {
+    uint32_t gen = __atomic_load_n(&ms->generation, __ATOMIC_ACQUIRE);
+    if (gen != ring_generation) {
+        if (shard_ring_build(&ring, ms->spec.shards, ms->spec.num_shards) != 0) return NULL;
+        ring_generation = gen;
+    }
+    return &ring;
+}
+
+int migration_moving(MigrationState *ms, const char *account_id) {
+    const ShardRing *r = current_ring(ms);
+    return r && shard_ring_lookup(r, account_id) == ms->spec.target;
+}
+
+// Dekker-style pairing with migration_freeze(): we announce ourselves before
+// reading the phase, it changes the phase before reading our flag
+int migration_enter(MigrationState *ms, int worker, const char *account_id, const char **to) {
+    __atomic_store_n(&ms->workers[worker].busy, 1, __ATOMIC_SEQ_CST);
+    uint32_t phase = __atomic_load_n(&ms->phase, __ATOMIC_SEQ_CST);
+    if (phase != MIGRATE_FROZEN && phase != MIGRATE_DONE) return 0;
+    if (!migration_moving(ms, account_id)) return 0;
+    *to = ring.shards[ms->spec.target].name;
+    return 1;
+}
+
+void migration_exit(MigrationState *ms, int worker) {
+    __atomic_store_n(&ms->workers[worker].busy, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Wait until every worker has been seen outside a request once: any request
+// it starts later reads the phase we just stored
+static int quiesce(MigrationState *ms) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 50000 };
+    for (int i = 0; i < STATS_MAX_WORKERS; i++) {
+        while (__atomic_load_n(&ms->workers[i].busy, __ATOMIC_SEQ_CST)) {
+            if (elapsed_ms(&start) >= MIGRATE_QUIESCE_MS) return -1;
+            nanosleep(&pause, NULL);
+        }
+    }
+    return 0;
+}
+
+int migration_start(MigrationState *ms, const MigrateSpec *spec) {
+    uint32_t phase = __atomic_load_n(&ms->phase, __ATOMIC_ACQUIRE);
+    if (phase == MIGRATE_COPYING || phase == MIGRATE_FROZEN) return -1;
+    if (spec->num_shards < 1 || spec->num_shards > SHARD_MAX ||
+        spec->target < 0 || spec->target >= spec->num_shards) return -1;
+
+    // Nobody may be reading the previous spec (phase DONE) while we replace it
+    __atomic_store_n(&ms->phase, MIGRATE_NONE, __ATOMIC_SEQ_CST);
+    if (quiesce(ms) != 0) return -1;
+    ms->spec = *spec;
+    for (int i = 0; i < ms->spec.num_shards; i++) {  // From the network
+        ms->spec.shards[i].name[SHARD_NAME_LEN - 1] = '\0';
+        ms->spec.shards[i].host[sizeof(ms->spec.shards[i].host) - 1] = '\0';
+    }
+    __atomic_add_fetch(&ms->generation, 1, __ATOMIC_RELEASE);
+    if (!current_ring(ms)) return -1;
+    __atomic_store_n(&ms->phase, MIGRATE_COPYING, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int migration_freeze(MigrationState *ms) {
+    __atomic_store_n(&ms->phase, MIGRATE_FROZEN, __ATOMIC_SEQ_CST);
+    if (quiesce(ms) != 0) {
+        __atomic_store_n(&ms->phase, MIGRATE_COPYING, __ATOMIC_RELEASE);
+        return -1;
+    }
+    return 0;
+}
+
+void migration_finish(MigrationState *ms) {
+    __atomic_store_n(&ms->phase, MIGRATE_DONE, __ATOMIC_RELEASE);
+}
+
+void migration_abort(MigrationState *ms) {
+    uint32_t phase = __atomic_load_n(&ms->phase, __ATOMIC_ACQUIRE);
+    if (phase == MIGRATE_COPYING || phase == MIGRATE_FROZEN) {
+        __atomic_store_n(&ms->phase, MIGRATE_NONE, __ATOMIC_RELEASE);
+    }
+}
+
+void migration_release(MigrationState *ms) {
+    uint32_t done = MIGRATE_DONE;
+    __atomic_compare_exchange_n(&ms->phase, &done, MIGRATE_NONE, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
@@ -7,7 +7,6 @@
 #include "crypto.h"
 #include <string.h>
 #include <arpa/inet.h>
-#include <stdlib.h> // for rand()
 
 // Verify packet checksum
 int verify_packet_checksum(const BankingPacket *packet) {
@@ -31,7 +30,7 @@ int pack_request(BankingPacket *packet, uint16_t opcode, const void *data, size_
     
     // 修改：設定 Header 欄位
     packet->header.op_code = htons(opcode);
-    packet->header.req_id = rand(); // 簡單給個 ID
+    packet->header.req_id = 0;  // No idempotency key unless the caller sets one
     
     if (data && data_size > 0) {
         memcpy(packet->data, data, data_size);
@@ -46,6 +45,11 @@ int pack_request(BankingPacket *packet, uint16_t opcode, const void *data, size_
     return 0;
 }
 
+// Not covered by the checksum, so it can be set after packing
+void packet_set_idempotency_key(BankingPacket *packet, uint32_t key) {
+    packet->header.req_id = htonl(key);
+}
+
 // Unpack request from packet
 int unpack_request(const BankingPacket *packet, void *data, size_t data_size) {
     if (verify_packet_checksum(packet) != 0) {
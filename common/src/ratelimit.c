@@ -0,0 +1,123 @@
+/*
+ * ratelimit.c
+ * Shared Token Bucket Rate Limits Implementation
+ */
+
+#include "ratelimit.h"
+#include <string.h>
+#include <time.h>
+
+#define TOKEN_BITS 24
+#define TOKEN_MASK ((1ULL << TOKEN_BITS) - 1)
+#define MILLI 1000ULL
+#define RL_CLASS_MASK 3ULL
+
+_Static_assert(RL_CLASSES <= RL_CLASS_MASK + 1, "class does not fit in the key's low bits");
+
+void ratelimit_init(RateLimitTable *table) {
+    memset(table, 0, sizeof(RateLimitTable));
+}
+
+void ratelimit_configure(RateLimitTable *table, RateClass cls, uint32_t rate, uint32_t burst) {
+    if (burst == 0) burst = rate;
+    if (burst > RL_MAX_BURST) burst = RL_MAX_BURST;
+    table->limits[cls].rate = rate;
+    table->limits[cls].burst = burst;
+}
+
+int ratelimit_enabled(const RateLimitTable *table, RateClass cls) {
+    return table->limits[cls].rate > 0;
+}
+
+// CLOCK_MONOTONIC is system-wide, so all workers agree on bucket timestamps
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a over the class and the key. The low bits carry the class so a
+// slot can be judged idle with its own limits; 0 is reserved for empty slots.
+static uint64_t key_hash(RateClass cls, const void *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    h = (h ^ (uint8_t)cls) * 1099511628211ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ ((const uint8_t *)key)[i]) * 1099511628211ULL;
+    }
+    h = (h & ~(uint64_t)RL_CLASS_MASK) | cls;
+    return h ? h : RL_CLASS_MASK + 1;
+}
+
+// Tokens after refilling up to now (milli-tokens), capped at the burst
+static uint64_t refill(uint64_t state, uint64_t now, const RateLimit *limit) {
+    uint64_t last = state >> TOKEN_BITS;
+    uint64_t tokens = state & TOKEN_MASK;
+    uint64_t cap = limit->burst * MILLI;
+    if (now > last) {
+        // rate tokens/s == rate milli-tokens/ms; since rate >= 1, elapsed >= cap
+        // always means a full bucket (and keeps the product from overflowing)
+        uint64_t elapsed = now - last;
+        tokens = (elapsed >= cap) ? cap : tokens + elapsed * limit->rate;
+        if (tokens > cap) tokens = cap;
+    }
+    return tokens;
+}
+
+static RateBucket *find_bucket(RateLimitTable *table, uint64_t h, uint64_t now) {
+    const RateLimit *limit = &table->limits[h & RL_CLASS_MASK];
+    for (int attempt = 0; attempt < 2; attempt++) {
+        RateBucket *reusable = NULL;
+        uint64_t reusable_key = 0;
+
+        for (int i = 0; i < RL_PROBE_LIMIT; i++) {
+            RateBucket *b = &table->buckets[(h + i) & (RL_SLOTS - 1)];
+            uint64_t k = __atomic_load_n(&b->key, __ATOMIC_ACQUIRE);
+            if (k == h) return b;
+            if (!reusable) {
+                // Empty, or idle long enough that the owner's bucket is full again
+                const RateLimit *owner = &table->limits[k & RL_CLASS_MASK];
+                uint64_t state = __atomic_load_n(&b->state, __ATOMIC_RELAXED);
+                if (k == 0 || refill(state, now, owner) == owner->burst * MILLI) {
+                    reusable = b;
+                    reusable_key = k;
+                }
+            }
+        }
+        if (!reusable) return NULL;
+
+        // A slot reused under a concurrent user of the old key hands out at
+        // most one token of a full bucket: harmless, so no further fencing.
+        if (__atomic_compare_exchange_n(&reusable->key, &reusable_key, h, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&reusable->state, (now << TOKEN_BITS) | (limit->burst * MILLI),
+                             __ATOMIC_RELEASE);
+            return reusable;
+        }
+        // Another worker claimed it first (possibly for the same key): look again
+    }
+    return NULL;
+}
+
+int ratelimit_allow(RateLimitTable *table, RateClass cls, const void *key, size_t key_len) {
+    const RateLimit *limit = &table->limits[cls];
+    if (limit->rate == 0) return 1;
+
+    uint64_t now = now_ms();
+    RateBucket *b = find_bucket(table, key_hash(cls, key, key_len), now);
+    if (!b) return 1;  // Table crowded: fail open
+
+    uint64_t old = __atomic_load_n(&b->state, __ATOMIC_RELAXED);
+    while (1) {
+        uint64_t tokens = refill(old, now, limit);
+        if (tokens < MILLI) return 0;
+
+        uint64_t last = old >> TOKEN_BITS;
+        uint64_t stamp = now > last ? now : last;
+        uint64_t updated = (stamp << TOKEN_BITS) | (tokens - MILLI);
+        if (__atomic_compare_exchange_n(&b->state, &old, updated, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+        // old now holds the current state: retry with it
+    }
+}
@@ -0,0 +1,106 @@
+#include "repl_log.h"
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/random.h>
+
+#define REPL_MASK (REPL_LOG_SIZE - 1)
+
+// 本行程的 log (Worker fork 後設定)
+static ReplLog *journal = NULL;
+static int journal_kick_fd = -1;
+
+void repl_log_init(ReplLog *log, ReplRole role) {
+    memset(log, 0, sizeof(*log));
+    log->role = role;
+    log->timeline = repl_new_timeline();
+}
+
+uint64_t repl_new_timeline(void) {
+    uint64_t id = 0;
+    if (getrandom(&id, sizeof(id), 0) != sizeof(id) || id == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ (uint64_t)getpid();
+    }
+    return id;
+}
+
+void repl_log_attach(ReplLog *log, int kick_fd) {
+    journal = log;
+    journal_kick_fd = kick_fd;
+}
+
+// Seqlock write: readers that see seq unchanged around their copy got a whole record
+static void write_record(uint64_t seq, ReplRecordType type, const Account *acc, uint32_t group_left) {
+    ReplRecord *r = &journal->records[seq & REPL_MASK];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->type = type;
+    memcpy(r->account_id, acc->account_id, ACCOUNT_ID_LEN);
+    r->balance = acc->balance;
+    r->version = acc->version;
+    r->group_left = group_left;
+    r->totp_last_step = acc->totp_last_step;
+    memcpy(r->totp_secret, acc->totp_secret, TOTP_SECRET_LEN);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->commit_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    __atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+}
+
+// Wake a sleeping sender (it re-checks head after announcing that it sleeps)
+static void kick_sender(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (journal_kick_fd >= 0 && __atomic_load_n(&journal->sender_idle, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        ssize_t n = write(journal_kick_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+uint64_t repl_log_append(ReplRecordType type, const Account *acc) {
+    if (!journal) return 0;
+
+    uint64_t seq = __atomic_add_fetch(&journal->head, 1, __ATOMIC_ACQ_REL);
+    write_record(seq, type, acc, 0);
+    kick_sender();
+    return seq;
+}
+
+uint64_t repl_log_append_group(ReplRecordType type, Account *const *accs, int count, uint64_t *seqs) {
+    if (!journal || count <= 0) return 0;
+
+    // One reservation: no other record lands inside the group
+    uint64_t last = __atomic_add_fetch(&journal->head, (uint64_t)count, __ATOMIC_ACQ_REL);
+    uint64_t first = last - count + 1;
+    for (int i = 0; i < count; i++) {
+        seqs[i] = first + i;
+        write_record(first + i, type, accs[i], (uint32_t)(count - 1 - i));
+    }
+    kick_sender();
+    return last;
+}
+
+int repl_log_read(const ReplLog *log, uint64_t seq, ReplRecord *out) {
+    const ReplRecord *r = &log->records[seq & REPL_MASK];
+
+    uint64_t before = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+    if (before > seq) return -1;        // Slot already holds a later lap
+    if (before != seq) {
+        // Reserved but not yet written, or overwritten while we were away
+        return repl_log_head(log) >= seq + REPL_LOG_SIZE ? -1 : 0;
+    }
+    memcpy(out, r, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq) return -1;
+    return 1;
+}
+
+void repl_log_ack(ReplLog *log, uint64_t seq) {
+    uint64_t cur = __atomic_load_n(&log->acked, __ATOMIC_RELAXED);
+    while (seq > cur &&
+           !__atomic_compare_exchange_n(&log->acked, &cur, seq, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
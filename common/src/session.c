@@ -0,0 +1,119 @@
+/*
+ * session.c
+ * Shared-Memory Session Table Implementation
+ */
+
+#include "session.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/rand.h>
+
+int session_table_init(SessionTable *table) {
+    if (!table) return -1;
+
+    memset(table, 0, sizeof(SessionTable));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);  // 支援跨行程
+    pthread_mutex_init(&table->write_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    return 0;
+}
+
+void session_table_cleanup(SessionTable *table) {
+    if (!table) return;
+    pthread_mutex_destroy(&table->write_lock);
+}
+
+// Tokens are random, so their first bytes are already a good hash
+static uint32_t token_index(const uint8_t *token) {
+    uint32_t h;
+    memcpy(&h, token, sizeof(h));
+    return h & (MAX_SESSIONS - 1);
+}
+
+int session_create(SessionTable *table, const char *account_id, uint8_t *token_out, int *evicted) {
+    if (!table || !account_id || !token_out) return -1;
+
+    uint8_t token[SESSION_TOKEN_LEN];
+    if (RAND_bytes(token, SESSION_TOKEN_LEN) != 1) return -1;
+
+    int64_t now = (int64_t)time(NULL);
+    uint32_t base = token_index(token);
+
+    pthread_mutex_lock(&table->write_lock);
+
+    // 找空的或已過期的位置；都沒有就覆蓋最快過期的那個
+    SessionSlot *slot = NULL;
+    SessionSlot *oldest = NULL;
+    for (int i = 0; i < SESSION_PROBE_LIMIT; i++) {
+        SessionSlot *s = &table->slots[(base + i) & (MAX_SESSIONS - 1)];
+        if (s->expiry <= now) {
+            slot = s;
+            break;
+        }
+        if (!oldest || s->expiry < oldest->expiry) oldest = s;
+    }
+    if (evicted) *evicted = !slot;
+    if (!slot) slot = oldest;
+
+    // Seqlock write: readers retry while seq is odd or changed under them
+    __atomic_fetch_add(&slot->seq, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(slot->token, token, SESSION_TOKEN_LEN);
+    strncpy(slot->account_id, account_id, ACCOUNT_ID_LEN - 1);
+    slot->account_id[ACCOUNT_ID_LEN - 1] = '\0';
+    slot->expiry = now + SESSION_TTL_SEC;
+    __atomic_fetch_add(&slot->seq, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&table->write_lock);
+
+    memcpy(token_out, token, SESSION_TOKEN_LEN);
+    return 0;
+}
+
+int session_lookup(SessionTable *table, const uint8_t *token, char *account_out) {
+    if (!table || !token) return -1;
+
+    int64_t now = (int64_t)time(NULL);
+    uint32_t base = token_index(token);
+
+    for (int i = 0; i < SESSION_PROBE_LIMIT; i++) {
+        SessionSlot *s = &table->slots[(base + i) & (MAX_SESSIONS - 1)];
+        SessionSlot copy;
+        uint32_t seq;
+
+        // Snapshot the slot; retry if a writer was active
+        do {
+            seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+            memcpy(&copy, s, sizeof(copy));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || seq != __atomic_load_n(&s->seq, __ATOMIC_RELAXED));
+
+        if (copy.expiry > now && memcmp(copy.token, token, SESSION_TOKEN_LEN) == 0) {
+            if (account_out) memcpy(account_out, copy.account_id, ACCOUNT_ID_LEN);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void session_token_to_hex(const uint8_t *token, char *hex_out) {
+    for (int i = 0; i < SESSION_TOKEN_LEN; i++) {
+        sprintf(hex_out + i * 2, "%02x", token[i]);
+    }
+    hex_out[SESSION_TOKEN_LEN * 2] = '\0';
+}
+
+int session_token_from_hex(const char *hex, uint8_t *token_out) {
+    for (int i = 0; i < SESSION_TOKEN_LEN; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1) return -1;
+        token_out[i] = (uint8_t)byte;
+    }
+    return 0;
+}
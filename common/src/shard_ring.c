@@ -0,0 +1,171 @@
+/*
+ * shard_ring.c
+ * Consistent-hash ring of banking_server shards
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "shard_ring.h"
+#include "account.h"
+
+// FNV-1a with a final avalanche (splitmix64): similar names land far apart
+static uint64_t ring_hash(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static int cmp_point(const void *a, const void *b) {
+    const RingPoint *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->shard - y->shard;
+}
+
+static int parse_line(char *line, ShardInfo *info, const char *path, int lineno) {
+    char addr[128];
+    int weight = 1;
+    int n = sscanf(line, "%31s %127s %d", info->name, addr, &weight);
+    if (n < 2) {
+        fprintf(stderr, "%s:%d: expected NAME HOST:PORT [WEIGHT]\n", path, lineno);
+        return -1;
+    }
+    char *colon = strrchr(addr, ':');
+    if (!colon || colon == addr || colon - addr >= (long)sizeof(info->host)) {
+        fprintf(stderr, "%s:%d: bad address '%s'\n", path, lineno, addr);
+        return -1;
+    }
+    *colon = '\0';
+    memcpy(info->host, addr, colon - addr + 1);
+    info->port = atoi(colon + 1);
+    if (info->port <= 0 || info->port > 65535) {
+        fprintf(stderr, "%s:%d: bad port '%s'\n", path, lineno, colon + 1);
+        return -1;
+    }
+    if (weight < 1 || weight > SHARD_MAX_WEIGHT) {
+        fprintf(stderr, "%s:%d: weight must be 1..%d\n", path, lineno, SHARD_MAX_WEIGHT);
+        return -1;
+    }
+    info->weight = weight;
+    return 0;
+}
+
+int shard_ring_load(ShardRing *ring, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    ShardInfo shards[SHARD_MAX];
+    int count = 0;
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0') continue;
+
+        if (count == SHARD_MAX) {
+            fprintf(stderr, "%s:%d: more than %d shards\n", path, lineno, SHARD_MAX);
+            fclose(f);
+            return -1;
+        }
+        ShardInfo *info = &shards[count];
+        if (parse_line(p, info, path, lineno) != 0) {
+            fclose(f);
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(shards[i].name, info->name) == 0) {
+                fprintf(stderr, "%s:%d: duplicate shard name '%s'\n", path, lineno, info->name);
+                fclose(f);
+                return -1;
+            }
+        }
+        count++;
+    }
+    fclose(f);
+    if (count == 0) {
+        fprintf(stderr, "%s: no shards\n", path);
+        return -1;
+    }
+    return shard_ring_build(ring, shards, count);
+}
+
+int shard_ring_build(ShardRing *ring, const ShardInfo *shards, int num_shards) {
+    if (num_shards < 1 || num_shards > SHARD_MAX) return -1;
+
+    ShardRing next;
+    memset(&next, 0, sizeof(next));
+    int total_weight = 0;
+    for (int s = 0; s < num_shards; s++) {
+        next.shards[s] = shards[s];
+        next.shards[s].name[SHARD_NAME_LEN - 1] = '\0';
+        if (next.shards[s].weight < 1 || next.shards[s].weight > SHARD_MAX_WEIGHT) return -1;
+        total_weight += next.shards[s].weight;
+    }
+    next.num_shards = num_shards;
+
+    next.points = malloc(sizeof(RingPoint) * total_weight * SHARD_VNODES);
+    if (!next.points) {
+        perror("malloc");
+        return -1;
+    }
+    for (int s = 0; s < next.num_shards; s++) {
+        for (int v = 0; v < next.shards[s].weight * SHARD_VNODES; v++) {
+            char key[SHARD_NAME_LEN + 16];
+            int len = snprintf(key, sizeof(key), "%s#%d", next.shards[s].name, v);
+            next.points[next.num_points].hash = ring_hash(key, len);
+            next.points[next.num_points].shard = s;
+            next.num_points++;
+        }
+    }
+    qsort(next.points, next.num_points, sizeof(RingPoint), cmp_point);
+
+    shard_ring_free(ring);
+    *ring = next;
+    return 0;
+}
+
+int shard_ring_find(const ShardRing *ring, const char *name) {
+    for (int i = 0; i < ring->num_shards; i++) {
+        if (strcmp(ring->shards[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int shard_ring_lookup(const ShardRing *ring, const char *account_id) {
+    if (ring->num_points == 0) return -1;
+    uint64_t h = ring_hash(account_id, strnlen(account_id, ACCOUNT_ID_LEN));
+
+    // First point at or after h, wrapping around to the start
+    int lo = 0, hi = ring->num_points;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring->points[lo == ring->num_points ? 0 : lo].shard;
+}
+
+void shard_ring_free(ShardRing *ring) {
+    free(ring->points);
+    ring->points = NULL;
+    ring->num_points = 0;
+    ring->num_shards = 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * stats.c
+ * Per-Worker Request Statistics Implementation
+ */
+
+#include "stats.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+static const char *op_names[STATS_OPS] = {
+    "unknown", "create_account", "deposit", "withdraw",
+    "balance", "req_otp", "login", "resume_session",
+    "snapshot_open", "snapshot_close", "transaction"
+};
+
+static const char *timeout_names[TIMEOUT_PHASES] = { "handshake", "header", "body", "idle" };
+
+void stats_init(StatsTable *table) {
+    memset(table, 0, sizeof(StatsTable));
+}
+
+int stats_op_index(uint16_t opcode) {
+    return (opcode >= OP_CREATE_ACCOUNT && opcode <= OP_TRANSACTION) ? opcode : 0;
+}
+
+const char *stats_op_name(int index) {
+    return (index >= 0 && index < STATS_OPS) ? op_names[index] : op_names[0];
+}
+
+const char *stats_timeout_name(TimeoutPhase phase) {
+    return (phase >= 0 && phase < TIMEOUT_PHASES) ? timeout_names[phase] : "unknown";
+}
+
+int stats_hist_bucket(uint64_t us) {
+    if (us < (1u << STATS_HIST_SUB_BITS)) return (int)us;
+
+    int msb = 63 - __builtin_clzll(us);
+    int sub = (int)((us >> (msb - STATS_HIST_SUB_BITS)) & ((1 << STATS_HIST_SUB_BITS) - 1));
+    int bucket = ((msb - STATS_HIST_SUB_BITS + 1) << STATS_HIST_SUB_BITS) + sub;
+    return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+// Largest value (us) that lands in this bucket
+uint64_t stats_hist_upper(int bucket) {
+    int per_group = 1 << STATS_HIST_SUB_BITS;
+    if (bucket < per_group) return (uint64_t)bucket;
+
+    int group = bucket / per_group - 1;  // msb - STATS_HIST_SUB_BITS
+    int sub = bucket % per_group;
+    return ((uint64_t)(per_group + sub + 1) << group) - 1;
+}
+
+void stats_record_op(WorkerStats *ws, uint16_t opcode, uint64_t latency_us, int is_error) {
+    OpStats *op = &ws->ops[stats_op_index(opcode)];
+    stats_add(&op->count, 1);
+    if (is_error) stats_add(&op->errors, 1);
+    stats_add(&op->sum_us, latency_us);
+    stats_add(&op->hist[stats_hist_bucket(latency_us)], 1);
+}
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Bounded append; output is silently truncated if the buffer is too small
+static void append(char *buf, size_t len, size_t *off, const char *fmt, ...) {
+    if (*off >= len) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0) *off = (*off + n < len) ? *off + n : len - 1;
+}
+
+#define SUM_FIELD(field, out) do {                         \
+        out = 0;                                           \
+        for (int w = 0; w < num_workers; w++)              \
+            out += load(&table->workers[w].field);         \
+    } while (0)
+
+size_t stats_format_prometheus(const StatsTable *table, int num_workers, char *buf, size_t len) {
+    size_t off = 0;
+    if (len == 0) return 0;
+    buf[0] = '\0';
+    if (num_workers > STATS_MAX_WORKERS) num_workers = STATS_MAX_WORKERS;
+
+    // Sum the worker slots once per opcode
+    OpStats total[STATS_OPS];
+    memset(total, 0, sizeof(total));
+    for (int w = 0; w < num_workers; w++) {
+        for (int i = 0; i < STATS_OPS; i++) {
+            const OpStats *op = &table->workers[w].ops[i];
+            total[i].count += load(&op->count);
+            total[i].errors += load(&op->errors);
+            total[i].sum_us += load(&op->sum_us);
+            for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+                total[i].hist[b] += load(&op->hist[b]);
+            }
+        }
+    }
+
+    append(buf, len, &off, "# HELP bank_requests_total Requests answered, by opcode.\n");
+    append(buf, len, &off, "# TYPE bank_requests_total counter\n");
+    for (int i = 0; i < STATS_OPS; i++) {
+        append(buf, len, &off, "bank_requests_total{op=\"%s\"} %lu\n", op_names[i], total[i].count);
+    }
+
+    append(buf, len, &off, "# HELP bank_request_errors_total Requests answered with a non-success status.\n");
+    append(buf, len, &off, "# TYPE bank_request_errors_total counter\n");
+    for (int i = 0; i < STATS_OPS; i++) {
+        append(buf, len, &off, "bank_request_errors_total{op=\"%s\"} %lu\n", op_names[i], total[i].errors);
+    }
+
+    // Exported at power-of-two boundaries; latencies are truncated to whole
+    // microseconds, so bucket "<= 2^k - 1 us" is exactly "< 2^k us".
+    append(buf, len, &off, "# HELP bank_request_duration_seconds Time from full request read to response queued.\n");
+    append(buf, len, &off, "# TYPE bank_request_duration_seconds histogram\n");
+    int per_group = 1 << STATS_HIST_SUB_BITS;
+    for (int i = 0; i < STATS_OPS; i++) {
+        if (total[i].count == 0) continue;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+            cumulative += total[i].hist[b];
+            if (b % per_group == per_group - 1 && b < STATS_HIST_BUCKETS - 1) {
+                append(buf, len, &off, "bank_request_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %lu\n",
+                       op_names[i], (stats_hist_upper(b) + 1) / 1e6, cumulative);
+            }
+        }
+        append(buf, len, &off, "bank_request_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n",
+               op_names[i], total[i].count);
+        append(buf, len, &off, "bank_request_duration_seconds_sum{op=\"%s\"} %.6f\n",
+               op_names[i], total[i].sum_us / 1e6);
+        append(buf, len, &off, "bank_request_duration_seconds_count{op=\"%s\"} %lu\n",
+               op_names[i], total[i].count);
+    }
+
+    uint64_t accepted, closed, hs_ok, hs_failed, otp_ok, otp_rejected, otp_unavailable, checksum;
+    SUM_FIELD(conns_accepted, accepted);
+    SUM_FIELD(conns_closed, closed);
+    SUM_FIELD(tls_handshakes, hs_ok);
+    SUM_FIELD(tls_handshake_failures, hs_failed);
+    SUM_FIELD(otp_ok, otp_ok);
+    SUM_FIELD(otp_rejected, otp_rejected);
+    SUM_FIELD(otp_unavailable, otp_unavailable);
+    SUM_FIELD(checksum_failures, checksum);
+    uint64_t rate_limited;
+    SUM_FIELD(rate_limited, rate_limited);
+    uint64_t shed;
+    SUM_FIELD(shed, shed);
+
+    append(buf, len, &off, "# HELP bank_connections_accepted_total Client connections accepted.\n");
+    append(buf, len, &off, "# TYPE bank_connections_accepted_total counter\n");
+    append(buf, len, &off, "bank_connections_accepted_total %lu\n", accepted);
+    append(buf, len, &off, "# HELP bank_connections_active Client connections currently open.\n");
+    append(buf, len, &off, "# TYPE bank_connections_active gauge\n");
+    append(buf, len, &off, "bank_connections_active %lu\n", accepted >= closed ? accepted - closed : 0);
+
+    append(buf, len, &off, "# HELP bank_connection_timeouts_total Connections closed for missing a deadline, by phase.\n");
+    append(buf, len, &off, "# TYPE bank_connection_timeouts_total counter\n");
+    for (int p = 0; p < TIMEOUT_PHASES; p++) {
+        uint64_t timeouts;
+        SUM_FIELD(conn_timeouts[p], timeouts);
+        append(buf, len, &off, "bank_connection_timeouts_total{phase=\"%s\"} %lu\n", timeout_names[p], timeouts);
+    }
+
+    append(buf, len, &off, "# HELP bank_tls_handshakes_total TLS handshakes, by result.\n");
+    append(buf, len, &off, "# TYPE bank_tls_handshakes_total counter\n");
+    append(buf, len, &off, "bank_tls_handshakes_total{result=\"ok\"} %lu\n", hs_ok);
+    append(buf, len, &off, "bank_tls_handshakes_total{result=\"failed\"} %lu\n", hs_failed);
+
+    append(buf, len, &off, "# HELP bank_otp_calls_total OTP generate/verify calls, by result.\n");
+    append(buf, len, &off, "# TYPE bank_otp_calls_total counter\n");
+    append(buf, len, &off, "bank_otp_calls_total{result=\"ok\"} %lu\n", otp_ok);
+    append(buf, len, &off, "bank_otp_calls_total{result=\"rejected\"} %lu\n", otp_rejected);
+    append(buf, len, &off, "bank_otp_calls_total{result=\"unavailable\"} %lu\n", otp_unavailable);
+
+    append(buf, len, &off, "# HELP bank_checksum_failures_total Requests rejected for a bad checksum.\n");
+    append(buf, len, &off, "# TYPE bank_checksum_failures_total counter\n");
+    append(buf, len, &off, "bank_checksum_failures_total %lu\n", checksum);
+
+    append(buf, len, &off, "# HELP bank_rate_limited_total Requests rejected by a rate limit.\n");
+    append(buf, len, &off, "# TYPE bank_rate_limited_total counter\n");
+    append(buf, len, &off, "bank_rate_limited_total %lu\n", rate_limited);
+
+    append(buf, len, &off, "# HELP bank_requests_shed_total Requests answered \"server busy\" under overload.\n");
+    append(buf, len, &off, "# TYPE bank_requests_shed_total counter\n");
+    append(buf, len, &off, "bank_requests_shed_total %lu\n", shed);
+    append(buf, len, &off, "# HELP bank_worker_load_level Admission control level (0 normal, 1 high, 2 overloaded).\n");
+    append(buf, len, &off, "# TYPE bank_worker_load_level gauge\n");
+    for (int w = 0; w < num_workers; w++) {
+        append(buf, len, &off, "bank_worker_load_level{worker=\"%d\"} %lu\n", w,
+               load(&table->workers[w].load_level));
+    }
+
+    const ReplStats *repl = &table->repl;
+    uint64_t sync_waits, sync_timeouts, replica_reads, replica_stale, replica_waits;
+    SUM_FIELD(repl_sync_waits, sync_waits);
+    SUM_FIELD(repl_sync_timeouts, sync_timeouts);
+    SUM_FIELD(replica_reads, replica_reads);
+    SUM_FIELD(replica_stale, replica_stale);
+    SUM_FIELD(replica_read_waits, replica_waits);
+    uint64_t moved;
+    SUM_FIELD(moved, moved);
+    uint64_t snapshot_reads, snapshot_too_old;
+    SUM_FIELD(snapshot_reads, snapshot_reads);
+    SUM_FIELD(snapshot_too_old, snapshot_too_old);
+    uint64_t txn_conflicts;
+    SUM_FIELD(txn_conflicts, txn_conflicts);
+    uint64_t idem_replays, idem_in_progress, idem_evictions;
+    SUM_FIELD(idem_replays, idem_replays);
+    SUM_FIELD(idem_in_progress, idem_in_progress);
+    SUM_FIELD(idem_evictions, idem_evictions);
+    uint64_t session_evictions;
+    SUM_FIELD(session_evictions, session_evictions);
+    append(buf, len, &off, "# HELP bank_repl_role Replication role (0 primary, 1 standby).\n");
+    append(buf, len, &off, "# TYPE bank_repl_role gauge\n");
+    append(buf, len, &off, "bank_repl_role %lu\n", load(&repl->role));
+    append(buf, len, &off, "# HELP bank_repl_standbys Standbys streaming from this primary.\n");
+    append(buf, len, &off, "# TYPE bank_repl_standbys gauge\n");
+    append(buf, len, &off, "bank_repl_standbys %lu\n", load(&repl->standbys));
+    append(buf, len, &off, "# HELP bank_repl_connected Standby: streaming from the primary.\n");
+    append(buf, len, &off, "# TYPE bank_repl_connected gauge\n");
+    append(buf, len, &off, "bank_repl_connected %lu\n", load(&repl->connected));
+    append(buf, len, &off, "# HELP bank_repl_primary_seq Last mutation sequence number on the primary.\n");
+    append(buf, len, &off, "# TYPE bank_repl_primary_seq gauge\n");
+    append(buf, len, &off, "bank_repl_primary_seq %lu\n", load(&repl->primary_seq));
+    append(buf, len, &off, "# HELP bank_repl_applied_seq Standby: last mutation sequence number applied.\n");
+    append(buf, len, &off, "# TYPE bank_repl_applied_seq gauge\n");
+    append(buf, len, &off, "bank_repl_applied_seq %lu\n", load(&repl->applied_seq));
+    append(buf, len, &off, "# HELP bank_repl_apply_lag_seconds Standby: time from commit on the primary to apply here.\n");
+    append(buf, len, &off, "# TYPE bank_repl_apply_lag_seconds summary\n");
+    append(buf, len, &off, "bank_repl_apply_lag_seconds_sum %.6f\n", load(&repl->lag_ns_sum) / 1e9);
+    append(buf, len, &off, "bank_repl_apply_lag_seconds_count %lu\n", load(&repl->applied));
+    append(buf, len, &off, "# HELP bank_repl_last_apply_lag_seconds Standby: apply lag of the last record.\n");
+    append(buf, len, &off, "# TYPE bank_repl_last_apply_lag_seconds gauge\n");
+    append(buf, len, &off, "bank_repl_last_apply_lag_seconds %.6f\n", load(&repl->lag_ns) / 1e9);
+    append(buf, len, &off, "# HELP bank_repl_snapshots_total Full resynchronisations sent (primary) or received (standby).\n");
+    append(buf, len, &off, "# TYPE bank_repl_snapshots_total counter\n");
+    append(buf, len, &off, "bank_repl_snapshots_total %lu\n", load(&repl->snapshots));
+    append(buf, len, &off, "# HELP bank_repl_sync_waits_total Responses held until a standby applied the change.\n");
+    append(buf, len, &off, "# TYPE bank_repl_sync_waits_total counter\n");
+    append(buf, len, &off, "bank_repl_sync_waits_total %lu\n", sync_waits);
+    append(buf, len, &off, "# HELP bank_repl_sync_timeouts_total Held responses released without a standby ack.\n");
+    append(buf, len, &off, "# TYPE bank_repl_sync_timeouts_total counter\n");
+    append(buf, len, &off, "bank_repl_sync_timeouts_total %lu\n", sync_timeouts);
+    if (load(&repl->role) == 1) {
+        uint64_t staleness = stats_repl_staleness_ns(repl);
+        append(buf, len, &off, "# HELP bank_repl_staleness_seconds Standby: how far behind the primary the data may be (-1 = never in sync).\n");
+        append(buf, len, &off, "# TYPE bank_repl_staleness_seconds gauge\n");
+        append(buf, len, &off, "bank_repl_staleness_seconds %.6f\n", staleness == UINT64_MAX ? -1.0 : staleness / 1e9);
+    }
+    append(buf, len, &off, "# HELP bank_replica_reads_total Read replica: balance queries answered here or sent back to the primary.\n");
+    append(buf, len, &off, "# TYPE bank_replica_reads_total counter\n");
+    append(buf, len, &off, "bank_replica_reads_total{result=\"served\"} %lu\n", replica_reads);
+    append(buf, len, &off, "bank_replica_reads_total{result=\"stale\"} %lu\n", replica_stale);
+    append(buf, len, &off, "# HELP bank_replica_read_waits_total Read replica: reads that waited for the client's own write to arrive.\n");
+    append(buf, len, &off, "# TYPE bank_replica_read_waits_total counter\n");
+    append(buf, len, &off, "bank_replica_read_waits_total %lu\n", replica_waits);
+
+    append(buf, len, &off, "# HELP bank_migration_phase Account migration out of this shard (0 none, 1 copying, 2 frozen, 3 done).\n");
+    append(buf, len, &off, "# TYPE bank_migration_phase gauge\n");
+    append(buf, len, &off, "bank_migration_phase %lu\n", load(&repl->migrate_phase));
+    append(buf, len, &off, "# HELP bank_migration_records_total Account records streamed to bank_migrate.\n");
+    append(buf, len, &off, "# TYPE bank_migration_records_total counter\n");
+    append(buf, len, &off, "bank_migration_records_total %lu\n", load(&repl->migrate_records));
+    append(buf, len, &off, "# HELP bank_moved_total Requests answered \"account moved\" (migrated to another shard).\n");
+    append(buf, len, &off, "# TYPE bank_moved_total counter\n");
+    append(buf, len, &off, "bank_moved_total %lu\n", moved);
+
+    append(buf, len, &off, "# HELP bank_snapshot_reads_total Balance queries as of a snapshot, by result.\n");
+    append(buf, len, &off, "# TYPE bank_snapshot_reads_total counter\n");
+    append(buf, len, &off, "bank_snapshot_reads_total{result=\"served\"} %lu\n", snapshot_reads);
+    append(buf, len, &off, "bank_snapshot_reads_total{result=\"too_old\"} %lu\n", snapshot_too_old);
+    append(buf, len, &off, "# HELP bank_txn_conflicts_total Transactions refused because an account changed after it was read.\n");
+    append(buf, len, &off, "# TYPE bank_txn_conflicts_total counter\n");
+    append(buf, len, &off, "bank_txn_conflicts_total %lu\n", txn_conflicts);
+    append(buf, len, &off, "# HELP bank_idempotent_retries_total Requests whose idempotency key was already claimed.\n");
+    append(buf, len, &off, "# TYPE bank_idempotent_retries_total counter\n");
+    append(buf, len, &off, "bank_idempotent_retries_total{result=\"replayed\"} %lu\n", idem_replays);
+    append(buf, len, &off, "bank_idempotent_retries_total{result=\"in_progress\"} %lu\n", idem_in_progress);
+    append(buf, len, &off, "# HELP bank_idempotency_evictions_total Completed idempotency entries evicted before they expired.\n");
+    append(buf, len, &off, "# TYPE bank_idempotency_evictions_total counter\n");
+    append(buf, len, &off, "bank_idempotency_evictions_total %lu\n", idem_evictions);
+    append(buf, len, &off, "# HELP bank_session_evictions_total Logins that overwrote a live session (its client must log in again).\n");
+    append(buf, len, &off, "# TYPE bank_session_evictions_total counter\n");
+    append(buf, len, &off, "bank_session_evictions_total %lu\n", session_evictions);
+
+    return off;
+}
+
+uint64_t stats_repl_staleness_ns(const ReplStats *repl) {
+    uint64_t fresh = __atomic_load_n(&repl->fresh_ns, __ATOMIC_ACQUIRE);
+    if (fresh == 0) return UINT64_MAX;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    return now > fresh ? now - fresh : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * timer_wheel.c
+ * Hierarchical Timer Wheel Implementation
+ */
+
+#include "timer_wheel.h"
+#include <string.h>
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_MAX_DELTA ((uint64_t)1 << (TW_LEVELS * TW_BITS))
+
+void timer_wheel_init(TimerWheel *tw, uint64_t now) {
+    memset(tw, 0, sizeof(TimerWheel));
+    tw->now = now;
+}
+
+void timer_node_init(TimerNode *node) {
+    node->next = NULL;
+    node->pprev = NULL;
+    node->expires = 0;
+}
+
+int timer_pending(const TimerNode *node) {
+    return node->pprev != NULL;
+}
+
+static void slot_insert(TimerNode **slot, TimerNode *node) {
+    node->next = *slot;
+    if (*slot) (*slot)->pprev = &node->next;
+    *slot = node;
+    node->pprev = slot;
+}
+
+static void slot_unlink(TimerNode *node) {
+    *node->pprev = node->next;
+    if (node->next) node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+// Pick the level by distance from now, the slot by the expiry bits of that level.
+// Timers already due are clamped to `earliest` so they still fire.
+static void place(TimerWheel *tw, TimerNode *node, uint64_t earliest) {
+    uint64_t expires = node->expires;
+    if (expires < earliest) {
+        expires = earliest;
+    }
+
+    uint64_t delta = expires - tw->now;
+    if (delta >= TW_MAX_DELTA) {
+        expires = tw->now + TW_MAX_DELTA - 1;  // Parked at the top level, re-placed on cascade
+        delta = TW_MAX_DELTA - 1;
+    }
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TW_BITS))) {
+        level++;
+    }
+    int idx = (int)((expires >> (level * TW_BITS)) & TW_MASK);
+    slot_insert(&tw->slots[level][idx], node);
+}
+
+void timer_wheel_add(TimerWheel *tw, TimerNode *node, uint64_t expires) {
+    if (timer_pending(node)) {
+        slot_unlink(node);
+    } else {
+        tw->count++;
+    }
+    node->expires = expires;
+    place(tw, node, tw->now + 1);  // The current tick has already been processed
+}
+
+void timer_wheel_del(TimerWheel *tw, TimerNode *node) {
+    if (timer_pending(node)) {
+        slot_unlink(node);
+        tw->count--;
+    }
+}
+
+// Move every timer of one upper-level slot down to where it now belongs
+static int cascade(TimerWheel *tw, int level) {
+    int idx = (int)((tw->now >> (level * TW_BITS)) & TW_MASK);
+    TimerNode *node = tw->slots[level][idx];
+    tw->slots[level][idx] = NULL;
+
+    while (node) {
+        TimerNode *next = node->next;
+        node->pprev = NULL;
+        place(tw, node, tw->now);  // Level 0 of this tick is processed right after
+        node = next;
+    }
+    return idx;
+}
+
+// Advance to tick `now`, running cb for every timer that expires on the way.
+// Returns the number of timers fired.
+size_t timer_wheel_advance(TimerWheel *tw, uint64_t now, TimerCallback cb, void *arg) {
+    size_t fired = 0;
+
+    while (tw->now < now) {
+        if (tw->count == 0) {
+            tw->now = now;  // Nothing scheduled, jump straight there
+            break;
+        }
+        tw->now++;
+
+        // Low bits wrapped: pull the next upper-level slot down
+        if ((tw->now & TW_MASK) == 0) {
+            for (int level = 1; level < TW_LEVELS; level++) {
+                if (cascade(tw, level) != 0) break;
+            }
+        }
+
+        TimerNode **slot = &tw->slots[0][tw->now & TW_MASK];
+        while (*slot) {
+            TimerNode *node = *slot;
+            slot_unlink(node);
+            tw->count--;
+            fired++;
+            cb(node, arg);
+        }
+    }
+    return fired;
+}
+
+// Ticks until the next timer may fire (exact within level 0, otherwise the
+// next cascade point). -1 when nothing is scheduled.
+int64_t timer_wheel_next_timeout(const TimerWheel *tw) {
+    if (tw->count == 0) return -1;
+
+    for (int i = 1; i <= TW_SLOTS; i++) {
+        if (tw->slots[0][(tw->now + i) & TW_MASK]) return i;
+    }
+    return TW_SLOTS - (int64_t)(tw->now & TW_MASK);
+}
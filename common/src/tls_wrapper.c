@@ -55,6 +55,22 @@ SSL_CTX *tls_create_server_context(const TLSConfig *config) {
     return ctx;
 }
 
+// Rebuild the server context from config and swap it into *ctx.
+// On failure the old context is kept so the caller can continue serving.
+// SSL objects created from the old context hold their own reference, so
+// established sessions are unaffected by freeing it here.
+int tls_reload_server_context(SSL_CTX **ctx, const TLSConfig *config) {
+    SSL_CTX *new_ctx = tls_create_server_context(config);
+    if (!new_ctx) {
+        return -1;
+    }
+    
+    SSL_CTX *old_ctx = *ctx;
+    *ctx = new_ctx;
+    tls_cleanup_context(old_ctx);
+    return 0;
+}
+
 // Create Client SSL Context
 SSL_CTX *tls_create_client_context(const TLSConfig *config) {
     const SSL_METHOD *method = TLS_client_method();
@@ -109,6 +125,42 @@ SSL *tls_accept_connection(SSL_CTX *ctx, int client_fd) {
     return ssl;
 }
 
+// Non-blocking accept: create the SSL object, the handshake is driven by tls_handshake_step()
+SSL *tls_accept_start(SSL_CTX *ctx, int client_fd) {
+    SSL *ssl = SSL_new(ctx);
+    if (!ssl) {
+        tls_print_error("Failed to create SSL structure");
+        return NULL;
+    }
+    
+    SSL_set_fd(ssl, client_fd);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+// Advance the handshake as far as the socket allows
+TlsIoStatus tls_handshake_step(SSL *ssl) {
+    int ret = SSL_do_handshake(ssl);
+    return ret == 1 ? TLS_IO_OK : tls_io_status(ssl, ret);
+}
+
+// Map the return value of SSL_read/SSL_write/SSL_do_handshake on a non-blocking socket
+TlsIoStatus tls_io_status(SSL *ssl, int ret) {
+    if (ret > 0) return TLS_IO_OK;
+    
+    switch (SSL_get_error(ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return TLS_IO_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_IO_WANT_WRITE;
+        case SSL_ERROR_ZERO_RETURN:
+            return TLS_IO_CLOSED;
+        default:
+            ERR_clear_error();  // Don't leave stale errors for the next connection
+            return TLS_IO_ERROR;
+    }
+}
+
 // Connect with TLS (Client side)
 SSL *tls_connect(SSL_CTX *ctx, int sock_fd, const char *hostname) {
     SSL *ssl = SSL_new(ctx);
@@ -133,6 +185,22 @@ SSL *tls_connect(SSL_CTX *ctx, int sock_fd, const char *hostname) {
     return ssl;
 }
 
+// Non-blocking connect: create the SSL object, the handshake is driven by tls_handshake_step()
+SSL *tls_connect_start(SSL_CTX *ctx, int sock_fd, const char *hostname) {
+    SSL *ssl = SSL_new(ctx);
+    if (!ssl) {
+        tls_print_error("Failed to create SSL structure");
+        return NULL;
+    }
+    
+    SSL_set_fd(ssl, sock_fd);
+    if (hostname) {
+        SSL_set_tlsext_host_name(ssl, hostname);
+    }
+    SSL_set_connect_state(ssl);
+    return ssl;
+}
+
 // Read from TLS connection
 int tls_read(SSL *ssl, void *buf, int len) {
     return SSL_read(ssl, buf, len);
@@ -143,6 +211,20 @@ int tls_write(SSL *ssl, const void *buf, int len) {
     return SSL_write(ssl, buf, len);
 }
 
+// Subject CN of the verified client certificate; returns -1 if there is none
+int tls_peer_common_name(SSL *ssl, char *buf, int len) {
+    X509 *cert = SSL_get_peer_certificate(ssl);
+    if (!cert) return -1;
+    
+    int ret = -1;
+    if (SSL_get_verify_result(ssl) == X509_V_OK &&
+        X509_NAME_get_text_by_NID(X509_get_subject_name(cert), NID_commonName, buf, len) > 0) {
+        ret = 0;
+    }
+    X509_free(cert);
+    return ret;
+}
+
 // Close TLS connection
 void tls_close(SSL *ssl) {
     if (ssl) {
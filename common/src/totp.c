@@ -0,0 +1,62 @@
+/*
+ * totp.c
+ * RFC 6238 TOTP Implementation (HMAC-SHA1 / HMAC-SHA256)
+ */
+
+#include "totp.h"
+#include <stdlib.h>
+#include <time.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define TOTP_MODULO 1000000  // 10^TOTP_DIGITS
+
+int totp_generate_secret(uint8_t *secret, size_t len) {
+    return RAND_bytes(secret, (int)len) == 1 ? 0 : -1;
+}
+
+uint64_t totp_current_step(void) {
+    return (uint64_t)time(NULL) / TOTP_STEP_SEC;
+}
+
+// HOTP (RFC 4226): HMAC over the big-endian counter + dynamic truncation
+uint32_t totp_code(const uint8_t *secret, size_t len, uint64_t step, TotpAlgo algo) {
+    uint8_t msg[8];
+    for (int i = 7; i >= 0; i--) {
+        msg[i] = (uint8_t)(step & 0xFF);
+        step >>= 8;
+    }
+
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int mac_len = 0;
+    const EVP_MD *md = (algo == TOTP_SHA256) ? EVP_sha256() : EVP_sha1();
+    if (!HMAC(md, secret, (int)len, msg, sizeof(msg), mac, &mac_len)) {
+        return 0;
+    }
+
+    int offset = mac[mac_len - 1] & 0x0F;
+    uint32_t bin = ((uint32_t)(mac[offset] & 0x7F) << 24) |
+                   ((uint32_t)mac[offset + 1] << 16) |
+                   ((uint32_t)mac[offset + 2] << 8) |
+                   (uint32_t)mac[offset + 3];
+    return bin % TOTP_MODULO;
+}
+
+uint64_t totp_match(const uint8_t *secret, size_t len, const char *code,
+                    uint64_t step, int skew, uint64_t last_step, TotpAlgo algo) {
+    char *end;
+    unsigned long value = strtoul(code, &end, 10);
+    if (end == code || *end != '\0' || value >= TOTP_MODULO) {
+        return 0;
+    }
+
+    for (int d = -skew; d <= skew; d++) {
+        uint64_t s = step + d;
+        if (s <= last_step) continue;  // Already used (or older than the last use)
+        if (totp_code(secret, len, s, algo) == (uint32_t)value) {
+            return s;
+        }
+    }
+    return 0;
+}
@@ -2,123 +2,378 @@
  * otp_server.c
  * 專門負責生成與驗證 OTP 的微服務
  * 通訊協定：Raw TCP + Binary Struct (No HTTP)
+ *
+ * 架構：
+ * - 多條事件迴圈執行緒 (epoll)，共用同一個 listen socket (EPOLLEXCLUSIVE)
+ * - 每條連線可連續送多個請求 (長連線)，非阻塞讀寫，回應依序寫回
+ * - OTP 資料存在分片雜湊表 (見 otp_store.c)，過期由計時輪回收
+ * - 模擬模式 (-L/-J/-E)：回應延遲 latency + 隨機 jitter 毫秒後才送出，
+ *   並依錯誤率直接丟棄請求 (呼叫端只會等到逾時)，用來在本機量測 OTP 服務
+ *   變慢或不穩時 Banking Server 的尾端延遲
+ *
+ * Usage: ./otp_server [-t threads] [-c capacity] [-T ttl_sec] [-v]
+ *                     [-L latency_ms] [-J jitter_ms] [-E error_pct]
  */
+#define _GNU_SOURCE  // accept4
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include "../common/include/otp_ipc.h"
+#include "../common/include/timer_wheel.h"
+#include "otp_store.h"
 
-#define MAX_OTPS 100
+#define DEFAULT_THREADS 4
+#define MAX_EVENTS 64
+#define CONN_BATCH 32         // 每條連線一次最多緩衝的請求/回應數
 
-// 簡單的內存資料庫
+struct OtpConn;
+
+// 模擬模式下延後送出的回應
+typedef struct DelayedReply {
+    TimerNode timer;
+    struct DelayedReply *next;   // 同一條連線上的延遲回應 (連線關閉時一併取消)
+    struct DelayedReply **pprev;
+    struct OtpConn *conn;
+    OtpIpcResponse res;
+} DelayedReply;
+
+// 每條連線的狀態 (輸入/輸出緩衝)
+typedef struct OtpConn {
+    int fd;
+    uint32_t events;          // 目前向 epoll 註冊的事件
+    size_t in_len;
+    size_t out_len;
+    size_t out_off;
+    DelayedReply *delayed;
+    char in_buf[sizeof(OtpIpcRequest) * CONN_BATCH];
+    char out_buf[sizeof(OtpIpcResponse) * CONN_BATCH];
+} OtpConn;
+
+typedef struct {
+    int id;
+    int listen_fd;
+} LoopArgs;
+
+// 每條事件迴圈執行緒自己的狀態
 typedef struct {
-    char account[32];
-    char otp[8];
-    time_t expiry;
-    int used;
-} OtpEntry;
+    int epfd;
+    unsigned int seed;
+    TimerWheel wheel;         // 延遲回應 (毫秒)
+} LoopState;
 
-OtpEntry otp_db[MAX_OTPS];
+static int verbose = 0;
 
-void handle_client(int client_fd) {
-    OtpIpcRequest req;
-    OtpIpcResponse res;
-    memset(&res, 0, sizeof(res));
+// 模擬模式參數
+static int mock_latency_ms = 0;
+static int mock_jitter_ms = 0;
+static double mock_error_pct = 0;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void handle_request(OtpIpcRequest *req, OtpIpcResponse *res, unsigned int *seed) {
+    memset(res, 0, sizeof(*res));
+    res->req_id = req->req_id;  // 回應帶回關聯 ID
 
-    // 1. 讀取請求 (直接讀取二進位 struct)
-    int bytes = read(client_fd, &req, sizeof(req));
-    if (bytes <= 0) return;
+    // 網路來的字串不保證結尾
+    req->account[sizeof(req->account) - 1] = '\0';
+    req->otp_code[sizeof(req->otp_code) - 1] = '\0';
 
-    printf("[OTP Server] Recv Op: %d, User: %s\n", req.op_code, req.account);
+    if (verbose) printf("[OTP Server] Recv Op: %d, User: %s\n", req->op_code, req->account);
 
-    if (req.op_code == OTP_OP_GENERATE) {
+    if (req->op_code == OTP_OP_GENERATE) {
         // 生成 OTP
-        int slot = -1;
-        // 找空位或更新舊的
-        for (int i = 0; i < MAX_OTPS; i++) {
-            if (!otp_db[i].used || strcmp(otp_db[i].account, req.account) == 0) {
-                slot = i;
-                break;
-            }
+        if (otp_store_generate(req->account, seed, res->otp_code) == 0) {
+            res->status = 1;
+            strcpy(res->message, "OTP Generated");
+            if (verbose) printf("[OTP Server] Gen OTP for %s: %s\n", req->account, res->otp_code);
+        } else {
+            res->status = 0;
+            strcpy(res->message, "Server Busy");
         }
 
-        if (slot >= 0) {
-            // 產生 6 位數亂數
-            int code = rand() % 900000 + 100000;
-            snprintf(otp_db[slot].otp, 8, "%d", code);
-            strcpy(otp_db[slot].account, req.account);
-            otp_db[slot].used = 1;
-            otp_db[slot].expiry = time(NULL) + 300; // 5分鐘有效
-
-            res.status = 1;
-            strcpy(res.otp_code, otp_db[slot].otp);
-            strcpy(res.message, "OTP Generated");
-            printf("[OTP Server] Gen OTP for %s: %s\n", req.account, res.otp_code);
+    } else if (req->op_code == OTP_OP_VERIFY) {
+        // 驗證 OTP (過期或已使用皆視為失敗)
+        if (otp_store_verify(req->account, req->otp_code)) {
+            res->status = 1;
+            strcpy(res->message, "Verified");
         } else {
-            res.status = 0;
-            strcpy(res.message, "Server Busy");
+            res->status = 0;
+            strcpy(res->message, "Invalid OTP");
         }
+        if (verbose) printf("[OTP Server] %s Verify %s\n", req->account, res->status ? "Success" : "Failed");
+    } else {
+        res->status = 0;
+        strcpy(res->message, "Unknown Op");
+    }
+}
 
-    } else if (req.op_code == OTP_OP_VERIFY) {
-        // 驗證 OTP
-        int found = 0;
-        for (int i = 0; i < MAX_OTPS; i++) {
-            if (otp_db[i].used && 
-                strcmp(otp_db[i].account, req.account) == 0) {
-                
-                if (strcmp(otp_db[i].otp, req.otp_code) == 0) {
-                    found = 1;
-                    otp_db[i].used = 0; // 用過即丟 (One-Time)
-                }
-                break;
-            }
+// 模擬模式：丟棄或延後回應。回傳 1 = 已接手 (不要立即回應)
+static int mock_intercept(LoopState *ls, OtpConn *c, const OtpIpcResponse *res) {
+    if (mock_error_pct > 0 && rand_r(&ls->seed) % 10000 < mock_error_pct * 100) {
+        return 1;  // 模擬請求遺失，呼叫端只會等到逾時
+    }
+
+    int delay = mock_latency_ms;
+    if (mock_jitter_ms > 0) delay += rand_r(&ls->seed) % (mock_jitter_ms + 1);
+    if (delay <= 0) return 0;
+
+    DelayedReply *d = malloc(sizeof(DelayedReply));
+    if (!d) return 0;  // 記憶體不足就直接回應
+    d->conn = c;
+    d->res = *res;
+    d->next = c->delayed;
+    if (c->delayed) c->delayed->pprev = &d->next;
+    c->delayed = d;
+    d->pprev = &c->delayed;
+
+    timer_node_init(&d->timer);
+    timer_wheel_add(&ls->wheel, &d->timer, now_ms() + delay);
+    return 1;
+}
+
+static void delayed_unlink(DelayedReply *d) {
+    *d->pprev = d->next;
+    if (d->next) d->next->pprev = d->pprev;
+}
+
+// 處理緩衝區中所有完整的請求 (輸出緩衝滿了就先停)
+static void conn_process(LoopState *ls, OtpConn *c) {
+    size_t off = 0;
+    while (c->in_len - off >= sizeof(OtpIpcRequest) &&
+           c->out_len + sizeof(OtpIpcResponse) <= sizeof(c->out_buf)) {
+        OtpIpcRequest req;
+        OtpIpcResponse res;
+        memcpy(&req, c->in_buf + off, sizeof(req));
+        off += sizeof(req);
+        handle_request(&req, &res, &ls->seed);
+        if (mock_intercept(ls, c, &res)) continue;
+        memcpy(c->out_buf + c->out_len, &res, sizeof(res));
+        c->out_len += sizeof(res);
+    }
+    if (off > 0) {
+        memmove(c->in_buf, c->in_buf + off, c->in_len - off);
+        c->in_len -= off;
+    }
+}
+
+// 回傳：0 = 全部送出, 1 = 還有剩 (等 EPOLLOUT), -1 = 錯誤
+static int conn_flush(OtpConn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out_buf + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return -1;
         }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
 
-        if (found) {
-            res.status = 1;
-            strcpy(res.message, "Verified");
-            printf("[OTP Server] %s Verified Success\n", req.account);
-        } else {
-            res.status = 0;
-            strcpy(res.message, "Invalid OTP");
-            printf("[OTP Server] %s Verify Failed\n", req.account);
+static void conn_close(LoopState *ls, OtpConn *c) {
+    while (c->delayed) {
+        DelayedReply *d = c->delayed;
+        delayed_unlink(d);
+        timer_wheel_del(&ls->wheel, &d->timer);
+        free(d);
+    }
+    epoll_ctl(ls->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+// 輸出未送完時只等 EPOLLOUT，避免輸入繼續堆積
+static void conn_update_events(int epfd, OtpConn *c) {
+    uint32_t want = (c->out_len > 0) ? EPOLLOUT : EPOLLIN;
+    if (want != c->events) {
+        struct epoll_event ev = { .events = want, .data.ptr = c };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = want;
+    }
+}
+
+static void conn_handle(LoopState *ls, OtpConn *c, uint32_t events) {
+    if (events & EPOLLERR) {
+        conn_close(ls, c);
+        return;
+    }
+
+    if ((events & EPOLLIN) && c->in_len < sizeof(c->in_buf)) {
+        ssize_t n = read(c->fd, c->in_buf + c->in_len, sizeof(c->in_buf) - c->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            conn_close(ls, c);  // 對方關閉連線
+            return;
+        }
+        if (n > 0) c->in_len += n;
+    } else if (events & EPOLLHUP) {
+        conn_close(ls, c);
+        return;
+    }
+
+    // 送出上一批，再處理剩下的請求
+    if (conn_flush(c) < 0) {
+        conn_close(ls, c);
+        return;
+    }
+    if (c->out_len == 0) {
+        conn_process(ls, c);
+        if (conn_flush(c) < 0) {
+            conn_close(ls, c);
+            return;
         }
     }
+    conn_update_events(ls->epfd, c);
+}
+
+// 延遲時間到：把回應放進輸出緩衝並送出 (緩衝滿就晚 1ms 再試)
+static void on_delay_expire(TimerNode *node, void *arg) {
+    LoopState *ls = (LoopState *)arg;
+    DelayedReply *d = timer_entry(node, DelayedReply, timer);
+    OtpConn *c = d->conn;
+
+    if (c->out_len + sizeof(OtpIpcResponse) > sizeof(c->out_buf)) {
+        timer_wheel_add(&ls->wheel, &d->timer, ls->wheel.now + 1);
+        return;
+    }
+    memcpy(c->out_buf + c->out_len, &d->res, sizeof(d->res));
+    c->out_len += sizeof(d->res);
+    delayed_unlink(d);
+    free(d);
+
+    if (conn_flush(c) < 0) {
+        conn_close(ls, c);
+        return;
+    }
+    conn_update_events(ls->epfd, c);
+}
+
+static void accept_all(int epfd, int listen_fd) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) return;  // EAGAIN：其他執行緒已接走或沒有新連線
+
+        OtpConn *c = calloc(1, sizeof(OtpConn));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+static void *event_loop(void *arg) {
+    LoopArgs *args = (LoopArgs *)arg;
+    LoopState ls;
+    ls.seed = (unsigned int)time(NULL) ^ (args->id * 7919u);
+    timer_wheel_init(&ls.wheel, now_ms());
+
+    ls.epfd = epoll_create1(0);
+    if (ls.epfd < 0) {
+        perror("epoll_create1");
+        return NULL;
+    }
 
-    // 2. 回傳回應
-    write(client_fd, &res, sizeof(res));
+    // data.ptr == NULL 代表 listen socket
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    epoll_ctl(ls.epfd, EPOLL_CTL_ADD, args->listen_fd, &ev);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        // 有延遲回應排程時，最多睡到下一個到期點
+        int timeout = (int)timer_wheel_next_timeout(&ls.wheel);
+        int n = epoll_wait(ls.epfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_all(ls.epfd, args->listen_fd);
+            } else {
+                conn_handle(&ls, events[i].data.ptr, events[i].events);
+            }
+        }
+        timer_wheel_advance(&ls.wheel, now_ms(), on_delay_expire, &ls);
+    }
+    return NULL;
 }
 
-int main() {
-    srand(time(NULL));
-    memset(otp_db, 0, sizeof(otp_db));
+int main(int argc, char **argv) {
+    int num_threads = DEFAULT_THREADS;
+    size_t capacity = OTP_DEFAULT_CAPACITY;
+    int ttl = OTP_DEFAULT_TTL;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:T:vL:J:E:")) != -1) {
+        switch (opt) {
+            case 't': num_threads = atoi(optarg); break;
+            case 'c': capacity = strtoul(optarg, NULL, 10); break;
+            case 'T': ttl = atoi(optarg); break;
+            case 'v': verbose = 1; break;
+            case 'L': mock_latency_ms = atoi(optarg); break;
+            case 'J': mock_jitter_ms = atoi(optarg); break;
+            case 'E': mock_error_pct = atof(optarg); break;
+            default:
+                printf("Usage: %s [-t threads] [-c capacity] [-T ttl_sec] [-v] "
+                       "[-L latency_ms] [-J jitter_ms] [-E error_pct]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (num_threads < 1) num_threads = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (otp_store_init(capacity, ttl) != 0) {
+        return 1;
+    }
 
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(OTP_PORT);
 
-    bind(server_fd, (struct sockaddr*)&addr, sizeof(addr));
-    listen(server_fd, 10);
+    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server_fd, 128) < 0) {
+        perror("[OTP Server] bind/listen failed");
+        return 1;
+    }
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
 
-    printf("=== C OTP Server Listening on Port %d ===\n", OTP_PORT);
+    printf("=== C OTP Server Listening on Port %d (%d threads, capacity %zu, TTL %ds) ===\n",
+           OTP_PORT, num_threads, capacity, ttl);
+    if (mock_latency_ms > 0 || mock_jitter_ms > 0 || mock_error_pct > 0) {
+        printf("=== Mock mode: latency %d ms + jitter 0-%d ms, error rate %.1f%% ===\n",
+               mock_latency_ms, mock_jitter_ms, mock_error_pct);
+    }
 
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t len = sizeof(client_addr);
-        int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &len);
-        
-        if (client_fd >= 0) {
-            handle_client(client_fd);
-            close(client_fd); // 短連線：處理完就斷開
-        }
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    LoopArgs *args = malloc(sizeof(LoopArgs) * num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        args[i].id = i;
+        args[i].listen_fd = server_fd;
+        pthread_create(&threads[i], NULL, event_loop, &args[i]);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
     }
+
+    free(threads);
+    free(args);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,182 @@
+/*
+ * otp_store.c
+ * 分片雜湊表 + 計時輪的 OTP 儲存區
+ */
+#include "otp_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/include/timer_wheel.h"
+
+#define OTP_SHARDS 64          // 分片數 (2 的次方)
+#define ENTRY_CHUNK 1024       // 每次向系統要的項目數
+
+typedef struct OtpEntry {
+    TimerNode timer;           // 到期時由計時輪回收
+    struct OtpEntry *hnext;    // 雜湊鏈
+    struct OtpEntry **hpprev;
+    uint32_t hash;
+    char account[32];
+    char otp[8];
+} OtpEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    OtpEntry **buckets;
+    uint32_t bucket_mask;
+    OtpEntry *free_list;       // 回收的項目
+    size_t used;               // 目前存活的 OTP 數
+    size_t allocated;          // 已配置的項目數 (<= capacity)
+    size_t capacity;
+    TimerWheel wheel;          // 以秒為刻度
+} OtpShard;
+
+static OtpShard shards[OTP_SHARDS];
+static int otp_ttl = OTP_DEFAULT_TTL;
+
+static uint64_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+// FNV-1a：帳號 -> 雜湊值 (低位選分片，高位選桶)
+static uint32_t hash_account(const char *account) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)account; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static OtpEntry **bucket_of(OtpShard *s, uint32_t hash) {
+    return &s->buckets[(hash >> 6) & s->bucket_mask];
+}
+
+static OtpEntry *lookup(OtpShard *s, const char *account, uint32_t hash) {
+    for (OtpEntry *e = *bucket_of(s, hash); e; e = e->hnext) {
+        if (e->hash == hash && strcmp(e->account, account) == 0) return e;
+    }
+    return NULL;
+}
+
+static void hash_unlink(OtpEntry *e) {
+    *e->hpprev = e->hnext;
+    if (e->hnext) e->hnext->hpprev = e->hpprev;
+}
+
+// 移出雜湊表與計時輪，放回 free list
+static void release(OtpShard *s, OtpEntry *e) {
+    hash_unlink(e);
+    timer_wheel_del(&s->wheel, &e->timer);
+    e->hnext = s->free_list;
+    s->free_list = e;
+    s->used--;
+}
+
+static void on_expire(TimerNode *node, void *arg) {
+    release((OtpShard *)arg, timer_entry(node, OtpEntry, timer));
+}
+
+static OtpEntry *alloc_entry(OtpShard *s) {
+    if (!s->free_list) {
+        size_t n = s->capacity - s->allocated;
+        if (n == 0) return NULL;  // 已達容量上限
+        if (n > ENTRY_CHUNK) n = ENTRY_CHUNK;
+
+        OtpEntry *chunk = calloc(n, sizeof(OtpEntry));
+        if (!chunk) return NULL;
+        for (size_t i = 0; i < n; i++) {
+            chunk[i].hnext = s->free_list;
+            s->free_list = &chunk[i];
+        }
+        s->allocated += n;
+    }
+
+    OtpEntry *e = s->free_list;
+    s->free_list = e->hnext;
+    timer_node_init(&e->timer);
+    return e;
+}
+
+int otp_store_init(size_t capacity, int ttl_sec) {
+    if (capacity < OTP_SHARDS) capacity = OTP_SHARDS;
+    otp_ttl = ttl_sec > 0 ? ttl_sec : OTP_DEFAULT_TTL;
+
+    size_t per_shard = (capacity + OTP_SHARDS - 1) / OTP_SHARDS;
+    uint32_t buckets = 1;
+    while (buckets < per_shard) buckets <<= 1;  // 負載因子 <= 1
+
+    uint64_t now = now_sec();
+    for (int i = 0; i < OTP_SHARDS; i++) {
+        OtpShard *s = &shards[i];
+        memset(s, 0, sizeof(*s));
+        pthread_mutex_init(&s->lock, NULL);
+        s->buckets = calloc(buckets, sizeof(OtpEntry *));
+        if (!s->buckets) {
+            fprintf(stderr, "[OTP Store] Out of memory\n");
+            return -1;
+        }
+        s->bucket_mask = buckets - 1;
+        s->capacity = per_shard;
+        timer_wheel_init(&s->wheel, now);
+    }
+    return 0;
+}
+
+int otp_store_generate(const char *account, unsigned int *seed, char *otp_out) {
+    uint32_t hash = hash_account(account);
+    OtpShard *s = &shards[hash & (OTP_SHARDS - 1)];
+    int ret = 0;
+
+    pthread_mutex_lock(&s->lock);
+    uint64_t now = now_sec();
+    timer_wheel_advance(&s->wheel, now, on_expire, s);
+
+    // 同帳號重新產生時覆蓋舊的 OTP
+    OtpEntry *e = lookup(s, account, hash);
+    if (!e && (e = alloc_entry(s)) != NULL) {
+        e->hash = hash;
+        strncpy(e->account, account, sizeof(e->account) - 1);
+        e->account[sizeof(e->account) - 1] = '\0';
+        OtpEntry **b = bucket_of(s, hash);
+        e->hnext = *b;
+        if (*b) (*b)->hpprev = &e->hnext;
+        *b = e;
+        e->hpprev = b;
+        s->used++;
+    }
+
+    if (e) {
+        // 產生 6 位數亂數
+        int code = rand_r(seed) % 900000 + 100000;
+        snprintf(e->otp, sizeof(e->otp), "%d", code);
+        memcpy(otp_out, e->otp, sizeof(e->otp));
+        timer_wheel_add(&s->wheel, &e->timer, now + otp_ttl);
+    } else {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int otp_store_verify(const char *account, const char *otp) {
+    uint32_t hash = hash_account(account);
+    OtpShard *s = &shards[hash & (OTP_SHARDS - 1)];
+    int ok = 0;
+
+    pthread_mutex_lock(&s->lock);
+    timer_wheel_advance(&s->wheel, now_sec(), on_expire, s);
+
+    OtpEntry *e = lookup(s, account, hash);
+    if (e && strcmp(e->otp, otp) == 0) {
+        ok = 1;
+        release(s, e);  // 用過即丟 (One-Time)
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
@@ -0,0 +1,24 @@
+/*
+ * otp_store.h
+ * OTP 儲存區：依帳號雜湊分片，每片一張雜湊表 + 一個計時輪 (Timer Wheel)
+ * - 產生/驗證皆為 O(1) 查找
+ * - 過期的 OTP 由計時輪主動回收，不會佔住容量
+ * - 總容量有上限 (記憶體有界)，項目依需求分批配置
+ */
+#ifndef OTP_STORE_H
+#define OTP_STORE_H
+
+#include <stddef.h>
+
+#define OTP_DEFAULT_CAPACITY (1 << 20)  // 最多同時存在的 OTP 數
+#define OTP_DEFAULT_TTL 300             // 有效秒數 (5 分鐘)
+
+int otp_store_init(size_t capacity, int ttl_sec);
+
+// 0 = 成功 (otp_out 至少 8 bytes), -1 = 容量已滿
+int otp_store_generate(const char *account, unsigned int *seed, char *otp_out);
+
+// 1 = 驗證成功 (OTP 隨即作廢), 0 = 失敗或已過期
+int otp_store_verify(const char *account, const char *otp);
+
+#endif // OTP_STORE_H
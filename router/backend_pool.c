@@ -0,0 +1,484 @@
+/*
+ * backend_pool.c
+ * Pipelined, non-blocking TLS connection pools to the shards (per router worker)
+ *
+ * backend_init() runs in the worker after fork(), so a pool always belongs
+ * to one worker. Each connection keeps its unanswered requests in a FIFO
+ * ring (answers come back in order) and the bytes not yet written in one
+ * contiguous buffer, so a burst of requests goes out in a few TLS records.
+ * Every request carries a deadline on a millisecond timer wheel; a shard
+ * that misses it is presumed stuck and the connection is dropped.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../common/include/tls_wrapper.h"
+#include "../common/include/session.h"
+#include "../common/include/timer_wheel.h"
+#include "../common/include/log_ring.h"
+#include "backend_pool.h"
+
+#define BACKEND_CONN_MAGIC 0x444e4b42   // "BKND": tells our epoll pointers from the router's
+#define PACKET_SIZE sizeof(BankingPacket)
+#define PIPELINE_MASK (BACKEND_PIPELINE - 1)
+
+typedef struct BackendConn BackendConn;
+
+typedef struct {
+    TimerNode timer;                    // Deadline
+    BackendConn *conn;
+    BackendCallback cb;                 // NULL once cancelled
+    void *arg;
+    int internal;                       // Session resume sent on a client's behalf
+    int attempts;                       // Sends left (resendable requests get two)
+    char token[SESSION_TOKEN_HEX_LEN];  // Session the request needs ("" = none)
+    BankingPacket req;                  // Kept for a resend
+} BackendPending;
+
+typedef enum {
+    BCONN_CLOSED,
+    BCONN_CONNECTING,                   // Non-blocking connect in progress
+    BCONN_HANDSHAKE,
+    BCONN_READY
+} BackendPhase;
+
+struct BackendConn {
+    uint32_t magic;
+    Backend *owner;
+    int fd;
+    SSL *ssl;
+    BackendPhase phase;
+    uint32_t events;                    // Currently registered epoll events
+    char bound[SESSION_TOKEN_HEX_LEN];  // Session bound once all queued requests ran ("" = unknown)
+    uint32_t head, tail;                // pending[head..tail), oldest first
+    BackendPending pending[BACKEND_PIPELINE];
+    size_t out_len;                     // Unwritten tail of the queued requests
+    char out_buf[BACKEND_PIPELINE * PACKET_SIZE];
+    size_t in_len;
+    BankingPacket in;
+};
+
+struct Backend {
+    ShardInfo info;
+    struct sockaddr_in addr;            // Resolved when the pool is created
+    int retired;
+    int down;                           // Last connection attempt failed
+    uint64_t retry_at_ms;               // While down: no new connection before this
+    BackendConn *conns[BACKEND_MAX_POOL];
+    struct Backend *next;
+};
+
+static Backend *backends = NULL;
+static int router_id = -1;              // Worker index, for log lines        // This worker's pools, including retired ones
+static int epoll_fd = -1;
+static SSL_CTX *tls_ctx = NULL;
+static int pool_size = BACKEND_DEFAULT_POOL;
+static int timeout_ms = BACKEND_DEFAULT_TIMEOUT_MS;
+static TimerWheel deadlines;            // Millisecond ticks
+
+static int enqueue(Backend *b, BackendPending *p);
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t conn_inflight(const BackendConn *c) {
+    return c->tail - c->head;
+}
+
+// Requests for a shard that cannot be reached fail fast (no connect per
+// request) until the next retry; logged once per outage
+static void backend_mark_down(Backend *b, const char *why) {
+    if (!b->down) {
+        log_write(LOG_LEVEL_WARN, "[Router %d] Shard %s unreachable (%s), retrying every %d ms\n",
+                  router_id, b->info.name, why, BACKEND_RETRY_MS);
+        b->down = 1;
+    }
+    b->retry_at_ms = now_ms() + BACKEND_RETRY_MS;
+}
+
+void backend_init(int worker, int epfd, SSL_CTX *ctx, int size, int timeout) {
+    router_id = worker;
+    epoll_fd = epfd;
+    tls_ctx = ctx;
+    pool_size = (size < 1) ? 1 : (size > BACKEND_MAX_POOL ? BACKEND_MAX_POOL : size);
+    timeout_ms = timeout;
+    timer_wheel_init(&deadlines, now_ms());
+}
+
+Backend *backend_create(const ShardInfo *info) {
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", info->port);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(info->host, port_str, &hints, &res) != 0 || !res) {
+        fprintf(stderr, "Cannot resolve shard %s (%s)\n", info->name, info->host);
+        return NULL;
+    }
+
+    Backend *b = calloc(1, sizeof(Backend));
+    if (!b) {
+        freeaddrinfo(res);
+        return NULL;
+    }
+    b->info = *info;
+    memcpy(&b->addr, res->ai_addr, sizeof(b->addr));
+    freeaddrinfo(res);
+    b->next = backends;
+    backends = b;
+    return b;
+}
+
+void backend_retire(Backend *b) {
+    b->retired = 1;  // Freed by backend_tick() once idle
+}
+
+const ShardInfo *backend_info(const Backend *b) {
+    return &b->info;
+}
+
+static void conn_update_events(BackendConn *c, uint32_t want) {
+    if (want == c->events) return;
+    struct epoll_event ev = { .events = want, .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+static int conn_open(BackendConn *c) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c->phase = BCONN_READY;
+    if (connect(fd, (struct sockaddr *)&c->owner->addr, sizeof(c->owner->addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        c->phase = BCONN_CONNECTING;
+    }
+    SSL *ssl = tls_connect_start(tls_ctx, fd, NULL);
+    if (!ssl) {
+        close(fd);
+        return -1;
+    }
+    // Queued requests are appended while a write is pending, and writes may
+    // complete record by record
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    c->fd = fd;
+    c->ssl = ssl;
+    if (c->phase == BCONN_READY) c->phase = BCONN_HANDSHAKE;
+    c->bound[0] = '\0';
+    c->head = c->tail = 0;
+    c->out_len = 0;
+    c->in_len = 0;
+    c->events = EPOLLOUT;  // Connect completion, then the handshake's first write
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        SSL_free(ssl);
+        close(fd);
+        c->fd = -1;
+        c->ssl = NULL;
+        c->phase = BCONN_CLOSED;
+        return -1;
+    }
+    return 0;
+}
+
+// Connection broke, missed a deadline or said GOAWAY: requests the shard
+// cannot have processed are sent again, the others fail or are resent if
+// they may be
+static void conn_fail(BackendConn *c, int going_away) {
+    if (c->phase == BCONN_CLOSED) return;
+    if (c->ssl) SSL_free(c->ssl);  // No close_notify: the connection is unusable
+    close(c->fd);                  // Also removes it from the epoll set
+    c->ssl = NULL;
+    c->fd = -1;
+    c->phase = BCONN_CLOSED;
+
+    // Copy the requests out first: a resend may reopen this very connection
+    uint32_t count = conn_inflight(c);
+    uint32_t unsent = (uint32_t)((c->out_len + PACKET_SIZE - 1) / PACKET_SIZE);
+    BackendPending failed[BACKEND_PIPELINE];
+    for (uint32_t i = 0; i < count; i++) {
+        BackendPending *p = &c->pending[(c->head + i) & PIPELINE_MASK];
+        timer_wheel_del(&deadlines, &p->timer);
+        failed[i] = *p;
+    }
+    c->head = c->tail = 0;
+    c->out_len = 0;
+    c->in_len = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        BackendPending *p = &failed[i];
+        if (p->internal || !p->cb) continue;  // Resumes are redone by the resend as needed
+        int processed = !going_away && i < count - unsent;
+        if (!processed) p->attempts++;        // That send did not count
+        if (p->attempts > 0 && enqueue(c->owner, p) == 0) continue;
+        p->cb(p->arg, processed ? BACKEND_LOST : BACKEND_UNAVAILABLE, NULL);
+    }
+}
+
+// Write as much queued output as the connection takes
+static int conn_flush(BackendConn *c) {
+    while (c->out_len > 0) {
+        int n = tls_write(c->ssl, c->out_buf, (int)c->out_len);
+        TlsIoStatus st = tls_io_status(c->ssl, n);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) break;
+        if (st != TLS_IO_OK) return -1;
+        memmove(c->out_buf, c->out_buf + n, c->out_len - n);
+        c->out_len -= n;
+    }
+    conn_update_events(c, EPOLLIN | (c->out_len > 0 ? EPOLLOUT : 0));
+    return 0;
+}
+
+// An answer for the oldest request, or an unsolicited GOAWAY
+static int conn_deliver(BackendConn *c) {
+    if (ntohs(c->in.header.op_code) == OP_GOAWAY) {
+        log_write(LOG_LEVEL_INFO, "[Router %d] Shard %s is going away, resending %u requests\n",
+                  router_id, c->owner->info.name, conn_inflight(c));
+        conn_fail(c, 1);
+        return -1;
+    }
+    if (conn_inflight(c) == 0) {
+        log_write(LOG_LEVEL_WARN, "[Router %d] Unexpected packet from shard %s\n",
+                  router_id, c->owner->info.name);
+        conn_fail(c, 0);
+        return -1;
+    }
+
+    BackendPending *p = &c->pending[c->head & PIPELINE_MASK];
+    timer_wheel_del(&deadlines, &p->timer);
+    c->head++;  // Free before the callback, which may submit again
+    if (!p->internal && p->cb) p->cb(p->arg, BACKEND_OK, &c->in);
+    return 0;
+}
+
+static int conn_read(BackendConn *c) {
+    while (c->phase == BCONN_READY) {
+        int n = tls_read(c->ssl, (char *)&c->in + c->in_len, (int)(PACKET_SIZE - c->in_len));
+        TlsIoStatus st = tls_io_status(c->ssl, n);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) return 0;
+        if (st != TLS_IO_OK) return -1;
+        c->in_len += n;
+        if (c->in_len == PACKET_SIZE) {
+            c->in_len = 0;
+            if (conn_deliver(c) < 0) return 1;  // Already closed
+        }
+    }
+    return 1;
+}
+
+int backend_handle_event(void *ptr, uint32_t events) {
+    BackendConn *c = ptr;
+    if (!c || c->magic != BACKEND_CONN_MAGIC) return 0;
+    if (c->phase == BCONN_CLOSED) return 1;
+
+    if (c->phase == BCONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            backend_mark_down(c->owner, strerror(err));
+            conn_fail(c, 0);
+            return 1;
+        }
+        c->phase = BCONN_HANDSHAKE;
+    }
+    if (c->phase == BCONN_HANDSHAKE) {
+        TlsIoStatus st = tls_handshake_step(c->ssl);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+            conn_update_events(c, st == TLS_IO_WANT_READ ? EPOLLIN : EPOLLOUT);
+            return 1;
+        }
+        if (st != TLS_IO_OK) {
+            backend_mark_down(c->owner, "TLS handshake failed");
+            conn_fail(c, 0);
+            return 1;
+        }
+        c->phase = BCONN_READY;
+        if (c->owner->down) {
+            log_write(LOG_LEVEL_WARN, "[Router %d] Shard %s reachable again\n", router_id, c->owner->info.name);
+            c->owner->down = 0;
+        }
+    }
+
+    int r = conn_read(c);
+    if (r < 0) {
+        conn_fail(c, 0);
+    } else if (r == 0 && conn_flush(c) < 0) {
+        conn_fail(c, 0);
+    }
+    return 1;
+}
+
+// Least busy open connection with room for `need` requests, preferring one
+// that already has the session bound. Another connection is opened (up to
+// pool_size) rather than queueing behind a busy one.
+static BackendConn *conn_pick(Backend *b, const char *token, uint32_t need) {
+    BackendConn *best = NULL;
+    int closed_slot = -1;
+    for (int i = 0; i < pool_size; i++) {
+        BackendConn *c = b->conns[i];
+        if (!c || c->phase == BCONN_CLOSED) {
+            if (closed_slot < 0) closed_slot = i;
+            continue;
+        }
+        if (conn_inflight(c) + need > BACKEND_PIPELINE) continue;
+        if (token && strcmp(c->bound, token) == 0) return c;
+        if (!best || conn_inflight(c) < conn_inflight(best)) best = c;
+    }
+    if (best && conn_inflight(best) == 0) return best;
+
+    if (closed_slot >= 0 && (!b->down || now_ms() >= b->retry_at_ms)) {
+        BackendConn *c = b->conns[closed_slot];
+        if (!c) {
+            c = calloc(1, sizeof(BackendConn));
+            if (!c) return best;
+            c->magic = BACKEND_CONN_MAGIC;
+            c->owner = b;
+            c->fd = -1;
+            b->conns[closed_slot] = c;
+        }
+        if (conn_open(c) == 0) return c;
+        backend_mark_down(b, strerror(errno));
+    }
+    return best;
+}
+
+static void conn_queue(BackendConn *c, const BackendPending *src) {
+    BackendPending *p = &c->pending[c->tail & PIPELINE_MASK];
+    *p = *src;
+    p->conn = c;
+    timer_node_init(&p->timer);
+    timer_wheel_add(&deadlines, &p->timer, now_ms() + timeout_ms);
+    c->tail++;
+    memcpy(c->out_buf + c->out_len, &p->req, PACKET_SIZE);
+    c->out_len += PACKET_SIZE;
+}
+
+static int enqueue(Backend *b, BackendPending *p) {
+    uint16_t opcode = ntohs(p->req.header.op_code);
+    int resume = p->token[0] != '\0';
+    BackendConn *c = conn_pick(b, resume ? p->token : NULL, 2);
+    if (!c) return -1;
+
+    if (resume && strcmp(c->bound, p->token) != 0) {
+        BackendPending r;
+        memset(&r, 0, sizeof(r));
+        r.internal = 1;
+        SessionRequest sreq;
+        memset(&sreq, 0, sizeof(sreq));
+        memcpy(sreq.session_token, p->token, sizeof(sreq.session_token));
+        pack_request(&r.req, OP_RESUME_SESSION, &sreq, sizeof(sreq));
+        conn_queue(c, &r);
+        memcpy(c->bound, p->token, sizeof(c->bound));
+    } else if (opcode == OP_LOGIN || opcode == OP_RESUME_SESSION) {
+        c->bound[0] = '\0';  // Whatever the outcome is, we don't track it
+    }
+    p->attempts--;
+    conn_queue(c, p);
+    if (c->phase == BCONN_READY && conn_flush(c) < 0) {
+        // Failed from the event loop: callers here may be iterating over requests
+        conn_update_events(c, EPOLLIN | EPOLLOUT);
+    }
+    return 0;
+}
+
+int backend_submit(Backend *b, const BankingPacket *req, const char *session_token,
+                   int resendable, BackendCallback cb, void *arg) {
+    if (b->retired) return -1;
+    BackendPending p;
+    memset(&p, 0, sizeof(p));
+    p.cb = cb;
+    p.arg = arg;
+    p.attempts = resendable ? 2 : 1;
+    if (session_token) snprintf(p.token, sizeof(p.token), "%s", session_token);
+    memcpy(&p.req, req, PACKET_SIZE);
+    return enqueue(b, &p);
+}
+
+void backend_cancel(void *arg) {
+    // Keep the entries so the answers are still consumed in order, just don't deliver them
+    for (Backend *b = backends; b; b = b->next) {
+        for (int i = 0; i < BACKEND_MAX_POOL; i++) {
+            BackendConn *c = b->conns[i];
+            if (!c) continue;
+            for (uint32_t k = c->head; k != c->tail; k++) {
+                if (c->pending[k & PIPELINE_MASK].arg == arg) c->pending[k & PIPELINE_MASK].cb = NULL;
+            }
+        }
+    }
+}
+
+static void on_deadline(TimerNode *node, void *arg) {
+    (void)arg;
+    BackendPending *p = timer_entry(node, BackendPending, timer);
+    BackendConn *c = p->conn;
+    log_write(LOG_LEVEL_WARN, "[Router %d] Shard %s did not answer within %d ms, reconnecting\n",
+              router_id, c->owner->info.name, timeout_ms);
+    conn_fail(c, 0);
+}
+
+int backend_next_timeout(void) {
+    int64_t ticks = timer_wheel_next_timeout(&deadlines);
+    return ticks < 0 ? -1 : (int)ticks;
+}
+
+static void backend_free(Backend *b) {
+    for (int i = 0; i < BACKEND_MAX_POOL; i++) {
+        BackendConn *c = b->conns[i];
+        if (!c) continue;
+        if (c->phase != BCONN_CLOSED) {
+            tls_close(c->ssl);
+            close(c->fd);
+        }
+        free(c);
+    }
+    free(b);
+}
+
+void backend_tick(void) {
+    timer_wheel_advance(&deadlines, now_ms(), on_deadline, NULL);
+
+    // Pools dropped from the membership go once their last answer is in
+    Backend **link = &backends;
+    while (*link) {
+        Backend *b = *link;
+        int busy = 0;
+        for (int i = 0; i < BACKEND_MAX_POOL; i++) {
+            if (b->conns[i] && conn_inflight(b->conns[i]) > 0) busy = 1;
+        }
+        if (b->retired && !busy) {
+            *link = b->next;
+            backend_free(b);
+        } else {
+            link = &b->next;
+        }
+    }
+}
+
+void backend_close_all(void) {
+    while (backends) {
+        Backend *b = backends;
+        backends = b->next;
+        backend_free(b);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * backend_pool.h
+ * bank_router side of the connections to the banking_server shards
+ *
+ * Each router worker keeps a small pool of long-lived TLS connections per
+ * shard. banking_server answers the requests of one connection in order,
+ * so requests are pipelined: many are written back to back and each
+ * response is matched to the oldest unanswered request of its connection.
+ * Everything is non-blocking and driven by the worker's epoll loop; each
+ * response is delivered to the callback given at submit time.
+ *
+ * Sessions live on a server connection (OP_LOGIN / OP_RESUME_SESSION bind
+ * one), and pool connections are shared by many clients. A request that
+ * needs a session is therefore preceded on its connection by a resume of
+ * the client's token unless that token is already the one bound there;
+ * the resume's answer is consumed here.
+ *
+ * Outcomes when a request gets no answer:
+ *   - BACKEND_UNAVAILABLE: never processed by the shard (not connected, or
+ *     it sent OP_GOAWAY first), safe to retry. Requests not yet written
+ *     and those behind a GOAWAY are resent on another connection first.
+ *   - BACKEND_LOST: written, but the connection broke or the deadline
+ *     passed. Only requests marked resendable (reads, OTP generation) are
+ *     sent again; a deposit may or may not have been applied.
+ */
+
+#ifndef BACKEND_POOL_H
+#define BACKEND_POOL_H
+
+#include <stdint.h>
+#include <openssl/ssl.h>
+
+#include "../common/include/protocol.h"
+#include "../common/include/shard_ring.h"
+
+#define BACKEND_MAX_POOL 8
+#define BACKEND_DEFAULT_POOL 2          // Connections per shard per worker
+#define BACKEND_PIPELINE 64             // Requests in flight per connection (power of 2)
+#define BACKEND_DEFAULT_TIMEOUT_MS 2000
+#define BACKEND_RETRY_MS 100            // Reconnect interval while a shard is unreachable
+
+typedef enum {
+    BACKEND_OK,                         // response is the shard's answer
+    BACKEND_UNAVAILABLE,                // Not processed, safe to retry
+    BACKEND_LOST                        // Outcome unknown
+} BackendStatus;
+
+typedef void (*BackendCallback)(void *arg, BackendStatus status, const BankingPacket *response);
+
+typedef struct Backend Backend;         // One shard's pool
+
+// Must be called in the worker (after fork) with its index and epoll fd
+void backend_init(int worker, int epfd, SSL_CTX *ctx, int pool_size, int timeout_ms);
+
+Backend *backend_create(const ShardInfo *info);
+
+// Membership change: no new requests; closed once its requests are answered
+void backend_retire(Backend *b);
+
+const ShardInfo *backend_info(const Backend *b);
+
+/**
+ * 送出 request (整個封包原樣轉送)
+ * session_token: 需要 session 時為 client 的 token (hex)，否則 NULL
+ * resendable: 連線中斷時可以重送 (查詢、OTP 產生)
+ * return: 0 = 已排入, -1 = 無可用連線 (cb 不會被呼叫)
+ */
+int backend_submit(Backend *b, const BankingPacket *req, const char *session_token,
+                   int resendable, BackendCallback cb, void *arg);
+
+// Drop callbacks still registered for arg (e.g. its client closed); answers are still consumed
+void backend_cancel(void *arg);
+
+// Returns 1 if ptr is a backend connection (and handles the event), 0 otherwise
+int backend_handle_event(void *ptr, uint32_t events);
+
+// epoll_wait timeout until the next request deadline (-1 = none)
+int backend_next_timeout(void);
+
+// Fail requests whose deadline has passed; call after every epoll_wait
+void backend_tick(void);
+
+void backend_close_all(void);
+
+#endif // BACKEND_POOL_H
@@ -0,0 +1,741 @@
+/*
+ * bank_router.c
+ * Account-Sharding Front End for banking_server
+ *
+ * Architecture:
+ * - Prefork: the master binds the port, then forks --workers processes
+ *   that accept from their own epoll loops (EPOLLEXCLUSIVE)
+ * - Clients: TLS is terminated here. Each connection has one request in
+ *   flight at a time, like on banking_server, so answers stay in order
+ * - Routing: every request from OP_CREATE_ACCOUNT to OP_LOGIN starts with
+ *   the account id, which picks the shard on a consistent-hash ring
+ *   (shard_ring.h). The packet is forwarded unchanged over the worker's
+ *   pipelined connection pool to that shard (backend_pool.h) and the
+ *   shard's answer is relayed as is
+ * - Sessions: a token from OP_LOGIN is only valid on the shard that issued
+ *   it. The router remembers each client's token and has it resumed on the
+ *   pool connection before a deposit or withdrawal; OP_RESUME_SESSION from
+ *   a client is tried on each shard in turn until one knows the token
+ * - SIGHUP: re-read the membership file. Pools of unchanged shards are
+ *   kept; removed shards finish their requests first. Accounts do not move
+ *   with the ring: bank_migrate copies them to the new owner and reloads
+ *   the routers. Until then, STATUS_ACCOUNT_MOVED from the old owner is
+ *   retried every MOVED_RETRY_MS (with a fresh ring lookup) instead of
+ *   being relayed
+ * - SIGINT/SIGTERM: workers stop accepting, send OP_GOAWAY to each client
+ *   at a request boundary and exit once their clients are gone
+ *
+ * Usage: ./bank_router <port> <shards_file> [verify_client] [--workers N]
+ *        [--pool N] [--backend-timeout MS] [--backend-verify]
+ *        [--drain-timeout MS]
+ */
+
+#define _GNU_SOURCE  // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../common/include/protocol.h"
+#include "../common/include/tls_wrapper.h"
+#include "../common/include/account.h"
+#include "../common/include/session.h"
+#include "../common/include/log_ring.h"
+#include "../common/include/shard_ring.h"
+#include "backend_pool.h"
+
+#define ROUTER_CONN_MAGIC 0x52545243     // "CRTR"
+#define BACKLOG 1024
+#define MAX_EVENTS 64
+#define ROUTER_MAX_WORKERS 16
+#define DEFAULT_WORKERS 2
+#define DEFAULT_DRAIN_TIMEOUT_MS 5000
+#define MOVED_RETRY_MS 20                // Account being migrated: ask again after this
+#define MOVED_RETRIES 100                // Then relay STATUS_ACCOUNT_MOVED
+
+typedef struct {
+    int workers;
+    int pool_size;                  // Connections per shard per worker
+    int backend_timeout_ms;
+    int backend_verify;             // Verify the shards' certificates
+    int drain_timeout_ms;
+    const char *shards_path;
+} RouterConfig;
+
+typedef enum {
+    RCONN_HANDSHAKE,
+    RCONN_READY,
+    RCONN_WAITING                   // Request forwarded, reads paused
+} RouterConnState;
+
+// One client connection in a worker's event loop
+typedef struct RouterConn {
+    uint32_t magic;                 // Tells client connections from pool connections
+    int fd;                         // -1 once closed
+    SSL *ssl;
+    RouterConnState state;
+    uint32_t events;
+    size_t in_len;
+    BankingPacket in;               // Also the request being forwarded
+    int out_pending;
+    BankingPacket out;
+    char session_token[SESSION_TOKEN_HEX_LEN];  // From the client's last login ("" = none)
+    int shard;                      // Shard the current request went to
+    int moved_retries;              // STATUS_ACCOUNT_MOVED answers to the current request
+    uint64_t retry_at_ms;
+    int going_away;
+    struct RouterConn *next_retry;  // Waiting to resend the current request
+    struct RouterConn *prev_live;
+    struct RouterConn *next_live;
+    struct RouterConn *next_closed; // Freed after the current epoll batch
+} RouterConn;
+
+static volatile sig_atomic_t keep_running = 1;
+static volatile sig_atomic_t reload_requested = 0;
+static pid_t worker_pids[ROUTER_MAX_WORKERS];
+static sigset_t wait_mask;          // Signals are only delivered while waiting (no lost wakeups)
+static int server_fd = -1;
+static SSL_CTX *server_ctx = NULL;  // Client side
+static SSL_CTX *backend_ctx = NULL; // Shard side
+static ShardRing ring;
+static RouterConfig config = {
+    .workers = DEFAULT_WORKERS,
+    .pool_size = BACKEND_DEFAULT_POOL,
+    .backend_timeout_ms = BACKEND_DEFAULT_TIMEOUT_MS,
+    .backend_verify = 0,
+    .drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT_MS
+};
+
+// Worker-local state
+static int worker_index = -1;
+static int worker_epfd = -1;
+static Backend *pools[SHARD_MAX];   // Indexed like ring.shards
+static RouterConn *live_conns = NULL;
+static int live_count = 0;
+static RouterConn *closed_conns = NULL;
+static RouterConn *retry_conns = NULL;
+static int draining = 0;
+static uint64_t drain_deadline_ms = 0;
+
+static void conn_drive(RouterConn *c);
+static void conn_dispatch(RouterConn *c);
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void signal_handler(int signum) {
+    (void)signum;
+    keep_running = 0;
+}
+
+static void sighup_handler(int signum) {
+    (void)signum;
+    reload_requested = 1;
+}
+
+static void sigchld_handler(int signum) {
+    (void)signum;  // Only wakes the master, which reaps in its loop
+}
+
+// One pool per shard of the current ring; pools of shards that stay (same
+// name and address) keep their connections across a reload
+static int pools_build(const ShardRing *old) {
+    Backend *next[SHARD_MAX] = { NULL };
+    int kept[SHARD_MAX] = { 0 };
+    for (int i = 0; i < ring.num_shards; i++) {
+        const ShardInfo *s = &ring.shards[i];
+        for (int j = 0; old && j < old->num_shards; j++) {
+            const ShardInfo *o = &old->shards[j];
+            if (pools[j] && !kept[j] && strcmp(o->name, s->name) == 0 &&
+                strcmp(o->host, s->host) == 0 && o->port == s->port) {
+                next[i] = pools[j];
+                kept[j] = 1;
+            }
+        }
+        if (!next[i]) next[i] = backend_create(s);
+        if (!next[i]) return -1;
+    }
+    for (int j = 0; old && j < old->num_shards; j++) {
+        if (pools[j] && !kept[j]) backend_retire(pools[j]);
+    }
+    memcpy(pools, next, sizeof(pools));
+    return 0;
+}
+
+static void reload_shards(void) {
+    ShardRing old = ring;
+    ShardRing next;
+    memset(&next, 0, sizeof(next));
+    if (shard_ring_load(&next, config.shards_path) != 0) {
+        log_write(LOG_LEVEL_WARN, "[Router %d] Reload of %s failed, keeping %d shards\n",
+                  worker_index, config.shards_path, old.num_shards);
+        ring = old;
+        return;
+    }
+    ring = next;
+    if (pools_build(&old) != 0) {
+        log_write(LOG_LEVEL_ERROR, "[Router %d] Cannot set up pools for the new shards, keeping the old ones\n",
+                  worker_index);
+        shard_ring_free(&ring);
+        ring = old;
+        return;
+    }
+    shard_ring_free(&old);
+    log_write(LOG_LEVEL_WARN, "[Router %d] Shards reloaded: %d shards, %d ring points\n",
+              worker_index, ring.num_shards, ring.num_points);
+}
+
+static void conn_set_events(RouterConn *c, uint32_t events) {
+    if (events == c->events) return;
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(worker_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+// Close now, free after the epoll batch (later events may still point at c)
+static void conn_close(RouterConn *c) {
+    if (c->fd < 0) return;
+    if (c->state == RCONN_WAITING) backend_cancel(c);  // The shard's answer is dropped
+    for (RouterConn **p = &retry_conns; *p; p = &(*p)->next_retry) {
+        if (*p == c) {
+            *p = c->next_retry;
+            break;
+        }
+    }
+    epoll_ctl(worker_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    tls_close(c->ssl);
+    close(c->fd);
+    c->fd = -1;
+    if (c->prev_live) c->prev_live->next_live = c->next_live;
+    else live_conns = c->next_live;
+    if (c->next_live) c->next_live->prev_live = c->prev_live;
+    live_count--;
+    c->next_closed = closed_conns;
+    closed_conns = c;
+}
+
+// An answer from the router itself (the request never reached a shard)
+static void conn_answer(RouterConn *c, int status, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void conn_answer(RouterConn *c, int status, const char *fmt, ...) {
+    BankingResponse response;
+    memset(&response, 0, sizeof(response));
+    response.status = status;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(response.message, sizeof(response.message), fmt, ap);
+    va_end(ap);
+    pack_response(&c->out, &response);
+    c->out_pending = 1;
+    c->state = RCONN_READY;
+}
+
+static void on_backend_reply(void *arg, BackendStatus status, const BankingPacket *reply);
+
+static void conn_forward(RouterConn *c, int shard, const char *session_token, int resendable) {
+    c->shard = shard;
+    if (backend_submit(pools[shard], &c->in, session_token, resendable, on_backend_reply, c) != 0) {
+        conn_answer(c, STATUS_SERVER_BUSY, "Shard %s unavailable, retry later", ring.shards[shard].name);
+        return;
+    }
+    c->state = RCONN_WAITING;
+}
+
+static void on_backend_reply(void *arg, BackendStatus status, const BankingPacket *reply) {
+    RouterConn *c = arg;
+    uint16_t opcode = ntohs(c->in.header.op_code);
+    const char *shard = c->shard < ring.num_shards ? ring.shards[c->shard].name : "?";
+
+    if (status == BACKEND_UNAVAILABLE) {
+        conn_answer(c, STATUS_SERVER_BUSY, "Shard %s unavailable, retry later", shard);
+    } else if (status == BACKEND_LOST) {
+        conn_answer(c, STATUS_ERROR, "No answer from shard %s, the request may or may not have been applied", shard);
+    } else {
+        BankingResponse response;
+        int ok = unpack_response(reply, &response) == 0 && response.status == STATUS_SUCCESS;
+
+        // A token is only known to the shard that issued it: ask the next one
+        if (opcode == OP_RESUME_SESSION && !ok && c->shard + 1 < ring.num_shards) {
+            conn_forward(c, c->shard + 1, NULL, 1);
+            if (c->state == RCONN_WAITING) return;
+        } else if (!ok && response.status == STATUS_ACCOUNT_MOVED && c->moved_retries < MOVED_RETRIES) {
+            // Nothing was done: resend once the migration's cutover reloads the ring
+            c->moved_retries++;
+            c->retry_at_ms = now_ms() + MOVED_RETRY_MS;
+            c->next_retry = retry_conns;
+            retry_conns = c;
+            return;
+        } else {
+            if (ok && opcode == OP_LOGIN) {
+                memcpy(c->session_token, response.session_token, sizeof(c->session_token));
+                c->session_token[sizeof(c->session_token) - 1] = '\0';
+            } else if (ok && opcode == OP_RESUME_SESSION) {
+                memcpy(c->session_token, c->in.data, sizeof(c->session_token));
+                c->session_token[sizeof(c->session_token) - 1] = '\0';
+            }
+            memcpy(&c->out, reply, sizeof(c->out));
+            c->out_pending = 1;
+            c->state = RCONN_READY;
+        }
+    }
+    conn_drive(c);
+}
+
+// epoll_wait timeout until the next retry (-1 = none)
+static int retry_next_timeout(void) {
+    if (!retry_conns) return -1;
+    uint64_t now = now_ms(), next = UINT64_MAX;
+    for (RouterConn *c = retry_conns; c; c = c->next_retry) {
+        if (c->retry_at_ms < next) next = c->retry_at_ms;
+    }
+    return next > now ? (int)(next - now) : 0;
+}
+
+static void retry_tick(void) {
+    uint64_t now = now_ms();
+    RouterConn **p = &retry_conns;
+    while (*p) {
+        RouterConn *c = *p;
+        if (c->retry_at_ms > now) {
+            p = &c->next_retry;
+            continue;
+        }
+        *p = c->next_retry;
+        conn_dispatch(c);
+        conn_drive(c);
+    }
+}
+
+static void conn_dispatch(RouterConn *c) {
+    uint32_t length = ntohl(c->in.header.length);
+    if (length < PROTOCOL_HEADER_SIZE || length > sizeof(BankingPacket) ||
+        verify_packet_checksum(&c->in) != 0) {
+        conn_answer(c, STATUS_ERROR, "Checksum verification failed");
+        return;
+    }
+    if (c->state != RCONN_WAITING) c->moved_retries = 0;  // A new request, not a retry
+
+    uint16_t opcode = ntohs(c->in.header.op_code);
+    if (opcode == OP_RESUME_SESSION) {
+        conn_forward(c, 0, NULL, 1);
+        return;
+    }
+    // Every payload from OP_CREATE_ACCOUNT to OP_LOGIN starts with the account id
+    if (opcode < OP_CREATE_ACCOUNT || opcode > OP_LOGIN) {
+        conn_answer(c, STATUS_ERROR, "Unknown operation");
+        return;
+    }
+    char account_id[ACCOUNT_ID_LEN];
+    memcpy(account_id, c->in.data, ACCOUNT_ID_LEN);
+    account_id[ACCOUNT_ID_LEN - 1] = '\0';
+    int shard = shard_ring_lookup(&ring, account_id);
+
+    if (opcode == OP_DEPOSIT || opcode == OP_WITHDRAW) {
+        if (!c->session_token[0]) {
+            conn_answer(c, STATUS_UNAUTHORIZED, "Login required for account %s", account_id);
+            return;
+        }
+        conn_forward(c, shard, c->session_token, 0);
+    } else {
+        // Reads and OTP generation may be resent; account creation and login may not
+        conn_forward(c, shard, NULL, opcode == OP_BALANCE || opcode == OP_REQ_OTP);
+    }
+}
+
+// Draining, at a request boundary: tell the client nothing more will be read
+static void conn_go_away(RouterConn *c) {
+    BankingResponse notice;
+    memset(&notice, 0, sizeof(notice));
+    notice.status = STATUS_GOING_AWAY;
+    snprintf(notice.message, sizeof(notice.message), "Router shutting down, reconnect");
+    pack_request(&c->out, OP_GOAWAY, &notice, sizeof(notice));
+    c->out_pending = 1;
+    c->going_away = 1;
+}
+
+// Handshake, then alternate between flushing the answer and reading the next request
+static void conn_drive(RouterConn *c) {
+    TlsIoStatus st;
+    if (c->fd < 0) return;
+
+    if (c->state == RCONN_HANDSHAKE) {
+        st = tls_handshake_step(c->ssl);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+            conn_set_events(c, st == TLS_IO_WANT_READ ? EPOLLIN : EPOLLOUT);
+            return;
+        }
+        if (st != TLS_IO_OK) {
+            log_write(LOG_LEVEL_WARN, "[Router %d] TLS handshake failed\n", worker_index);
+            conn_close(c);
+            return;
+        }
+        c->state = RCONN_READY;
+    }
+
+    while (1) {
+        if (c->out_pending) {
+            st = tls_io_status(c->ssl, tls_write(c->ssl, &c->out, sizeof(BankingPacket)));
+            if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+                conn_set_events(c, st == TLS_IO_WANT_READ ? EPOLLIN : EPOLLOUT);
+                return;
+            }
+            if (st != TLS_IO_OK) {
+                conn_close(c);
+                return;
+            }
+            c->out_pending = 0;
+        }
+
+        if (c->state == RCONN_WAITING) {
+            conn_set_events(c, 0);  // Resumed by on_backend_reply()
+            return;
+        }
+        if (c->going_away) {
+            conn_close(c);
+            return;
+        }
+        if (draining && c->in_len == 0) {
+            conn_go_away(c);
+            continue;
+        }
+
+        int bytes = tls_read(c->ssl, (char *)&c->in + c->in_len, sizeof(BankingPacket) - c->in_len);
+        st = tls_io_status(c->ssl, bytes);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+            conn_set_events(c, st == TLS_IO_WANT_READ ? EPOLLIN : EPOLLOUT);
+            return;
+        }
+        if (st != TLS_IO_OK) {
+            conn_close(c);
+            return;
+        }
+        c->in_len += bytes;
+        if (c->in_len == sizeof(BankingPacket)) {
+            c->in_len = 0;
+            conn_dispatch(c);
+        }
+    }
+}
+
+static void accept_clients(void) {
+    while (1) {
+        int fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;  // EAGAIN: backlog drained (or another worker took it)
+        }
+
+        RouterConn *c = calloc(1, sizeof(RouterConn));
+        SSL *ssl = c ? tls_accept_start(server_ctx, fd) : NULL;
+        if (!ssl) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->magic = ROUTER_CONN_MAGIC;
+        c->fd = fd;
+        c->ssl = ssl;
+        c->state = RCONN_HANDSHAKE;
+        c->events = EPOLLIN;
+        struct epoll_event ev = { .events = c->events, .data.ptr = c };
+        if (epoll_ctl(worker_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            tls_close(ssl);
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next_live = live_conns;
+        if (live_conns) live_conns->prev_live = c;
+        live_conns = c;
+        live_count++;
+        conn_drive(c);
+    }
+}
+
+static void worker_start_drain(void) {
+    draining = 1;
+    drain_deadline_ms = now_ms() + config.drain_timeout_ms;
+    epoll_ctl(worker_epfd, EPOLL_CTL_DEL, server_fd, NULL);
+    close(server_fd);
+    server_fd = -1;
+    log_write(LOG_LEVEL_WARN, "[Router %d] Draining %d connections\n", worker_index, live_count);
+
+    RouterConn *c = live_conns;
+    while (c) {
+        RouterConn *next = c->next_live;
+        if (c->state == RCONN_HANDSHAKE) {
+            conn_close(c);
+        } else {
+            conn_drive(c);  // Idle: GOAWAY now; waiting: after the shard's answer
+        }
+        c = next;
+    }
+}
+
+static int min_timeout(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return a < b ? a : b;
+}
+
+static void worker_main(int id) {
+    signal(SIGINT, SIG_IGN);  // The master tells us when to drain
+    signal(SIGCHLD, SIG_DFL);
+    worker_index = id;
+    worker_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker_epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    backend_init(id, worker_epfd, backend_ctx, config.pool_size, config.backend_timeout_ms);
+    if (pools_build(NULL) != 0) exit(EXIT_FAILURE);
+
+    struct epoll_event lev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    epoll_ctl(worker_epfd, EPOLL_CTL_ADD, server_fd, &lev);
+    printf("[Router %d] Started (PID: %d)\n", id, getpid());
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        if (!keep_running && !draining) worker_start_drain();
+        if (draining && (live_count == 0 || now_ms() >= drain_deadline_ms)) break;
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_shards();
+        }
+
+        int timeout = min_timeout(backend_next_timeout(), retry_next_timeout());
+        if (draining) timeout = min_timeout(timeout, (int)(drain_deadline_ms - now_ms()));
+        int n = epoll_pwait(worker_epfd, events, MAX_EVENTS, timeout, &wait_mask);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_pwait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == NULL) {
+                accept_clients();
+            } else if (!backend_handle_event(ptr, events[i].events)) {
+                RouterConn *c = ptr;
+                if (c->fd < 0) continue;  // Closed earlier in this batch
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    conn_close(c);
+                } else {
+                    conn_drive(c);
+                }
+            }
+        }
+        backend_tick();
+        retry_tick();
+
+        while (closed_conns) {
+            RouterConn *c = closed_conns;
+            closed_conns = c->next_closed;
+            free(c);
+        }
+    }
+
+    while (live_conns) conn_close(live_conns);
+    backend_close_all();
+    printf("[Router %d] Exiting\n", id);
+    exit(0);
+}
+
+static int create_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("Bind failed");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, BACKLOG) < 0) {
+        perror("Listen failed");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static pid_t spawn_worker(int id) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        worker_main(id);
+    }
+    return pid;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s <port> <shards_file> [verify_client] [options]\n", prog);
+    printf("  shards_file: one shard per line, NAME HOST:PORT [WEIGHT] ('#' comments)\n");
+    printf("  --workers N              Router processes (default %d, max %d)\n", DEFAULT_WORKERS, ROUTER_MAX_WORKERS);
+    printf("  --pool N                 Connections per shard per worker (default %d, max %d)\n",
+           BACKEND_DEFAULT_POOL, BACKEND_MAX_POOL);
+    printf("  --backend-timeout MS     A shard that takes longer is presumed stuck (default %d)\n",
+           BACKEND_DEFAULT_TIMEOUT_MS);
+    printf("  --backend-verify         Verify the shards' certificates against the CA\n");
+    printf("  --drain-timeout MS       On shutdown, time allowed to finish in-flight requests (default %d)\n",
+           DEFAULT_DRAIN_TIMEOUT_MS);
+    printf("SIGHUP re-reads shards_file.\n");
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_opts[] = {
+        {"workers",         required_argument, NULL, 'w'},
+        {"pool",            required_argument, NULL, 'p'},
+        {"backend-timeout", required_argument, NULL, 't'},
+        {"backend-verify",  no_argument,       NULL, 'V'},
+        {"drain-timeout",   required_argument, NULL, 'd'},
+        {"help",            no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                config.workers = atoi(optarg);
+                if (config.workers < 1 || config.workers > ROUTER_MAX_WORKERS) {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                config.pool_size = atoi(optarg);
+                break;
+            case 't':
+                config.backend_timeout_ms = atoi(optarg);
+                if (config.backend_timeout_ms <= 0) config.backend_timeout_ms = BACKEND_DEFAULT_TIMEOUT_MS;
+                break;
+            case 'V':
+                config.backend_verify = 1;
+                break;
+            case 'd':
+                config.drain_timeout_ms = atoi(optarg);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (argc - optind < 2) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int port = atoi(argv[optind]);
+    config.shards_path = argv[optind + 1];
+    int verify_client = (argc - optind >= 3) ? atoi(argv[optind + 2]) : 0;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);  // Workers log straight to stdout (no log ring)
+    printf("=== Bank Router ===\n");
+    if (shard_ring_load(&ring, config.shards_path) != 0) exit(EXIT_FAILURE);
+    for (int i = 0; i < ring.num_shards; i++) {
+        printf("[Master] Shard %s at %s:%d (weight %d)\n", ring.shards[i].name,
+               ring.shards[i].host, ring.shards[i].port, ring.shards[i].weight);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, sighup_handler);
+    signal(SIGCHLD, sigchld_handler);
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+
+    TLSConfig server_tls = {
+        .ca_cert_path = DEFAULT_CA_CERT,
+        .server_cert_path = DEFAULT_SERVER_CERT,
+        .server_key_path = DEFAULT_SERVER_KEY,
+        .verify_peer = verify_client
+    };
+    TLSConfig backend_tls = {
+        .ca_cert_path = DEFAULT_CA_CERT,
+        .client_cert_path = DEFAULT_CLIENT_CERT,  // For shards that verify clients
+        .client_key_path = DEFAULT_CLIENT_KEY,
+        .verify_peer = config.backend_verify
+    };
+    server_ctx = tls_create_server_context(&server_tls);
+    backend_ctx = tls_create_client_context(&backend_tls);
+    if (!server_ctx || !backend_ctx) {
+        fprintf(stderr, "Failed to create TLS context\n");
+        exit(EXIT_FAILURE);
+    }
+
+    server_fd = create_listener(port);
+    if (server_fd < 0) exit(EXIT_FAILURE);
+    printf("[Master] Listening on port %d, %d workers, %d connections per shard each\n",
+           port, config.workers, config.pool_size);
+
+    for (int i = 0; i < config.workers; i++) {
+        worker_pids[i] = spawn_worker(i);
+    }
+
+    // Forward SIGHUP to the workers; replace a worker that died
+    while (keep_running) {
+        sigsuspend(&wait_mask);
+        if (reload_requested) {
+            reload_requested = 0;
+            for (int i = 0; i < config.workers; i++) {
+                if (worker_pids[i] > 0) kill(worker_pids[i], SIGHUP);
+            }
+        }
+        pid_t pid;
+        while (keep_running && (pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (int i = 0; i < config.workers; i++) {
+                if (worker_pids[i] == pid) {
+                    printf("[Master] Router %d exited, restarting it\n", i);
+                    worker_pids[i] = spawn_worker(i);
+                }
+            }
+        }
+    }
+
+    printf("\n[Master] Draining workers (up to %d ms)...\n", config.drain_timeout_ms);
+    close(server_fd);
+    for (int i = 0; i < config.workers; i++) {
+        if (worker_pids[i] > 0) kill(worker_pids[i], SIGTERM);
+    }
+    for (int i = 0; i < config.workers; i++) {
+        if (worker_pids[i] > 0) waitpid(worker_pids[i], NULL, 0);
+    }
+    shard_ring_free(&ring);
+    tls_cleanup_context(server_ctx);
+    tls_cleanup_context(backend_ctx);
+    printf("[Master] Shutdown complete\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * admission.c
+ * Load shedding / admission control for the banking worker
+ */
+
+#include "admission.h"
+#include "../common/include/log_ring.h"
+
+#define INTERVAL_NS ((uint64_t)ADMISSION_INTERVAL_MS * 1000000ULL)
+
+// Worker-local: each worker process has its own copy after fork
+static int admission_worker = -1;
+static uint64_t target_ns = 0;
+static int depth_limit = 0;
+static LoadLevel level = LOAD_NORMAL;
+static uint64_t interval_start_ns = 0;
+static uint64_t min_delay_ns = UINT64_MAX;
+static int min_depth = -1;
+
+static const char *level_names[] = { "normal", "high", "overloaded" };
+
+void admission_init(int worker_id, int target_delay_ms, int max_depth) {
+    admission_worker = worker_id;
+    target_ns = target_delay_ms > 0 ? (uint64_t)target_delay_ms * 1000000ULL : 0;
+    depth_limit = max_depth > 0 ? max_depth : 0;
+    level = LOAD_NORMAL;
+    interval_start_ns = 0;
+    min_delay_ns = UINT64_MAX;
+    min_depth = -1;
+}
+
+static LoadLevel evaluate(void) {
+    if (min_depth < 0) return LOAD_NORMAL;  // No iteration in the interval: idle
+
+    int over = 0, over2 = 0;
+    if (target_ns) {
+        over |= min_delay_ns > target_ns;
+        over2 |= min_delay_ns > 2 * target_ns;
+    }
+    if (depth_limit) {
+        over |= min_depth > depth_limit;
+        over2 |= min_depth > 2 * depth_limit;
+    }
+    return over2 ? LOAD_OVERLOADED : over ? LOAD_HIGH : LOAD_NORMAL;
+}
+
+LoadLevel admission_update(uint64_t now_ns, uint64_t delay_ns, int depth) {
+    if (!target_ns && !depth_limit) return LOAD_NORMAL;
+
+    if (interval_start_ns == 0) interval_start_ns = now_ns;
+    if (delay_ns < min_delay_ns) min_delay_ns = delay_ns;
+    if (min_depth < 0 || depth < min_depth) min_depth = depth;
+
+    if (now_ns - interval_start_ns >= INTERVAL_NS) {
+        LoadLevel next = evaluate();
+        if (next != level) {
+            log_write(next > level ? LOG_LEVEL_WARN : LOG_LEVEL_INFO,
+                      "[Worker %d] Load %s -> %s (queue delay %.2f ms, depth %d)\n",
+                      admission_worker, level_names[level], level_names[next], min_delay_ns / 1e6, min_depth);
+            level = next;
+        }
+        interval_start_ns = now_ns;
+        min_delay_ns = UINT64_MAX;
+        min_depth = -1;
+    }
+    return level;
+}
+
+LoadLevel admission_level(void) {
+    return level;
+}
+
+int admission_admit(RequestPriority prio) {
+    switch (level) {
+        case LOAD_NORMAL:     return 1;
+        case LOAD_HIGH:       return prio >= PRIO_NORMAL;
+        case LOAD_OVERLOADED: return prio >= PRIO_HIGH;
+    }
+    return 1;
+}
+
+int admission_next_timeout(void) {
+    return level == LOAD_NORMAL ? -1 : ADMISSION_INTERVAL_MS;
+}
@@ -0,0 +1,52 @@
+/*
+ * admission.h
+ * Load shedding / admission control for the banking worker
+ *
+ * Every event-loop iteration the worker reports two overload signals:
+ *   - queue delay: time from epoll_wait returning to the next call, i.e. how
+ *     long an event that became ready meanwhile waits to be looked at
+ *   - queue depth: ready events in the batch plus requests still in flight
+ *     (parked on the OTP service)
+ * As in CoDel only a standing queue counts: the load level is re-evaluated
+ * every ADMISSION_INTERVAL_MS from the minimum of each signal over the
+ * interval, so a single burst never triggers shedding.
+ *
+ * LOAD_HIGH sheds low-priority requests and stops accepting connections
+ * (they wait in the kernel backlog or go to a less loaded worker);
+ * LOAD_OVERLOADED (twice the threshold) sheds everything but high priority.
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+#define ADMISSION_INTERVAL_MS 100
+
+typedef enum {
+    PRIO_LOW,       // Creating accounts, starting a login (OP_REQ_OTP), no session
+    PRIO_NORMAL,    // Deposits / withdrawals on an authenticated session
+    PRIO_HIGH       // Completing a login or resuming, balance reads on a session
+} RequestPriority;
+
+typedef enum {
+    LOAD_NORMAL,
+    LOAD_HIGH,
+    LOAD_OVERLOADED
+} LoadLevel;
+
+// target_delay_ms / max_depth = 0 disable that signal (both 0 = never shed)
+void admission_init(int worker_id, int target_delay_ms, int max_depth);
+
+// Once per loop iteration, after the batch has been handled
+LoadLevel admission_update(uint64_t now_ns, uint64_t delay_ns, int depth);
+
+LoadLevel admission_level(void);
+
+// 1 = serve the request, 0 = answer "server busy"
+int admission_admit(RequestPriority prio);
+
+// epoll_wait timeout so an idle worker still steps its level back down (-1 = none needed)
+int admission_next_timeout(void);
+
+#endif // ADMISSION_H
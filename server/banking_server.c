@@ -4,38 +4,293 @@
  * 
  * Architecture:
  * - Master Process: Listens for connections, forks workers
- * - Worker Processes: Handle client requests with TLS
- * - Shared Memory: AccountDB with mutex locking
+ * - Worker Processes: Each runs an epoll loop over many non-blocking TLS
+ *   connections; remote OTP calls park their request and the worker keeps
+ *   serving other connections until the reply arrives
+ * - Shared Memory: AccountDB with mutex locking + login session table
+ * - SIGHUP: Reload certificate/key for new handshakes without restarting
+ * - OTP: remote OTP microservice (default) or local RFC 6238 TOTP
+ * - Sessions: OP_LOGIN issues a token; deposit/withdraw require a session
+ *   bound to the same account (OP_RESUME_SESSION rebinds after a reconnect)
+ * - Stats: workers record per-opcode counters/latency histograms in shared
+ *   memory; the master serves them in Prometheus format on 127.0.0.1
+ * - SIGUSR1: each worker prints its per-stage timing breakdown
+ * - Logging: workers write binary entries to per-worker shared-memory rings;
+ *   a drainer process formats them and does the (possibly blocking) write
+ * - Rate limits: shared token buckets per client IP, client certificate and
+ *   account; over-budget requests get STATUS_RATE_LIMITED
+ * - Load shedding: an overloaded worker stops accepting and answers
+ *   low-priority requests with STATUS_SERVER_BUSY
+ * - Deadlines: handshake, request header, request body and idle phases are
+ *   timed on a per-worker timer wheel; late connections are closed
+ * - Shutdown drains: workers stop accepting, finish in-flight requests and
+ *   send OP_GOAWAY on each connection at a request boundary before exiting
+ * - SIGUSR2: hot upgrade. The master re-execs its binary (a new build at the
+ *   same path) and passes the listening sockets over a UNIX socket with
+ *   SCM_RIGHTS; the new master takes over the shared segment and starts its
+ *   workers, then the old master drains and exits. The listening socket is
+ *   never closed, so no connection is refused during a deploy
+ * - Replication: a replication process streams every account change to
+ *   standby servers (--repl-listen) or applies the primary's stream
+ *   (--standby-of). A standby rejects client requests with
+ *   STATUS_NOT_PRIMARY until it is promoted (SIGRTMIN to the master);
+ *   --repl-sync holds mutation responses until a standby has them.
+ *   With --read-replica a standby answers balance queries that are fresh
+ *   enough, and waits for a client's own write when asked (min_seq)
+ * - Migration: bank_migrate pulls the accounts a new shard membership gives
+ *   to another shard through the replication port; frozen and moved
+ *   accounts are answered STATUS_ACCOUNT_MOVED (migration.h)
+ * - Local transport: with --local-socket, clients on this host running as
+ *   our user (or root) exchange requests and responses with a worker over
+ *   shared-memory rings instead of TLS (local_ring.h); they go through the
+ *   same dispatch, limits and handlers
+ * - Snapshot reads: OP_SNAPSHOT_OPEN pins a commit timestamp; balance
+ *   queries carrying its id read the account versions as of that point
+ *   (account.h), so a report sees one consistent state without blocking writers
+ * - Transactions: OP_TRANSACTION applies several deposits/withdrawals at
+ *   once if the versions of the accounts it read are unchanged (optimistic
+ *   concurrency; STATUS_TXN_CONFLICT asks the client to re-read and retry)
+ * - Idempotent retries: a deposit, withdrawal or transaction sent with an
+ *   idempotency key (PacketHeader.req_id) runs once per login session; a
+ *   retry of it gets the stored response (idempotency.h)
  * 
  * Compile: gcc banking_server.c ../common/*.c -o banking_server -lssl -lcrypto -lpthread
- * Usage: ./banking_server <port> [verify_client]
+ * Usage: ./banking_server <port> [verify_client] [--otp-mode remote|totp]
+ *        [--totp-skew N] [--totp-algo sha1|sha256] [--otp-timeout MS]
+ *        [--otp-breaker N] [--otp-cooldown MS] [--otp-fallback fail|totp]
+ *        [--stats-port N] [--slow-ms MS] [--slow-sample N]
+ *        [--log-level debug|info|warn|error] [--log-rate N]
+ *        [--rate-ip R[:B]] [--rate-cert R[:B]] [--rate-account R[:B]] [--rate-otp R[:B]]
+ *        [--shed-delay MS] [--shed-depth N] [--handshake-timeout MS]
+ *        [--header-timeout MS] [--body-timeout MS] [--idle-timeout MS]
+ *        [--drain-timeout MS] [--shm-key KEY] [--repl-listen [ADDR:]PORT]
+ *        [--standby-of HOST:PORT] [--repl-sync MS] [--read-replica MS]
+ *        [--local-socket PATH]
  */
 
+#define _GNU_SOURCE  // accept4
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <signal.h>
+#include <getopt.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <errno.h>
 
 #include "../common/include/protocol.h"
 #include "../common/include/account.h"
 #include "../common/include/ipc.h"
+#include "../common/include/session.h"
+#include "../common/include/stats.h"
+#include "../common/include/log_ring.h"
+#include "../common/include/ratelimit.h"
 #include "../common/include/tls_wrapper.h"
 #include "../common/include/otp_ipc.h"
+#include "../common/include/timer_wheel.h"
+#include "../common/include/local_ring.h"
+#include "../common/include/crypto.h"
+#include "otp_client.h"
+#include "stats_server.h"
+#include "req_timing.h"
+#include "admission.h"
+#include "replication.h"
 
 #define MAX_WORKERS 5
 #define DEFAULT_PORT 8888
-#define BACKLOG 10
+#define BACKLOG 128  // Connections deferred by overloaded workers wait here
+#define MAX_EVENTS 64
+
+// Connection deadlines (ms)
+#define DEFAULT_HANDSHAKE_TIMEOUT_MS 10000
+#define DEFAULT_HEADER_TIMEOUT_MS 10000
+#define DEFAULT_BODY_TIMEOUT_MS 30000
+#define DEFAULT_IDLE_TIMEOUT_MS 300000
+#define DEFAULT_DRAIN_TIMEOUT_MS 10000
+#define DRAIN_KILL_GRACE_MS 2000   // Master SIGKILLs workers this long after the drain deadline
+#define UPGRADE_READY_TIMEOUT_MS 10000  // Old master keeps serving if the new one is not up by then
+#define UPGRADE_FD_STATS 0x1       // Hand-over message flags: which optional sockets follow the listener
+#define UPGRADE_FD_REPL 0x2
+#define UPGRADE_FD_LOCAL 0x4
+#define UPGRADE_MAX_FDS 4
+
+// Old and new workers overlap during a hot upgrade, so each master generation
+// writes its own set of stats slots and log rings (single writer per slot)
+#define WORKER_GENERATIONS (STATS_MAX_WORKERS / MAX_WORKERS)
+
+_Static_assert(MAX_WORKERS <= STATS_MAX_WORKERS, "stats table too small for MAX_WORKERS");
+_Static_assert(MAX_WORKERS <= LOG_MAX_RINGS, "log table too small for MAX_WORKERS");
+_Static_assert(WORKER_GENERATIONS >= 2 && LOG_MAX_RINGS >= STATS_MAX_WORKERS,
+               "stats/log tables too small for two generations of workers");
+
+#define LOG_DRAIN_IDLE_NS 2000000  // Drainer poll interval when all rings are empty
+
+typedef enum {
+    OTP_MODE_REMOTE,  // Ask the OTP microservice (otp_server)
+    OTP_MODE_TOTP     // Verify RFC 6238 codes locally against shared-memory secrets
+} OtpMode;
+
+typedef enum {
+    OTP_FALLBACK_FAIL,  // OTP service unavailable: reject the request
+    OTP_FALLBACK_TOTP   // OTP service unavailable: use local TOTP for this call
+} OtpFallback;
+
+// Runtime options (set in main before fork, read-only in workers)
+typedef struct {
+    OtpMode otp_mode;
+    int totp_skew;
+    TotpAlgo totp_algo;
+    OtpFallback otp_fallback;
+    OtpClientConfig otp_client;
+    int stats_port;                 // 0 = stats endpoint disabled
+    int slow_ms;                    // Slow-request log threshold, 0 = off
+    int slow_sample;                // Log every Nth slow request
+    LogLevel log_level;
+    int log_rate;                   // Entries/s per worker below WARN, 0 = unlimited
+    RateLimit rate_limits[RL_CLASSES];  // Copied into shared memory at startup
+    int shed_delay_ms;              // Queue delay target for load shedding, 0 = off
+    int shed_depth;                 // Queue depth limit for load shedding, 0 = off
+    int timeout_ms[TIMEOUT_PHASES]; // Connection deadlines, 0 = none
+    int drain_timeout_ms;           // Shutdown: max time to finish in-flight requests
+    int repl_sync_ms;               // Hold mutation responses until a standby applied them, 0 = async
+    int read_staleness_ms;          // Standby: serve balance reads at most this stale, 0 = no reads
+} ServerConfig;
+
+// Session bound to one client connection (worker-local)
+typedef struct {
+    int bound;
+    uint8_t token[SESSION_TOKEN_LEN];
+} ConnSession;
+
+typedef enum {
+    CONN_HANDSHAKE,   // TLS handshake in progress
+    CONN_READY,       // Reading requests
+    CONN_PARKED       // Waiting for an OTP reply, reads paused
+} ConnState;
+
+// One client connection in a worker's event loop
+typedef struct ClientConn {
+    int fd;                         // -1 once closed
+    SSL *ssl;                       // NULL for a local client
+    int local;                      // Local transport: requests and responses go through ring
+    LocalEndpoint ring;
+    uint32_t local_id;              // Local request being answered
+    uint32_t peer_ip;               // Rate limit keys
+    char cert_cn[64];               // Empty without a verified client certificate
+    ConnState state;
+    uint32_t events;                // Currently registered epoll events
+    TimerNode deadline;             // On worker_deadlines while waiting on the client
+    TimeoutPhase deadline_phase;    // TIMEOUT_PHASES = no deadline
+    ConnSession sess;
+    size_t in_len;
+    BankingPacket in;
+    uint16_t req_op;                // Request being answered (for stats)
+    uint32_t idem_key;              // Idempotency entry claimed by that request (0 = none)
+    uint64_t req_start_us;
+    ReqTiming timing;               // Stage breakdown of the current request
+    uint64_t parked_ns;
+    int out_pending;                // Response waiting for the socket
+    BankingPacket out;
+    char parked_account[ACCOUNT_ID_LEN];  // Request parked on an OTP call
+    char parked_otp[10];
+    int going_away;                 // OP_GOAWAY queued: close once it is written
+    uint64_t sync_seq;              // Parked until a standby applied this record (0 = not held)
+    uint64_t sync_deadline_ms;      // Response goes out regardless after this
+    int sync_read;                  // Read replica: answer the balance of parked_account at release
+    BankingResponse held;           // The response being held (sync_read = 0)
+    struct ClientConn *prev_sync;   // Worker's FIFO of held responses and waiting reads
+    struct ClientConn *next_sync;
+    struct ClientConn *prev_live;   // Worker's list of open connections (for draining)
+    struct ClientConn *next_live;
+    struct ClientConn *next_closed; // Freed after the current epoll batch
+} ClientConn;
 
 // Global variables
 static volatile sig_atomic_t keep_running = 1;
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t timing_dump_requested = 0;
+static volatile sig_atomic_t upgrade_requested = 0;
+static volatile sig_atomic_t promote_requested = 0;
 static pid_t worker_pids[MAX_WORKERS];
+static int worker_slot_base = 0;            // First stats slot / log ring of this generation
+static char self_exe[PATH_MAX];             // Resolved at startup: a deploy replaces the file
+static char **exec_args = NULL;             // argv for the re-exec (without --upgrade-fd)
+static int exec_argc = 0;
+static pid_t upgrade_parent = -1;           // Old master, draining while it is still our parent
 static int server_fd = -1;
 static SSL_CTX *ssl_ctx = NULL;
+static TLSConfig tls_config;
+static SessionTable *session_table = NULL;  // Lives in the shared segment
+static StatsTable *stats_table = NULL;      // Lives in the shared segment
+static LogTable *log_table = NULL;          // Lives in the shared segment (NULL = no drainer)
+static RateLimitTable *rate_table = NULL;   // Lives in the shared segment
+static pid_t drainer_pid = -1;
+static ReplLog *repl_log = NULL;            // Lives in the shared segment
+static MigrationState *migration = NULL;    // Lives in the shared segment
+static IdemCache *idem_cache = NULL;        // Lives in the shared segment
+static AccountDB *repl_db = NULL;
+static int repl_listen_fd = -1;             // Standbys connect here (-1 = no --repl-listen)
+static const char *local_socket_path = NULL;  // --local-socket
+static int local_listen_fd = -1;            // Local clients connect here
+static int repl_kick_fd = -1;               // Workers -> sender: records appended
+static int repl_wake_fd = -1;               // Sender/receiver -> workers: acked/applied advanced (edge-triggered, never read)
+static char standby_host[256];              // --standby-of
+static int standby_port = 0;
+static pid_t repl_pid = -1;                 // Sender or receiver process
+static volatile sig_atomic_t repl_exited = 0;  // repl_pid was reaped by the SIGCHLD handler
+static int stats_listen_fd = -1;            // For the replication process to close after fork
+static ServerConfig config = {
+    .otp_mode = OTP_MODE_REMOTE,
+    .totp_skew = TOTP_DEFAULT_SKEW,
+    .totp_algo = TOTP_SHA1,
+    .otp_fallback = OTP_FALLBACK_FAIL,
+    .otp_client = {
+        .timeout_ms = OTP_DEFAULT_TIMEOUT_MS,
+        .breaker_threshold = OTP_DEFAULT_BREAKER_THRESHOLD,
+        .breaker_cooldown_ms = OTP_DEFAULT_BREAKER_COOLDOWN_MS
+    },
+    .stats_port = DEFAULT_STATS_PORT,
+    .slow_ms = 0,
+    .slow_sample = 1,
+    .log_level = LOG_LEVEL_INFO,
+    .log_rate = LOG_DEFAULT_RATE,
+    .timeout_ms = {
+        [TIMEOUT_HANDSHAKE] = DEFAULT_HANDSHAKE_TIMEOUT_MS,
+        [TIMEOUT_HEADER] = DEFAULT_HEADER_TIMEOUT_MS,
+        [TIMEOUT_BODY] = DEFAULT_BODY_TIMEOUT_MS,
+        [TIMEOUT_IDLE] = DEFAULT_IDLE_TIMEOUT_MS
+    },
+    .drain_timeout_ms = DEFAULT_DRAIN_TIMEOUT_MS
+};
+
+// Worker-local state (set in worker_main after fork)
+static int worker_index = -1;
+static int worker_epfd = -1;
+static AccountDB *worker_db = NULL;
+static WorkerStats *worker_stats = NULL;    // This worker's slot in stats_table
+static ClientConn *closed_conns = NULL;
+static int worker_inflight = 0;             // Requests dispatched but not yet answered
+static int listener_armed = 0;              // Listening socket in this worker's epoll set
+static TimerWheel worker_deadlines;         // Connection deadlines, millisecond ticks
+static ClientConn *live_conns = NULL;
+static int live_count = 0;
+static volatile sig_atomic_t drain_requested = 0;
+static int draining = 0;
+static uint64_t drain_deadline_ms = 0;
+static int drain_goaways = 0;
+static ClientConn *sync_head = NULL;        // Held responses and waiting reads, oldest first
+static ClientConn *sync_tail = NULL;
+static uint64_t sync_behind = 0;            // Timed out on this record: async until a standby has it
 
 // Signal handler for graceful shutdown
 void signal_handler(int signum) {
@@ -53,73 +308,538 @@ void signal_handler(int signum) {
     }
 }
 
-// SIGCHLD handler to reap zombie processes
+// SIGHUP handler: only flag the reload, the context is rebuilt outside signal context.
+// Master and workers share this handler; each process swaps its own ssl_ctx.
+void sighup_handler(int signum) {
+    (void)signum;
+    reload_requested = 1;
+}
+
+// Rebuild ssl_ctx from the certificate/key files on disk
+static int reload_tls_context(const char *who) {
+    reload_requested = 0;
+    if (tls_reload_server_context(&ssl_ctx, &tls_config) != 0) {
+        fprintf(stderr, "[%s] Certificate reload failed, keeping current context\n", who);
+        return -1;
+    }
+    printf("[%s] TLS context reloaded from %s\n", who, tls_config.server_cert_path);
+    return 0;
+}
+
+// SIGUSR1: the master forwards it, each worker prints its stage timing
+void sigusr1_handler(int signum) {
+    (void)signum;
+    timing_dump_requested = 1;
+}
+
+// SIGUSR2: hot upgrade, handled in the master loop
+void sigusr2_handler(int signum) {
+    (void)signum;
+    upgrade_requested = 1;
+}
+
+// SIGRTMIN: promote a standby, handled in the master loop. Only the
+// server's own user (or root) can send it
+void sigpromote_handler(int signum) {
+    (void)signum;
+    promote_requested = 1;
+}
+
+// SIGCHLD handler to reap zombie processes. Once reaped, repl_pid may be
+// reused by an unrelated process, so it is flagged rather than signalled
 void sigchld_handler(int signum) {
     (void)signum;
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    int saved_errno = errno;
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        if (pid == repl_pid) repl_exited = 1;
+    }
+    errno = saved_errno;
+}
+
+static void conn_drive(ClientConn *c);
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void conn_set_events(ClientConn *c, uint32_t events) {
+    if (events == c->events) return;
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(worker_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+// A deadline covers a whole phase: it is only re-armed when the phase
+// changes, so trickling bytes does not extend it
+static void conn_set_deadline(ClientConn *c, TimeoutPhase phase) {
+    if (phase == c->deadline_phase) return;
+    c->deadline_phase = phase;
+    if (phase == TIMEOUT_PHASES || config.timeout_ms[phase] <= 0) {
+        timer_wheel_del(&worker_deadlines, &c->deadline);
+        return;
+    }
+    timer_wheel_add(&worker_deadlines, &c->deadline, now_us() / 1000 + config.timeout_ms[phase]);
+}
+
+// Waiting on the client: poll for what OpenSSL needs, under the current phase's deadline
+static void conn_wait(ClientConn *c, TlsIoStatus st) {
+    conn_set_events(c, st == TLS_IO_WANT_READ ? EPOLLIN : EPOLLOUT);
+    
+    TimeoutPhase phase;
+    if (c->state == CONN_HANDSHAKE) {
+        phase = TIMEOUT_HANDSHAKE;
+    } else if (c->out_pending || c->in_len == 0) {
+        phase = TIMEOUT_IDLE;  // Between requests, or the client is not reading our response
+    } else if (c->in_len < sizeof(PacketHeader)) {
+        phase = TIMEOUT_HEADER;
+    } else {
+        phase = TIMEOUT_BODY;
+    }
+    conn_set_deadline(c, phase);
+}
+
+static void sync_unlink(ClientConn *c) {
+    if (c->prev_sync) c->prev_sync->next_sync = c->next_sync;
+    else sync_head = c->next_sync;
+    if (c->next_sync) c->next_sync->prev_sync = c->prev_sync;
+    else sync_tail = c->prev_sync;
+    c->prev_sync = c->next_sync = NULL;
+    c->sync_seq = 0;
+    __atomic_sub_fetch(&repl_log->sync_waiters, 1, __ATOMIC_RELAXED);
+}
+
+// Close now, free after the epoll batch (later events may still point at c)
+static void conn_close(ClientConn *c) {
+    if (c->fd < 0) return;
+    log_write(LOG_LEVEL_INFO, "[Worker %d] Client disconnected\n", worker_index);
+    stats_add(&worker_stats->conns_closed, 1);
+    if (c->state == CONN_PARKED) worker_inflight--;  // Its OTP reply / held response will never be answered
+    if (c->idem_key) {
+        // A held mutation was applied: its retry must get the held response
+        if (c->sync_seq && !c->sync_read) idem_finish(idem_cache, c->sess.token, c->idem_key, &c->held);
+        else idem_abort(idem_cache, c->sess.token, c->idem_key);
+        c->idem_key = 0;
+    }
+    if (c->sync_seq) sync_unlink(c);
+    timer_wheel_del(&worker_deadlines, &c->deadline);
+    otp_client_cancel(c);
+    epoll_ctl(worker_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->local) {
+        epoll_ctl(worker_epfd, EPOLL_CTL_DEL, c->ring.req_efd, NULL);
+        local_server_close(&c->ring);  // Requests still queued were not processed
+    }
+    tls_close(c->ssl);
+    close(c->fd);
+    c->fd = -1;
+    if (c->prev_live) c->prev_live->next_live = c->next_live;
+    else live_conns = c->next_live;
+    if (c->next_live) c->next_live->prev_live = c->prev_live;
+    live_count--;
+    c->next_closed = closed_conns;
+    closed_conns = c;
+}
+
+static void conn_deadline_expired(TimerNode *node, void *arg) {
+    (void)arg;
+    ClientConn *c = timer_entry(node, ClientConn, deadline);
+    log_write(LOG_LEVEL_INFO, "[Worker %d] Closing connection: %s timeout\n",
+              worker_index, stats_timeout_name(c->deadline_phase));
+    stats_add(&worker_stats->conn_timeouts[c->deadline_phase], 1);
+    c->deadline_phase = TIMEOUT_PHASES;
+    conn_close(c);
 }
 
-// 內部 helper: 送出 Struct 給 OTP Server 並接收回應
-int call_otp_service(int opcode, const char *account, const char *otp_in, char *otp_out) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) return 0;
+// Every request gets exactly one response, so latency is recorded here
+// (a local client's goes straight into its ring, announced by local_drive)
+static void conn_send(ClientConn *c, const BankingResponse *response) {
+    uint64_t t0 = timing_now();
+    if (c->local) {
+        local_server_push(&c->ring, c->local_id, response);
+    } else {
+        pack_response(&c->out, response);
+    }
+    c->timing.stage_ns[STAGE_PACK] += timing_now() - t0;
+    if (c->idem_key) {
+        idem_finish(idem_cache, c->sess.token, c->idem_key, response);
+        c->idem_key = 0;
+    }
+    c->out_pending = 1;
+    worker_inflight--;
+    stats_record_op(worker_stats, c->req_op, now_us() - c->req_start_us,
+                    response->status != STATUS_SUCCESS);
+}
+
+// Semi-synchronous replication: park a successful mutation's response until a
+// standby has applied its record. With no standby connected there is nothing
+// to wait for; after a timeout the worker answers asynchronously until the
+// standby has caught up, so a stalled standby costs one timeout, not one per request.
+static int sync_hold(ClientConn *c, const BankingResponse *response, uint64_t seq) {
+    if (config.repl_sync_ms <= 0 || response->status != STATUS_SUCCESS) return 0;
+    if (__atomic_load_n(&stats_table->repl.standbys, __ATOMIC_RELAXED) == 0) return 0;
+    if (sync_behind) {
+        if (__atomic_load_n(&repl_log->acked, __ATOMIC_ACQUIRE) < sync_behind) return 0;
+        log_write(LOG_LEVEL_WARN, "[Worker %d] Standby caught up, replicating synchronously again\n", worker_index);
+        sync_behind = 0;
+    }
+    
+    // Announce the waiter before checking acked: the sender acks first and
+    // checks for waiters second, so one of us sees the other
+    __atomic_add_fetch(&repl_log->sync_waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&repl_log->acked, __ATOMIC_SEQ_CST) >= seq) {
+        __atomic_sub_fetch(&repl_log->sync_waiters, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    c->held = *response;
+    c->sync_seq = seq;
+    c->sync_deadline_ms = now_us() / 1000 + config.repl_sync_ms;
+    c->state = CONN_PARKED;
+    c->prev_sync = sync_tail;
+    c->next_sync = NULL;
+    if (sync_tail) sync_tail->next_sync = c;
+    else sync_head = c;
+    sync_tail = c;
+    stats_add(&worker_stats->repl_sync_waits, 1);
+    return 1;
+}
+
+static void answer_balance(AccountDB *db, const char *account_id, BankingResponse *response) {
+    double balance;
+    uint64_t version = 0;
+    int result = account_get_balance(db, account_id, &balance, &version);
+    response->status = result;
+    response->balance = balance;
+    response->version = version;
+    
+    if (result == 0) {
+        snprintf(response->message, sizeof(response->message),
+                "Account %s balance: %.2f", account_id, balance);
+    } else if (result == -2) {
+        snprintf(response->message, sizeof(response->message),
+                "Account %s not found", account_id);
+    } else {
+        snprintf(response->message, sizeof(response->message),
+                "Query failed");
+    }
+}
+
+// Balance as of an OP_SNAPSHOT_OPEN: writers never wait for it, and every
+// read with the same snapshot_id sees the same set of committed changes
+static void snapshot_read(AccountDB *db, const char *account_id, uint64_t snapshot_id, BankingResponse *response) {
+    double balance = 0;
+    uint64_t version = 0, ts = 0;
+    int result = account_view_balance(db, snapshot_id, account_id, &balance, &version, &ts);
+    response->balance = balance;
+    response->version = version;
+    response->snapshot_ts = ts;
+    if (result == 0) {
+        stats_add(&worker_stats->snapshot_reads, 1);
+        response->status = STATUS_SUCCESS;
+        snprintf(response->message, sizeof(response->message),
+                "Account %s balance at snapshot %lu: %.2f", account_id, ts, balance);
+    } else if (result == -2) {
+        stats_add(&worker_stats->snapshot_reads, 1);
+        response->status = STATUS_ACCOUNT_NOT_FOUND;
+        snprintf(response->message, sizeof(response->message),
+                "Account %s not found at snapshot %lu", account_id, ts);
+    } else {
+        stats_add(&worker_stats->snapshot_too_old, 1);
+        response->status = STATUS_SNAPSHOT_TOO_OLD;
+        snprintf(response->message, sizeof(response->message),
+                "Snapshot expired or too old, open a new one");
+    }
+}
 
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(OTP_PORT);
-    inet_pton(AF_INET, OTP_IP, &serv_addr.sin_addr);
+// Read replica: answer from the applied state if it is within the staleness
+// bound (refused otherwise: the client reads from the primary instead)
+static void replica_read(const char *account_id, BankingResponse *response) {
+    uint64_t applied = __atomic_load_n(&stats_table->repl.applied_seq, __ATOMIC_ACQUIRE);
+    uint64_t staleness = stats_repl_staleness_ns(&stats_table->repl);
+    if (staleness > (uint64_t)config.read_staleness_ms * 1000000ULL) {
+        stats_add(&worker_stats->replica_stale, 1);
+        response->status = STATUS_REPLICA_STALE;
+        snprintf(response->message, sizeof(response->message),
+                "Replica more than %d ms behind the primary", config.read_staleness_ms);
+        return;
+    }
+    answer_balance(worker_db, account_id, response);
+    response->commit_seq = applied;  // Everything up to here is in the answer
+    response->staleness_ms = (uint32_t)(staleness / 1000000);
+    stats_add(&worker_stats->replica_reads, 1);
+}
 
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("Cannot connect to OTP Server");
-        close(sock);
+// Read replica, read-your-writes: park a balance read until the client's last
+// write (min_seq) has been applied here, at most read_staleness_ms. Not when
+// the replica is already past the bound (cut off from the primary): the
+// client goes to the primary right away instead of after the wait
+static int replica_wait(ClientConn *c, const char *account_id, uint64_t min_seq) {
+    if (stats_repl_staleness_ns(&stats_table->repl) > (uint64_t)config.read_staleness_ms * 1000000ULL) return 0;
+    __atomic_add_fetch(&repl_log->sync_waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&stats_table->repl.applied_seq, __ATOMIC_SEQ_CST) >= min_seq) {
+        __atomic_sub_fetch(&repl_log->sync_waiters, 1, __ATOMIC_RELAXED);
         return 0;
     }
+    memcpy(c->parked_account, account_id, ACCOUNT_ID_LEN);
+    c->sync_read = 1;
+    c->sync_seq = min_seq;
+    c->sync_deadline_ms = now_us() / 1000 + config.read_staleness_ms;
+    c->state = CONN_PARKED;
+    c->prev_sync = sync_tail;
+    c->next_sync = NULL;
+    if (sync_tail) sync_tail->next_sync = c;
+    else sync_head = c;
+    sync_tail = c;
+    stats_add(&worker_stats->replica_read_waits, 1);
+    return 1;
+}
+
+// Deadlines grow along the FIFO, sequence numbers only among held responses
+// (reads wait for their own client's write), so every entry is checked
+static void sync_release(void) {
+    uint64_t acked = __atomic_load_n(&repl_log->acked, __ATOMIC_ACQUIRE);
+    uint64_t applied = __atomic_load_n(&stats_table->repl.applied_seq, __ATOMIC_ACQUIRE);
+    uint64_t now_ms = now_us() / 1000;
+    ClientConn *next;
+    for (ClientConn *c = sync_head; c; c = next) {
+        next = c->next_sync;
+        uint64_t done = c->sync_read ? applied : acked;
+        if (c->sync_seq > done && now_ms < c->sync_deadline_ms) continue;
+        
+        BankingResponse response;
+        if (!c->sync_read) {
+            response = c->held;
+            if (c->sync_seq > acked) {
+                stats_add(&worker_stats->repl_sync_timeouts, 1);
+                if (!sync_behind) {
+                    log_write(LOG_LEVEL_WARN, "[Worker %d] No standby applied record %lu within %d ms, "
+                              "answering asynchronously until one does\n", worker_index, c->sync_seq, config.repl_sync_ms);
+                }
+                sync_behind = c->sync_seq;
+            }
+        } else {
+            memset(&response, 0, sizeof(response));
+            if (c->sync_seq > applied &&
+                __atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) == REPL_ROLE_STANDBY) {
+                stats_add(&worker_stats->replica_stale, 1);
+                response.status = STATUS_REPLICA_STALE;
+                snprintf(response.message, sizeof(response.message),
+                        "Change %lu not on the replica yet", c->sync_seq);
+            } else if (__atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) == REPL_ROLE_STANDBY) {
+                replica_read(c->parked_account, &response);
+            } else {
+                answer_balance(worker_db, c->parked_account, &response);  // Promoted meanwhile
+            }
+        }
+        sync_unlink(c);
+        c->sync_read = 0;
+        c->state = CONN_READY;
+        conn_send(c, &response);
+        conn_drive(c);
+    }
+}
+
+// Outcome of a call to the OTP service (before any fallback)
+static void count_otp_call(int status) {
+    if (status == OTP_CALL_OK) {
+        stats_add(&worker_stats->otp_ok, 1);
+    } else if (status == OTP_CALL_REJECTED) {
+        stats_add(&worker_stats->otp_rejected, 1);
+    } else {
+        stats_add(&worker_stats->otp_unavailable, 1);
+    }
+}
+
+static void fill_otp_generated(BankingResponse *response, int status, const char *otp_code) {
+    if (status == OTP_CALL_OK) {
+         response->status = STATUS_SUCCESS;
+         // In a real system, OTP is sent via SMS. Here we return it for testing convenience
+         snprintf(response->message, sizeof(response->message), "OTP Generated: %s", otp_code);
+    } else if (status == OTP_CALL_UNAVAILABLE) {
+         response->status = STATUS_ERROR;
+         snprintf(response->message, sizeof(response->message), "OTP Service Unavailable");
+    } else {
+         response->status = STATUS_ERROR;
+         snprintf(response->message, sizeof(response->message), "OTP Generation Failed");
+    }
+}
+
+static void fill_login_result(ClientConn *c, BankingResponse *response, const char *account_id, int status) {
+    int evicted = 0;
+    if (status == OTP_CALL_OK && session_create(session_table, account_id, c->sess.token, &evicted) == 0) {
+        if (evicted) stats_add(&worker_stats->session_evictions, 1);
+        c->sess.bound = 1;
+        session_token_to_hex(c->sess.token, response->session_token);
+        response->status = STATUS_SUCCESS;
+        snprintf(response->message, sizeof(response->message), "Login Successful");
+    } else if (status == OTP_CALL_OK) {
+        response->status = STATUS_ERROR;
+        snprintf(response->message, sizeof(response->message), "Session creation failed");
+    } else if (status == OTP_CALL_UNAVAILABLE) {
+        response->status = STATUS_ERROR;
+        snprintf(response->message, sizeof(response->message), "OTP Service Unavailable");
+    } else {
+        response->status = STATUS_ERROR;
+        snprintf(response->message, sizeof(response->message), "Invalid OTP");
+    }
+}
 
-    // 1. 準備請求包
-    OtpIpcRequest req;
-    memset(&req, 0, sizeof(req));
-    req.op_code = opcode;
-    strncpy(req.account, account, sizeof(req.account) - 1);
-    if (otp_in) strncpy(req.otp_code, otp_in, sizeof(req.otp_code) - 1);
+// Local RFC 6238 TOTP (primary in totp mode, fallback in remote mode)
+static int totp_generate_local(const char *account_id, char *otp_code) {
+    // Normally the user's authenticator app computes this
+    return account_totp_code(worker_db, account_id, config.totp_algo, otp_code) == 0
+           ? OTP_CALL_OK : OTP_CALL_REJECTED;
+}
 
-    // 2. 傳送
-    write(sock, &req, sizeof(req));
+static int totp_verify_local(const char *account_id, const char *otp) {
+    // No round trip: HMAC check + replay guard under the account lock
+    return account_totp_verify(worker_db, account_id, otp, config.totp_skew, config.totp_algo) == 0
+           ? OTP_CALL_OK : OTP_CALL_REJECTED;
+}
 
-    // 3. 接收回應
-    OtpIpcResponse res;
-    int bytes = read(sock, &res, sizeof(res));
-    close(sock);
+// Remote call outcome -> response, applying the fallback policy if the service is unavailable
+static void answer_otp_generate(BankingResponse *response, const char *account_id,
+                                int status, const char *otp_code) {
+    char local_code[10] = {0};
+    count_otp_call(status);
+    if (status == OTP_CALL_UNAVAILABLE && config.otp_fallback == OTP_FALLBACK_TOTP) {
+        status = totp_generate_local(account_id, local_code);
+        otp_code = local_code;
+    }
+    fill_otp_generated(response, status, otp_code);
+}
 
-    if (bytes > 0 && res.status == 1) {
-        if (otp_out) strncpy(otp_out, res.otp_code, 8); // 如果是 Gen，把 OTP 帶出來
-        return 1; // 成功
+static void answer_login(ClientConn *c, BankingResponse *response, const char *account_id,
+                         const char *otp, int status) {
+    count_otp_call(status);
+    if (status == OTP_CALL_UNAVAILABLE && config.otp_fallback == OTP_FALLBACK_TOTP) {
+        status = totp_verify_local(account_id, otp);
     }
-    return 0; // 失敗
+    fill_login_result(c, response, account_id, status);
+}
+
+// OTP service replies: answer the parked request and resume reading
+static void otp_generate_done(void *arg, int status, const char *otp_code) {
+    ClientConn *c = arg;
+    BankingResponse response;
+    memset(&response, 0, sizeof(response));
+    uint64_t t0 = timing_now();
+    c->timing.stage_ns[STAGE_OTP_WAIT] = t0 - c->parked_ns;
+    answer_otp_generate(&response, c->parked_account, status, otp_code);
+    c->timing.stage_ns[STAGE_HANDLER] += timing_now() - t0;
+
+    c->state = CONN_READY;
+    conn_send(c, &response);
+    conn_drive(c);
+}
+
+static void otp_verify_done(void *arg, int status, const char *otp_code) {
+    (void)otp_code;
+    ClientConn *c = arg;
+    BankingResponse response;
+    memset(&response, 0, sizeof(response));
+    uint64_t t0 = timing_now();
+    c->timing.stage_ns[STAGE_OTP_WAIT] = t0 - c->parked_ns;
+    answer_login(c, &response, c->parked_account, c->parked_otp, status);
+    c->timing.stage_ns[STAGE_HANDLER] += timing_now() - t0;
+
+    c->state = CONN_READY;
+    conn_send(c, &response);
+    conn_drive(c);
 }
 
-// 替換原本的 request_otp_generation
-int request_otp_generation(const char *account, char *out_otp) {
-    // 呼叫我們的自定義協定
-    return call_otp_service(OTP_OP_GENERATE, account, NULL, out_otp);
+// Money operations: the connection's session must still be live and bound to this account
+static int session_authorized(const ConnSession *sess, const char *account_id) {
+    char bound_account[ACCOUNT_ID_LEN];
+    if (!sess->bound) return 0;
+    if (session_lookup(session_table, sess->token, bound_account) != 0) return 0;
+    return strncmp(bound_account, account_id, ACCOUNT_ID_LEN) == 0;
+}
+
+// OP_TRANSACTION: withdrawals need a session on that account (as OP_WITHDRAW
+// does); credits may go to any account but must not exceed the debits, so a
+// transaction moves money and never creates it (that takes an OP_DEPOSIT with a
+// session). Validation against the versions read and the commit happen in
+// account_transact under the accounts' locks
+static void run_transaction(const ConnSession *sess, AccountDB *db, TxnRequest *req, BankingResponse *response) {
+    AccountTxnRead reads[TXN_MAX_READS];
+    AccountTxnWrite writes[TXN_MAX_WRITES];
+    if (req->num_reads > TXN_MAX_READS || req->num_writes < 1 || req->num_writes > TXN_MAX_WRITES) {
+        response->status = STATUS_ERROR;
+        snprintf(response->message, sizeof(response->message),
+                "Transaction needs 1-%d writes and at most %d reads", TXN_MAX_WRITES, TXN_MAX_READS);
+        return;
+    }
+    for (int i = 0; i < req->num_reads; i++) {
+        memcpy(reads[i].account_id, req->reads[i].account_id, ACCOUNT_ID_LEN);
+        reads[i].account_id[ACCOUNT_ID_LEN - 1] = '\0';
+        reads[i].version = req->reads[i].version;
+    }
+    double credits = 0, debits = 0;
+    for (int i = 0; i < req->num_writes; i++) {
+        memcpy(writes[i].account_id, req->writes[i].account_id, ACCOUNT_ID_LEN);
+        writes[i].account_id[ACCOUNT_ID_LEN - 1] = '\0';
+        writes[i].amount = req->writes[i].amount;
+        if (writes[i].amount < 0 && !session_authorized(sess, writes[i].account_id)) {
+            response->status = STATUS_UNAUTHORIZED;
+            snprintf(response->message, sizeof(response->message),
+                    "Login required for account %s", writes[i].account_id);
+            return;
+        }
+        if (writes[i].amount > 0) credits += writes[i].amount;
+        else debits -= writes[i].amount;
+    }
+    if (credits > debits + 1e-9) {  // Tolerance for the rounding of split amounts
+        response->status = STATUS_INVALID_AMOUNT;
+        snprintf(response->message, sizeof(response->message),
+                "Credits (%.2f) exceed debits (%.2f)", credits, debits);
+        return;
+    }
+    
+    const char *failed = "";
+    int result = account_transact(db, reads, req->num_reads, writes, req->num_writes, &failed);
+    if (result == 0) {
+        response->status = STATUS_SUCCESS;
+        snprintf(response->message, sizeof(response->message),
+                "Transaction committed (%d writes)", req->num_writes);
+    } else if (result == -4) {
+        stats_add(&worker_stats->txn_conflicts, 1);
+        response->status = STATUS_TXN_CONFLICT;
+        snprintf(response->message, sizeof(response->message),
+                "Account %s changed since it was read, retry", failed);
+    } else if (result == -3) {
+        response->status = STATUS_INSUFFICIENT_FUNDS;
+        snprintf(response->message, sizeof(response->message), "Insufficient funds in account %s", failed);
+    } else if (result == -2) {
+        response->status = STATUS_ACCOUNT_NOT_FOUND;
+        snprintf(response->message, sizeof(response->message), "Account %s not found", failed);
+    } else {
+        response->status = STATUS_INVALID_AMOUNT;
+        snprintf(response->message, sizeof(response->message), "Invalid transaction amount");
+    }
 }
 
-// 替換原本的 verify_otp_remote
-int verify_otp_remote(const char *account, const char *otp) {
-    // 呼叫我們的自定義協定
-    return call_otp_service(OTP_OP_VERIFY, account, otp, NULL);
+static int unpack_timed(ClientConn *c, const BankingPacket *packet, void *req, size_t size) {
+    uint64_t t0 = timing_now();
+    int ret = unpack_request(packet, req, size);
+    c->timing.stage_ns[STAGE_UNPACK] += timing_now() - t0;
+    return ret;
 }
 
-// Process client request
-void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
+// Process client request (parks the connection instead of answering for remote OTP calls)
+void process_request(ClientConn *c, AccountDB *db, const BankingPacket *req_packet) {
+    ConnSession *sess = &c->sess;
     BankingResponse response;
     memset(&response, 0, sizeof(response));
     
     uint16_t opcode = ntohs(req_packet->header.op_code);
+    uint64_t seq_before = account_last_seq();
     
     switch (opcode) {
         case OP_CREATE_ACCOUNT: {
             CreateAccountRequest req;
-            if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
                 int result = account_create(db, req.account_id, req.initial_balance);
                 response.status = result;
                 response.balance = req.initial_balance;
@@ -146,7 +866,14 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
         
         case OP_DEPOSIT: {
             DepositRequest req;
-            if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.account_id[sizeof(req.account_id) - 1] = '\0';
+                if (!session_authorized(sess, req.account_id)) {
+                    response.status = STATUS_UNAUTHORIZED;
+                    snprintf(response.message, sizeof(response.message),
+                            "Login required for account %s", req.account_id);
+                    break;
+                }
                 double new_balance;
                 int result = account_deposit(db, req.account_id, req.amount, &new_balance);
                 response.status = result;
@@ -171,7 +898,14 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
         
         case OP_WITHDRAW: {
             WithdrawRequest req;
-            if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.account_id[sizeof(req.account_id) - 1] = '\0';
+                if (!session_authorized(sess, req.account_id)) {
+                    response.status = STATUS_UNAUTHORIZED;
+                    snprintf(response.message, sizeof(response.message),
+                            "Login required for account %s", req.account_id);
+                    break;
+                }
                 double new_balance;
                 int result = account_withdraw(db, req.account_id, req.amount, &new_balance);
                 response.status = result;
@@ -199,15 +933,19 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
         
         case OP_REQ_OTP: {
             OtpRequest req;
-            if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
-                char otp_code[10] = {0};
-                if (request_otp_generation(req.account_id, otp_code)) {
-                     response.status = STATUS_SUCCESS;
-                     // In a real system, OTP is sent via SMS. Here we return it for testing convenience
-                     snprintf(response.message, sizeof(response.message), "OTP Generated: %s", otp_code);
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.account_id[sizeof(req.account_id) - 1] = '\0';
+                if (config.otp_mode == OTP_MODE_TOTP) {
+                    char otp_code[10] = {0};
+                    fill_otp_generated(&response, totp_generate_local(req.account_id, otp_code), otp_code);
+                } else if (otp_client_submit(OTP_OP_GENERATE, req.account_id, NULL,
+                                             otp_generate_done, c) == 0) {
+                    memcpy(c->parked_account, req.account_id, ACCOUNT_ID_LEN);
+                    c->parked_ns = timing_now();
+                    c->state = CONN_PARKED;  // Answered by otp_generate_done()
                 } else {
-                     response.status = STATUS_ERROR;
-                     snprintf(response.message, sizeof(response.message), "OTP Generation Failed");
+                    // Circuit open or no connection: fail fast
+                    answer_otp_generate(&response, req.account_id, OTP_CALL_UNAVAILABLE, NULL);
                 }
             } else {
                 response.status = STATUS_ERROR;
@@ -218,13 +956,20 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
 
         case OP_LOGIN: {
             LoginRequest req;
-             if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
-                if (verify_otp_remote(req.account_id, req.otp)) {
-                    response.status = STATUS_SUCCESS;
-                    snprintf(response.message, sizeof(response.message), "Login Successful");
+             if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.account_id[sizeof(req.account_id) - 1] = '\0';
+                req.otp[sizeof(req.otp) - 1] = '\0';
+                if (config.otp_mode == OTP_MODE_TOTP) {
+                    fill_login_result(c, &response, req.account_id,
+                                      totp_verify_local(req.account_id, req.otp));
+                } else if (otp_client_submit(OTP_OP_VERIFY, req.account_id, req.otp,
+                                             otp_verify_done, c) == 0) {
+                    memcpy(c->parked_account, req.account_id, ACCOUNT_ID_LEN);
+                    memcpy(c->parked_otp, req.otp, sizeof(c->parked_otp));
+                    c->parked_ns = timing_now();
+                    c->state = CONN_PARKED;  // Answered by otp_verify_done()
                 } else {
-                    response.status = STATUS_ERROR;
-                    snprintf(response.message, sizeof(response.message), "Invalid OTP");
+                    answer_login(c, &response, req.account_id, req.otp, OTP_CALL_UNAVAILABLE);
                 }
             } else {
                 response.status = STATUS_ERROR;
@@ -233,23 +978,68 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
             break;
         }
 
-        case OP_BALANCE: {
-            BalanceRequest req;
-            if (unpack_request(req_packet, &req, sizeof(req)) == 0) {
-                double balance;
-                int result = account_get_balance(db, req.account_id, &balance);
-                response.status = result;
-                response.balance = balance;
-                
-                if (result == 0) {
+        case OP_RESUME_SESSION: {
+            SessionRequest req;
+            uint8_t token[SESSION_TOKEN_LEN];
+            char account_id[ACCOUNT_ID_LEN];
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.session_token[sizeof(req.session_token) - 1] = '\0';
+                // Any worker can resume: the table is in shared memory
+                if (session_token_from_hex(req.session_token, token) == 0 &&
+                    session_lookup(session_table, token, account_id) == 0) {
+                    memcpy(sess->token, token, SESSION_TOKEN_LEN);
+                    sess->bound = 1;
+                    response.status = STATUS_SUCCESS;
                     snprintf(response.message, sizeof(response.message),
-                            "Account %s balance: %.2f", req.account_id, balance);
-                } else if (result == -2) {
+                            "Session resumed for account %s", account_id);
+                } else {
+                    // Drop the old binding too: a connection shared by several
+                    // clients (bank_router) must not keep the previous one's session
+                    sess->bound = 0;
+                    response.status = STATUS_UNAUTHORIZED;
                     snprintf(response.message, sizeof(response.message),
-                            "Account %s not found", req.account_id);
+                            "Session invalid or expired");
+                }
+            } else {
+                response.status = STATUS_ERROR;
+                snprintf(response.message, sizeof(response.message), "Invalid request format");
+            }
+            break;
+        }
+
+        case OP_BALANCE: {
+            BalanceRequest req;
+            memset(&req, 0, sizeof(req));  // Older clients send no min_seq / snapshot_id
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                req.account_id[sizeof(req.account_id) - 1] = '\0';
+                if (req.snapshot_id != 0) {
+                    snapshot_read(db, req.account_id, req.snapshot_id, &response);
+                } else if (__atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) != REPL_ROLE_STANDBY) {
+                    answer_balance(db, req.account_id, &response);
+                } else if (req.min_seq == 0 || !replica_wait(c, req.account_id, req.min_seq)) {
+                    replica_read(req.account_id, &response);
+                }
+            } else {
+                response.status = STATUS_ERROR;
+                snprintf(response.message, sizeof(response.message), "Invalid request format");
+            }
+            break;
+        }
+        
+        case OP_SNAPSHOT_OPEN: {
+            SnapshotRequest req;
+            memset(&req, 0, sizeof(req));
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                uint64_t id, ts;
+                if (account_view_open(db, req.lease_ms, &id, &ts) == 0) {
+                    response.status = STATUS_SUCCESS;
+                    response.snapshot_id = id;
+                    response.snapshot_ts = ts;
+                    snprintf(response.message, sizeof(response.message), "Snapshot %lu opened at %lu", id, ts);
                 } else {
+                    response.status = STATUS_SERVER_BUSY;
                     snprintf(response.message, sizeof(response.message),
-                            "Query failed");
+                            "All %d snapshots in use, retry later", MVCC_MAX_SNAPSHOTS);
                 }
             } else {
                 response.status = STATUS_ERROR;
@@ -258,127 +1048,1275 @@ void process_request(SSL *ssl, AccountDB *db, const BankingPacket *req_packet) {
             break;
         }
         
+        case OP_SNAPSHOT_CLOSE: {
+            SnapshotRequest req;
+            memset(&req, 0, sizeof(req));
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                // Closing an expired snapshot is not an error: it is gone either way
+                account_view_close(db, req.snapshot_id);
+                response.status = STATUS_SUCCESS;
+                snprintf(response.message, sizeof(response.message), "Snapshot %lu closed", req.snapshot_id);
+            } else {
+                response.status = STATUS_ERROR;
+                snprintf(response.message, sizeof(response.message), "Invalid request format");
+            }
+            break;
+        }
+        
+        case OP_TRANSACTION: {
+            TxnRequest req;
+            memset(&req, 0, sizeof(req));
+            if (unpack_timed(c, req_packet, &req, sizeof(req)) == 0) {
+                run_transaction(sess, db, &req, &response);
+            } else {
+                response.status = STATUS_ERROR;
+                snprintf(response.message, sizeof(response.message), "Invalid request format");
+            }
+            break;
+        }
+        
         default:
             response.status = STATUS_ERROR;
             snprintf(response.message, sizeof(response.message), "Unknown operation");
             break;
     }
     
-    // Send response
-    BankingPacket resp_packet;
-    pack_response(&resp_packet, &response);
-    tls_write(ssl, &resp_packet, sizeof(BankingPacket));
+    if (c->state == CONN_PARKED) return;
+    uint64_t seq = account_last_seq();
+    if (seq != seq_before) {
+        response.commit_seq = seq;  // For read-your-writes on a read replica
+        if (sync_hold(c, &response, seq)) return;
+    }
+    conn_send(c, &response);
 }
 
-// Worker process main loop
-void worker_main(int worker_id, AccountDB *db) {
-    printf("[Worker %d] Started (PID: %d)\n", worker_id, getpid());
+// The accounts a request names (NUL-terminated copies): every payload from
+// OP_CREATE_ACCOUNT to OP_LOGIN starts with one, OP_TRANSACTION lists its
+// reads and writes. Entries past the payload the client sent are not counted
+static int request_accounts(const ClientConn *c, uint16_t opcode, char ids[][ACCOUNT_ID_LEN]) {
+    int n = 0;
+    if (opcode >= OP_CREATE_ACCOUNT && opcode <= OP_LOGIN) {
+        memcpy(ids[n], c->in.data, ACCOUNT_ID_LEN);
+        ids[n++][ACCOUNT_ID_LEN - 1] = '\0';
+    } else if (opcode == OP_TRANSACTION) {
+        const TxnRequest *txn = (const TxnRequest *)c->in.data;
+        size_t len = ntohl(c->in.header.length) - PROTOCOL_HEADER_SIZE;
+        for (int i = 0; i < TXN_MAX_READS + TXN_MAX_WRITES; i++) {
+            int read = i < TXN_MAX_READS;
+            int k = read ? i : i - TXN_MAX_READS;
+            if (k >= (read ? txn->num_reads : txn->num_writes)) continue;
+            const char *id = read ? txn->reads[k].account_id : txn->writes[k].account_id;
+            if ((size_t)(id - c->in.data) + ACCOUNT_ID_LEN > len) break;
+            memcpy(ids[n], id, ACCOUNT_ID_LEN);
+            ids[n++][ACCOUNT_ID_LEN - 1] = '\0';
+        }
+    }
+    return n;
+}
+
+// One token from every bucket this request is charged to (all workers share the buckets)
+static int request_allowed(ClientConn *c, uint16_t opcode) {
+    // Local clients have no address; the account buckets still apply
+    if (!c->local && !ratelimit_allow(rate_table, RL_CLIENT_IP, &c->peer_ip, sizeof(c->peer_ip))) return 0;
+    if (c->cert_cn[0] && !ratelimit_allow(rate_table, RL_CLIENT_CERT, c->cert_cn, strlen(c->cert_cn))) {
+        return 0;
+    }
     
-    // Worker signal handler for graceful shutdown
-    void worker_signal_handler(int signum) {
-        if (signum == SIGTERM) {
-            printf("[Worker %d] Received shutdown signal, exiting...\n", worker_id);
-            exit(0);
+    // A transaction is charged to every account it names
+    char ids[TXN_MAX_READS + TXN_MAX_WRITES][ACCOUNT_ID_LEN];
+    int n = request_accounts(c, opcode, ids);
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(ids[i]);
+        if (!ratelimit_allow(rate_table, RL_ACCOUNT, ids[i], len)) return 0;
+        if ((opcode == OP_REQ_OTP || opcode == OP_LOGIN) &&
+            !ratelimit_allow(rate_table, RL_ACCOUNT_OTP, ids[i], len)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// What to keep serving under overload: finish logins that are under way and
+// serve authenticated sessions; starting new work is shed first
+static RequestPriority request_priority(const ClientConn *c, uint16_t opcode) {
+    switch (opcode) {
+        case OP_LOGIN:
+        case OP_RESUME_SESSION:
+        case OP_SNAPSHOT_CLOSE:    // Lets writers reclaim old versions sooner
+            return PRIO_HIGH;
+        case OP_BALANCE:
+            return c->sess.bound ? PRIO_HIGH : PRIO_LOW;
+        case OP_DEPOSIT:
+        case OP_WITHDRAW:
+        case OP_TRANSACTION:
+            return c->sess.bound ? PRIO_NORMAL : PRIO_LOW;
+        default:
+            return PRIO_LOW;
+    }
+}
+
+// A deposit, withdrawal or transaction with an idempotency key runs once per
+// (session, key). Claims the key for this request, or answers a retry of it
+// here: return 1 if the request was answered
+static int idem_check(ClientConn *c) {
+    uint32_t key = ntohl(c->in.header.req_id);
+    if (key == 0 || !c->sess.bound) return 0;
+    if (c->req_op != OP_DEPOSIT && c->req_op != OP_WITHDRAW && c->req_op != OP_TRANSACTION) return 0;
+    
+    size_t len = ntohl(c->in.header.length) - PROTOCOL_HEADER_SIZE;
+    if (len > MAX_DATA_SIZE) len = MAX_DATA_SIZE;
+    BankingResponse response;
+    int evicted = 0;
+    switch (idem_begin(idem_cache, c->sess.token, key, idem_fingerprint(c->req_op, c->in.data, len),
+                       &response, &evicted)) {
+        case IDEM_NEW:
+            if (evicted) stats_add(&worker_stats->idem_evictions, 1);
+            c->idem_key = key;
+            return 0;
+        case IDEM_REPLAY:
+            stats_add(&worker_stats->idem_replays, 1);
+            break;
+        case IDEM_MISMATCH:
+            memset(&response, 0, sizeof(response));
+            response.status = STATUS_ERROR;
+            snprintf(response.message, sizeof(response.message),
+                     "Idempotency key %u was used for a different request", key);
+            break;
+        default:
+            // Nothing was done for this attempt, so a later one is safe
+            stats_add(&worker_stats->idem_in_progress, 1);
+            memset(&response, 0, sizeof(response));
+            response.status = STATUS_SERVER_BUSY;
+            snprintf(response.message, sizeof(response.message),
+                     "Request %u still in progress, retry later", key);
+            break;
+    }
+    conn_send(c, &response);
+    return 1;
+}
+
+static void conn_dispatch(ClientConn *c) {
+    c->req_op = ntohs(c->in.header.op_code);
+    c->req_start_us = now_us();
+    worker_inflight++;
+    conn_set_deadline(c, TIMEOUT_PHASES);  // Our turn now; parked requests have the OTP deadline
+    c->timing.opcode = c->req_op;
+    
+    // Verify checksum (a local request never crossed a wire)
+    uint64_t t0 = timing_now();
+    int bad_checksum = !c->local && verify_packet_checksum(&c->in) != 0;
+    c->timing.stage_ns[STAGE_CHECKSUM] = timing_now() - t0;
+    if (bad_checksum) {
+        log_write(LOG_LEVEL_WARN, "[Worker %d] Checksum verification failed\n", worker_index);
+        stats_add(&worker_stats->checksum_failures, 1);
+        BankingResponse error_resp;
+        memset(&error_resp, 0, sizeof(error_resp));
+        error_resp.status = STATUS_ERROR;
+        snprintf(error_resp.message, sizeof(error_resp.message),
+                "Checksum verification failed");
+        conn_send(c, &error_resp);
+        return;
+    }
+    
+    // Until promoted, a standby's accounts belong to the replication stream
+    // (a read replica still answers balance queries)
+    if (__atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) == REPL_ROLE_STANDBY &&
+        (config.read_staleness_ms <= 0 || c->req_op != OP_BALANCE)) {
+        BankingResponse standby;
+        memset(&standby, 0, sizeof(standby));
+        standby.status = STATUS_NOT_PRIMARY;
+        snprintf(standby.message, sizeof(standby.message), "Standby server, use the primary");
+        conn_send(c, &standby);
+        return;
+    }
+    
+    // Shedding is decided before any real work (and before spending rate-limit tokens)
+    if (!admission_admit(request_priority(c, c->req_op))) {
+        stats_add(&worker_stats->shed, 1);
+        BankingResponse busy;
+        memset(&busy, 0, sizeof(busy));
+        busy.status = STATUS_SERVER_BUSY;
+        snprintf(busy.message, sizeof(busy.message), "Server busy, retry later");
+        conn_send(c, &busy);
+        return;
+    }
+    
+    if (!request_allowed(c, c->req_op)) {
+        stats_add(&worker_stats->rate_limited, 1);
+        BankingResponse limited;
+        memset(&limited, 0, sizeof(limited));
+        limited.status = STATUS_RATE_LIMITED;
+        snprintf(limited.message, sizeof(limited.message), "Rate limit exceeded, retry later");
+        conn_send(c, &limited);
+        return;
+    }
+    
+    // Accounts migrated to another shard, or frozen for the cutover of one
+    // (a transaction is refused if any of its accounts is)
+    char ids[TXN_MAX_READS + TXN_MAX_WRITES][ACCOUNT_ID_LEN];
+    int num_ids = request_accounts(c, c->req_op, ids);
+    int account_op = num_ids > 0;
+    for (int i = 0; i < num_ids; i++) {
+        const char *moved_to = NULL;
+        if (migration_enter(migration, worker_index, ids[i], &moved_to)) {
+            migration_exit(migration, worker_index);
+            stats_add(&worker_stats->moved, 1);
+            BankingResponse moved;
+            memset(&moved, 0, sizeof(moved));
+            moved.status = STATUS_ACCOUNT_MOVED;
+            snprintf(moved.message, sizeof(moved.message), "Account %s moved to shard %s", ids[i], moved_to);
+            conn_send(c, &moved);
+            return;
+        }
+    }
+    
+    if (idem_check(c)) {
+        if (account_op) migration_exit(migration, worker_index);
+        return;
+    }
+    
+    // Process request; handler time excludes the stages measured inside it
+    uint64_t lock_before = account_lock_wait_ns();
+    t0 = timing_now();
+    process_request(c, worker_db, &c->in);
+    if (account_op) migration_exit(migration, worker_index);
+    uint64_t elapsed = timing_now() - t0;
+    uint64_t *stage = c->timing.stage_ns;
+    stage[STAGE_LOCK_WAIT] = account_lock_wait_ns() - lock_before;
+    uint64_t inner = stage[STAGE_UNPACK] + stage[STAGE_LOCK_WAIT] + stage[STAGE_PACK];
+    stage[STAGE_HANDLER] = elapsed > inner ? elapsed - inner : 0;
+}
+
+// Draining, at a request boundary: tell the client nothing more will be read.
+// Anything it sends from now on was not processed, so a retry elsewhere is safe.
+static void conn_go_away(ClientConn *c) {
+    BankingResponse notice;
+    memset(&notice, 0, sizeof(notice));
+    notice.status = STATUS_GOING_AWAY;
+    snprintf(notice.message, sizeof(notice.message), "Server shutting down, reconnect");
+    pack_request(&c->out, OP_GOAWAY, &notice, sizeof(notice));
+    c->out_pending = 1;
+    c->going_away = 1;
+    drain_goaways++;
+}
+
+// Local client: take requests off its ring until it is empty or one parks,
+// then announce the responses conn_send pushed. Draining closes the channel
+// at a request boundary, like OP_GOAWAY does for a TLS connection.
+static void local_drive(ClientConn *c) {
+    LocalRequest req;
+    while (1) {
+        if (c->out_pending) {
+            c->out_pending = 0;
+            if (c->timing.start_ns) timing_finish(&c->timing, timing_now());
+        }
+        if (c->state == CONN_PARKED) break;  // Resumed by the OTP callback / sync_release
+        if (draining) {
+            conn_close(c);
+            return;
+        }
+        
+        int r = local_server_pop(&c->ring, &req);
+        if (r < 0) {
+            log_write(LOG_LEVEL_WARN, "[Worker %d] Local client corrupted its channel\n", worker_index);
+            conn_close(c);
+            return;
         }
+        if (r == 0) {
+            if (local_server_sleep(&c->ring)) break;  // The request eventfd wakes us
+            continue;
+        }
+        
+        // Same packet as from the wire, so the handlers cannot tell the difference
+        c->timing.start_ns = timing_now();
+        c->local_id = req.id;
+        c->in.header.op_code = htons(req.op);
+        c->in.header.length = htonl(PROTOCOL_HEADER_SIZE + req.len);
+        c->in.header.req_id = htonl(req.key);
+        memcpy(c->in.data, req.data, req.len);
+        memset(c->in.data + req.len, 0, LOCAL_REQ_BYTES - req.len);
+        c->in.header.checksum = htons(calculate_checksum(c->in.data, req.len));
+        conn_dispatch(c);
+    }
+    local_server_notify(&c->ring);
+}
+
+// Advance a connection as far as its socket allows: handshake, then
+// alternate between flushing the response and reading the next request.
+static void conn_drive(ClientConn *c) {
+    TlsIoStatus st;
+    
+    if (c->local) {
+        local_drive(c);
+        return;
     }
     
-    signal(SIGTERM, worker_signal_handler);
+    if (c->state == CONN_HANDSHAKE) {
+        st = tls_handshake_step(c->ssl);
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+            conn_wait(c, st);
+            return;
+        }
+        if (st != TLS_IO_OK) {
+            log_write(LOG_LEVEL_WARN, "[Worker %d] TLS handshake failed\n", worker_index);
+            stats_add(&worker_stats->tls_handshake_failures, 1);
+            conn_close(c);
+            return;
+        }
+        log_write(LOG_LEVEL_INFO, "[Worker %d] TLS connection established (Cipher: %s)\n",
+                  worker_index, SSL_get_cipher(c->ssl));
+        stats_add(&worker_stats->tls_handshakes, 1);
+        if (tls_config.verify_peer) {
+            tls_peer_common_name(c->ssl, c->cert_cn, sizeof(c->cert_cn));
+        }
+        c->state = CONN_READY;
+    }
     
     while (1) {
-        // Accept connection (blocking, will be interrupted by master shutdown)
+        if (c->out_pending) {
+            // Retried with the same buffer until OpenSSL takes it
+            uint64_t t0 = timing_now();
+            st = tls_io_status(c->ssl, tls_write(c->ssl, &c->out, sizeof(BankingPacket)));
+            uint64_t t1 = timing_now();
+            c->timing.stage_ns[STAGE_WRITE] += t1 - t0;
+            if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+                conn_wait(c, st);
+                return;
+            }
+            if (st != TLS_IO_OK) {
+                conn_close(c);
+                return;
+            }
+            c->out_pending = 0;
+            if (c->timing.start_ns) timing_finish(&c->timing, t1);
+        }
+        
+        if (c->state == CONN_PARKED) {
+            conn_set_events(c, 0);  // Resumed by the OTP callback
+            return;
+        }
+        
+        if (c->going_away) {
+            conn_close(c);
+            return;
+        }
+        if (draining && c->in_len == 0) {
+            conn_go_away(c);  // A partly received request is finished first
+            continue;
+        }
+        
+        uint64_t t0 = timing_now();
+        int bytes = tls_read(c->ssl, (char *)&c->in + c->in_len, sizeof(BankingPacket) - c->in_len);
+        st = tls_io_status(c->ssl, bytes);
+        if (st == TLS_IO_OK) {
+            // Only reads that delivered bytes count; idle time between requests does not
+            if (c->timing.start_ns == 0) c->timing.start_ns = t0;
+            c->timing.stage_ns[STAGE_READ] += timing_now() - t0;
+        }
+        if (st == TLS_IO_WANT_READ || st == TLS_IO_WANT_WRITE) {
+            conn_wait(c, st);
+            return;
+        }
+        if (st != TLS_IO_OK) {
+            // Connection closed or error
+            conn_close(c);
+            return;
+        }
+        
+        c->in_len += bytes;
+        if (c->in_len == sizeof(BankingPacket)) {
+            c->in_len = 0;
+            conn_dispatch(c);
+        }
+    }
+}
+
+static void accept_clients(void) {
+    while (1) {
         struct sockaddr_in client_addr;
         socklen_t addr_len = sizeof(client_addr);
         
-        int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &addr_len);
+        int client_fd = accept4(server_fd, (struct sockaddr*)&client_addr, &addr_len, SOCK_NONBLOCK);
         if (client_fd < 0) {
-            if (errno == EINTR || errno == EBADF) {
-                // Server socket closed, time to exit
-                break;
-            }
-            continue;
+            if (errno == EINTR) continue;
+            return;  // EAGAIN: backlog drained (or another worker took it)
         }
         
         char client_ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("[Worker %d] Accepted connection from %s:%d\n",
-               worker_id, client_ip, ntohs(client_addr.sin_port));
+        log_write(LOG_LEVEL_INFO, "[Worker %d] Accepted connection from %s:%d\n",
+                  worker_index, client_ip, ntohs(client_addr.sin_port));
+        
+        // Pick up a rotated certificate before the next handshake;
+        // sessions already established keep using the old context.
+        if (reload_requested) {
+            char who[32];
+            snprintf(who, sizeof(who), "Worker %d", worker_index);
+            reload_tls_context(who);
+        }
         
-        // TLS Handshake
-        SSL *ssl = tls_accept_connection(ssl_ctx, client_fd);
+        ClientConn *c = calloc(1, sizeof(ClientConn));
+        SSL *ssl = c ? tls_accept_start(ssl_ctx, client_fd) : NULL;
         if (!ssl) {
-            printf("[Worker %d] TLS handshake failed\n", worker_id);
+            free(c);
             close(client_fd);
             continue;
         }
+        c->fd = client_fd;
+        c->ssl = ssl;
+        c->peer_ip = client_addr.sin_addr.s_addr;
+        c->state = CONN_HANDSHAKE;
+        c->events = EPOLLIN;
+        timer_node_init(&c->deadline);
+        c->deadline_phase = TIMEOUT_PHASES;
         
-        printf("[Worker %d] TLS connection established (Cipher: %s)\n",
-               worker_id, SSL_get_cipher(ssl));
-        
-        // Handle client requests
-        BankingPacket packet;
-        while (1) {
-            int bytes = tls_read(ssl, &packet, sizeof(BankingPacket));
-            
-            if (bytes <= 0) {
-                // Connection closed or error
-                break;
-            }
-            
-            if (bytes != sizeof(BankingPacket)) {
-                printf("[Worker %d] Invalid packet size: %d\n", worker_id, bytes);
-                break;
-            }
-            
-            // Verify checksum
-            if (verify_packet_checksum(&packet) != 0) {
-                printf("[Worker %d] Checksum verification failed\n", worker_id);
-                BankingResponse error_resp;
-                memset(&error_resp, 0, sizeof(error_resp));
-                error_resp.status = STATUS_ERROR;
-                snprintf(error_resp.message, sizeof(error_resp.message),
-                        "Checksum verification failed");
-                
-                BankingPacket error_packet;
-                pack_response(&error_packet, &error_resp);
-                tls_write(ssl, &error_packet, sizeof(BankingPacket));
-                continue;
-            }
-            
-            // Process request
-            process_request(ssl, db, &packet);
+        struct epoll_event ev = { .events = c->events, .data.ptr = c };
+        if (epoll_ctl(worker_epfd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            tls_close(ssl);
+            close(client_fd);
+            free(c);
+            continue;
         }
-        
-        printf("[Worker %d] Client disconnected\n", worker_id);
-        tls_close(ssl);
-        close(client_fd);
+        c->next_live = live_conns;
+        if (live_conns) live_conns->prev_live = c;
+        live_conns = c;
+        live_count++;
+        stats_add(&worker_stats->conns_accepted, 1);
+        conn_drive(c);  // The ClientHello may already be waiting
     }
-    
-    printf("[Worker %d] Shutting down\n", worker_id);
-    exit(0);
+}
+
+// Local clients: only processes of our own user (or root) get a channel;
+// the socket file is 0600 as well
+static void accept_local_clients(void) {
+    while (1) {
+        int fd = accept4(local_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        
+        struct ucred cred = { .pid = 0, .uid = (uid_t)-1 };
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+            (cred.uid != geteuid() && cred.uid != 0)) {
+            log_write(LOG_LEVEL_WARN, "[Worker %d] Local client refused (pid %d, uid %u)\n",
+                      worker_index, (int)cred.pid, (unsigned)cred.uid);
+            close(fd);
+            continue;
+        }
+        
+        ClientConn *c = calloc(1, sizeof(ClientConn));
+        if (!c || local_server_open(&c->ring, fd) != 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->local = 1;
+        c->state = CONN_READY;
+        c->events = EPOLLRDHUP;  // The socket only carries the hangup
+        timer_node_init(&c->deadline);
+        c->deadline_phase = TIMEOUT_PHASES;
+        
+        struct epoll_event ev = { .events = c->events, .data.ptr = c };
+        struct epoll_event kev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(worker_epfd, EPOLL_CTL_ADD, fd, &ev) < 0 ||
+            epoll_ctl(worker_epfd, EPOLL_CTL_ADD, c->ring.req_efd, &kev) < 0) {
+            epoll_ctl(worker_epfd, EPOLL_CTL_DEL, fd, NULL);
+            local_server_close(&c->ring);
+            close(fd);
+            free(c);
+            continue;
+        }
+        log_write(LOG_LEVEL_INFO, "[Worker %d] Local client connected (pid %d)\n", worker_index, (int)cred.pid);
+        c->next_live = live_conns;
+        if (live_conns) live_conns->prev_live = c;
+        live_conns = c;
+        live_count++;
+        stats_add(&worker_stats->conns_accepted, 1);
+        conn_drive(c);  // Announces that we wait for the first requests
+    }
+}
+
+// Deferred accept: an overloaded worker takes the listening socket out of its
+// epoll set (EPOLLEXCLUSIVE registrations cannot be modified, only re-added)
+static void listener_arm(int on) {
+    if (on == listener_armed) return;
+    if (on) {
+        // Listening socket is shared by all workers; EPOLLEXCLUSIVE wakes only one
+        struct epoll_event lev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (epoll_ctl(worker_epfd, EPOLL_CTL_ADD, server_fd, &lev) < 0) return;
+    } else {
+        epoll_ctl(worker_epfd, EPOLL_CTL_DEL, server_fd, NULL);
+    }
+    listener_armed = on;
+}
+
+static void worker_sigterm_handler(int signum) {
+    (void)signum;
+    drain_requested = 1;
+}
+
+// Stop accepting and push every connection towards its next request boundary,
+// where conn_drive sends OP_GOAWAY and closes it
+static void worker_start_drain(void) {
+    draining = 1;
+    drain_deadline_ms = now_us() / 1000 + config.drain_timeout_ms;
+    listener_arm(0);
+    close(server_fd);
+    server_fd = -1;
+    if (local_listen_fd >= 0) {
+        epoll_ctl(worker_epfd, EPOLL_CTL_DEL, local_listen_fd, NULL);
+        close(local_listen_fd);
+        local_listen_fd = -1;
+    }
+    log_write(LOG_LEVEL_WARN, "[Worker %d] Draining %d connections (deadline %d ms)\n",
+              worker_index, live_count, config.drain_timeout_ms);
+    
+    ClientConn *c = live_conns;
+    while (c) {
+        ClientConn *next = c->next_live;  // c may be closed below
+        if (c->state == CONN_HANDSHAKE) {
+            conn_close(c);  // No request can be under way yet
+        } else {
+            conn_drive(c);  // Idle: GOAWAY now; busy: after its response
+        }
+        c = next;
+    }
+}
+
+// epoll_wait timeouts, -1 = none
+static int min_timeout(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return a < b ? a : b;
+}
+
+// Worker process main loop
+void worker_main(int worker_id, AccountDB *db) {
+    printf("[Worker %d] Started (PID: %d)\n", worker_id, getpid());
+    
+    // SIGTERM from the master: drain, then leave the loop
+    signal(SIGTERM, worker_sigterm_handler);
+    
+    worker_index = worker_id;
+    worker_db = db;
+    worker_stats = &stats_table->workers[worker_id];
+    worker_epfd = epoll_create1(0);
+    if (worker_epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    
+    listener_arm(1);
+    if (!listener_armed) {
+        perror("epoll_ctl listen");
+        exit(EXIT_FAILURE);
+    }
+    if (local_listen_fd >= 0) {
+        // Trusted clients: never deferred under overload (their requests still are shed)
+        struct epoll_event lev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &local_listen_fd };
+        if (epoll_ctl(worker_epfd, EPOLL_CTL_ADD, local_listen_fd, &lev) < 0) {
+            perror("epoll_ctl local socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+    otp_client_init(worker_epfd, &config.otp_client);
+    timing_init(worker_id, config.slow_ms, config.slow_sample);
+    admission_init(worker_id, config.shed_delay_ms, config.shed_depth);
+    timer_wheel_init(&worker_deadlines, now_us() / 1000);
+    if (log_table) {
+        log_attach(&log_table->rings[worker_id], config.log_level, config.log_rate);
+    }
+    if (repl_listen_fd >= 0) {
+        close(repl_listen_fd);  // The sender's; we only journal
+        repl_log_attach(repl_log, repl_kick_fd);
+    }
+    if (config.repl_sync_ms > 0 || config.read_staleness_ms > 0) {
+        // Shared by all workers: a worker reading it would hide the event from
+        // the others, so nobody does and every write is an edge for each of them
+        struct epoll_event wev = { .events = EPOLLIN | EPOLLET, .data.ptr = &repl_wake_fd };
+        epoll_ctl(worker_epfd, EPOLL_CTL_ADD, repl_wake_fd, &wev);
+    }
+    
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        if (timing_dump_requested) {
+            timing_dump_requested = 0;
+            timing_dump();
+        }
+        
+        if (drain_requested && !draining) worker_start_drain();
+        if (draining) {
+            uint64_t now_ms = now_us() / 1000;
+            if (live_count == 0) break;
+            if (now_ms >= drain_deadline_ms) {
+                log_write(LOG_LEVEL_WARN, "[Worker %d] Drain deadline passed, closing %d connections\n",
+                          worker_index, live_count);
+                while (live_conns) conn_close(live_conns);
+                break;
+            }
+        }
+        
+        // Wake up for the next OTP call or connection deadline (or to re-evaluate
+        // the load level while shedding, or to enforce the drain deadline)
+        // even if nothing is readable
+        int timeout = min_timeout(otp_client_next_timeout(), admission_next_timeout());
+        timeout = min_timeout(timeout, (int)timer_wheel_next_timeout(&worker_deadlines));
+        if (draining) timeout = min_timeout(timeout, (int)(drain_deadline_ms - now_us() / 1000));
+        if (sync_head) {
+            uint64_t now_ms = now_us() / 1000;
+            int left = sync_head->sync_deadline_ms > now_ms ? (int)(sync_head->sync_deadline_ms - now_ms) : 0;
+            timeout = min_timeout(timeout, left);
+        }
+        
+        int n = epoll_wait(worker_epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;  // e.g. SIGHUP
+            perror("epoll_wait");
+            break;
+        }
+        uint64_t batch_start = timing_now();
+        int depth = n + worker_inflight;
+        
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == NULL) {
+                accept_clients();
+            } else if (ptr == &local_listen_fd) {
+                accept_local_clients();
+            } else if (ptr == &repl_wake_fd) {
+                // Held responses and waiting reads are released below
+            } else if (!otp_client_handle_event(ptr, events[i].events)) {
+                ClientConn *c = ptr;
+                if (c->fd < 0) continue;  // Closed earlier in this batch
+                if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                    conn_close(c);
+                } else {
+                    if (c->local) local_server_woken(&c->ring);  // Its request eventfd
+                    conn_drive(c);
+                }
+            }
+        }
+        
+        otp_client_tick();
+        timer_wheel_advance(&worker_deadlines, now_us() / 1000, conn_deadline_expired, NULL);
+        sync_release();
+        
+        // Time until the next epoll_wait is what newly ready connections queue for
+        uint64_t batch_end = timing_now();
+        LoadLevel load = admission_update(batch_end, batch_end - batch_start, depth);
+        if (!draining) listener_arm(load == LOAD_NORMAL);
+        stats_set(&worker_stats->load_level, load);
+        
+        while (closed_conns) {
+            ClientConn *c = closed_conns;
+            closed_conns = c->next_closed;
+            free(c);
+        }
+    }
+    
+    if (draining) {
+        log_write(LOG_LEVEL_WARN, "[Worker %d] Drained (%d GOAWAY sent), exiting\n", worker_id, drain_goaways);
+    } else {
+        printf("[Worker %d] Shutting down\n", worker_id);
+    }
+    stats_set(&worker_stats->load_level, LOAD_NORMAL);  // Slot stays idle until a later generation
+    otp_client_close_all();
+    exit(0);
+}
+
+// Log drainer process: formats the workers' rings and writes them to stdout
+static volatile sig_atomic_t drainer_stop = 0;
+
+static void drainer_signal_handler(int signum) {
+    (void)signum;
+    drainer_stop = 1;
+}
+
+static void drainer_main(LogTable *logs) {
+    signal(SIGTERM, drainer_signal_handler);
+    signal(SIGINT, SIG_IGN);   // Keep draining until the master has stopped the workers
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+    
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = LOG_DRAIN_IDLE_NS };
+    while (1) {
+        if (log_drain(logs, worker_slot_base, MAX_WORKERS, stdout) > 0) continue;
+        if (drainer_stop) break;  // Rings empty and workers gone
+        nanosleep(&idle, NULL);
+    }
+    exit(0);
+}
+
+// "RATE" or "RATE:BURST" (tokens per second, bucket size)
+static int parse_rate(const char *arg, RateLimit *limit) {
+    char *end;
+    long rate = strtol(arg, &end, 10);
+    long burst = rate;
+    if (*end == ':') burst = strtol(end + 1, &end, 10);
+    if (*end != '\0' || rate < 0 || burst < 0) return -1;
+    limit->rate = rate;
+    limit->burst = burst;
+    return 0;
+}
+
+// Non-blocking listening socket; workers accept from their epoll loops
+static int create_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    
+    // Set socket options
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    // Bind
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Bind failed");
+        close(fd);
+        return -1;
+    }
+    
+    // Listen
+    if (listen(fd, BACKLOG) < 0) {
+        perror("Listen failed");
+        close(fd);
+        return -1;
+    }
+    
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Local transport socket, mode 0600. A socket file left by a server that is
+// gone is replaced; one that still accepts is not.
+static int create_local_listener(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Local socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Local socket creation failed");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Local socket %s is in use by another server\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(path);
+    
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Local socket creation failed");
+        return -1;
+    }
+    mode_t old_mask = umask(0077);  // Never reachable by other users, not even briefly
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || listen(fd, BACKLOG) < 0) {
+        perror("Local socket bind failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Hot upgrade: the listening sockets travel as SCM_RIGHTS on a one-byte message
+// (listener first, then the stats, replication and local sockets the flags announce)
+static int send_listen_fds(int sock, char flags, const int *fds, int nfds) {
+    struct iovec iov = { .iov_base = &flags, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = CMSG_SPACE(nfds * sizeof(int))
+    };
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+// Returns the number of descriptors received (at most UPGRADE_MAX_FDS), -1 on error
+static int recv_listen_fds(int sock, char *flags, int *fds) {
+    struct iovec iov = { .iov_base = flags, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)
+    };
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1 || (msg.msg_flags & MSG_CTRUNC)) return -1;
+    
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) return -1;
+    int nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+    return nfds;
+}
+
+// Re-exec the binary at self_exe (normally a freshly deployed build) with our
+// arguments, hand it the listening sockets and wait until its workers are up.
+// Returns the new master's PID once it serves, -1 if this master keeps serving.
+static pid_t hot_upgrade(int stats_fd) {
+    // Our stats slots / log rings are only free for reuse once the previous
+    // generation has fully drained, i.e. once our old master has exited
+    if (upgrade_parent > 0 && getppid() == upgrade_parent) {
+        fprintf(stderr, "[Master] Previous master (PID %d) is still draining, upgrade refused\n",
+                upgrade_parent);
+        return -1;
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("[Master] Upgrade socketpair failed");
+        return -1;
+    }
+    
+    printf("[Master] Upgrading: starting %s\n", self_exe);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sv[0]);
+        fcntl(sv[1], F_SETFD, 0);  // The one descriptor that survives the exec
+        char fd_arg[16];
+        snprintf(fd_arg, sizeof(fd_arg), "%d", sv[1]);
+        exec_args[exec_argc] = "--upgrade-fd";
+        exec_args[exec_argc + 1] = fd_arg;
+        exec_args[exec_argc + 2] = NULL;
+        execv(self_exe, exec_args);
+        perror("[Master] exec of the new binary failed");
+        _exit(127);
+    }
+    close(sv[1]);
+    if (pid < 0) {
+        perror("[Master] Upgrade fork failed");
+        close(sv[0]);
+        return -1;
+    }
+    
+    // The new master answers one byte once its workers are running; EOF means
+    // it exited (bad binary, incompatible shared memory layout, ...)
+    int fds[UPGRADE_MAX_FDS] = { server_fd };
+    int nfds = 1;
+    char flags = 0;
+    if (stats_fd >= 0) {
+        fds[nfds++] = stats_fd;
+        flags |= UPGRADE_FD_STATS;
+    }
+    if (repl_listen_fd >= 0) {
+        fds[nfds++] = repl_listen_fd;
+        flags |= UPGRADE_FD_REPL;
+    }
+    if (local_listen_fd >= 0) {
+        fds[nfds++] = local_listen_fd;
+        flags |= UPGRADE_FD_LOCAL;
+    }
+    char ready = 0;
+    if (send_listen_fds(sv[0], flags, fds, nfds) == 0) {
+        struct pollfd pfd = { .fd = sv[0], .events = POLLIN };
+        uint64_t give_up = now_us() / 1000 + UPGRADE_READY_TIMEOUT_MS;
+        while (1) {
+            uint64_t now = now_us() / 1000;
+            if (now >= give_up) break;
+            int r = poll(&pfd, 1, (int)(give_up - now));
+            if (r < 0 && errno == EINTR) continue;  // e.g. SIGCHLD
+            if (r > 0 && read(sv[0], &ready, 1) != 1) ready = 0;
+            break;
+        }
+    }
+    close(sv[0]);
+    
+    if (ready != 'R') {
+        fprintf(stderr, "[Master] Upgrade failed, keeping the current binary\n");
+        kill(pid, SIGKILL);  // Still starting up after the timeout (no-op if it exited)
+        return -1;
+    }
+    printf("[Master] New master (PID %d) is serving\n", pid);
+    return pid;
+}
+
+// Sender on a primary with standbys to serve, receiver on a standby
+static pid_t repl_spawn(int stats_fd) {
+    int primary = __atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) == REPL_ROLE_PRIMARY;
+    if (primary && repl_listen_fd < 0) return -1;
+    
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(server_fd);
+        if (local_listen_fd >= 0) close(local_listen_fd);
+        if (stats_fd >= 0) close(stats_fd);
+        if (primary) {
+            repl_sender_main(repl_listen_fd, repl_kick_fd, repl_wake_fd, repl_db, repl_log, &stats_table->repl,
+                             migration);
+        }
+        if (repl_listen_fd >= 0) close(repl_listen_fd);
+        repl_receiver_main(standby_host, standby_port, config.read_staleness_ms > 0 ? repl_wake_fd : -1,
+                           repl_db, repl_log, &stats_table->repl);
+    } else if (pid < 0) {
+        perror("[Master] Fork replication process failed");
+    }
+    return pid;
+}
+
+// repl_pid and repl_exited change with SIGCHLD blocked, so the handler
+// never matches a pid against a stale value
+static void repl_start(int stats_fd) {
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    repl_exited = 0;
+    repl_pid = repl_spawn(stats_fd);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+static void repl_terminate(void) {
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    if (repl_pid > 0 && !repl_exited) {
+        kill(repl_pid, SIGTERM);
+        waitpid(repl_pid, NULL, 0);
+    }
+    repl_pid = -1;
+    repl_exited = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// SIGRTMIN: stop following the old primary and take writes. Sequence
+// numbers continue after the highest one applied, on a new timeline, so the
+// old primary (if it comes back as a standby) resyncs from our snapshot.
+static int promote(void) {
+    if (__atomic_load_n(&repl_log->role, __ATOMIC_RELAXED) != REPL_ROLE_STANDBY) return -1;
+    repl_terminate();
+    
+    uint64_t max_seq = account_max_seq(repl_db);
+    if (repl_log_head(repl_log) < max_seq) __atomic_store_n(&repl_log->head, max_seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&repl_log->timeline, repl_new_timeline(), __ATOMIC_RELAXED);
+    __atomic_store_n(&repl_log->role, REPL_ROLE_PRIMARY, __ATOMIC_RELEASE);
+    stats_set(&stats_table->repl.role, REPL_ROLE_PRIMARY);
+    stats_set(&stats_table->repl.connected, 0);
+    printf("[Master] Promoted to primary (log position %lu, timeline %016lx)\n",
+           repl_log_head(repl_log), repl_log->timeline);
+    
+    repl_start(stats_listen_fd);
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s <port> [verify_client (0=No, 1=Yes)] [options]\n", prog);
+    printf("  --otp-mode remote|totp   OTP microservice (default) or local TOTP\n");
+    printf("  --totp-skew N            Accept TOTP codes within +-N steps (default %d)\n", TOTP_DEFAULT_SKEW);
+    printf("  --totp-algo sha1|sha256  TOTP HMAC algorithm (default sha1)\n");
+    printf("  --otp-timeout MS         Deadline per OTP service call (default %d)\n", OTP_DEFAULT_TIMEOUT_MS);
+    printf("  --otp-breaker N          Open the circuit after N consecutive failures (default %d)\n",
+           OTP_DEFAULT_BREAKER_THRESHOLD);
+    printf("  --otp-cooldown MS        Time the circuit stays open before a probe (default %d)\n",
+           OTP_DEFAULT_BREAKER_COOLDOWN_MS);
+    printf("  --otp-fallback fail|totp When the OTP service is unavailable: reject (default) or use local TOTP\n");
+    printf("  --stats-port N           Prometheus stats on 127.0.0.1:N, 0 = off (default %d)\n",
+           DEFAULT_STATS_PORT);
+    printf("  --slow-ms MS             Log the stage breakdown of requests slower than MS (default off)\n");
+    printf("  --slow-sample N          Only log every Nth slow request (default 1)\n");
+    printf("  --log-level LEVEL        debug|info|warn|error (default info)\n");
+    printf("  --log-rate N             Max info/debug log entries per second per worker, 0 = no limit (default %d)\n",
+           LOG_DEFAULT_RATE);
+    printf("  --rate-ip R[:B]          Requests/s per client IP, burst B (default off)\n");
+    printf("  --rate-cert R[:B]        Requests/s per client certificate CN with mTLS (default off)\n");
+    printf("  --rate-account R[:B]     Requests/s per account (default off)\n");
+    printf("  --rate-otp R[:B]         OTP requests + logins/s per account (default off)\n");
+    printf("  --shed-delay MS          Shed load when a worker's queue delay stays above MS (default off)\n");
+    printf("  --shed-depth N           Shed load when a worker's queue depth stays above N (default off)\n");
+    printf("  --handshake-timeout MS   Close connections whose TLS handshake takes longer, 0 = none (default %d)\n",
+           DEFAULT_HANDSHAKE_TIMEOUT_MS);
+    printf("  --header-timeout MS      Max time from a request's first byte to its full header (default %d)\n",
+           DEFAULT_HEADER_TIMEOUT_MS);
+    printf("  --body-timeout MS        Max time from a request's header to the full packet (default %d)\n",
+           DEFAULT_BODY_TIMEOUT_MS);
+    printf("  --idle-timeout MS        Close connections idle between requests for longer (default %d)\n",
+           DEFAULT_IDLE_TIMEOUT_MS);
+    printf("  --drain-timeout MS       On shutdown, time allowed to finish in-flight requests (default %d)\n",
+           DEFAULT_DRAIN_TIMEOUT_MS);
+    printf("  --shm-key KEY            Shared memory key, to run a standby next to its primary (default 0x%x)\n",
+           SHM_KEY);
+    printf("  --repl-listen [ADDR:]PORT  Stream account changes to standbys (default address 127.0.0.1)\n");
+    printf("  --standby-of HOST:PORT   Start as a standby of that primary; kill -RTMIN <master pid> takes over\n");
+    printf("  --repl-sync MS           Hold mutation responses until a standby applied them, at most MS (default 0 = async)\n");
+    printf("  --read-replica MS        Standby: answer balance queries at most MS behind the primary (default 0 = refuse)\n");
+    printf("  --local-socket PATH      Serve clients of this host and user over shared-memory rings (UNIX socket)\n");
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s <port> [verify_client (0=No, 1=Yes)]\n", argv[0]);
+    static const struct option long_opts[] = {
+        {"otp-mode",  required_argument, NULL, 'm'},
+        {"totp-skew", required_argument, NULL, 's'},
+        {"totp-algo", required_argument, NULL, 'a'},
+        {"otp-timeout",  required_argument, NULL, 't'},
+        {"otp-breaker",  required_argument, NULL, 'b'},
+        {"otp-cooldown", required_argument, NULL, 'c'},
+        {"otp-fallback", required_argument, NULL, 'f'},
+        {"stats-port",   required_argument, NULL, 'p'},
+        {"slow-ms",      required_argument, NULL, 'S'},
+        {"slow-sample",  required_argument, NULL, 'N'},
+        {"log-level",    required_argument, NULL, 'l'},
+        {"log-rate",     required_argument, NULL, 'r'},
+        {"rate-ip",      required_argument, NULL, 'I'},
+        {"rate-cert",    required_argument, NULL, 'C'},
+        {"rate-account", required_argument, NULL, 'A'},
+        {"rate-otp",     required_argument, NULL, 'O'},
+        {"shed-delay",   required_argument, NULL, 'D'},
+        {"shed-depth",   required_argument, NULL, 'Q'},
+        {"handshake-timeout", required_argument, NULL, 'H'},
+        {"header-timeout",    required_argument, NULL, 'R'},
+        {"body-timeout",      required_argument, NULL, 'B'},
+        {"idle-timeout",      required_argument, NULL, 'i'},
+        {"drain-timeout",     required_argument, NULL, 'd'},
+        {"shm-key",           required_argument, NULL, 'k'},
+        {"repl-listen",       required_argument, NULL, 'L'},
+        {"standby-of",        required_argument, NULL, 'F'},
+        {"repl-sync",         required_argument, NULL, 'Y'},
+        {"read-replica",      required_argument, NULL, 'E'},
+        {"local-socket",      required_argument, NULL, 'u'},
+        {"upgrade-fd",        required_argument, NULL, 'U'},  // Internal: set by the old master
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    
+    // Keep the arguments for a hot upgrade (getopt_long reorders argv)
+    if (readlink("/proc/self/exe", self_exe, sizeof(self_exe) - 1) < 0) {
+        snprintf(self_exe, sizeof(self_exe), "%s", argv[0]);
+    }
+    exec_args = calloc(argc + 3, sizeof(char *));
+    if (!exec_args) {
+        perror("calloc");
         exit(EXIT_FAILURE);
     }
+    exec_args[exec_argc++] = argv[0];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--upgrade-fd") == 0) {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "--upgrade-fd=", 13) == 0) continue;
+        exec_args[exec_argc++] = argv[i];
+    }
+    
+    int upgrade_fd = -1;
+    const char *repl_listen_spec = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "h", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'm':
+                if (strcmp(optarg, "totp") == 0) {
+                    config.otp_mode = OTP_MODE_TOTP;
+                } else if (strcmp(optarg, "remote") == 0) {
+                    config.otp_mode = OTP_MODE_REMOTE;
+                } else {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                config.totp_skew = atoi(optarg);
+                if (config.totp_skew < 0) config.totp_skew = 0;
+                break;
+            case 'a':
+                config.totp_algo = (strcmp(optarg, "sha256") == 0) ? TOTP_SHA256 : TOTP_SHA1;
+                break;
+            case 't':
+                config.otp_client.timeout_ms = atoi(optarg);
+                if (config.otp_client.timeout_ms < 1) config.otp_client.timeout_ms = 1;
+                break;
+            case 'b':
+                config.otp_client.breaker_threshold = atoi(optarg);
+                if (config.otp_client.breaker_threshold < 1) config.otp_client.breaker_threshold = 1;
+                break;
+            case 'c':
+                config.otp_client.breaker_cooldown_ms = atoi(optarg);
+                if (config.otp_client.breaker_cooldown_ms < 0) config.otp_client.breaker_cooldown_ms = 0;
+                break;
+            case 'f':
+                if (strcmp(optarg, "totp") == 0) {
+                    config.otp_fallback = OTP_FALLBACK_TOTP;
+                } else if (strcmp(optarg, "fail") == 0) {
+                    config.otp_fallback = OTP_FALLBACK_FAIL;
+                } else {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                config.stats_port = atoi(optarg);
+                break;
+            case 'S':
+                config.slow_ms = atoi(optarg);
+                break;
+            case 'N':
+                config.slow_sample = atoi(optarg);
+                if (config.slow_sample < 1) config.slow_sample = 1;
+                break;
+            case 'l':
+                if (strcmp(optarg, "debug") == 0) {
+                    config.log_level = LOG_LEVEL_DEBUG;
+                } else if (strcmp(optarg, "info") == 0) {
+                    config.log_level = LOG_LEVEL_INFO;
+                } else if (strcmp(optarg, "warn") == 0) {
+                    config.log_level = LOG_LEVEL_WARN;
+                } else if (strcmp(optarg, "error") == 0) {
+                    config.log_level = LOG_LEVEL_ERROR;
+                } else {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                config.log_rate = atoi(optarg);
+                if (config.log_rate < 0) config.log_rate = 0;
+                break;
+            case 'I':
+            case 'C':
+            case 'A':
+            case 'O': {
+                RateClass cls = (c == 'I') ? RL_CLIENT_IP : (c == 'C') ? RL_CLIENT_CERT :
+                                (c == 'A') ? RL_ACCOUNT : RL_ACCOUNT_OTP;
+                if (parse_rate(optarg, &config.rate_limits[cls]) != 0) {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'D':
+                config.shed_delay_ms = atoi(optarg);
+                if (config.shed_delay_ms < 0) config.shed_delay_ms = 0;
+                break;
+            case 'Q':
+                config.shed_depth = atoi(optarg);
+                if (config.shed_depth < 0) config.shed_depth = 0;
+                break;
+            case 'd':
+                config.drain_timeout_ms = atoi(optarg);
+                if (config.drain_timeout_ms < 0) config.drain_timeout_ms = 0;
+                break;
+            case 'k': {
+                char *end;
+                long key = strtol(optarg, &end, 0);
+                if (*end != '\0' || key <= 0) {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                ipc_set_key((key_t)key);
+                break;
+            }
+            case 'L':
+                repl_listen_spec = optarg;
+                break;
+            case 'F':
+                if (repl_parse_target(optarg, standby_host, sizeof(standby_host), &standby_port) != 0) {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'Y':
+                config.repl_sync_ms = atoi(optarg);
+                if (config.repl_sync_ms < 0) config.repl_sync_ms = 0;
+                break;
+            case 'E':
+                config.read_staleness_ms = atoi(optarg);
+                if (config.read_staleness_ms < 0) config.read_staleness_ms = 0;
+                break;
+            case 'u':
+                local_socket_path = optarg;
+                break;
+            case 'U':
+                upgrade_fd = atoi(optarg);
+                break;
+            case 'H':
+            case 'R':
+            case 'B':
+            case 'i': {
+                TimeoutPhase phase = (c == 'H') ? TIMEOUT_HANDSHAKE : (c == 'R') ? TIMEOUT_HEADER :
+                                     (c == 'B') ? TIMEOUT_BODY : TIMEOUT_IDLE;
+                config.timeout_ms[phase] = atoi(optarg);
+                if (config.timeout_ms[phase] < 0) config.timeout_ms[phase] = 0;
+                break;
+            }
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
     
-    int port = atoi(argv[1]);
-    int verify_client = (argc >= 3) ? atoi(argv[2]) : 0;
+    // Positional arguments (getopt_long moves them to the end)
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    int port = atoi(argv[optind]);
+    int verify_client = (optind + 1 < argc) ? atoi(argv[optind + 1]) : 0;
     
     printf("=== Banking Server Starting ===\n");
     printf("Port: %d\n", port);
     printf("Workers: %d\n", MAX_WORKERS);
     printf("Client Verification: %s\n", verify_client ? "YES (mTLS)" : "NO");
+    if (config.otp_mode == OTP_MODE_TOTP) {
+        printf("OTP Mode: local TOTP (%s, skew +-%d steps)\n",
+               config.totp_algo == TOTP_SHA256 ? "HMAC-SHA256" : "HMAC-SHA1", config.totp_skew);
+    } else {
+        printf("OTP Mode: remote (%s:%d, timeout %d ms, breaker %d failures / %d ms, fallback %s)\n",
+               OTP_IP, OTP_PORT, config.otp_client.timeout_ms, config.otp_client.breaker_threshold,
+               config.otp_client.breaker_cooldown_ms,
+               config.otp_fallback == OTP_FALLBACK_TOTP ? "totp" : "fail");
+    }
+    if (config.shed_delay_ms > 0) {
+        printf("Load Shedding: when a worker's queue delay stays above %d ms\n", config.shed_delay_ms);
+    }
+    if (config.shed_depth > 0) {
+        printf("Load Shedding: when a worker's queue depth stays above %d\n", config.shed_depth);
+    }
     
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     signal(SIGCHLD, sigchld_handler);
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGHUP, sighup_handler);
+    signal(SIGUSR1, sigusr1_handler);
+    signal(SIGUSR2, sigusr2_handler);
+    signal(SIGRTMIN, sigpromote_handler);
     
-    // Initialize TLS
-    TLSConfig tls_config = {
+    // Initialize TLS (config kept global so SIGHUP can rebuild the context)
+    tls_config = (TLSConfig){
         .ca_cert_path = DEFAULT_CA_CERT,
         .server_cert_path = DEFAULT_SERVER_CERT,
         .server_key_path = DEFAULT_SERVER_KEY,
@@ -392,54 +2330,149 @@ int main(int argc, char **argv) {
     }
     printf("[Master] TLS context initialized\n");
     
-    // Initialize Shared Memory (IPC)
+    // Hot upgrade: the old master sends its listening sockets first; any failure
+    // from here to the ready byte makes it keep serving
+    int inherited_fds[UPGRADE_MAX_FDS] = { -1, -1, -1, -1 };
+    int inherited_stats = -1, inherited_repl = -1, inherited_local = -1;
+    if (upgrade_fd >= 0) {
+        char flags = 0;
+        int n = recv_listen_fds(upgrade_fd, &flags, inherited_fds);
+        int next = 1;
+        if ((flags & UPGRADE_FD_STATS) && next < n) inherited_stats = inherited_fds[next++];
+        if ((flags & UPGRADE_FD_REPL) && next < n) inherited_repl = inherited_fds[next++];
+        if ((flags & UPGRADE_FD_LOCAL) && next < n) inherited_local = inherited_fds[next++];
+        if (n < 1) {
+            fprintf(stderr, "[Master] No listening socket received from the old master\n");
+            tls_cleanup_context(ssl_ctx);
+            exit(EXIT_FAILURE);
+        }
+        upgrade_parent = getppid();
+    }
+    
+    // Initialize Shared Memory (IPC); an upgrade takes over the old master's
+    // segment so accounts, sessions and rate-limit buckets carry across
     IPCContext ipc_ctx;
-    if (ipc_init_server(&ipc_ctx) != 0) {
+    if ((upgrade_fd >= 0 ? ipc_attach_server(&ipc_ctx) : ipc_init_server(&ipc_ctx)) != 0) {
         fprintf(stderr, "Failed to create shared memory\n");
         tls_cleanup_context(ssl_ctx);
         exit(EXIT_FAILURE);
     }
     AccountDB *db = ipc_get_db(&ipc_ctx);
+    session_table = ipc_get_sessions(&ipc_ctx);
+    stats_table = ipc_get_stats(&ipc_ctx);
+    if (upgrade_fd >= 0) ipc_ctx.seg->generation++;
+    worker_slot_base = (ipc_ctx.seg->generation % WORKER_GENERATIONS) * MAX_WORKERS;
+    if (stats_table->num_workers < (uint32_t)(worker_slot_base + MAX_WORKERS)) {
+        stats_table->num_workers = worker_slot_base + MAX_WORKERS;  // For bankstat and /metrics
+    }
+    rate_table = ipc_get_ratelimits(&ipc_ctx);
+    repl_db = db;
+    repl_log = ipc_get_repl(&ipc_ctx);
+    migration = ipc_get_migration(&ipc_ctx);
+    idem_cache = ipc_get_idempotency(&ipc_ctx);
+    if (upgrade_fd < 0 && standby_port > 0) repl_log->role = REPL_ROLE_STANDBY;  // An upgrade keeps the role
+    stats_set(&stats_table->repl.role, repl_log->role);
+    static const char *rate_names[RL_CLASSES] = { "client IP", "client cert", "account", "account OTP" };
+    for (int i = 0; i < RL_CLASSES; i++) {
+        ratelimit_configure(rate_table, i, config.rate_limits[i].rate, config.rate_limits[i].burst);
+        if (ratelimit_enabled(rate_table, i)) {
+            printf("[Master] Rate limit per %s: %u/s, burst %u\n",
+                   rate_names[i], rate_table->limits[i].rate, rate_table->limits[i].burst);
+        }
+    }
     printf("[Master] Shared memory initialized (Size: %lu bytes)\n", sizeof(AccountDB));
     
-    // Create TCP Socket
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("Socket creation failed");
-        ipc_cleanup(&ipc_ctx, 1);
-        tls_cleanup_context(ssl_ctx);
-        exit(EXIT_FAILURE);
+    if (upgrade_fd >= 0) {
+        // Already bound, listening and non-blocking: the backlog kept filling meanwhile
+        server_fd = inherited_fds[0];
+        printf("[Master] Took over port %d from PID %d (generation %u)\n",
+               port, upgrade_parent, ipc_ctx.seg->generation);
+    } else {
+        server_fd = create_listener(port);
+        if (server_fd < 0) {
+            ipc_cleanup(&ipc_ctx, 1);
+            tls_cleanup_context(ssl_ctx);
+            exit(EXIT_FAILURE);
+        }
+        printf("[Master] Listening on port %d\n", port);
     }
     
-    // Set socket options
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Stats endpoint is master-only (not inherited into the workers' epoll sets)
+    int stats_fd = -1;
+    if (config.stats_port > 0) {
+        stats_fd = (inherited_stats >= 0) ? inherited_stats : stats_server_listen(config.stats_port);
+        if (stats_fd >= 0) {
+            printf("[Master] Stats on http://127.0.0.1:%d/metrics\n", config.stats_port);
+        }
+    } else if (inherited_stats >= 0) {
+        close(inherited_stats);
+    }
+    stats_listen_fd = stats_fd;
     
-    // Bind
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+    // Replication: workers journal and the sender streams only with --repl-listen
+    // (a standby keeps the socket for when it is promoted)
+    if (repl_listen_spec) {
+        repl_listen_fd = (inherited_repl >= 0) ? inherited_repl : repl_listen(repl_listen_spec);
+        if (repl_listen_fd < 0) {
+            if (stats_fd >= 0) close(stats_fd);
+            close(server_fd);
+            ipc_cleanup(&ipc_ctx, upgrade_fd < 0);
+            tls_cleanup_context(ssl_ctx);
+            exit(EXIT_FAILURE);
+        }
+        printf("[Master] Replication stream on %s\n", repl_listen_spec);
+    } else if (inherited_repl >= 0) {
+        close(inherited_repl);
+    }
     
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("Bind failed");
-        close(server_fd);
-        ipc_cleanup(&ipc_ctx, 1);
-        tls_cleanup_context(ssl_ctx);
+    // Local transport: the workers accept and each serves its clients' rings
+    if (local_socket_path) {
+        local_listen_fd = (inherited_local >= 0) ? inherited_local : create_local_listener(local_socket_path);
+        if (local_listen_fd < 0) {
+            if (repl_listen_fd >= 0) close(repl_listen_fd);
+            if (stats_fd >= 0) close(stats_fd);
+            close(server_fd);
+            ipc_cleanup(&ipc_ctx, upgrade_fd < 0);
+            tls_cleanup_context(ssl_ctx);
+            exit(EXIT_FAILURE);
+        }
+        printf("[Master] Local clients (uid %d or root) on %s\n", (int)geteuid(), local_socket_path);
+    } else if (inherited_local >= 0) {
+        close(inherited_local);
+    }
+    repl_kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    repl_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (repl_kick_fd < 0 || repl_wake_fd < 0) {
+        perror("eventfd");
         exit(EXIT_FAILURE);
     }
+    if (repl_log->role == REPL_ROLE_STANDBY && config.read_staleness_ms > 0) {
+        printf("[Master] Read replica of %s:%d, serving balances at most %d ms stale\n",
+               standby_host, standby_port, config.read_staleness_ms);
+    } else if (repl_log->role == REPL_ROLE_STANDBY) {
+        printf("[Master] Standby of %s:%d, client requests are refused until promoted\n",
+               standby_host, standby_port);
+    } else if (config.repl_sync_ms > 0) {
+        printf("[Master] Synchronous replication: mutations wait up to %d ms for a standby\n",
+               config.repl_sync_ms);
+    }
     
-    // Listen
-    if (listen(server_fd, BACKLOG) < 0) {
-        perror("Listen failed");
+    // Fork the log drainer before the workers so it is there to empty their rings
+    fflush(stdout);
+    drainer_pid = fork();
+    if (drainer_pid == 0) {
+        if (stats_fd >= 0) close(stats_fd);
+        if (upgrade_fd >= 0) close(upgrade_fd);
+        if (repl_listen_fd >= 0) close(repl_listen_fd);
+        if (local_listen_fd >= 0) close(local_listen_fd);
         close(server_fd);
-        ipc_cleanup(&ipc_ctx, 1);
-        tls_cleanup_context(ssl_ctx);
-        exit(EXIT_FAILURE);
+        drainer_main(ipc_get_logs(&ipc_ctx));
+    } else if (drainer_pid > 0) {
+        log_table = ipc_get_logs(&ipc_ctx);
+    } else {
+        perror("Fork log drainer failed, workers will log directly");
     }
     
-    printf("[Master] Listening on port %d\n", port);
-    
     // Fork worker processes
     for (int i = 0; i < MAX_WORKERS; i++) {
         pid_t pid = fork();
@@ -449,7 +2482,9 @@ int main(int argc, char **argv) {
             continue;
         } else if (pid == 0) {
             // Child process (Worker)
-            worker_main(i, db);
+            if (stats_fd >= 0) close(stats_fd);
+            if (upgrade_fd >= 0) close(upgrade_fd);
+            worker_main(worker_slot_base + i, db);
             // Should never reach here
             exit(0);
         } else {
@@ -458,37 +2493,142 @@ int main(int argc, char **argv) {
         }
     }
     
+    repl_start(stats_fd);
+    
     printf("[Master] All workers spawned, ready to accept connections\n");
-    printf("[Master] Press Ctrl+C to shutdown gracefully\n");
+    printf("[Master] Press Ctrl+C to shutdown gracefully, kill -HUP %d to reload certificates,\n"
+           "         kill -USR1 %d to print per-stage timing, kill -USR2 %d to upgrade the binary\n",
+           getpid(), getpid(), getpid());
+    if (repl_log->role == REPL_ROLE_STANDBY) {
+        printf("[Master] kill -RTMIN %d to promote this standby\n", getpid());
+    }
     
-    // Master waits for shutdown signal
+    // Workers are up: the old master stops accepting and drains its own
+    if (upgrade_fd >= 0) {
+        char ready = 'R';
+        if (write(upgrade_fd, &ready, 1) != 1) perror("[Master] Upgrade ready notification failed");
+        close(upgrade_fd);
+    }
+    pid_t successor = -1;
+    
+    // Master waits for shutdown signal, answering stats scrapes meanwhile
+    struct pollfd pfd = { .fd = stats_fd, .events = POLLIN };
     while (keep_running) {
-        pause();  // Wait for signal
+        // poll() is not restarted by SA_RESTART, so signals still wake us (fd -1 is ignored)
+        if (poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN)) {
+            stats_server_handle(stats_fd, stats_table, stats_table->num_workers);
+        }
+        
+        // The SIGCHLD handler reaps it; a replication process that died is started again
+        if (repl_exited && keep_running) {
+            fprintf(stderr, "[Master] Replication process exited, restarting it\n");
+            repl_start(stats_fd);
+        }
+        
+        if (promote_requested && keep_running) {
+            promote_requested = 0;
+            if (promote() != 0) {
+                fprintf(stderr, "[Master] Promote requested but this server is not a standby\n");
+            }
+        }
+        
+        if (reload_requested && keep_running) {
+            // Validate the new files in the master first so a bad rotation
+            // never reaches the workers, then fan the reload out.
+            if (reload_tls_context("Master") == 0) {
+                for (int i = 0; i < MAX_WORKERS; i++) {
+                    if (worker_pids[i] > 0) {
+                        kill(worker_pids[i], SIGHUP);
+                    }
+                }
+            }
+        }
+        
+        if (timing_dump_requested && keep_running) {
+            timing_dump_requested = 0;
+            for (int i = 0; i < MAX_WORKERS; i++) {
+                if (worker_pids[i] > 0) {
+                    kill(worker_pids[i], SIGUSR1);
+                }
+            }
+        }
+        
+        if (upgrade_requested && keep_running) {
+            upgrade_requested = 0;
+            successor = hot_upgrade(stats_fd);
+            if (successor > 0) {
+                keep_running = 0;  // Drain below, the new master keeps the sockets
+                repl_terminate();  // and runs its own replication process
+            }
+        }
     }
     
-    // Graceful shutdown
-    printf("\n[Master] Shutting down workers...\n");
+    // Graceful shutdown: stop listening (the workers close their copies when
+    // they start draining), then let the workers finish what is in flight.
+    // After a hot upgrade the new master still holds the listening socket, so
+    // clients told to go away reconnect straight to its workers.
+    printf("\n[Master] Draining workers (up to %d ms)...\n", config.drain_timeout_ms);
+    close(server_fd);
+    server_fd = -1;
+    if (local_listen_fd >= 0) {
+        close(local_listen_fd);
+        local_listen_fd = -1;
+        if (successor < 0) unlink(local_socket_path);  // Otherwise the new master serves it
+    }
+    signal(SIGCHLD, SIG_DFL);  // Reap the workers here, not in the handler
     for (int i = 0; i < MAX_WORKERS; i++) {
         if (worker_pids[i] > 0) {
             kill(worker_pids[i], SIGTERM);
         }
     }
     
-    // Wait for all workers to terminate
-    for (int i = 0; i < MAX_WORKERS; i++) {
-        if (worker_pids[i] > 0) {
-            waitpid(worker_pids[i], NULL, 0);
-            printf("[Master] Worker %d terminated\n", i);
+    // Wait for all workers to terminate; one stuck past its drain deadline is killed
+    uint64_t kill_at = now_us() / 1000 + config.drain_timeout_ms + DRAIN_KILL_GRACE_MS;
+    int remaining = MAX_WORKERS;
+    while (remaining > 0) {
+        remaining = 0;
+        for (int i = 0; i < MAX_WORKERS; i++) {
+            if (worker_pids[i] <= 0) continue;
+            pid_t r = waitpid(worker_pids[i], NULL, WNOHANG);
+            if (r == worker_pids[i] || (r < 0 && errno == ECHILD)) {
+                printf("[Master] Worker %d terminated\n", worker_slot_base + i);
+                worker_pids[i] = 0;
+            } else if (now_us() / 1000 >= kill_at) {
+                printf("[Master] Worker %d did not drain in time, killing it\n", worker_slot_base + i);
+                kill(worker_pids[i], SIGKILL);
+                remaining++;
+            } else {
+                remaining++;
+            }
         }
+        if (remaining > 0) usleep(10000);
+    }
+    
+    // Workers are gone (their last changes streamed): stop replicating,
+    // then let the drainer empty the rings and exit
+    repl_terminate();
+    if (drainer_pid > 0) {
+        kill(drainer_pid, SIGTERM);
+        waitpid(drainer_pid, NULL, 0);
     }
     
     // Cleanup
     if (server_fd >= 0) {
         close(server_fd);
     }
-    ipc_cleanup(&ipc_ctx, 1);
+    if (stats_fd >= 0) {
+        close(stats_fd);
+    }
+    if (repl_listen_fd >= 0) {
+        close(repl_listen_fd);
+    }
+    ipc_cleanup(&ipc_ctx, successor < 0);  // The new master owns the segment now
     tls_cleanup_context(ssl_ctx);
     
-    printf("[Master] Shutdown complete\n");
+    if (successor > 0) {
+        printf("[Master] Handed over to PID %d, exiting\n", successor);
+    } else {
+        printf("[Master] Shutdown complete\n");
+    }
     return 0;
 }
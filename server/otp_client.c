@@ -0,0 +1,409 @@
+/*
+ * otp_client.c
+ * Persistent, non-blocking OTP service connection pool (per worker process)
+ *
+ * otp_client_init() runs in the worker after fork(), so the pool always
+ * belongs to one worker and is never shared across processes. Requests
+ * are queued on a pool connection and answered through the worker's
+ * epoll loop; outstanding calls are indexed by req_id and carry a
+ * deadline on a millisecond timer wheel.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../common/include/otp_ipc.h"
+#include "../common/include/timer_wheel.h"
+#include "../common/include/log_ring.h"
+#include "otp_client.h"
+
+typedef struct {
+    int fd;
+    int connecting;            // Non-blocking connect still in progress
+    uint32_t events;           // Currently registered epoll events
+    size_t out_len;
+    char out_buf[sizeof(OtpIpcRequest) * OTP_MAX_PENDING];
+    size_t in_len;
+    char in_buf[sizeof(OtpIpcResponse)];
+} OtpConn;
+
+typedef struct {
+    TimerNode timer;           // Call deadline
+    uint32_t req_id;           // 0 = free
+    int slot;                  // Pool connection carrying the request
+    int attempts;              // Sends left (generate may be resent)
+    OtpIpcRequest req;
+    OtpCallback cb;            // NULL once cancelled
+    void *arg;
+} OtpPending;
+
+typedef enum {
+    BREAKER_CLOSED,            // Calls go through
+    BREAKER_OPEN,              // Fail fast until open_until
+    BREAKER_HALF_OPEN          // One probe call in flight
+} BreakerState;
+
+static OtpConn pool[OTP_POOL_SIZE];
+static OtpPending pending[OTP_MAX_PENDING];
+static OtpClientConfig cfg;
+static TimerWheel deadlines;   // Millisecond ticks
+static int epoll_fd = -1;
+static int next_conn = 0;
+static uint32_t next_req_id = 0;
+
+static struct {
+    BreakerState state;
+    int failures;              // Consecutive
+    uint64_t open_until;       // ms
+} breaker;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void otp_client_init(int epfd, const OtpClientConfig *config) {
+    epoll_fd = epfd;
+    cfg = *config;
+    for (int i = 0; i < OTP_POOL_SIZE; i++) {
+        pool[i].fd = -1;
+    }
+    memset(pending, 0, sizeof(pending));
+    timer_wheel_init(&deadlines, now_ms());
+    breaker.state = BREAKER_CLOSED;
+    breaker.failures = 0;
+    next_req_id = (uint32_t)getpid() << 16;  // Distinct id range per worker
+}
+
+// May a call go out now? Moves OPEN -> HALF_OPEN once the cooldown is over.
+static int breaker_allow(void) {
+    if (breaker.state == BREAKER_CLOSED) return 1;
+    if (breaker.state == BREAKER_OPEN && now_ms() >= breaker.open_until) {
+        breaker.state = BREAKER_HALF_OPEN;  // This call is the probe
+        return 1;
+    }
+    return 0;
+}
+
+static void breaker_success(void) {
+    if (breaker.state != BREAKER_CLOSED) {
+        log_write(LOG_LEVEL_WARN, "[OTP Client %d] Circuit closed, OTP service recovered\n", getpid());
+    }
+    breaker.state = BREAKER_CLOSED;
+    breaker.failures = 0;
+}
+
+static void breaker_failure(void) {
+    breaker.failures++;
+    if (breaker.state == BREAKER_HALF_OPEN ||
+        (breaker.state == BREAKER_CLOSED && breaker.failures >= cfg.breaker_threshold)) {
+        if (breaker.state == BREAKER_CLOSED) {
+            log_write(LOG_LEVEL_WARN, "[OTP Client %d] Circuit open after %d failures, retry in %d ms\n",
+                      getpid(), breaker.failures, cfg.breaker_cooldown_ms);
+        }
+        breaker.state = BREAKER_OPEN;
+        breaker.open_until = now_ms() + cfg.breaker_cooldown_ms;
+    }
+}
+
+static int otp_connect(int *connecting) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(OTP_PORT);
+    inet_pton(AF_INET, OTP_IP, &serv_addr.sin_addr);
+
+    *connecting = 0;
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            perror("Cannot connect to OTP Server");
+            close(sock);
+            return -1;
+        }
+        *connecting = 1;
+    }
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+static void conn_update_events(OtpConn *c) {
+    uint32_t want = EPOLLIN | ((c->connecting || c->out_len > 0) ? EPOLLOUT : 0);
+    if (want == c->events) return;
+
+    struct epoll_event ev = { .events = want, .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+static int conn_open(int slot) {
+    OtpConn *c = &pool[slot];
+    c->fd = otp_connect(&c->connecting);
+    if (c->fd < 0) return -1;
+
+    c->in_len = 0;
+    c->out_len = 0;
+    c->events = EPOLLIN | (c->connecting ? EPOLLOUT : 0);
+
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Write as much queued output as the socket takes
+static int conn_flush(OtpConn *c) {
+    if (c->connecting) return 0;
+
+    size_t off = 0;
+    while (off < c->out_len) {
+        ssize_t n = send(c->fd, c->out_buf + off, c->out_len - off, MSG_NOSIGNAL);
+        if (n > 0) {
+            off += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    memmove(c->out_buf, c->out_buf + off, c->out_len - off);
+    c->out_len -= off;
+    conn_update_events(c);
+    return 0;
+}
+
+// Get a usable connection from the pool, reopening closed ones
+static int conn_acquire(void) {
+    for (int i = 0; i < OTP_POOL_SIZE; i++) {
+        int slot = next_conn;
+        next_conn = (next_conn + 1) % OTP_POOL_SIZE;
+
+        if (pool[slot].fd >= 0 || conn_open(slot) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static OtpPending *pending_alloc(void) {
+    for (int i = 0; i < OTP_MAX_PENDING; i++) {
+        uint32_t id = ++next_req_id;
+        if (id == 0) id = ++next_req_id;
+
+        OtpPending *p = &pending[id & (OTP_MAX_PENDING - 1)];
+        if (p->req_id == 0) {
+            p->req_id = id;
+            return p;
+        }
+    }
+    return NULL;  // Too many calls outstanding
+}
+
+// Queue the request on a pool connection. A write error here is picked
+// up by the event loop (EPOLLERR/EPOLLHUP), which fails or resends it.
+static int send_pending(OtpPending *p) {
+    int slot = conn_acquire();
+    if (slot < 0) return -1;
+
+    OtpConn *c = &pool[slot];
+    if (c->out_len + sizeof(p->req) > sizeof(c->out_buf)) return -1;
+
+    p->req.req_id = p->req_id;
+    memcpy(c->out_buf + c->out_len, &p->req, sizeof(p->req));
+    c->out_len += sizeof(p->req);
+    p->slot = slot;
+    p->attempts--;
+
+    conn_flush(c);
+    return 0;
+}
+
+static void pending_finish(OtpPending *p, int status, const char *otp_code) {
+    OtpCallback cb = p->cb;
+    void *arg = p->arg;
+    timer_wheel_del(&deadlines, &p->timer);
+    p->req_id = 0;  // Free before the callback, which may submit again
+
+    if (status == OTP_CALL_UNAVAILABLE) {
+        breaker_failure();
+    } else {
+        breaker_success();
+    }
+    if (cb) cb(arg, status, otp_code);
+}
+
+// Connection broke: resend what may be resent, fail the rest
+static void conn_fail(int slot) {
+    OtpConn *c = &pool[slot];
+    if (c->fd < 0) return;
+    close(c->fd);  // Also removes it from the epoll set
+    c->fd = -1;
+    c->connecting = 0;
+    c->in_len = 0;
+    c->out_len = 0;
+
+    // Snapshot the ids first: callbacks may allocate new entries
+    uint32_t ids[OTP_MAX_PENDING];
+    int n = 0;
+    for (int i = 0; i < OTP_MAX_PENDING; i++) {
+        if (pending[i].req_id != 0 && pending[i].slot == slot) {
+            ids[n++] = pending[i].req_id;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        OtpPending *p = &pending[ids[i] & (OTP_MAX_PENDING - 1)];
+        if (p->req_id != ids[i]) continue;
+        // Generate is safe to resend; a verify may already have consumed
+        // the code, so it only gets one attempt.
+        if (p->attempts > 0 && p->cb && send_pending(p) == 0) continue;
+        pending_finish(p, OTP_CALL_UNAVAILABLE, NULL);
+    }
+}
+
+static void deliver(const OtpIpcResponse *res) {
+    OtpPending *p = &pending[res->req_id & (OTP_MAX_PENDING - 1)];
+    if (p->req_id == 0 || p->req_id != res->req_id) return;  // Stale reply
+
+    char otp_code[sizeof(res->otp_code) + 1] = {0};
+    memcpy(otp_code, res->otp_code, sizeof(res->otp_code));  // Gen 時把 OTP 帶出來
+    pending_finish(p, res->status == 1 ? OTP_CALL_OK : OTP_CALL_REJECTED, otp_code);
+}
+
+static int conn_read(OtpConn *c) {
+    while (1) {
+        ssize_t n = recv(c->fd, c->in_buf + c->in_len, sizeof(c->in_buf) - c->in_len, 0);
+        if (n > 0) {
+            c->in_len += n;
+            if (c->in_len == sizeof(c->in_buf)) {
+                OtpIpcResponse res;
+                memcpy(&res, c->in_buf, sizeof(res));
+                c->in_len = 0;
+                deliver(&res);
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;  // EOF or error
+        }
+    }
+}
+
+int otp_client_handle_event(void *ptr, uint32_t events) {
+    if ((OtpConn *)ptr < &pool[0] || (OtpConn *)ptr >= &pool[OTP_POOL_SIZE]) {
+        return 0;
+    }
+
+    OtpConn *c = ptr;
+    int slot = (int)(c - pool);
+    if (c->fd < 0) return 1;
+
+    if (c->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            fprintf(stderr, "Cannot connect to OTP Server: %s\n", strerror(err));
+            conn_fail(slot);
+            return 1;
+        }
+        c->connecting = 0;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && conn_read(c) < 0) {
+        conn_fail(slot);
+        return 1;
+    }
+    if (conn_flush(c) < 0) {
+        conn_fail(slot);
+    }
+    return 1;
+}
+
+static void on_deadline(TimerNode *node, void *arg) {
+    (void)arg;
+    OtpPending *p = timer_entry(node, OtpPending, timer);
+    OtpConn *c = &pool[p->slot];
+
+    // Still connecting: treat as a connect timeout and start over next time
+    if (c->fd >= 0 && c->connecting) {
+        conn_fail(p->slot);
+        if (p->req_id == 0) return;  // Finished by conn_fail
+    }
+    pending_finish(p, OTP_CALL_UNAVAILABLE, NULL);  // A late reply is dropped as stale
+}
+
+int otp_client_next_timeout(void) {
+    int64_t ticks = timer_wheel_next_timeout(&deadlines);
+    return ticks < 0 ? -1 : (int)ticks;
+}
+
+void otp_client_tick(void) {
+    timer_wheel_advance(&deadlines, now_ms(), on_deadline, NULL);
+}
+
+int otp_client_submit(int opcode, const char *account, const char *otp_in,
+                      OtpCallback cb, void *arg) {
+    OtpPending *p = pending_alloc();
+    if (!p) return -1;
+    if (!breaker_allow()) {
+        p->req_id = 0;
+        return -1;  // Fail fast, no connect attempt
+    }
+
+    memset(&p->req, 0, sizeof(p->req));
+    p->req.op_code = opcode;
+    strncpy(p->req.account, account, sizeof(p->req.account) - 1);
+    if (otp_in) strncpy(p->req.otp_code, otp_in, sizeof(p->req.otp_code) - 1);
+    p->attempts = (opcode == OTP_OP_GENERATE) ? 2 : 1;
+    p->cb = cb;
+    p->arg = arg;
+
+    if (send_pending(p) != 0) {
+        p->req_id = 0;
+        breaker_failure();
+        return -1;
+    }
+    timer_node_init(&p->timer);
+    timer_wheel_add(&deadlines, &p->timer, now_ms() + cfg.timeout_ms);
+    return 0;
+}
+
+void otp_client_cancel(void *arg) {
+    // Keep the entry so its reply is still consumed, just don't deliver it
+    for (int i = 0; i < OTP_MAX_PENDING; i++) {
+        if (pending[i].req_id != 0 && pending[i].arg == arg) {
+            pending[i].cb = NULL;
+        }
+    }
+}
+
+void otp_client_close_all(void) {
+    if (epoll_fd < 0) return;
+    for (int i = 0; i < OTP_POOL_SIZE; i++) {
+        if (pool[i].fd >= 0) {
+            close(pool[i].fd);
+            pool[i].fd = -1;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * otp_client.h
+ * Banking worker side of the OTP service protocol
+ *
+ * Each worker keeps a small pool of long-lived connections to the OTP
+ * server instead of a TCP handshake per call. Requests carry a
+ * correlation id so replies can be matched on a shared connection.
+ *
+ * Calls are asynchronous: the pool sockets are non-blocking and live in
+ * the worker's epoll set, and each reply is delivered to the callback
+ * given at submit time. The worker keeps serving other connections
+ * while a call is outstanding.
+ *
+ * Every call has a deadline (timer wheel, millisecond ticks). Timeouts and
+ * connection errors feed a per-worker circuit breaker: after `threshold`
+ * consecutive failures calls fail fast for `cooldown_ms`, then a single
+ * probe call decides whether the circuit closes again.
+ */
+
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+#include <stdint.h>
+
+#define OTP_POOL_SIZE 2        // Connections per worker process
+#define OTP_MAX_PENDING 256    // Outstanding calls per worker (power of 2)
+
+#define OTP_DEFAULT_TIMEOUT_MS 1000
+#define OTP_DEFAULT_BREAKER_THRESHOLD 5
+#define OTP_DEFAULT_BREAKER_COOLDOWN_MS 5000
+
+// Call outcome passed to the callback
+#define OTP_CALL_OK           1   // otp_code filled for generate
+#define OTP_CALL_REJECTED     0   // Service answered "no" (bad code, store full)
+#define OTP_CALL_UNAVAILABLE -1   // Timeout, connection error or circuit open
+
+typedef struct {
+    int timeout_ms;            // Per-call deadline
+    int breaker_threshold;     // Consecutive failures that open the circuit
+    int breaker_cooldown_ms;   // Open time before a probe is allowed
+} OtpClientConfig;
+
+typedef void (*OtpCallback)(void *arg, int status, const char *otp_code);
+
+// Must be called in the worker (after fork) with its epoll fd
+void otp_client_init(int epfd, const OtpClientConfig *config);
+
+// Returns 0 if the call was sent/queued, -1 if it is unavailable right now
+// (circuit open, no connection, too many calls); cb is not called then.
+int otp_client_submit(int opcode, const char *account, const char *otp_in,
+                      OtpCallback cb, void *arg);
+
+// Drop callbacks still registered for arg (e.g. its connection closed)
+void otp_client_cancel(void *arg);
+
+// Returns 1 if ptr is an OTP pool connection (and handles the event), 0 otherwise
+int otp_client_handle_event(void *ptr, uint32_t events);
+
+// epoll_wait timeout until the next call deadline (-1 = none)
+int otp_client_next_timeout(void);
+
+// Fail calls whose deadline has passed; call after every epoll_wait
+void otp_client_tick(void);
+
+void otp_client_close_all(void);
+
+#endif // OTP_CLIENT_H
@@ -0,0 +1,705 @@
+/*
+ * replication.c
+ * Mutation log streaming: primary-side sender and standby-side receiver
+ *
+ * Both run in a process of their own, forked by the master, so a slow or
+ * unreachable peer never stalls a worker. The sender never blocks on a
+ * standby either: each one has a bounded output buffer that is refilled
+ * from the shared log as the socket drains.
+ */
+
+#define _GNU_SOURCE  // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../common/include/log_ring.h"
+#include "replication.h"
+
+#define REPL_OUT_MSGS 64              // Per-standby output buffer, in messages
+#define REPL_IN_MSGS 64               // Standby receive buffer, in messages
+
+typedef struct {
+    int fd;                           // -1 = free
+    int greeted;                      // First control message received (nothing is sent before)
+    int migrate;                      // bank_migrate: moving accounts only, acks ignored
+    int freeze_pending;               // Send REPL_MSG_FROZEN once every record up to freeze_at is sent
+    int moved_pending;                // Send REPL_MSG_MOVED
+    int caught_up;                    // Migration: told bank_migrate it has everything so far
+    uint64_t freeze_at;
+    uint32_t snap_rate;               // Migration snapshot pace (accounts/s)
+    double snap_tokens;
+    uint64_t snap_refill_ms;
+    int snap_index;                   // >= 0: next account of the snapshot being sent
+    uint64_t next;                    // Next log record to send
+    uint64_t stall_since_ms;          // Waiting on an unpublished record since (0 = not waiting)
+    uint64_t last_send_ms;
+    size_t out_off, out_len;
+    char out[REPL_OUT_MSGS * sizeof(ReplMessage)];
+    size_t in_len;
+    char in[sizeof(ReplAck) + sizeof(MigrateSpec)];
+    char addr[INET_ADDRSTRLEN];
+} Standby;
+
+static volatile sig_atomic_t repl_stop = 0;
+static MigrationState *migration = NULL;  // Sender: accounts moving to another shard
+
+static void repl_signal_handler(int signum) {
+    (void)signum;
+    repl_stop = 1;
+}
+
+// No SA_RESTART: a blocking recv/poll returns EINTR on SIGTERM
+static void repl_signals(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = repl_signal_handler;
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGINT, SIG_IGN);   // The master decides when replication stops
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int repl_parse_target(const char *spec, char *host, size_t host_len, int *port) {
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= host_len) return -1;
+    char *end;
+    long p = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || p <= 0 || p > 65535) return -1;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+    *port = (int)p;
+    return 0;
+}
+
+int repl_listen(const char *spec) {
+    char host[64] = "127.0.0.1";  // The stream is not encrypted: loopback unless asked otherwise
+    int port;
+    if (strchr(spec, ':')) {
+        if (repl_parse_target(spec, host, sizeof(host), &port) != 0) return -1;
+    } else {
+        port = atoi(spec);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (port <= 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid replication address %s\n", spec);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Replication socket creation failed");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, REPL_MAX_STANDBYS) < 0) {
+        perror("Replication bind/listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ---- Primary side ----
+
+static ReplMessage *queue_message(Standby *s, uint32_t type, const ReplLog *log, const ReplRecord *rec) {
+    ReplMessage *m = (ReplMessage *)(s->out + s->out_len);
+    memset(m, 0, sizeof(*m));
+    m->magic = REPL_MAGIC;
+    m->type = type;
+    m->timeline = __atomic_load_n(&log->timeline, __ATOMIC_RELAXED);
+    m->head = repl_log_head(log);
+    m->sent_ns = realtime_ns();
+    if (rec) m->rec = *rec;
+    s->out_len += sizeof(*m);
+    return m;
+}
+
+// The stream resumes right after the position read here. Every record up to
+// it was committed under its account lock before we read the head, so the
+// snapshot (taken under the same locks) already includes it; records after
+// it may be sent twice, which the standby's sequence check absorbs.
+static void start_snapshot(Standby *s, ReplLog *log, ReplStats *stats) {
+    uint64_t pos = repl_log_head(log);
+    queue_message(s, REPL_MSG_SNAPSHOT_BEGIN, log, NULL)->head = pos;
+    s->snap_index = 0;
+    s->next = pos + 1;
+    s->stall_since_ms = 0;
+    if (!s->migrate) stats_add(&stats->snapshots, 1);
+}
+
+// A migration reads the accounts at a bounded pace: each read holds the
+// account's lock, which the workers serving it need too
+static int snapshot_paced(Standby *s, uint64_t now) {
+    if (now > s->snap_refill_ms) {
+        s->snap_tokens += (now - s->snap_refill_ms) * (double)s->snap_rate / 1000.0;
+        double burst = s->snap_rate / 100.0 + 1;  // 10 ms worth
+        if (s->snap_tokens > burst) s->snap_tokens = burst;
+        s->snap_refill_ms = now;
+    }
+    if (s->snap_tokens < 1) return 0;
+    s->snap_tokens -= 1;
+    return 1;
+}
+
+// A migration stream only carries the accounts that move
+static int stream_wants(const Standby *s, const ReplRecord *rec, ReplStats *stats) {
+    if (!s->migrate) return 1;
+    if (rec->type == REPL_DEACTIVATE) return 0;  // The cutover on our side, not a change to copy
+    if (!migration_moving(migration, rec->account_id)) return 0;
+    stats_add(&stats->migrate_records, 1);
+    return 1;
+}
+
+// Refill the output buffer from the snapshot / log
+static void standby_fill(Standby *s, AccountDB *db, ReplLog *log, ReplStats *stats, uint64_t now) {
+    while (s->out_len + sizeof(ReplMessage) <= sizeof(s->out)) {
+        ReplRecord rec;
+        if (s->moved_pending) {
+            queue_message(s, REPL_MSG_MOVED, log, NULL);
+            s->moved_pending = 0;
+            continue;
+        }
+        if (s->snap_index >= 0) {
+            if (s->migrate && !snapshot_paced(s, now)) break;
+            int r = account_snapshot(db, s->snap_index, &rec);
+            if (r < 0) {
+                queue_message(s, REPL_MSG_SNAPSHOT_END, log, NULL);
+                s->snap_index = -1;
+            } else {
+                s->snap_index++;
+                if (r == 0 && stream_wants(s, &rec, stats)) queue_message(s, REPL_MSG_RECORD, log, &rec);
+                // A standby that missed a cutover's REPL_DEACTIVATE still has to stop serving it
+                else if (r == 1 && !s->migrate) queue_message(s, REPL_MSG_RECORD, log, &rec);
+            }
+            continue;
+        }
+        if (s->freeze_pending && s->next > s->freeze_at) {
+            queue_message(s, REPL_MSG_FROZEN, log, NULL)->head = s->freeze_at;
+            s->freeze_pending = 0;
+            continue;
+        }
+
+        int r = repl_log_read(log, s->next, &rec);
+        if (r > 0) {
+            if (stream_wants(s, &rec, stats)) queue_message(s, REPL_MSG_RECORD, log, &rec);
+            s->next++;
+            s->stall_since_ms = 0;
+        } else if (r < 0) {
+            log_write(LOG_LEVEL_WARN, "[Repl] Standby %s fell behind the log, resending a snapshot\n", s->addr);
+            start_snapshot(s, log, stats);
+        } else {
+            // Caught up, or the record is reserved but not yet written
+            if (s->next <= repl_log_head(log)) {
+                if (s->stall_since_ms == 0) s->stall_since_ms = now;
+                if (now - s->stall_since_ms >= REPL_STALL_MS) {
+                    log_write(LOG_LEVEL_WARN, "[Repl] Record %lu never published, resending a snapshot\n",
+                              s->next);
+                    start_snapshot(s, log, stats);
+                    continue;
+                }
+            }
+            if (s->migrate && !s->caught_up && s->next > repl_log_head(log)) {
+                // Heartbeats wait for an idle link, which a busy source never has
+                queue_message(s, REPL_MSG_HEARTBEAT, log, NULL);
+                s->caught_up = 1;
+            }
+            break;
+        }
+    }
+
+    if (s->greeted && s->out_len == 0 && now - s->last_send_ms >= REPL_HEARTBEAT_MS) {
+        queue_message(s, REPL_MSG_HEARTBEAT, log, NULL);
+    }
+}
+
+static void migration_phase_changed(ReplStats *stats) {
+    stats_set(&stats->migrate_phase, __atomic_load_n(&migration->phase, __ATOMIC_RELAXED));
+}
+
+static void standby_close(Standby *s, ReplStats *stats) {
+    if (s->migrate) {
+        uint32_t phase = __atomic_load_n(&migration->phase, __ATOMIC_RELAXED);
+        if (phase == MIGRATE_COPYING || phase == MIGRATE_FROZEN) {
+            log_write(LOG_LEVEL_WARN, "[Repl] Migration stream from %s broke (%s), accounts stay here\n",
+                      s->addr, migration_phase_name(phase));
+            migration_abort(migration);
+            migration_phase_changed(stats);
+        }
+    } else {
+        log_write(LOG_LEVEL_WARN, "[Repl] Standby %s disconnected\n", s->addr);
+    }
+    close(s->fd);
+    s->fd = -1;
+}
+
+// Returns -1 if the standby is gone
+static int standby_flush(Standby *s, uint64_t now) {
+    while (s->out_off < s->out_len) {
+        ssize_t n = send(s->fd, s->out + s->out_off, s->out_len - s->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        s->out_off += n;
+        s->last_send_ms = now;
+    }
+    if (s->out_off == s->out_len) {
+        s->out_off = s->out_len = 0;
+    } else if (s->out_off > 0) {
+        memmove(s->out, s->out + s->out_off, s->out_len - s->out_off);
+        s->out_len -= s->out_off;
+        s->out_off = 0;
+    }
+    return 0;
+}
+
+// The source's part of the cutover: the moving accounts stop being served here
+// (journaled, so our standbys stop serving them too)
+static int deactivate_moving(AccountDB *db) {
+    ReplRecord rec;
+    int r, moved = 0;
+    for (int i = 0; (r = account_snapshot(db, i, &rec)) >= 0; i++) {
+        if (r == 0 && migration_moving(migration, rec.account_id)) {
+            account_deactivate(db, i);
+            moved++;
+        }
+    }
+    return moved;
+}
+
+// Returns -1 to drop the connection
+static int handle_control(Standby *s, const ReplAck *ctl, const MigrateSpec *spec,
+                          AccountDB *db, ReplLog *log, ReplStats *stats) {
+    uint32_t phase = __atomic_load_n(&migration->phase, __ATOMIC_RELAXED);
+    const MigrateSpec *cur = &migration->spec;
+
+    switch (ctl->type) {
+        case REPL_CTL_ACK:
+            if (!s->migrate) repl_log_ack(log, ctl->applied);
+            return 0;
+
+        case REPL_CTL_STANDBY:
+            if (s->greeted) return -1;
+            s->greeted = 1;
+            start_snapshot(s, log, stats);
+            log_write(LOG_LEVEL_WARN, "[Repl] Standby %s connected, sending snapshot\n", s->addr);
+            return 0;
+
+        case REPL_CTL_MIGRATE:
+            if (s->greeted) return -1;
+            if (migration_start(migration, spec) != 0) {
+                log_write(LOG_LEVEL_WARN, "[Repl] Refusing a migration from %s: another one is running, "
+                          "or the membership is invalid\n", s->addr);
+                return -1;
+            }
+            s->greeted = 1;
+            s->migrate = 1;
+            s->snap_rate = spec->rate ? spec->rate : MIGRATE_DEFAULT_RATE;
+            s->snap_tokens = 1;
+            s->snap_refill_ms = now_ms();
+            start_snapshot(s, log, stats);
+            migration_phase_changed(stats);
+            log_write(LOG_LEVEL_WARN, "[Repl] Migration to shard %s (%s) started, copying at %u accounts/s\n",
+                      cur->shards[cur->target].name, s->addr, s->snap_rate);
+            return 0;
+
+        case REPL_CTL_FREEZE:
+            if (!s->migrate || phase != MIGRATE_COPYING || s->snap_index >= 0) return -1;
+            if (migration_freeze(migration) != 0) {
+                log_write(LOG_LEVEL_WARN, "[Repl] Migration freeze failed: a worker stayed busy for %d ms\n",
+                          MIGRATE_QUIESCE_MS);
+                return -1;
+            }
+            s->freeze_at = repl_log_head(log);
+            s->freeze_pending = 1;
+            migration_phase_changed(stats);
+            log_write(LOG_LEVEL_WARN, "[Repl] Migration frozen at record %lu\n", s->freeze_at);
+            return 0;
+
+        case REPL_CTL_FINISH: {
+            if (!s->migrate || phase != MIGRATE_FROZEN || s->freeze_pending) return -1;
+            int moved = deactivate_moving(db);
+            migration_finish(migration);
+            migration_phase_changed(stats);
+            s->moved_pending = 1;
+            log_write(LOG_LEVEL_WARN, "[Repl] Migration done: %d accounts moved to shard %s\n",
+                      moved, cur->shards[cur->target].name);
+            return 0;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+// Returns -1 if the peer is gone or sent garbage
+static int standby_read_control(Standby *s, AccountDB *db, ReplLog *log, ReplStats *stats) {
+    while (1) {
+        size_t need = sizeof(ReplAck);
+        if (s->in_len >= sizeof(ReplAck) && ((ReplAck *)s->in)->type == REPL_CTL_MIGRATE) {
+            need += sizeof(MigrateSpec);
+        }
+        ssize_t n = recv(s->fd, s->in + s->in_len, need - s->in_len, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        s->in_len += n;
+        if (s->in_len < sizeof(ReplAck)) continue;
+
+        ReplAck ctl;
+        memcpy(&ctl, s->in, sizeof(ctl));
+        if (ctl.magic != REPL_MAGIC) return -1;
+        if (s->in_len < need || (ctl.type == REPL_CTL_MIGRATE && need == sizeof(ReplAck))) continue;
+
+        MigrateSpec spec;
+        if (ctl.type == REPL_CTL_MIGRATE) memcpy(&spec, s->in + sizeof(ReplAck), sizeof(spec));
+        s->in_len = 0;
+        if (handle_control(s, &ctl, &spec, db, log, stats) < 0) return -1;
+    }
+}
+
+static void accept_standbys(int listen_fd, Standby *standbys) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listen_fd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        Standby *s = NULL;
+        for (int i = 0; i < REPL_MAX_STANDBYS && !s; i++) {
+            if (standbys[i].fd < 0) s = &standbys[i];
+        }
+        if (!s) {
+            log_write(LOG_LEVEL_WARN, "[Repl] Too many standbys, refusing one\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        memset(s, 0, sizeof(*s));
+        s->fd = fd;
+        s->snap_index = -1;  // Until it says what it is
+        inet_ntop(AF_INET, &addr.sin_addr, s->addr, sizeof(s->addr));
+    }
+}
+
+void repl_sender_main(int listen_fd, int kick_fd, int wake_fd, AccountDB *db,
+                      ReplLog *log, ReplStats *stats, MigrationState *ms) {
+    repl_signals();
+    // A migration does not survive its stream: the accounts stay here
+    migration = ms;
+    migration_abort(migration);
+    repl_log_attach(log, -1);  // Cutover deactivations are journaled from here (we are the one to kick)
+    migration_phase_changed(stats);
+    printf("[Repl] Sender started (PID: %d)\n", getpid());
+    fflush(stdout);
+
+    Standby standbys[REPL_MAX_STANDBYS];
+    for (int i = 0; i < REPL_MAX_STANDBYS; i++) standbys[i].fd = -1;
+
+    struct pollfd pfds[2 + REPL_MAX_STANDBYS];
+    uint64_t last_acked = __atomic_load_n(&log->acked, __ATOMIC_RELAXED);
+    int busy = 0;
+
+    while (!repl_stop) {
+        // Sleep until a worker appends (kick), a standby is writable / acks, or
+        // the heartbeat is due. Announce the sleep before the final head check
+        // so an append either sees sender_idle or is seen by us.
+        int timeout = busy ? 1 : REPL_HEARTBEAT_MS;
+        int idle = !busy;
+        uint64_t head = repl_log_head(log);
+        if (idle) {
+            __atomic_add_fetch(&log->sender_idle, 1, __ATOMIC_SEQ_CST);
+            for (int i = 0; i < REPL_MAX_STANDBYS; i++) {
+                Standby *s = &standbys[i];
+                if (s->fd >= 0 && s->snap_index < 0 && s->next <= repl_log_head(log)) timeout = 0;
+            }
+            if (repl_log_head(log) != head) timeout = 0;
+        }
+
+        int n = 0;
+        pfds[n++] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+        pfds[n++] = (struct pollfd){ .fd = kick_fd, .events = POLLIN };
+        for (int i = 0; i < REPL_MAX_STANDBYS; i++) {
+            Standby *s = &standbys[i];
+            if (s->fd < 0) continue;
+            pfds[n++] = (struct pollfd){ .fd = s->fd, .events = POLLIN | (s->out_len ? POLLOUT : 0) };
+        }
+        poll(pfds, n, timeout);
+        if (idle) __atomic_sub_fetch(&log->sender_idle, 1, __ATOMIC_SEQ_CST);
+
+        uint64_t drain;
+        while (read(kick_fd, &drain, sizeof(drain)) > 0) {}
+        accept_standbys(listen_fd, standbys);
+
+        uint64_t now = now_ms();
+        int connected = 0;
+        busy = 0;
+        for (int i = 0; i < REPL_MAX_STANDBYS; i++) {
+            Standby *s = &standbys[i];
+            if (s->fd < 0) continue;
+            if (standby_read_control(s, db, log, stats) < 0) {
+                standby_close(s, stats);
+                continue;
+            }
+            if (!s->greeted) continue;
+            standby_fill(s, db, log, stats, now);
+            if (standby_flush(s, now) < 0) {
+                standby_close(s, stats);
+                continue;
+            }
+            // More to send than the buffer held, or waiting for a record to be published
+            if (s->out_len == 0 && (s->snap_index >= 0 || s->stall_since_ms)) busy = 1;
+            if (!s->migrate) connected++;
+        }
+        stats_set(&stats->standbys, connected);
+        stats_set(&stats->primary_seq, repl_log_head(log));
+
+        // Held responses in the workers wait for this. The fence pairs with the
+        // one in the workers' sync_hold: they count themselves, then check acked
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uint64_t acked = __atomic_load_n(&log->acked, __ATOMIC_ACQUIRE);
+        if (acked != last_acked) {
+            last_acked = acked;
+            if (wake_fd >= 0 && __atomic_load_n(&log->sync_waiters, __ATOMIC_RELAXED) > 0) {
+                uint64_t one = 1;
+                ssize_t w = write(wake_fd, &one, sizeof(one));
+                (void)w;
+            }
+        }
+    }
+
+    // The gauges are left alone: after a hot upgrade our successor's sender owns them
+    for (int i = 0; i < REPL_MAX_STANDBYS; i++) {
+        if (standbys[i].fd >= 0) close(standbys[i].fd);
+    }
+    exit(0);
+}
+
+// ---- Standby side ----
+
+static int connect_primary(const char *host, int port) {
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 || !res) return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // A silent primary (no heartbeat) counts as gone
+    struct timeval tv = { .tv_sec = REPL_TIMEOUT_MS / 1000, .tv_usec = (REPL_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static int send_ack(int fd, uint64_t applied) {
+    ReplAck ack = { .magic = REPL_MAGIC, .type = REPL_CTL_ACK, .applied = applied };
+    return send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) == sizeof(ack) ? 0 : -1;
+}
+
+// Snapshot from a new timeline: accounts the primary does not have are dropped
+static void drop_unlisted(AccountDB *db, char (*ids)[ACCOUNT_ID_LEN], int count) {
+    ReplRecord local;
+    int r;
+    for (int i = 0; (r = account_snapshot(db, i, &local)) >= 0; i++) {
+        if (r != 0) continue;
+        int listed = 0;
+        for (int j = 0; j < count && !listed; j++) {
+            listed = strncmp(ids[j], local.account_id, ACCOUNT_ID_LEN) == 0;
+        }
+        if (!listed) {
+            log_write(LOG_LEVEL_WARN, "[Repl] Account %s not on the primary's timeline, deactivated\n",
+                      local.account_id);
+            account_deactivate(db, i);
+        }
+    }
+}
+
+// Stream one connection until it breaks; returns 0 on SIGTERM
+static int receive_stream(int fd, int wake_fd, AccountDB *db, ReplLog *log, ReplStats *stats) {
+    static char buf[REPL_IN_MSGS * sizeof(ReplMessage)];
+    static char snap_ids[MAX_ACCOUNTS][ACCOUNT_ID_LEN];
+    static ReplRecord group[TXN_MAX_ACCOUNTS];  // Transaction waiting for the rest of its records
+    int group_len = 0;
+    size_t len = 0;
+    int in_snapshot = 0, force = 0, snap_count = 0;
+    uint64_t snap_pos = 0, applied = 0, acked = 0;
+    uint64_t fresh = __atomic_load_n(&stats->fresh_ns, __ATOMIC_RELAXED);
+
+    while (!repl_stop) {
+        ssize_t n = recv(fd, buf + len, sizeof(buf) - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            log_write(LOG_LEVEL_WARN, "[Repl] Lost the primary (%s)\n",
+                      n == 0 ? "closed" : errno == EAGAIN ? "no heartbeat" : strerror(errno));
+            return -1;
+        }
+        len += n;
+        uint64_t arrived = monotonic_ns();
+
+        size_t off = 0;
+        for (; len - off >= sizeof(ReplMessage); off += sizeof(ReplMessage)) {
+            ReplMessage *m = (ReplMessage *)(buf + off);
+            if (m->magic != REPL_MAGIC) {
+                log_write(LOG_LEVEL_ERROR, "[Repl] Bad message from the primary\n");
+                return -1;
+            }
+            stats_set(&stats->primary_seq, m->head);
+
+            switch (m->type) {
+                case REPL_MSG_SNAPSHOT_BEGIN:
+                    in_snapshot = 1;
+                    force = m->timeline != __atomic_load_n(&log->timeline, __ATOMIC_RELAXED);
+                    snap_pos = m->head;
+                    snap_count = 0;
+                    group_len = 0;  // The snapshot covers it
+                    break;
+
+                case REPL_MSG_SNAPSHOT_END:
+                    if (force) drop_unlisted(db, snap_ids, snap_count);
+                    __atomic_store_n(&log->timeline, m->timeline, __ATOMIC_RELAXED);
+                    in_snapshot = 0;
+                    if (snap_pos > applied) applied = snap_pos;
+                    stats_add(&stats->snapshots, 1);
+                    log_write(LOG_LEVEL_WARN, "[Repl] Snapshot applied (%d accounts%s), streaming from %lu\n",
+                              snap_count, force ? ", new timeline" : "", snap_pos);
+                    break;
+
+                case REPL_MSG_RECORD:
+                    if (in_snapshot) {
+                        if (account_apply(db, &m->rec, force) < 0) {
+                            log_write(LOG_LEVEL_ERROR, "[Repl] Cannot apply account %s (database full)\n",
+                                      m->rec.account_id);
+                        }
+                        if (m->rec.type != REPL_DEACTIVATE && snap_count < MAX_ACCOUNTS) {
+                            memcpy(snap_ids[snap_count++], m->rec.account_id, ACCOUNT_ID_LEN);
+                        }
+                        break;
+                    }
+                    // A transaction is applied once all of its records are here, so a
+                    // promotion never finds half of one
+                    if (group_len > 0 && m->rec.seq != group[group_len - 1].seq + 1) group_len = 0;
+                    if (m->rec.group_left > 0 || group_len > 0) {
+                        if (group_len < TXN_MAX_ACCOUNTS) group[group_len++] = m->rec;
+                        if (m->rec.group_left > 0) break;
+                    }
+                    const ReplRecord *recs = group_len > 0 ? group : &m->rec;
+                    int count = group_len > 0 ? group_len : 1;
+                    group_len = 0;
+                    for (int i = 0; i < count; i++) {
+                        if (account_apply(db, &recs[i], 0) < 0) {
+                            log_write(LOG_LEVEL_ERROR, "[Repl] Cannot apply account %s (database full)\n",
+                                      recs[i].account_id);
+                        }
+                        stats_add(&stats->applied, 1);
+                    }
+                    applied = m->rec.seq;
+                    int64_t waited = m->sent_ns - m->rec.commit_ns;  // Same clock on both ends
+                    if (waited < 0) waited = 0;
+                    if (arrived - waited > fresh) fresh = arrived - waited;
+                    int64_t lag = realtime_ns() - m->rec.commit_ns;
+                    if (lag < 0) lag = 0;
+                    stats_set(&stats->lag_ns, lag);
+                    stats_add(&stats->lag_ns_sum, lag * count);  // One sample per record
+                    break;
+
+                case REPL_MSG_HEARTBEAT:
+                default:
+                    break;
+            }
+            if (!in_snapshot && m->head <= applied) fresh = arrived;  // Caught up with the primary
+        }
+        memmove(buf, buf + off, len - off);
+        len -= off;
+
+        // One ack per batch read, once the batch is applied
+        if (applied != acked && !in_snapshot) {
+            if (send_ack(fd, applied) < 0) return -1;
+            acked = applied;
+            __atomic_store_n(&stats->applied_seq, applied, __ATOMIC_RELEASE);
+            // Read replica: reads waiting for a client's own write (see the sender for the fence)
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (wake_fd >= 0 && __atomic_load_n(&log->sync_waiters, __ATOMIC_RELAXED) > 0) {
+                uint64_t one = 1;
+                ssize_t w = write(wake_fd, &one, sizeof(one));
+                (void)w;
+            }
+        }
+        __atomic_store_n(&stats->fresh_ns, fresh, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void repl_receiver_main(const char *host, int port, int wake_fd, AccountDB *db,
+                        ReplLog *log, ReplStats *stats) {
+    repl_signals();
+    printf("[Repl] Standby of %s:%d (PID: %d)\n", host, port, getpid());
+    fflush(stdout);
+
+    int backoff_ms = 100;
+    while (!repl_stop) {
+        int fd = connect_primary(host, port);
+        if (fd < 0) {
+            struct timespec ts = { .tv_sec = backoff_ms / 1000, .tv_nsec = (backoff_ms % 1000) * 1000000L };
+            nanosleep(&ts, NULL);
+            if (backoff_ms < REPL_RECONNECT_MAX_MS) backoff_ms *= 2;
+            continue;
+        }
+        backoff_ms = 100;
+        ReplAck hello = { .magic = REPL_MAGIC, .type = REPL_CTL_STANDBY };
+        if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+            close(fd);
+            continue;
+        }
+        log_write(LOG_LEVEL_WARN, "[Repl] Connected to primary %s:%d\n", host, port);
+        stats_set(&stats->connected, 1);
+        // Stopped: left as is, a hot upgrade's successor may be connected already
+        if (receive_stream(fd, wake_fd, db, log, stats) < 0) stats_set(&stats->connected, 0);
+        close(fd);
+    }
+    exit(0);
+}
@@ -0,0 +1,97 @@
+/*
+ * replication.h
+ * Primary/standby replication of the account table
+ *
+ * Each master runs one replication process next to its workers:
+ *   - primary (--repl-listen): accepts standbys on a plain TCP port (same
+ *     trust model as the OTP service link) and streams the shared-memory
+ *     mutation log to each of them. A new standby, or one that fell more
+ *     than REPL_LOG_SIZE records behind, first gets a snapshot of every
+ *     account, then the log from the snapshot's position on.
+ *   - standby (--standby-of): connects to the primary, applies the records
+ *     to its own segment and acknowledges the last sequence number applied.
+ *     It reconnects by itself when the stream breaks.
+ *
+ * A connection starts with a control message saying what it is: a standby,
+ * or bank_migrate with the accounts it takes over (migration.h). A
+ * migration stream carries only those accounts and does not count as a
+ * standby for acks.
+ *
+ * Acks feed ReplLog.acked; with --repl-sync the workers hold the response
+ * of a mutation until a standby has applied it (semi-synchronous, with a
+ * timeout after which the response goes out anyway).
+ *
+ * The standby also tracks how fresh its data is (ReplStats.fresh_ns, on its
+ * own monotonic clock): when it has applied everything up to the head a
+ * message announced, it matched the primary when that message arrived; a
+ * streamed record shows it matched the primary as of the record's commit,
+ * i.e. the time it waited on the primary before the arrival. Read replicas
+ * bound the staleness of the balances they serve with it.
+ *
+ * Messages are fixed-size structs in host byte order, like the OTP link:
+ * primary and standby must run the same build on the same architecture.
+ */
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stdint.h>
+#include "../common/include/account.h"
+#include "../common/include/repl_log.h"
+#include "../common/include/stats.h"
+#include "../common/include/migration.h"
+
+#define REPL_MAGIC 0x4c504552         // "REPL"
+#define REPL_MAX_STANDBYS 8
+#define REPL_HEARTBEAT_MS 100         // Idle primary -> standby keepalive (carries the primary's head)
+#define REPL_TIMEOUT_MS 3000          // Standby reconnects after this long without a message
+#define REPL_STALL_MS 1000            // Unpublished record (writer died mid-append): resync instead
+#define REPL_RECONNECT_MAX_MS 2000
+
+typedef enum {
+    REPL_MSG_RECORD = 1,              // One after-image (streamed, or part of a snapshot)
+    REPL_MSG_SNAPSHOT_BEGIN,          // head = position the stream continues after
+    REPL_MSG_SNAPSHOT_END,
+    REPL_MSG_HEARTBEAT,
+    REPL_MSG_FROZEN,                  // Migration: every change of the moving accounts was sent before this
+    REPL_MSG_MOVED                    // Migration: the accounts are deactivated on the source
+} ReplMsgType;
+
+// Standby / bank_migrate -> primary
+typedef enum {
+    REPL_CTL_ACK = 0,                 // Every record up to `applied` is applied
+    REPL_CTL_STANDBY,                 // First message of a standby
+    REPL_CTL_MIGRATE,                 // First message of bank_migrate, followed by a MigrateSpec
+    REPL_CTL_FREEZE,                  // Migration caught up: freeze the moving accounts
+    REPL_CTL_FINISH                   // Migration applied up to REPL_MSG_FROZEN: hand the accounts over
+} ReplCtlType;
+
+// Primary -> standby
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                    // ReplMsgType
+    uint64_t timeline;                // Primary's timeline
+    uint64_t head;                    // Primary's last sequence number when sent
+    int64_t sent_ns;                  // Primary's CLOCK_REALTIME when sent (only compared with rec.commit_ns)
+    ReplRecord rec;                   // REPL_MSG_RECORD only
+} ReplMessage;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                    // ReplCtlType
+    uint64_t applied;                 // REPL_CTL_ACK only
+} ReplAck;
+
+// Replication process mains (forked by the master; exit on SIGTERM)
+void repl_sender_main(int listen_fd, int kick_fd, int wake_fd, AccountDB *db,
+                      ReplLog *log, ReplStats *stats, MigrationState *migration);
+void repl_receiver_main(const char *host, int port, int wake_fd, AccountDB *db,
+                        ReplLog *log, ReplStats *stats);
+
+// Listening socket for standbys ("PORT" or "ADDR:PORT", default address 127.0.0.1)
+int repl_listen(const char *spec);
+
+// "HOST:PORT" -> host and port; -1 if malformed
+int repl_parse_target(const char *spec, char *host, size_t host_len, int *port);
+
+#endif // REPLICATION_H
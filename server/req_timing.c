@@ -0,0 +1,137 @@
+/*
+ * req_timing.c
+ * Per-request stage timing for the banking worker
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "req_timing.h"
+#include "../common/include/protocol.h"
+#include "../common/include/log_ring.h"
+
+// Log-linear like the stats histograms, but in ns and up to ~68 s
+#define TIMING_SUB_BITS 2
+#define TIMING_HIST_BUCKETS 144
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t hist[TIMING_HIST_BUCKETS];
+} StageAgg;
+
+static const char *stage_names[STAGE_COUNT] = {
+    "read", "checksum", "unpack", "lock_wait", "handler", "otp_wait", "pack", "write"
+};
+
+// Worker-local: each worker process has its own copy after fork
+static int timing_worker = -1;
+static uint64_t slow_ns = 0;
+static int slow_sample = 1;
+static uint64_t slow_seen = 0;
+static uint64_t requests = 0;
+static StageAgg stages[STAGE_COUNT];
+static StageAgg total;
+
+void timing_init(int worker_id, int slow_ms, int sample_every) {
+    timing_worker = worker_id;
+    slow_ns = slow_ms > 0 ? (uint64_t)slow_ms * 1000000ULL : 0;
+    slow_sample = sample_every > 0 ? sample_every : 1;
+    memset(stages, 0, sizeof(stages));
+    memset(&total, 0, sizeof(total));
+}
+
+static int hist_bucket(uint64_t ns) {
+    if (ns < (1u << TIMING_SUB_BITS)) return (int)ns;
+    
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (msb - TIMING_SUB_BITS)) & ((1 << TIMING_SUB_BITS) - 1));
+    int bucket = ((msb - TIMING_SUB_BITS + 1) << TIMING_SUB_BITS) + sub;
+    return bucket < TIMING_HIST_BUCKETS ? bucket : TIMING_HIST_BUCKETS - 1;
+}
+
+static uint64_t hist_upper(int bucket) {
+    int per_group = 1 << TIMING_SUB_BITS;
+    if (bucket < per_group) return (uint64_t)bucket;
+    if (bucket == TIMING_HIST_BUCKETS - 1) return UINT64_MAX;
+    
+    int group = bucket / per_group - 1;
+    int sub = bucket % per_group;
+    return ((uint64_t)(per_group + sub + 1) << group) - 1;
+}
+
+static void agg_add(StageAgg *a, uint64_t ns) {
+    a->count++;
+    a->sum_ns += ns;
+    if (ns > a->max_ns) a->max_ns = ns;
+    a->hist[hist_bucket(ns)]++;
+}
+
+// Upper bound of the bucket holding the q-th quantile (capped at the exact max)
+static uint64_t agg_quantile(const StageAgg *a, double q) {
+    uint64_t rank = (uint64_t)(q * a->count);
+    uint64_t seen = 0;
+    for (int b = 0; b < TIMING_HIST_BUCKETS; b++) {
+        seen += a->hist[b];
+        if (seen > rank) {
+            uint64_t upper = hist_upper(b);
+            return upper < a->max_ns ? upper : a->max_ns;
+        }
+    }
+    return a->max_ns;
+}
+
+static const char *op_name(uint16_t opcode) {
+    switch (opcode) {
+        case OP_CREATE_ACCOUNT: return "create_account";
+        case OP_DEPOSIT: return "deposit";
+        case OP_WITHDRAW: return "withdraw";
+        case OP_BALANCE: return "balance";
+        case OP_REQ_OTP: return "req_otp";
+        case OP_LOGIN: return "login";
+        case OP_RESUME_SESSION: return "resume_session";
+        case OP_SNAPSHOT_OPEN: return "snapshot_open";
+        case OP_SNAPSHOT_CLOSE: return "snapshot_close";
+        case OP_TRANSACTION: return "transaction";
+        default: return "unknown";
+    }
+}
+
+void timing_finish(ReqTiming *t, uint64_t end_ns) {
+    uint64_t elapsed = end_ns - t->start_ns;
+    requests++;
+    agg_add(&total, elapsed);
+    
+    // Stages a request did not go through (e.g. otp_wait) stay at 0 and are skipped
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (t->stage_ns[s]) agg_add(&stages[s], t->stage_ns[s]);
+    }
+    
+    if (slow_ns && elapsed >= slow_ns && slow_seen++ % slow_sample == 0) {
+        const uint64_t *ns = t->stage_ns;
+        log_write(LOG_LEVEL_WARN, "[Worker %d] Slow request op=%s total=%.3f ms: read=%.3f checksum=%.3f "
+                  "unpack=%.3f lock_wait=%.3f handler=%.3f otp_wait=%.3f pack=%.3f write=%.3f\n",
+                  timing_worker, op_name(t->opcode), elapsed / 1e6,
+                  ns[STAGE_READ] / 1e6, ns[STAGE_CHECKSUM] / 1e6, ns[STAGE_UNPACK] / 1e6,
+                  ns[STAGE_LOCK_WAIT] / 1e6, ns[STAGE_HANDLER] / 1e6, ns[STAGE_OTP_WAIT] / 1e6,
+                  ns[STAGE_PACK] / 1e6, ns[STAGE_WRITE] / 1e6);
+    }
+    
+    memset(t, 0, sizeof(*t));
+}
+
+void timing_dump(void) {
+    printf("[Worker %d] Stage timing over %lu requests (us, p50/p99 = bucket upper bound):\n",
+           timing_worker, requests);
+    printf("  %-10s %10s %10s %10s %10s %10s\n", "stage", "count", "avg", "p50", "p99", "max");
+    for (int s = 0; s <= STAGE_COUNT; s++) {
+        const StageAgg *a = (s < STAGE_COUNT) ? &stages[s] : &total;
+        if (a->count == 0) continue;
+        printf("  %-10s %10lu %10.1f %10.1f %10.1f %10.1f\n",
+               s < STAGE_COUNT ? stage_names[s] : "total", a->count,
+               a->sum_ns / 1e3 / a->count, agg_quantile(a, 0.50) / 1e3,
+               agg_quantile(a, 0.99) / 1e3, a->max_ns / 1e3);
+    }
+    fflush(stdout);
+}
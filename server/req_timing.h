@@ -0,0 +1,52 @@
+/*
+ * req_timing.h
+ * Per-request stage timing for the banking worker
+ *
+ * Each connection carries a ReqTiming that the event loop fills with the
+ * time spent in every stage of the request it is serving (CLOCK_MONOTONIC_RAW,
+ * a vDSO call, no syscall). When the response has been written the stages
+ * are folded into worker-local aggregates, which are printed on SIGUSR1.
+ * Requests slower than a threshold can additionally be logged (sampled)
+ * with their full breakdown.
+ */
+
+#ifndef REQ_TIMING_H
+#define REQ_TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    STAGE_READ,        // tls_read calls that delivered the request
+    STAGE_CHECKSUM,    // verify_packet_checksum
+    STAGE_UNPACK,      // unpack_request
+    STAGE_LOCK_WAIT,   // Waiting for account/DB mutexes
+    STAGE_HANDLER,     // Rest of process_request (account op, message snprintf)
+    STAGE_OTP_WAIT,    // Parked on the OTP service
+    STAGE_PACK,        // pack_response (serialize + checksum)
+    STAGE_WRITE,       // tls_write calls that sent the response
+    STAGE_COUNT
+} TimingStage;
+
+typedef struct {
+    uint64_t start_ns;             // First bytes of the request read (0 = idle)
+    uint16_t opcode;
+    uint64_t stage_ns[STAGE_COUNT];
+} ReqTiming;
+
+static inline uint64_t timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// slow_ms = 0 disables the slow-request log; every sample_every-th slow request is printed
+void timing_init(int worker_id, int slow_ms, int sample_every);
+
+// Response fully written: aggregate, maybe log, and reset t for the next request
+void timing_finish(ReqTiming *t, uint64_t end_ns);
+
+// Print the aggregated stage table (called from the event loop, not the signal handler)
+void timing_dump(void);
+
+#endif // REQ_TIMING_H
@@ -0,0 +1,80 @@
+/*
+ * stats_server.c
+ * Local stats endpoint served by the master process
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "stats_server.h"
+
+#define STATS_BUF_SIZE (64 * 1024)
+
+int stats_server_listen(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);  // Handed over explicitly on upgrade
+    if (fd < 0) {
+        perror("Stats socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local only
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        perror("Stats bind/listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+void stats_server_handle(int listen_fd, const StatsTable *table, int num_workers) {
+    static char body[STATS_BUF_SIZE];
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    // The master is single-threaded: never let a slow scraper hold it up
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Consume the request (any path is answered with the metrics)
+    char req[1024];
+    ssize_t n = recv(fd, req, sizeof(req), 0);
+    (void)n;
+
+    size_t body_len = stats_format_prometheus(table, num_workers, body, sizeof(body));
+
+    char header[160];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "\r\n", body_len);
+    write_all(fd, header, header_len);
+    write_all(fd, body, body_len);
+    close(fd);
+}
@@ -0,0 +1,23 @@
+/*
+ * stats_server.h
+ * Local stats endpoint served by the master process
+ *
+ * Answers every connection with the aggregated worker statistics in
+ * Prometheus text format (wrapped in a minimal HTTP/1.0 response, so both
+ * a Prometheus scraper and `curl` work). Bound to 127.0.0.1 only.
+ */
+
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include "../common/include/stats.h"
+
+#define DEFAULT_STATS_PORT 9100
+
+// Returns the listening fd, or -1 on failure
+int stats_server_listen(int port);
+
+// Accept one scrape and answer it (the listen fd must be readable)
+void stats_server_handle(int listen_fd, const StatsTable *table, int num_workers);
+
+#endif // STATS_SERVER_H
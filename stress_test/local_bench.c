@@ -0,0 +1,234 @@
+/*
+ * local_bench.c
+ * Load Test for the Local Transport (shared-memory rings)
+ *
+ * Each thread opens its own channel to banking_server --local-socket,
+ * creates an account, logs in (OTP code taken from the generate response)
+ * and then keeps `window` deposits in flight, publishing each batch with
+ * one flush. Reports throughput, time per operation and the latency of a
+ * full window; batch 1 measures a single request's round trip.
+ *
+ * Compiles to: ../bin/local_bench
+ * Usage: ./local_bench <socket_path> [threads] [ops_per_thread] [window]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../common/include/protocol.h"
+#include "../common/include/local_ring.h"
+
+#define DEFAULT_THREADS 1
+#define DEFAULT_OPS 1000000
+#define DEFAULT_WINDOW 128
+#define CALL_TIMEOUT_MS 5000
+
+typedef struct {
+    int thread_id;
+    const char *path;
+    int num_ops;
+    int window;
+
+    // Stats
+    double *batch_lat_us;
+    int batch_count;
+    long ok_count;
+    long fail_count;
+    int setup_failed;
+} BenchArgs;
+
+static pthread_barrier_t start_barrier;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// One request, waiting for its answer (setup steps)
+static int local_call(LocalClient *lc, uint16_t op, const void *data, size_t len, BankingResponse *res) {
+    LocalResponse out;
+    if (local_submit(lc, op, data, len, 0) < 0) return -1;
+    if (local_receive(lc, &out, CALL_TIMEOUT_MS) != 1) return -1;
+    *res = out.response;
+    return 0;
+}
+
+// Account of its own per thread and run, logged in on this channel
+static int bench_setup(LocalClient *lc, const char *account) {
+    BankingResponse res;
+    CreateAccountRequest create;
+    memset(&create, 0, sizeof(create));
+    snprintf(create.account_id, sizeof(create.account_id), "%s", account);
+    create.initial_balance = 0;
+    if (local_call(lc, OP_CREATE_ACCOUNT, &create, sizeof(create), &res) != 0 ||
+        (res.status != STATUS_SUCCESS && res.status != STATUS_ACCOUNT_EXISTS)) {
+        fprintf(stderr, "[%s] Create failed: %s\n", account, res.message);
+        return -1;
+    }
+
+    OtpRequest otp;
+    memset(&otp, 0, sizeof(otp));
+    snprintf(otp.account_id, sizeof(otp.account_id), "%s", account);
+    LoginRequest login;
+    memset(&login, 0, sizeof(login));
+    snprintf(login.account_id, sizeof(login.account_id), "%s", account);
+    if (local_call(lc, OP_REQ_OTP, &otp, sizeof(otp), &res) != 0 || res.status != STATUS_SUCCESS ||
+        sscanf(res.message, "OTP Generated: %9s", login.otp) != 1) {
+        fprintf(stderr, "[%s] OTP request failed: %s\n", account, res.message);
+        return -1;
+    }
+    if (local_call(lc, OP_LOGIN, &login, sizeof(login), &res) != 0 || res.status != STATUS_SUCCESS) {
+        fprintf(stderr, "[%s] Login failed: %s\n", account, res.message);
+        return -1;
+    }
+    return 0;
+}
+
+static void *bench_thread(void *arg) {
+    BenchArgs *b = (BenchArgs *)arg;
+    LocalClient lc;
+    char account[20];
+    snprintf(account, sizeof(account), "lb_%d_%d", (int)getpid() % 100000, b->thread_id);
+
+    if (local_connect(&lc, b->path) != 0) {
+        perror("local_connect");
+        b->setup_failed = 1;
+    } else if (bench_setup(&lc, account) != 0) {
+        local_disconnect(&lc);
+        b->setup_failed = 1;
+    }
+    pthread_barrier_wait(&start_barrier);
+    if (b->setup_failed) return NULL;
+
+    DepositRequest dep;
+    memset(&dep, 0, sizeof(dep));
+    snprintf(dep.account_id, sizeof(dep.account_id), "%s", account);
+    dep.amount = 1.0;
+
+    int done = 0;
+    while (done < b->num_ops) {
+        int n = b->num_ops - done < b->window ? b->num_ops - done : b->window;
+        double t0 = now_us();
+        for (int i = 0; i < n; i++) local_submit(&lc, OP_DEPOSIT, &dep, sizeof(dep), 0);
+        local_flush(&lc);
+        for (int i = 0; i < n; i++) {
+            LocalResponse out;
+            if (local_receive(&lc, &out, CALL_TIMEOUT_MS) != 1) {
+                fprintf(stderr, "[%s] Channel closed or timed out\n", account);
+                b->fail_count += n - i;
+                local_disconnect(&lc);
+                return NULL;
+            }
+            if (out.response.status == STATUS_SUCCESS) b->ok_count++;
+            else b->fail_count++;
+        }
+        b->batch_lat_us[b->batch_count++] = now_us() - t0;
+        done += n;
+    }
+
+    // Every acknowledged deposit must be in the balance
+    BankingResponse res;
+    BalanceRequest bal;
+    memset(&bal, 0, sizeof(bal));
+    snprintf(bal.account_id, sizeof(bal.account_id), "%s", account);
+    if (local_call(&lc, OP_BALANCE, &bal, sizeof(bal), &res) == 0 && res.balance != (double)b->ok_count) {
+        fprintf(stderr, "[%s] Balance %.2f, expected %ld\n", account, res.balance, b->ok_count);
+    }
+    local_disconnect(&lc);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char *name, double *lat, int n) {
+    if (n == 0) {
+        printf("  %-8s: no samples\n", name);
+        return;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("  %-8s: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           name, lat[n / 2], lat[(int)(n * 0.90)], lat[(int)(n * 0.99)],
+           lat[(int)(n * 0.999)], lat[n - 1]);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s <socket_path> [threads] [ops_per_thread] [window (1-%d)]\n", argv[0], LOCAL_RING_SIZE);
+        return 1;
+    }
+    const char *path = argv[1];
+    int num_threads = (argc >= 3) ? atoi(argv[2]) : DEFAULT_THREADS;
+    int num_ops = (argc >= 4) ? atoi(argv[3]) : DEFAULT_OPS;
+    int window = (argc >= 5) ? atoi(argv[4]) : DEFAULT_WINDOW;
+
+    if (num_threads < 1 || num_ops < 1 || window < 1 || window > LOCAL_RING_SIZE) {
+        printf("Usage: %s <socket_path> [threads] [ops_per_thread] [window (1-%d)]\n", argv[0], LOCAL_RING_SIZE);
+        return 1;
+    }
+
+    printf("=== Local Transport Load Test ===\n");
+    printf("Socket: %s\n", path);
+    printf("Threads: %d, Deposits per thread: %d, Window: %d\n", num_threads, num_ops, window);
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    BenchArgs *args = calloc(num_threads, sizeof(BenchArgs));
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+
+    for (int i = 0; i < num_threads; i++) {
+        args[i].thread_id = i;
+        args[i].path = path;
+        args[i].num_ops = num_ops;
+        args[i].window = window;
+        args[i].batch_lat_us = malloc(sizeof(double) * (num_ops / window + 1));
+        pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_us();
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed_sec = (now_us() - start) / 1e6;
+
+    // Merge per-thread samples
+    long total_ok = 0, total_fail = 0, total_batches = 0;
+    int setup_failed = 0;
+    for (int i = 0; i < num_threads; i++) {
+        total_ok += args[i].ok_count;
+        total_fail += args[i].fail_count;
+        total_batches += args[i].batch_count;
+        setup_failed += args[i].setup_failed;
+    }
+    double *lat_all = malloc(sizeof(double) * (total_batches + 1));
+    long k = 0;
+    for (int i = 0; i < num_threads; i++) {
+        memcpy(lat_all + k, args[i].batch_lat_us, sizeof(double) * args[i].batch_count);
+        k += args[i].batch_count;
+        free(args[i].batch_lat_us);
+    }
+
+    printf("\n=== Local Bench Results ===\n");
+    printf("Duration   : %.2f sec\n", elapsed_sec);
+    printf("Deposits   : %ld ok, %ld failed (%d threads could not log in)\n", total_ok, total_fail, setup_failed);
+    printf("Throughput : %.0f ops/sec\n", (total_ok + total_fail) / elapsed_sec);
+    if (total_ok + total_fail > 0) {
+        printf("Per op     : %.0f ns (wall time / operations per thread)\n",
+               elapsed_sec * 1e9 / ((double)(total_ok + total_fail) / (num_threads - setup_failed)));
+    }
+    printf("Latency:\n");
+    print_latency(window == 1 ? "Request" : "Window", lat_all, (int)total_batches);
+
+    pthread_barrier_destroy(&start_barrier);
+    free(lat_all);
+    free(threads);
+    free(args);
+    return 0;
+}
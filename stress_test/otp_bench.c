@@ -0,0 +1,212 @@
+/*
+ * otp_bench.c
+ * Load Test for the OTP Service
+ *
+ * Each thread plays one banking worker and runs Generate -> Verify pairs
+ * against the OTP server, recording per-call latency.
+ *
+ * Compiles to: ../bin/otp_bench
+ * Usage: ./otp_bench [threads] [pairs_per_thread] [persistent (0/1)] [accounts_per_thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "../common/include/otp_ipc.h"
+
+#define DEFAULT_THREADS 50
+#define DEFAULT_PAIRS 1000
+#define DEFAULT_ACCOUNTS 8
+
+typedef struct {
+    int thread_id;
+    int num_pairs;
+    int persistent;
+    int num_accounts;
+
+    // Stats
+    double *gen_lat_us;
+    double *verify_lat_us;
+    int gen_count;
+    int verify_count;
+    int fail_count;
+} BenchArgs;
+
+static pthread_barrier_t start_barrier;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int otp_connect(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(OTP_PORT);
+    inet_pton(AF_INET, OTP_IP, &serv_addr.sin_addr);
+
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, (char *)buf + got, len - got);
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return 0;
+}
+
+// One request/response exchange; opens a fresh connection when *sock < 0
+static int otp_call(int *sock, int persistent, const OtpIpcRequest *req, OtpIpcResponse *res) {
+    if (*sock < 0 && (*sock = otp_connect()) < 0) return -1;
+
+    int ok = write(*sock, req, sizeof(*req)) == (ssize_t)sizeof(*req) &&
+             read_full(*sock, res, sizeof(*res)) == 0;
+
+    if (!ok || !persistent) {
+        close(*sock);
+        *sock = -1;
+    }
+    return ok ? 0 : -1;
+}
+
+static void *bench_thread(void *arg) {
+    BenchArgs *b = (BenchArgs *)arg;
+    int sock = -1;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (int i = 0; i < b->num_pairs; i++) {
+        OtpIpcRequest req;
+        OtpIpcResponse res;
+        memset(&req, 0, sizeof(req));
+        snprintf(req.account, sizeof(req.account), "bench_%d_%d",
+                 b->thread_id, i % b->num_accounts);
+
+        // Generate
+        req.op_code = OTP_OP_GENERATE;
+        double t0 = now_us();
+        if (otp_call(&sock, b->persistent, &req, &res) != 0 || res.status != 1) {
+            b->fail_count++;
+            continue;
+        }
+        b->gen_lat_us[b->gen_count++] = now_us() - t0;
+
+        // Verify with the code we just got
+        req.op_code = OTP_OP_VERIFY;
+        memcpy(req.otp_code, res.otp_code, sizeof(req.otp_code));
+        t0 = now_us();
+        if (otp_call(&sock, b->persistent, &req, &res) != 0 || res.status != 1) {
+            b->fail_count++;
+            continue;
+        }
+        b->verify_lat_us[b->verify_count++] = now_us() - t0;
+    }
+
+    if (sock >= 0) close(sock);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(const char *name, double *lat, int n) {
+    if (n == 0) {
+        printf("  %-8s: no samples\n", name);
+        return;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("  %-8s: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           name, lat[n / 2], lat[(int)(n * 0.90)], lat[(int)(n * 0.99)],
+           lat[(int)(n * 0.999)], lat[n - 1]);
+}
+
+int main(int argc, char **argv) {
+    int num_threads = (argc >= 2) ? atoi(argv[1]) : DEFAULT_THREADS;
+    int num_pairs = (argc >= 3) ? atoi(argv[2]) : DEFAULT_PAIRS;
+    int persistent = (argc >= 4) ? atoi(argv[3]) : 0;
+    int num_accounts = (argc >= 5) ? atoi(argv[4]) : DEFAULT_ACCOUNTS;
+
+    if (num_threads < 1 || num_pairs < 1 || num_accounts < 1) {
+        printf("Usage: %s [threads] [pairs_per_thread] [persistent (0/1)] [accounts_per_thread]\n", argv[0]);
+        return 1;
+    }
+
+    printf("=== OTP Service Load Test ===\n");
+    printf("Target: %s:%d\n", OTP_IP, OTP_PORT);
+    printf("Threads: %d, Gen/Verify pairs per thread: %d\n", num_threads, num_pairs);
+    printf("Connection: %s\n", persistent ? "persistent" : "one per call");
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    BenchArgs *args = calloc(num_threads, sizeof(BenchArgs));
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+
+    for (int i = 0; i < num_threads; i++) {
+        args[i].thread_id = i;
+        args[i].num_pairs = num_pairs;
+        args[i].persistent = persistent;
+        args[i].num_accounts = num_accounts;
+        args[i].gen_lat_us = malloc(sizeof(double) * num_pairs);
+        args[i].verify_lat_us = malloc(sizeof(double) * num_pairs);
+        pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_us();
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed_sec = (now_us() - start) / 1e6;
+
+    // Merge per-thread samples
+    long total_gen = 0, total_verify = 0, total_fail = 0;
+    for (int i = 0; i < num_threads; i++) {
+        total_gen += args[i].gen_count;
+        total_verify += args[i].verify_count;
+        total_fail += args[i].fail_count;
+    }
+    double *gen_all = malloc(sizeof(double) * (total_gen + 1));
+    double *verify_all = malloc(sizeof(double) * (total_verify + 1));
+    long g = 0, v = 0;
+    for (int i = 0; i < num_threads; i++) {
+        memcpy(gen_all + g, args[i].gen_lat_us, sizeof(double) * args[i].gen_count);
+        memcpy(verify_all + v, args[i].verify_lat_us, sizeof(double) * args[i].verify_count);
+        g += args[i].gen_count;
+        v += args[i].verify_count;
+        free(args[i].gen_lat_us);
+        free(args[i].verify_lat_us);
+    }
+
+    printf("\n=== OTP Bench Results ===\n");
+    printf("Duration   : %.2f sec\n", elapsed_sec);
+    printf("Calls      : %ld generate, %ld verify, %ld failed\n", total_gen, total_verify, total_fail);
+    printf("Throughput : %.0f calls/sec\n", (total_gen + total_verify) / elapsed_sec);
+    printf("Latency:\n");
+    print_latency("Generate", gen_all, (int)total_gen);
+    print_latency("Verify", verify_all, (int)total_verify);
+
+    pthread_barrier_destroy(&start_barrier);
+    free(gen_all);
+    free(verify_all);
+    free(threads);
+    free(args);
+    return 0;
+}
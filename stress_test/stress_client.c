@@ -14,6 +14,7 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <signal.h>
 
 #include "../common/include/protocol.h"
 #include "../common/include/tls_wrapper.h"
@@ -21,6 +22,19 @@
 // Configuration
 #define DEFAULT_THREADS 100
 #define DEFAULT_REQUESTS 100 // Requests per thread
+#define DEFAULT_SLO_MS 50     // Flows finishing within this count towards goodput
+#define RETRY_LIMIT 5
+#define RETRY_BACKOFF_US 10000  // Doubled on every retry
+#define RECONNECT_LIMIT 10
+#define RECONNECT_BACKOFF_US 50000
+#define RECONNECT_BACKOFF_MAX_US 1000000
+#define READS_PER_FLOW 9        // Read modes: balance reads after each deposit
+
+typedef enum {
+    READS_NONE,
+    READS_EVENTUAL,     // Any answer within the replica's staleness bound
+    READS_OWN_WRITES    // min_seq = our last deposit (read-your-writes)
+} ReadMode;
 
 typedef struct {
     int thread_id;
@@ -28,15 +42,37 @@ typedef struct {
     int server_port;
     int verify_cert;
     int num_requests;
+    int login_only;   // 1 = repeat ReqOTP -> Login only (login benchmark)
+    ReadMode read_mode;  // Log in once, then Deposit + READS_PER_FLOW Balance per flow
+    int replica_port;    // Balance reads go to this read replica first (0 = primary only)
+    double slo_ms;
     
     // Stats
     int success_count;
     int fail_count;
+    int good_count;   // Flows that completed within the SLO
     double total_latency_ms;
     double max_latency_ms;
     double min_latency_ms;
+    
+    // ReqOTP + Login latency per flow
+    double *login_latency_ms;
+    int login_count;
+    int login_rejected;
+    
+    // Read modes
+    int replica_reads;      // Answered by the replica
+    int primary_reads;      // Refused by the replica (stale / not a replica) or no replica
+    int stale_reads;        // Balance older than our own last deposit
+    uint32_t max_staleness_ms;
 } ThreadArgs;
 
+static int rate_limited_total = 0;  // STATUS_RATE_LIMITED responses (all threads)
+static int busy_total = 0;          // STATUS_SERVER_BUSY responses (all threads)
+static int goaway_total = 0;        // OP_GOAWAY notices (followed by a reconnect)
+static int conn_errors_total = 0;   // Requests lost to a broken connection
+static int resent_total = 0;        // Keyed deposits/withdrawals resent after a broken connection
+
 // Helper: Get current time in milliseconds
 double get_time_ms() {
     struct timeval tv;
@@ -44,12 +80,19 @@ double get_time_ms() {
     return (tv.tv_sec * 1000.0) + (tv.tv_usec / 1000.0);
 }
 
-// Helper: Send and Receive
-int perform_request(SSL *ssl, uint16_t opcode, void *req_data, size_t req_size, BankingResponse *response) {
-    BankingPacket req_packet;
-    if (pack_request(&req_packet, opcode, req_data, req_size) != 0) return -1;
-    
-    if (tls_write(ssl, &req_packet, sizeof(BankingPacket)) <= 0) return -1;
+// One thread's connection to the server, re-established after OP_GOAWAY
+typedef struct {
+    ThreadArgs *args;
+    SSL_CTX *ctx;
+    int port;
+    int sock;
+    SSL *ssl;
+    char session_token[33];  // From the last login, resumed on a new connection
+    uint32_t last_key;       // Idempotency keys are unique per session: a counter will do
+} ServerConn;
+
+static int send_and_receive(SSL *ssl, const BankingPacket *req_packet, BankingResponse *response) {
+    if (tls_write(ssl, req_packet, sizeof(BankingPacket)) <= 0) return -1;
     
     BankingPacket resp_packet;
     int bytes = tls_read(ssl, &resp_packet, sizeof(BankingPacket));
@@ -58,6 +101,131 @@ int perform_request(SSL *ssl, uint16_t opcode, void *req_data, size_t req_size,
     return unpack_response(&resp_packet, response);
 }
 
+static void conn_close(ServerConn *conn) {
+    if (!conn->ssl) return;
+    tls_close(conn->ssl);
+    close(conn->sock);
+    conn->ssl = NULL;
+}
+
+static int conn_open(ServerConn *conn) {
+    conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in serv_addr;
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(conn->port);
+    inet_pton(AF_INET, conn->args->server_ip, &serv_addr.sin_addr);
+    
+    if (connect(conn->sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(conn->sock);
+        return -1;
+    }
+    conn->ssl = tls_connect(conn->ctx, conn->sock, "api.bank.com");
+    if (!conn->ssl) {
+        close(conn->sock);
+        return -2;
+    }
+    
+    // Reconnected after a GOAWAY: carry the login over
+    if (conn->session_token[0]) {
+        SessionRequest req;
+        memcpy(req.session_token, conn->session_token, sizeof(req.session_token));
+        BankingPacket packet;
+        BankingResponse response;
+        if (pack_request(&packet, OP_RESUME_SESSION, &req, sizeof(req)) != 0 ||
+            send_and_receive(conn->ssl, &packet, &response) != 0) {
+            conn_close(conn);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// The server is draining: nothing sent after its last response was processed,
+// so reconnect (it may take a moment for a replacement to listen) and resend
+static int conn_reconnect(ServerConn *conn) {
+    conn_close(conn);
+    useconds_t backoff = RECONNECT_BACKOFF_US;
+    for (int attempt = 0; attempt < RECONNECT_LIMIT; attempt++) {
+        if (conn_open(conn) == 0) return 0;
+        usleep(backoff);
+        if (backoff < RECONNECT_BACKOFF_MAX_US) backoff *= 2;
+    }
+    return -1;
+}
+
+// Helper: Send and Receive (backs off and retries while the server rate limits or sheds us,
+// reconnects when it goes away). Logged in, deposits and withdrawals carry an
+// idempotency key, so one whose connection broke is resent: the server runs it at most once
+int perform_request(ServerConn *conn, uint16_t opcode, void *req_data, size_t req_size, BankingResponse *response) {
+    BankingPacket req_packet;
+    if (pack_request(&req_packet, opcode, req_data, req_size) != 0) return -1;
+    int keyed = conn->session_token[0] && (opcode == OP_DEPOSIT || opcode == OP_WITHDRAW);
+    if (keyed) {
+        packet_set_idempotency_key(&req_packet, ++conn->last_key);
+    }
+    
+    useconds_t backoff = RETRY_BACKOFF_US;
+    int resends = 0;
+    for (int attempt = 0; ; attempt++) {
+        if (!conn->ssl || send_and_receive(conn->ssl, &req_packet, response) != 0) {
+            __atomic_add_fetch(&conn_errors_total, 1, __ATOMIC_RELAXED);
+            if (keyed && resends++ < RETRY_LIMIT && conn_reconnect(conn) == 0) {
+                __atomic_add_fetch(&resent_total, 1, __ATOMIC_RELAXED);
+                attempt--;
+                continue;
+            }
+            conn_close(conn);
+            return -1;
+        }
+        
+        if (response->status == STATUS_GOING_AWAY) {
+            __atomic_add_fetch(&goaway_total, 1, __ATOMIC_RELAXED);
+            if (conn_reconnect(conn) != 0) {
+                __atomic_add_fetch(&conn_errors_total, 1, __ATOMIC_RELAXED);
+                return -1;
+            }
+            attempt--;  // Not a retry of a rejected request
+            continue;
+        }
+        if (response->status == STATUS_RATE_LIMITED) {
+            __atomic_add_fetch(&rate_limited_total, 1, __ATOMIC_RELAXED);
+        } else if (response->status == STATUS_SERVER_BUSY) {
+            __atomic_add_fetch(&busy_total, 1, __ATOMIC_RELAXED);
+        } else {
+            return 0;
+        }
+        if (attempt == RETRY_LIMIT) return 0;
+        
+        usleep(backoff);
+        backoff *= 2;
+    }
+}
+
+// Read modes: the replica first, the primary when the replica refuses
+static int read_balances(ServerConn *conn, ServerConn *replica, ThreadArgs *t_args,
+                         const char *account_id, double written, uint64_t written_seq) {
+    for (int k = 0; k < READS_PER_FLOW; k++) {
+        BalanceRequest req;
+        memset(&req, 0, sizeof(req));
+        strncpy(req.account_id, account_id, sizeof(req.account_id) - 1);
+        if (t_args->read_mode == READS_OWN_WRITES) req.min_seq = written_seq;
+        
+        BankingResponse response;
+        if (replica->ssl && perform_request(replica, OP_BALANCE, &req, sizeof(req), &response) == 0 &&
+            response.status == STATUS_SUCCESS) {
+            t_args->replica_reads++;
+            if (response.staleness_ms > t_args->max_staleness_ms) t_args->max_staleness_ms = response.staleness_ms;
+        } else if (perform_request(conn, OP_BALANCE, &req, sizeof(req), &response) == 0 &&
+                   response.status == STATUS_SUCCESS) {
+            t_args->primary_reads++;
+        } else {
+            return 0;
+        }
+        if (response.balance < written - 0.005) t_args->stale_reads++;  // Deposits only grow it
+    }
+    return 1;
+}
+
 void *worker_thread(void *args) {
     ThreadArgs *t_args = (ThreadArgs *)args;
     t_args->min_latency_ms = 999999.0;
@@ -71,32 +239,34 @@ void *worker_thread(void *args) {
         .verify_peer = t_args->verify_cert
     };
     
-    SSL_CTX *ctx = tls_create_client_context(&tls_config);
-    if (!ctx) {
+    ServerConn conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.args = t_args;
+    conn.port = t_args->server_port;
+    conn.ctx = tls_create_client_context(&tls_config);
+    if (!conn.ctx) {
         printf("[Thread %d] TLS Context Failed\n", t_args->thread_id);
         return NULL;
     }
     
     // Connect
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(t_args->server_port);
-    inet_pton(AF_INET, t_args->server_ip, &serv_addr.sin_addr);
-    
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+    int rc = conn_open(&conn);
+    if (rc != 0) {
         // Only print error for first few threads to avoid flooding
-        if (t_args->thread_id < 5) printf("[Thread %d] Connect Failed\n", t_args->thread_id);
-        tls_cleanup_context(ctx);
+        if (t_args->thread_id < 5) {
+            printf("[Thread %d] %s\n", t_args->thread_id, rc == -2 ? "TLS Handshake Failed" : "Connect Failed");
+        }
+        tls_cleanup_context(conn.ctx);
         return NULL;
     }
     
-    SSL *ssl = tls_connect(ctx, sock, "api.bank.com");
-    if (!ssl) {
-        if (t_args->thread_id < 5) printf("[Thread %d] TLS Handshake Failed\n", t_args->thread_id);
-        close(sock);
-        tls_cleanup_context(ctx);
-        return NULL;
+    ServerConn replica;
+    memset(&replica, 0, sizeof(replica));
+    replica.args = t_args;
+    replica.ctx = conn.ctx;
+    replica.port = t_args->replica_port;
+    if (t_args->replica_port && conn_open(&replica) != 0 && t_args->thread_id < 5) {
+        printf("[Thread %d] Replica connect failed, reading from the primary\n", t_args->thread_id);
     }
     
     // Prepare Account ID
@@ -110,19 +280,35 @@ void *worker_thread(void *args) {
     for (int i = 0; i < t_args->num_requests; i++) {
         double start_time = get_time_ms();
         BankingResponse response;
+        int completed = 0;
         
         // Sequence: Create -> ReqOTP -> Login -> Deposit -> Withdraw -> Balance
+        // Login mode: Create once, then only ReqOTP -> Login
+        // Read modes: Create -> ReqOTP -> Login once, then Deposit -> Balance x READS_PER_FLOW
+        
+        if (t_args->read_mode && i > 0) {
+            DepositRequest dep_req;
+            strncpy(dep_req.account_id, account_id, sizeof(dep_req.account_id));
+            dep_req.amount = 100.0;
+            completed = perform_request(&conn, OP_DEPOSIT, &dep_req, sizeof(dep_req), &response) == 0 &&
+                        response.status == STATUS_SUCCESS &&
+                        read_balances(&conn, &replica, t_args, account_id, response.balance, response.commit_seq);
+            goto flow_done;
+        }
         
         // 1. Create Account
         CreateAccountRequest create_req;
         strncpy(create_req.account_id, account_id, sizeof(create_req.account_id));
         create_req.initial_balance = 1000.0;
         
-        if (perform_request(ssl, OP_CREATE_ACCOUNT, &create_req, sizeof(create_req), &response) == 0) {
+        if ((t_args->login_only && i > 0) ||
+            perform_request(&conn, OP_CREATE_ACCOUNT, &create_req, sizeof(create_req), &response) == 0) {
+            double login_start = get_time_ms();
+            
             // 2. Request OTP
             OtpRequest otp_req;
             strncpy(otp_req.account_id, account_id, sizeof(otp_req.account_id));
-            if (perform_request(ssl, OP_REQ_OTP, &otp_req, sizeof(otp_req), &response) == 0 && response.status == STATUS_SUCCESS) {
+            if (perform_request(&conn, OP_REQ_OTP, &otp_req, sizeof(otp_req), &response) == 0 && response.status == STATUS_SUCCESS) {
                 // Parse OTP from message "OTP Generated: XXXXXX"
                 char *ptr = strstr(response.message, ": ");
                 if (ptr) {
@@ -134,17 +320,32 @@ void *worker_thread(void *args) {
                     strncpy(login_req.account_id, account_id, sizeof(login_req.account_id));
                     strncpy(login_req.otp, otp_code, sizeof(login_req.otp));
                     
-                    if (perform_request(ssl, OP_LOGIN, &login_req, sizeof(login_req), &response) == 0 && response.status == STATUS_SUCCESS) {
-                         // 4. Deposit
-                        DepositRequest dep_req;
-                        strncpy(dep_req.account_id, account_id, sizeof(dep_req.account_id));
-                        dep_req.amount = 100.0;
-                        perform_request(ssl, OP_DEPOSIT, &dep_req, sizeof(dep_req), &response);
+                    if (perform_request(&conn, OP_LOGIN, &login_req, sizeof(login_req), &response) == 0 && response.status == STATUS_SUCCESS) {
+                        t_args->login_latency_ms[t_args->login_count++] = get_time_ms() - login_start;
+                        memcpy(conn.session_token, response.session_token, sizeof(conn.session_token));
+                        
+                        if (!t_args->login_only) {
+                            // 4. Deposit
+                            DepositRequest dep_req;
+                            strncpy(dep_req.account_id, account_id, sizeof(dep_req.account_id));
+                            dep_req.amount = 100.0;
+                            completed = perform_request(&conn, OP_DEPOSIT, &dep_req, sizeof(dep_req), &response) == 0 &&
+                                        response.status == STATUS_SUCCESS;
+                            if (completed && t_args->read_mode) {
+                                completed = read_balances(&conn, &replica, t_args, account_id,
+                                                          response.balance, response.commit_seq);
+                            }
+                        } else {
+                            completed = 1;
+                        }
+                    } else {
+                        t_args->login_rejected++;  // e.g. TOTP code already used in this step
                     }
                 }
             }
         }
         
+flow_done:;
         double end_time = get_time_ms();
         double latency = end_time - start_time;
         
@@ -152,33 +353,56 @@ void *worker_thread(void *args) {
         if (latency > t_args->max_latency_ms) t_args->max_latency_ms = latency;
         if (latency < t_args->min_latency_ms) t_args->min_latency_ms = latency;
         t_args->success_count++; // Counting 'flow' success
+        if (completed && latency <= t_args->slo_ms) t_args->good_count++;
     }
     
     // Cleanup
-    tls_close(ssl);
-    close(sock);
-    tls_cleanup_context(ctx);
+    conn_close(&replica);
+    conn_close(&conn);
+    tls_cleanup_context(conn.ctx);
     
     return NULL;
 }
 
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
 int main(int argc, char **argv) {
     if (argc < 3) {
-        printf("Usage: %s <ip> <port> [threads] [requests_per_thread] [verify_cert]\n", argv[0]);
+        printf("Usage: %s <ip> <port> [threads] [requests_per_thread] [verify_cert] [flow|login|read|read-ryw] [slo_ms] [replica_port]\n", argv[0]);
         return 1;
     }
     
+    signal(SIGPIPE, SIG_IGN);  // A server that closes on us is reported, not fatal
+    
     char *ip = argv[1];
     int port = atoi(argv[2]);
     int num_threads = (argc >= 4) ? atoi(argv[3]) : DEFAULT_THREADS;
     int reqs_per_thread = (argc >= 5) ? atoi(argv[4]) : DEFAULT_REQUESTS;
     int verify = (argc >= 6) ? atoi(argv[5]) : 0;
+    const char *mode = (argc >= 7) ? argv[6] : "flow";
+    int login_only = strcmp(mode, "login") == 0;
+    ReadMode read_mode = strcmp(mode, "read") == 0 ? READS_EVENTUAL :
+                         strcmp(mode, "read-ryw") == 0 ? READS_OWN_WRITES : READS_NONE;
+    double slo_ms = (argc >= 8) ? atof(argv[7]) : DEFAULT_SLO_MS;
+    int replica_port = (argc >= 9) ? atoi(argv[8]) : 0;
     
     printf("=== Stress Test Client ===\n");
     printf("Target: %s:%d\n", ip, port);
     printf("Threads: %d\n", num_threads);
     printf("Requests/Thread: %d\n", reqs_per_thread);
     printf("OTP/TLS Verify: %s\n", verify ? "YES" : "NO");
+    if (login_only) {
+        printf("Mode: login (ReqOTP -> Login)\n");
+    } else if (read_mode) {
+        printf("Mode: %s (Deposit -> %d x Balance%s)\n", mode, READS_PER_FLOW,
+               read_mode == READS_OWN_WRITES ? ", reading our own writes" : "");
+        if (replica_port) printf("Read replica: %s:%d\n", ip, replica_port);
+    } else {
+        printf("Mode: flow\n");
+    }
     
     pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
     ThreadArgs *t_args = malloc(sizeof(ThreadArgs) * num_threads);
@@ -193,13 +417,26 @@ int main(int argc, char **argv) {
         t_args[i].verify_cert = verify;
         t_args[i].success_count = 0;
         t_args[i].fail_count = 0;
+        t_args[i].good_count = 0;
+        t_args[i].slo_ms = slo_ms;
         t_args[i].total_latency_ms = 0;
+        t_args[i].login_latency_ms = malloc(sizeof(double) * reqs_per_thread);
+        t_args[i].login_count = 0;
+        t_args[i].login_rejected = 0;
+        t_args[i].login_only = login_only;
+        t_args[i].read_mode = read_mode;
+        t_args[i].replica_port = replica_port;
+        t_args[i].replica_reads = 0;
+        t_args[i].primary_reads = 0;
+        t_args[i].stale_reads = 0;
+        t_args[i].max_staleness_ms = 0;
         
         pthread_create(&threads[i], NULL, worker_thread, &t_args[i]);
     }
     
     // Wait for completion
     int total_reqs = 0;
+    int total_good = 0;
     double total_latency_sum = 0;
     double global_max = 0;
     double global_min = 999999;
@@ -207,6 +444,7 @@ int main(int argc, char **argv) {
     for (int i = 0; i < num_threads; i++) {
         pthread_join(threads[i], NULL);
         total_reqs += t_args[i].success_count;
+        total_good += t_args[i].good_count;
         total_latency_sum += t_args[i].total_latency_ms;
         if (t_args[i].max_latency_ms > global_max) global_max = t_args[i].max_latency_ms;
         if (t_args[i].min_latency_ms < global_min) global_min = t_args[i].min_latency_ms;
@@ -219,11 +457,65 @@ int main(int argc, char **argv) {
     printf("Total Duration: %.2f sec\n", total_duration_sec);
     printf("Total Completed Flows: %d\n", total_reqs);
     printf("Throughput: %.2f flows/sec\n", total_reqs / total_duration_sec);
+    printf("Goodput: %.2f flows/sec (completed within %.0f ms: %d)\n",
+           total_good / total_duration_sec, slo_ms, total_good);
     printf("Latency (Flow):\n");
     printf("  Avg: %.2f ms\n", (total_latency_sum / total_reqs));
     printf("  Min: %.2f ms\n", global_min);
     printf("  Max: %.2f ms\n", global_max);
+    if (rate_limited_total > 0) {
+        printf("Rate limited responses: %d (retried with backoff)\n", rate_limited_total);
+    }
+    if (busy_total > 0) {
+        printf("Server busy responses: %d (retried with backoff)\n", busy_total);
+    }
+    if (goaway_total > 0) {
+        printf("GOAWAY notices: %d (reconnected and resent)\n", goaway_total);
+    }
+    if (conn_errors_total > 0) {
+        printf("Connection errors: %d (%d keyed requests resent)\n", conn_errors_total, resent_total);
+    }
+    
+    if (read_mode) {
+        int replica_reads = 0, primary_reads = 0, stale_reads = 0;
+        uint32_t max_staleness = 0;
+        for (int i = 0; i < num_threads; i++) {
+            replica_reads += t_args[i].replica_reads;
+            primary_reads += t_args[i].primary_reads;
+            stale_reads += t_args[i].stale_reads;
+            if (t_args[i].max_staleness_ms > max_staleness) max_staleness = t_args[i].max_staleness_ms;
+        }
+        printf("Balance reads: %.2f/sec (replica %d, primary %d), older than our own deposit: %d\n",
+               (replica_reads + primary_reads) / total_duration_sec, replica_reads, primary_reads, stale_reads);
+        if (replica_reads > 0) printf("Replica staleness bound reported: max %u ms\n", max_staleness);
+    }
+    
+    // Login latency (ReqOTP + Login round trips)
+    int login_total = 0, login_rejected = 0;
+    for (int i = 0; i < num_threads; i++) {
+        login_total += t_args[i].login_count;
+        login_rejected += t_args[i].login_rejected;
+    }
+    if (login_only) {
+        printf("Logins: %.2f attempts/sec, %.2f accepted/sec (accepted %d, rejected %d)\n",
+               (login_total + login_rejected) / total_duration_sec,
+               login_total / total_duration_sec, login_total, login_rejected);
+    }
+    if (login_total > 0) {
+        double *all = malloc(sizeof(double) * login_total);
+        int n = 0;
+        for (int i = 0; i < num_threads; i++) {
+            memcpy(all + n, t_args[i].login_latency_ms, sizeof(double) * t_args[i].login_count);
+            n += t_args[i].login_count;
+        }
+        qsort(all, login_total, sizeof(double), cmp_double);
+        printf("Latency (ReqOTP + Login, %d logins):\n", login_total);
+        printf("  p50: %.3f ms, p99: %.3f ms, Max: %.3f ms\n",
+               all[login_total / 2], all[(int)(login_total * 0.99)], all[login_total - 1]);
+        free(all);
+    }
     
+    for (int i = 0; i < num_threads; i++) free(t_args[i].login_latency_ms);
     free(threads);
     free(t_args);
     return 0;
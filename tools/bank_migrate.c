@@ -0,0 +1,388 @@
+/*
+ * bank_migrate.c
+ * Online account migration between banking_server shards
+ *
+ * Runs on the host of the shard that takes the accounts over (the target)
+ * and attaches to its shared memory. It subscribes to the replication port
+ * of each shard that owns some of them now (the sources, started with
+ * --repl-listen) with the membership after the move, and imports what they
+ * stream: a paced snapshot of the moving accounts, then every later change
+ * of them. The sources keep serving the accounts the whole time.
+ *
+ * Once every copy has caught up it asks all sources to freeze them
+ * (requests answered STATUS_ACCOUNT_MOVED, which bank_router retries),
+ * applies the streams up to the freeze, lets the sources deactivate them,
+ * installs the new membership file and reloads the routers (SIGHUP).
+ * Accounts are only refused between the freeze and the routers' reload.
+ *
+ * A new shard takes arcs of the ring from every existing one, so all of
+ * them are sources; the membership must only be installed once they have
+ * all handed over (otherwise the routers send accounts here that are not).
+ *
+ * Imports are journaled in the target's mutation log like any other write,
+ * so its own standby follows. Sessions of the moved accounts stay on the
+ * source: their clients log in again.
+ *
+ * Compiles to: ../bin/bank_migrate
+ * Usage: ./bank_migrate <new_shards_file> <target_name> <source HOST:PORT>...
+ *                       [--shm-key KEY] [--rate N] [--install PATH] [--router-pid PID]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../common/include/ipc.h"
+#include "../server/replication.h"
+
+#define MAX_ROUTERS 16
+
+typedef enum {
+    SRC_COPYING,                    // Snapshot, then catching up with its log
+    SRC_CAUGHT_UP,
+    SRC_FREEZING,                   // Applying its stream up to the freeze
+    SRC_FROZEN,
+    SRC_FINISHING,
+    SRC_MOVED
+} SourceState;
+
+typedef struct {
+    const char *addr;
+    int fd;
+    SourceState state;
+    int in_snapshot;
+    int copied;
+    int streamed;
+} Source;
+
+typedef struct {
+    char account_id[ACCOUNT_ID_LEN];
+    uint64_t seq;                   // Source's sequence number of the last image applied
+} Imported;
+
+static Imported imported[MAX_ACCOUNTS];
+static int imported_count = 0;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s <new_shards_file> <target_name> <source HOST:PORT>...\n"
+           "          [--shm-key KEY] [--rate N] [--install PATH] [--router-pid PID]...\n"
+           "  new_shards_file  membership after the move (shard_ring.h format)\n"
+           "  target_name      this host's shard in that file\n"
+           "  source           --repl-listen address of every shard giving accounts to it\n"
+           "  --shm-key        this shard's --shm-key (default 0x%x)\n"
+           "  --rate           snapshot pace on the source, accounts/s (default %d)\n"
+           "  --install        copy new_shards_file over the routers' membership file at the cutover\n"
+           "  --router-pid     bank_router master to reload at the cutover (repeatable)\n",
+           prog, SHM_KEY, MIGRATE_DEFAULT_RATE);
+}
+
+static int connect_source(const char *spec) {
+    char host[64];
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(host)) return -1;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0 || !res) return -1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { .tv_sec = REPL_TIMEOUT_MS / 1000, .tv_usec = (REPL_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static int send_control(int fd, uint32_t type, const MigrateSpec *spec) {
+    char buf[sizeof(ReplAck) + sizeof(MigrateSpec)];
+    ReplAck ctl = { .magic = REPL_MAGIC, .type = type };
+    size_t len = sizeof(ctl);
+    memcpy(buf, &ctl, sizeof(ctl));
+    if (spec) {
+        memcpy(buf + len, spec, sizeof(*spec));
+        len += sizeof(*spec);
+    }
+    return send(fd, buf, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// Called once poll() says a message has started arriving
+static int recv_message(const Source *src, ReplMessage *m) {
+    size_t got = 0;
+    while (got < sizeof(*m)) {
+        ssize_t n = recv(src->fd, (char *)m + got, sizeof(*m) - got, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "bank_migrate: lost source %s (%s)\n", src->addr,
+                    n == 0 ? "closed" : errno == EAGAIN ? "no heartbeat" : strerror(errno));
+            return -1;
+        }
+        got += n;
+    }
+    if (m->magic != REPL_MAGIC) {
+        fprintf(stderr, "bank_migrate: bad message from source %s\n", src->addr);
+        return -1;
+    }
+    return 0;
+}
+
+// Snapshot and stream overlap: keep only the newest image of each account
+static int import_record(AccountDB *db, const ReplRecord *rec) {
+    Imported *im = NULL;
+    for (int i = 0; i < imported_count && !im; i++) {
+        if (strncmp(imported[i].account_id, rec->account_id, ACCOUNT_ID_LEN) == 0) im = &imported[i];
+    }
+    if (im && rec->seq <= im->seq) return 0;
+    if (!im) {
+        if (imported_count >= MAX_ACCOUNTS) return -1;
+        im = &imported[imported_count++];
+        memcpy(im->account_id, rec->account_id, ACCOUNT_ID_LEN);
+    }
+    im->seq = rec->seq;
+    return account_import(db, rec);
+}
+
+// Same directory as the destination, so the rename is atomic
+static int install_file(const char *src, const char *dst) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    FILE *in = fopen(src, "r");
+    FILE *out = in ? fopen(tmp, "w") : NULL;
+    if (!out) {
+        if (in) fclose(in);
+        return -1;
+    }
+    char buf[4096];
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) ok = 0;
+    }
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok || rename(tmp, dst) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns -1 if the source is lost or the target is full
+static int handle_message(Source *src, AccountDB *db) {
+    ReplMessage m;
+    if (recv_message(src, &m) != 0) return -1;
+
+    switch (m.type) {
+        case REPL_MSG_SNAPSHOT_BEGIN:
+            src->in_snapshot = 1;
+            break;
+
+        case REPL_MSG_SNAPSHOT_END:
+            src->in_snapshot = 0;
+            printf("%s: snapshot copied (%d accounts)\n", src->addr, src->copied);
+            break;
+
+        case REPL_MSG_RECORD:
+            if (import_record(db, &m.rec) != 0) {
+                fprintf(stderr, "bank_migrate: no room for account %s on the target\n", m.rec.account_id);
+                return -1;
+            }
+            if (src->in_snapshot) src->copied++;
+            else src->streamed++;
+            break;
+
+        case REPL_MSG_HEARTBEAT:
+            // The source sends one as soon as the stream has caught up with its log
+            if (src->state == SRC_COPYING && !src->in_snapshot) src->state = SRC_CAUGHT_UP;
+            break;
+
+        case REPL_MSG_FROZEN:
+            if (src->state == SRC_FREEZING) src->state = SRC_FROZEN;
+            break;
+
+        case REPL_MSG_MOVED:
+            if (src->state == SRC_FINISHING) src->state = SRC_MOVED;
+            break;
+
+        default:
+            break;
+    }
+    return 0;
+}
+
+// Moves every source still in state `from` on with `ctl`; returns 1 once all have reached it
+static int advance_all(Source *srcs, int n, SourceState from, uint32_t ctl, SourceState to) {
+    for (int i = 0; i < n; i++) {
+        if (srcs[i].state < from) return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (srcs[i].state != from) continue;
+        if (send_control(srcs[i].fd, ctl, NULL) != 0) return -1;
+        srcs[i].state = to;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    long key = SHM_KEY;
+    long rate = MIGRATE_DEFAULT_RATE;
+    const char *install = NULL;
+    pid_t routers[MAX_ROUTERS];
+    int num_routers = 0;
+
+    static const struct option options[] = {
+        { "shm-key",    required_argument, NULL, 'k' },
+        { "rate",       required_argument, NULL, 'r' },
+        { "install",    required_argument, NULL, 'i' },
+        { "router-pid", required_argument, NULL, 'p' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'k': key = strtol(optarg, NULL, 0); break;
+            case 'r': rate = strtol(optarg, NULL, 10); break;
+            case 'i': install = optarg; break;
+            case 'p':
+                if (num_routers == MAX_ROUTERS || atoi(optarg) <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                routers[num_routers++] = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    int num_sources = argc - optind - 2;
+    if (num_sources < 1 || num_sources > SHARD_MAX || key <= 0 || rate <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *ring_path = argv[optind];
+    const char *target_name = argv[optind + 1];
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    ShardRing ring = {0};
+    if (shard_ring_load(&ring, ring_path) != 0) return 1;
+    int target = shard_ring_find(&ring, target_name);
+    if (target < 0) {
+        fprintf(stderr, "bank_migrate: no shard named %s in %s\n", target_name, ring_path);
+        return 1;
+    }
+    MigrateSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.num_shards = ring.num_shards;
+    spec.target = target;
+    spec.rate = (uint32_t)rate;
+    memcpy(spec.shards, ring.shards, sizeof(ShardInfo) * ring.num_shards);
+
+    ipc_set_key((key_t)key);
+    IPCContext ctx;
+    if (ipc_attach_client(&ctx, 0) != 0) {
+        fprintf(stderr, "bank_migrate: is the target banking_server running (and built from the same tree)?\n");
+        return 1;
+    }
+    SharedSegment *seg = ctx.seg;
+    ReplLog *log = ipc_get_repl(&ctx);
+    if (__atomic_load_n(&log->role, __ATOMIC_RELAXED) != REPL_ROLE_PRIMARY) {
+        fprintf(stderr, "bank_migrate: the target is a standby\n");
+        return 1;
+    }
+    repl_log_attach(log, -1);  // Its sender picks the imports up on its next poll
+
+    // A source that loses its stream (we exit) puts its accounts back in service
+    Source srcs[SHARD_MAX];
+    struct pollfd pfds[SHARD_MAX];
+    memset(srcs, 0, sizeof(srcs));
+    for (int i = 0; i < num_sources; i++) {
+        srcs[i].addr = argv[optind + 2 + i];
+        srcs[i].fd = connect_source(srcs[i].addr);
+        if (srcs[i].fd < 0 || send_control(srcs[i].fd, REPL_CTL_MIGRATE, &spec) != 0) {
+            fprintf(stderr, "bank_migrate: cannot reach the replication port %s\n", srcs[i].addr);
+            return 1;
+        }
+        pfds[i].fd = srcs[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    printf("Moving the accounts of shard %s from %d shards (%ld accounts/s each)\n",
+           target_name, num_sources, rate);
+
+    uint64_t start = now_ms(), freeze_ms = 0;
+    int done = 0;
+    while (!done) {
+        if (poll(pfds, num_sources, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return 1;
+        }
+        for (int i = 0; i < num_sources; i++) {
+            if (pfds[i].revents && handle_message(&srcs[i], ctx.db) != 0) {
+                fprintf(stderr, "bank_migrate: aborted, accounts not handed over yet stay on their source\n");
+                return 1;
+            }
+        }
+
+        // Freeze together, hand over together: the cutover is as short as the slowest source's
+        int r = advance_all(srcs, num_sources, SRC_CAUGHT_UP, REPL_CTL_FREEZE, SRC_FREEZING);
+        if (r > 0 && !freeze_ms) freeze_ms = now_ms();
+        if (r >= 0) r = advance_all(srcs, num_sources, SRC_FROZEN, REPL_CTL_FINISH, SRC_FINISHING);
+        if (r < 0) {
+            fprintf(stderr, "bank_migrate: lost a source during the cutover, aborted\n");
+            return 1;
+        }
+        done = 1;
+        for (int i = 0; i < num_sources; i++) done &= srcs[i].state == SRC_MOVED;
+    }
+
+    int streamed = 0;
+    for (int i = 0; i < num_sources; i++) {
+        streamed += srcs[i].streamed;
+        close(srcs[i].fd);
+    }
+
+    // A shard taking back accounts it moved away earlier must serve them again
+    migration_release(ipc_get_migration(&ctx));
+    stats_set(&seg->stats.repl.migrate_phase, MIGRATE_NONE);
+
+    if (install && install_file(ring_path, install) != 0) {
+        fprintf(stderr, "bank_migrate: cannot install %s as %s (%s); accounts are refused until the "
+                "routers get the new membership\n", ring_path, install, strerror(errno));
+    }
+    for (int i = 0; i < num_routers; i++) {
+        if (kill(routers[i], SIGHUP) != 0) {
+            fprintf(stderr, "bank_migrate: cannot reload router %d: %s\n", (int)routers[i], strerror(errno));
+        }
+    }
+    printf("Moved %d accounts (%d changes streamed) in %lu ms; refused for %lu ms at the cutover\n",
+           imported_count, streamed, now_ms() - start, now_ms() - freeze_ms);
+    shmdt(seg);
+    shard_ring_free(&ring);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * bankstat.c
+ * Live monitor for a running banking_server
+ *
+ * Attaches read-only to the server's shared memory segment and prints,
+ * every interval: requests/s per opcode, active connections and load
+ * level (shed requests/s) per worker,
+ * lock contention, account usage and the hottest accounts. Everything is
+ * read straight from memory (no locks taken, no network round trip), so
+ * watching a loaded server costs it nothing.
+ *
+ * Compiles to: ../bin/bankstat
+ * Usage: ./bankstat [interval_sec] [count (0 = forever)] [shm_key (server's --shm-key)]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "../common/include/ipc.h"
+
+#define DEFAULT_INTERVAL 1
+#define HOT_ACCOUNTS 5
+
+typedef struct {
+    uint64_t op_count[STATS_OPS];
+    uint64_t op_errors[STATS_OPS];
+    uint64_t op_sum_us[STATS_OPS];
+    uint64_t worker_requests[STATS_MAX_WORKERS];
+    uint64_t worker_active[STATS_MAX_WORKERS];
+    uint64_t worker_shed[STATS_MAX_WORKERS];
+    uint64_t worker_level[STATS_MAX_WORKERS];
+    uint64_t db_contended;
+    int account_count;
+    Account accounts[MAX_ACCOUNTS];
+} Snapshot;
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Racy copy by design: a monitor must never take the server's locks
+static void take_snapshot(const SharedSegment *seg, int num_workers, Snapshot *s) {
+    memset(s, 0, sizeof(*s));
+    for (int w = 0; w < num_workers; w++) {
+        const WorkerStats *ws = &seg->stats.workers[w];
+        for (int i = 0; i < STATS_OPS; i++) {
+            uint64_t count = load(&ws->ops[i].count);
+            s->op_count[i] += count;
+            s->op_errors[i] += load(&ws->ops[i].errors);
+            s->op_sum_us[i] += load(&ws->ops[i].sum_us);
+            s->worker_requests[w] += count;
+        }
+        uint64_t accepted = load(&ws->conns_accepted);
+        uint64_t closed = load(&ws->conns_closed);
+        s->worker_active[w] = accepted >= closed ? accepted - closed : 0;
+        s->worker_shed[w] = load(&ws->shed);
+        s->worker_level[w] = load(&ws->load_level);
+    }
+    s->db_contended = load(&seg->db.db_lock_contended);
+    s->account_count = seg->db.account_count;
+    if (s->account_count < 0 || s->account_count > MAX_ACCOUNTS) s->account_count = 0;
+    memcpy(s->accounts, seg->db.accounts, sizeof(Account) * s->account_count);
+}
+
+// The server removes the segment on shutdown; we keep our mapping until we detach
+static int server_gone(int shm_id) {
+    struct shmid_ds ds;
+    return shmctl(shm_id, IPC_STAT, &ds) != 0 || (ds.shm_perm.mode & SHM_DEST);
+}
+
+static void print_report(const Snapshot *prev, const Snapshot *cur, int num_workers, double secs) {
+    char timestr[32];
+    time_t now = time(NULL);
+    strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&now));
+
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_OPS; i++) total += cur->op_count[i] - prev->op_count[i];
+
+    printf("bankstat  %s   %.0f req/s   accounts %d/%d\n\n",
+           timestr, total / secs, cur->account_count, MAX_ACCOUNTS);
+
+    printf("%-16s %10s %10s %12s\n", "OPCODE", "REQ/S", "ERR/S", "AVG(us)");
+    for (int i = 1; i < STATS_OPS; i++) {
+        uint64_t count = cur->op_count[i] - prev->op_count[i];
+        uint64_t errors = cur->op_errors[i] - prev->op_errors[i];
+        uint64_t sum_us = cur->op_sum_us[i] - prev->op_sum_us[i];
+        printf("%-16s %10.0f %10.0f %12.0f\n", stats_op_name(i),
+               count / secs, errors / secs, count ? (double)sum_us / count : 0.0);
+    }
+
+    static const char *levels[] = { "normal", "high", "overload" };
+    printf("\n%-8s %12s %10s %10s %10s\n", "WORKER", "ACTIVE_CONN", "REQ/S", "LOAD", "SHED/S");
+    for (int w = 0; w < num_workers; w++) {
+        uint64_t level = cur->worker_level[w];
+        printf("%-8d %12lu %10.0f %10s %10.0f\n", w, cur->worker_active[w],
+               (cur->worker_requests[w] - prev->worker_requests[w]) / secs,
+               level < 3 ? levels[level] : "?",
+               (cur->worker_shed[w] - prev->worker_shed[w]) / secs);
+    }
+
+    uint64_t acc_contended = 0, acc_contended_prev = 0;
+    for (int i = 0; i < cur->account_count; i++) acc_contended += cur->accounts[i].lock_contended;
+    for (int i = 0; i < prev->account_count; i++) acc_contended_prev += prev->accounts[i].lock_contended;
+    printf("\nLOCK CONTENTION   db_lock %.0f/s (total %lu)   account locks %.0f/s (total %lu)\n",
+           (cur->db_contended - prev->db_contended) / secs, cur->db_contended,
+           (acc_contended - acc_contended_prev) / secs, acc_contended);
+
+    // Hot accounts: most lock acquisitions during this interval
+    int top[HOT_ACCOUNTS];
+    uint64_t top_ops[HOT_ACCOUNTS];
+    int ntop = 0;
+    for (int i = 0; i < cur->account_count; i++) {
+        uint64_t ops = cur->accounts[i].ops - (i < prev->account_count ? prev->accounts[i].ops : 0);
+        if (ops == 0) continue;
+        if (ntop < HOT_ACCOUNTS) {
+            ntop++;
+        } else if (ops <= top_ops[HOT_ACCOUNTS - 1]) {
+            continue;
+        }
+        int pos = ntop - 1;
+        while (pos > 0 && top_ops[pos - 1] < ops) {
+            top[pos] = top[pos - 1];
+            top_ops[pos] = top_ops[pos - 1];
+            pos--;
+        }
+        top[pos] = i;
+        top_ops[pos] = ops;
+    }
+
+    printf("\n%-20s %10s %12s %14s\n", "HOT ACCOUNT", "OPS/S", "CONTENDED/S", "BALANCE");
+    for (int k = 0; k < ntop; k++) {
+        const Account *acc = &cur->accounts[top[k]];
+        uint64_t contended = acc->lock_contended -
+                             (top[k] < prev->account_count ? prev->accounts[top[k]].lock_contended : 0);
+        printf("%-20.*s %10.0f %12.0f %14.2f\n", ACCOUNT_ID_LEN, acc->account_id,
+               top_ops[k] / secs, contended / secs, acc->balance);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int interval = (argc >= 2) ? atoi(argv[1]) : DEFAULT_INTERVAL;
+    int count = (argc >= 3) ? atoi(argv[2]) : 0;
+    long key = (argc >= 4) ? strtol(argv[3], NULL, 0) : SHM_KEY;
+
+    if (interval < 1 || key <= 0) {
+        printf("Usage: %s [interval_sec] [count (0 = forever)] [shm_key]\n", argv[0]);
+        return 1;
+    }
+    ipc_set_key((key_t)key);
+
+    IPCContext ctx;
+    if (ipc_attach_client(&ctx, 1) != 0) {
+        fprintf(stderr, "bankstat: is banking_server running (and built from the same tree)?\n");
+        return 1;
+    }
+
+    const SharedSegment *seg = ctx.seg;
+    int num_workers = seg->stats.num_workers;
+    if (num_workers < 1 || num_workers > STATS_MAX_WORKERS) num_workers = STATS_MAX_WORKERS;
+
+    // Two snapshots, swapped every interval
+    static Snapshot snaps[2];
+    Snapshot *prev = &snaps[0], *cur = &snaps[1];
+    int clear = isatty(STDOUT_FILENO);
+
+    struct timespec t_prev, t_cur;
+    take_snapshot(seg, num_workers, prev);
+    clock_gettime(CLOCK_MONOTONIC, &t_prev);
+
+    for (int n = 0; count == 0 || n < count; n++) {
+        sleep(interval);
+        if (server_gone(ctx.shm_id)) {
+            printf("bankstat: server has exited\n");
+            break;
+        }
+        // A hot upgrade moves the workers to a new set of slots
+        if ((int)seg->stats.num_workers != num_workers && seg->stats.num_workers <= STATS_MAX_WORKERS) {
+            num_workers = seg->stats.num_workers;
+            take_snapshot(seg, num_workers, prev);
+        }
+        take_snapshot(seg, num_workers, cur);
+        clock_gettime(CLOCK_MONOTONIC, &t_cur);
+        double secs = (t_cur.tv_sec - t_prev.tv_sec) + (t_cur.tv_nsec - t_prev.tv_nsec) / 1e9;
+
+        if (clear) printf("\033[H\033[2J");  // top-style redraw on a terminal
+        else if (n > 0) printf("\n");
+        print_report(prev, cur, num_workers, secs);
+
+        Snapshot *tmp = prev;
+        prev = cur;
+        cur = tmp;
+        t_prev = t_cur;
+    }
+
+    ipc_cleanup(&ctx, 0);
+    return 0;
+}